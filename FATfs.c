@@ -1,32 +1,213 @@
 
 #include "FATfs.h"
 #include "HAL.h"
+#include "HAL_async.h"
+#include "HAL_cache.h"
+#include "HAL_pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define FATFS_HAVE_SSSE3 1 /** Build the SSSE3 unpack kernel, it is selected at run time */
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FATFS_HAVE_SSE2 1 /** Build the SSE2 free cluster scan and column kernels, part of the x86-64 baseline */
+#endif
 
 /*******************************************************************************
  * Definitions
  ******************************************************************************/
 
 #define DEFAULT_SECTOR_SIZE 512      /** Define size of sector by 512 byte */
-#define FIRST_SECTOR_OF_ROOT_DIR 19; /** Define the sector number where the root directory start */
-#define ROOT_DIR_SECTOR 14;          /** Define the number of sectors used by the root directory */
+#define FATFS_DIR_ENTRY_SIZE 32U     /** Size of a directory entry on disk */
+#define FATFS_FAT12_CLUSTERS 4085U   /** Volumes with fewer clusters use FAT12 */
+#define FATFS_FAT32_MASK 0x0FFFFFFFU /** Bits of a FAT32 entry holding the cluster */
+#define FATFS_FAT_WINDOW_MIN 2U      /** Fewest FAT sectors kept, a FAT12 entry can straddle two sectors */
+#define FATFS_NO_SECTOR 0xFFFFFFFFU  /** Sector of an empty slot of the FAT window */
+#define FATFS_ASYNC_WINDOW 32U       /** Maximum number of cluster reads kept in flight by fatfs_read_file */
+#define FATFS_READV_WINDOW 64U       /** Maximum number of ranges gathered into one vectored read */
+#define FATFS_EXTENT_MAPS 16U        /** Number of files whose extents are kept */
+#define FATFS_DCACHE_BUCKETS 64U     /** Buckets of the dentry cache, directories spread over their low cluster bits */
+#define FATFS_INDEX_MIN_SLOTS 16U    /** Fewest slots of the name hash of a directory */
+#define FATFS_LFN_MAX_ENTRIES 20U    /** A long name spans at most 20 entries */
+#define FATFS_LFN_CHARS 13U          /** UTF-16 characters held by one long name entry */
+#define FATFS_LFN_LAST 0x40U         /** Flag of the first long name entry on disk, holding the end of the name */
+#define FATFS_LFN_MAX_LENGTH 255U    /** Longest name, in UTF-16 characters */
+#define FATFS_MBR_TABLE 446U         /** Offset of the partition table in the master boot record */
+#define FATFS_MBR_ENTRIES 4U         /** Number of primary partitions */
+#define FATFS_MBR_SECTOR 512U        /** Size of a sector in the LBA addresses of the partition table */
+#define FATFS_GROW_MIN_CAPACITY 64U  /** First capacity of the arrays grown by fatfs_grow */
+
+/**
+ * @brief  Define one slot of the FAT window: a FAT sector loaded on demand
+ */
+typedef struct
+{
+    uint32_t sector; /** Sector of the FAT held, relative to its first sector, FATFS_NO_SECTOR when empty */
+    uint8_t *data;   /** Data of the sector */
+} fatfs_fat_slot_t;
+
+/**
+ * @brief  Define the long name being assembled while a directory is scanned, kept from one block to the next
+ */
+typedef struct
+{
+    uint16_t chars[FATFS_LFN_MAX_ENTRIES * FATFS_LFN_CHARS]; /** UTF-16 name, each entry at its position */
+    uint8_t entries;                                         /** Entries of the name, 0 when no name is being assembled */
+    uint8_t remaining;                                       /** Entries still expected before the short entry */
+    uint8_t checksum;                                        /** Checksum of the short name, repeated in every entry */
+} fatfs_lfn_t;
+
+/**
+ * @brief  Define the outcome of appending a block of a directory to a listing
+ */
+typedef enum
+{
+    FATFS_SCAN_ERROR = -1, /** The listing could not be grown */
+    FATFS_SCAN_END = 0,    /** The end of the directory is in the block */
+    FATFS_SCAN_MORE = 1    /** The next block must be read */
+} fatfs_scan_t;
+
+/**
+ * @brief  Define the kernels of one FAT type, generated from FATfs_kernel.h and selected at mount
+ */
+typedef struct
+{
+    uint32_t bits;                                                             /** Width of the FAT entries */
+    uint32_t sectors_per_cluster;                                              /** Fixed layout of the set, 0 when read from the volume */
+    uint32_t data_start;                                                       /** Fixed first sector of cluster 2, 0 when read from the volume */
+    uint32_t cluster_count;                                                    /** Fixed number of data clusters, 0 when read from the volume */
+    uint32_t (*next)(uint32_t cluster);                                        /** Next cluster of a chain */
+    bool (*end_of_chain)(uint32_t cluster);                                    /** Check if a FAT entry ends a chain */
+    uint32_t (*cluster_sector)(uint32_t cluster);                              /** First sector of a data cluster */
+    uint32_t (*fat_entry)(uint32_t cluster);                                   /** Decode one FAT entry through the window */
+    fatfs_extent_t *(*build_extents)(uint32_t start_cluster, uint32_t *count); /** Merge the contiguous clusters of a chain */
+    fatfs_scan_t (*add_entries)(const uint8_t *data, uint32_t bytes, DirList *list, fatfs_lfn_t *lfn); /** Append the entries of a directory block */
+    fatfs_scan_t (*add_columns)(const uint8_t *data, uint32_t bytes, fatfs_dir_columns_t *columns); /** Append them to columns */
+} fatfs_kernel_t;
 
 /*******************************************************************************
  * Variables
  ******************************************************************************/
 
-static fatfs_bootsector_struct_t s_FAT12Info; /** FAT12 boot sector information */
-static uint8_t *s_fat_table = NULL;           /** Pointer to the FAT table */
+static fatfs_bootsector_struct_t s_FAT12Info;                  /** Boot sector of the volume */
+static fatfs_geometry_t s_geo;                                 /** Layout of the volume computed from the boot sector */
+static uint32_t *s_fat_next = NULL;                            /** FAT unpacked at init: next cluster of every cluster */
+static uint32_t s_fat_entries = 0;                             /** Number of entries of the FAT, 0 when no volume is open */
+static uint32_t s_fat_budget = FATFS_FAT_BUDGET_DEFAULT;       /** Memory given to the FAT, set by fatfs_set_fat_budget */
+static fatfs_fat_slot_t *s_fat_window = NULL;                  /** FAT sectors loaded on demand when the FAT is over budget */
+static uint32_t s_fat_window_slots = 0;                        /** Number of slots of s_fat_window */
+static uint64_t *s_free_map = NULL;                            /** One bit per cluster, set when the cluster is free */
+static uint32_t s_free_count = 0;                              /** Number of free clusters, valid when s_free_known */
+static bool s_free_known = false;                              /** Set once the free count is read from FSInfo or counted */
+static uint32_t s_free_cursor = 2;                             /** Where the next next-fit search starts */
+static uint32_t s_free_largest_first = 0;                      /** First cluster of the largest free run */
+static uint32_t s_free_largest_length = 0;                     /** Length of the largest free run */
+static bool s_free_largest_valid = false;                      /** Cleared when the bitmap changes */
+static fatfs_extent_map_t s_extent_maps[FATFS_EXTENT_MAPS];    /** Extents of the files read last */
+static uint32_t s_extent_clock = 0;                            /** Incremented on every lookup, orders the maps by use */
+static fatfs_dentry_t *s_dcache[FATFS_DCACHE_BUCKETS];         /** Cached listings, chained per bucket */
+static fatfs_dentry_t *s_dcache_mru = NULL;                    /** Listing used last */
+static fatfs_dentry_t *s_dcache_lru = NULL;                    /** Listing used least recently, evicted first */
+static uint32_t s_dcache_bytes = 0;                            /** Memory held by the cached listings */
+static uint32_t s_dcache_budget = FATFS_DCACHE_BUDGET_DEFAULT; /** Memory given to the listings, set by fatfs_set_dcache_budget */
+static const fatfs_kernel_t s_kernel_fat12;                    /** Kernels of FAT12, defined with the others below */
+static const fatfs_kernel_t *s_kernel = &s_kernel_fat12;       /** Kernels of the open volume, chosen once at mount */
 
 /*******************************************************************************
  * Prototypes
  ******************************************************************************/
 
-static int offsetCluster(uint32_t cluster); /** Calculate the offset for a given cluster in the file */
+static uint32_t offsetCluster(uint32_t cluster);                                      /** Calculate the offset for a given cluster in the file */
+static bool fatfs_end_of_chain(uint32_t cluster);                                     /** Check if a FAT entry ends a chain */
+static FAT_status_t fatfs_load_geometry(const uint8_t *sector);                       /** Compute the layout of the volume from its boot sector */
+static const fatfs_kernel_t *fatfs_select_kernel(void);                               /** Kernels of the layout of the volume */
+static FAT_status_t fatfs_load_fat(void);                                             /** Unpack the FAT, or set up its window when over budget */
+static const uint8_t *fatfs_fat_sector(uint32_t sector);                              /** Get a sector of the FAT from the window */
+static uint32_t fatfs_fat_entry(uint32_t cluster);                                    /** Decode one FAT entry through the window */
+static void fatfs_free_fat(void);                                                     /** Release the FAT and its window */
+static void fatfs_free_init(void);                                                    /** Set up the free space of the volume at mount */
+static FAT_status_t fatfs_free_build(void);                                           /** Build the free cluster bitmap from the FAT */
+static void fatfs_free_mark_zero(const uint32_t *next, uint64_t *map, uint32_t count); /** Set the bit of every zero entry */
+static bool fatfs_free_ready(void);                                                   /** Build the bitmap on its first use */
+static uint32_t fatfs_free_next(uint32_t cluster, uint32_t end);                      /** Find the next free cluster */
+static uint32_t fatfs_free_run(uint32_t cluster, uint32_t end);                       /** Measure a run of free clusters */
+static void fatfs_free_deinit(void);                                                  /** Release the free cluster bitmap */
+static void fatfs_unpack(const uint8_t *fat, uint32_t *next, uint32_t count);         /** Unpack the FAT with the fastest kernel of the CPU */
+static void fatfs_unpack_fat12(const uint8_t *fat, uint32_t *next, uint32_t count);   /** Unpack 12-bit FAT entries, portable */
+static void fatfs_unpack_fat16(const uint8_t *fat, uint32_t *next, uint32_t count);   /** Unpack 16-bit FAT entries */
+static void fatfs_unpack_fat32(const uint8_t *fat, uint32_t *next, uint32_t count);   /** Unpack 32-bit FAT entries */
+#if defined(FATFS_HAVE_SSSE3)
+static void fatfs_unpack_fat12_ssse3(const uint8_t *fat, uint32_t *next, uint32_t count); /** Unpack 12-bit FAT entries, 8 per shuffle */
+#endif
+static const uint8_t *fatfs_get_sectors(uint32_t index, uint32_t num, uint8_t *buff); /** Get sector data in place or through a buffer */
+static fatfs_scan_t fatfs_add_entries(const uint8_t *data, uint32_t bytes, DirList *list, fatfs_lfn_t *lfn); /** Append the entries of a directory block to the list */
+static bool fatfs_reserve_entries(DirList *list, uint32_t count);                    /** Make room for more entries in a listing */
+static bool fatfs_reserve_names(DirList *list, uint32_t bytes);                       /** Make room for more long names in a listing */
+static void fatfs_lfn_collect(fatfs_lfn_t *lfn, const uint8_t *raw);                  /** Add a long name entry to the name being assembled */
+static bool fatfs_lfn_attach(fatfs_lfn_t *lfn, const uint8_t *raw, DirList *list, DirEntry *entry); /** Give the long name to its short entry */
+static uint8_t fatfs_lfn_checksum(const uint8_t *shortName);                          /** Checksum of a short name, stored in its long name entries */
+static uint32_t fatfs_utf16_to_utf8(const uint16_t *chars, uint32_t count, char *out); /** Convert a long name to UTF-8 */
+static bool fatfs_reserve_columns(fatfs_dir_columns_t *columns, uint32_t count);      /** Make room for more entries in columns */
+static int fatfs_scan_dir(uint32_t start_cluster, DirList *list, fatfs_dir_columns_t *columns); /** Read the blocks of a directory */
+static bool fatfs_read_file_async(uint32_t start_cluster);                            /** Stream a file with many cluster reads in flight */
+static uint32_t fatfs_cluster_sector(uint32_t cluster);                               /** First sector of a data cluster */
+static fatfs_extent_t *fatfs_build_extents(uint32_t start_cluster, uint32_t *count);  /** Merge the contiguous clusters of a chain */
+static const fatfs_extent_t *fatfs_lookup_extents(uint32_t start_cluster, uint32_t *count); /** Cached extents of a file */
+static FAT_status_t fatfs_read_bytes(uint32_t first_sector, uint32_t offset, uint8_t *buff, uint32_t length); /** Read bytes of a run of sectors */
+static bool fatfs_read_file_extents(const fatfs_extent_t *extents, uint32_t count);   /** Stream a file extent by extent */
+static fatfs_dentry_t *fatfs_dcache_find(uint32_t start_cluster);                     /** Find a cached listing */
+static void fatfs_dcache_detach(fatfs_dentry_t *dentry);                              /** Remove a listing from the cache */
+static void fatfs_dcache_trim(void);                                                  /** Evict listings until the cache fits its budget */
+static void fatfs_dcache_free(fatfs_dentry_t *dentry);                                /** Free a listing out of the cache */
+static bool fatfs_dcache_index(fatfs_dentry_t *dentry);                               /** Build the name hash of a listing */
+static void fatfs_dcache_insert(fatfs_dentry_t *dentry, uint32_t hash, uint32_t index); /** Add an entry to the name hash */
+static const DirEntry *fatfs_dcache_match(fatfs_dentry_t *dentry, const char *name, uint32_t length); /** Find a path component in a listing */
+static const DirEntry *fatfs_dcache_probe(fatfs_dentry_t *dentry, const char *name, uint32_t length, bool isLong); /** Find a short or long name */
+static bool fatfs_is_boot_sector(const uint8_t *sector);                              /** Check if a sector holds a FAT boot sector */
+static bool fatfs_find_partition(uint8_t *sector);                                    /** Move to the first FAT partition of a disk dump */
 
 /*******************************************************************************
  * Code
  ******************************************************************************/
 
+/** One set of kernels per FAT type, and one per standard floppy whose layout is a constant */
+#define FATFS_KERNEL_SUFFIX fat12
+#define FATFS_KERNEL_BITS 12
+#include "FATfs_kernel.h"
+
+#define FATFS_KERNEL_SUFFIX fat16
+#define FATFS_KERNEL_BITS 16
+#include "FATfs_kernel.h"
+
+#define FATFS_KERNEL_SUFFIX fat32
+#define FATFS_KERNEL_BITS 32
+#include "FATfs_kernel.h"
+
+#define FATFS_KERNEL_SUFFIX floppy720 /** 3.5" double density, 720 KiB */
+#define FATFS_KERNEL_BITS 12
+#define FATFS_KERNEL_BPS 512U
+#define FATFS_KERNEL_SPC 2U
+#define FATFS_KERNEL_DATA_START 14U
+#define FATFS_KERNEL_CLUSTERS 713U
+#include "FATfs_kernel.h"
+
+#define FATFS_KERNEL_SUFFIX floppy1440 /** 3.5" high density, 1.44 MB */
+#define FATFS_KERNEL_BITS 12
+#define FATFS_KERNEL_BPS 512U
+#define FATFS_KERNEL_SPC 1U
+#define FATFS_KERNEL_DATA_START 33U
+#define FATFS_KERNEL_CLUSTERS 2847U
+#include "FATfs_kernel.h"
+
+#define FATFS_KERNEL_SUFFIX floppy2880 /** 3.5" extra density, 2.88 MB */
+#define FATFS_KERNEL_BITS 12
+#define FATFS_KERNEL_BPS 512U
+#define FATFS_KERNEL_SPC 2U
+#define FATFS_KERNEL_DATA_START 34U
+#define FATFS_KERNEL_CLUSTERS 2863U
+#include "FATfs_kernel.h"
+
 /**
  * @brief Initialize the filesystem and release resources
  *
@@ -34,314 +215,2632 @@ static int offsetCluster(uint32_t cluster); /** Calculate the offset for a given
  * @return int int Status code indicating success (0) or failure (-1)
  */
 int fatfs_init(const char *image_path)
+{
+    return fatfs_init_ex(image_path, NULL); /** Use the default configuration of the HAL */
+}
+
+/**
+ * @brief Initialize the filesystem with an explicit configuration of the HAL
+ *
+ * @param image_path path of the file to init
+ * @param config Access mode of the image (stdio, mmap, ...), NULL selects the default
+ * @return int Status code indicating success (0) or failure (-1)
+ */
+int fatfs_init_ex(const char *image_path, const kmc_config_t *config)
 {
     FAT_status_t result = FAT_OK;            /** Variable to store the result of initialization */
     uint8_t bootSector[DEFAULT_SECTOR_SIZE]; /** Buffer to hold the boot sector data */
 
     /** Initialize the layer with the image path */
-    if (kmc_init(image_path) != 0)
+    if (kmc_init_ex(image_path, config) != 0)
     {
         fprintf(stderr, "Failed to open image file\n");
         result = FAT_ERROR; /** Indicate failure to open the image file */
     }
     /** Read the boot sector from the image */
-    else if ((kmc_read_sector(0, bootSector)) != DEFAULT_SECTOR_SIZE)
+    else if (kmc_read_bytes(0, bootSector, DEFAULT_SECTOR_SIZE) != DEFAULT_SECTOR_SIZE) /** The sector size is not known yet */
     {
         fprintf(stderr, "Error: Failed to read boot sector\n");
         result = FAT_ERROR; /** Indicate failure to read the boot sector */
     }
+    /** A whole disk starts with a partition table instead of the boot sector */
+    else if ((!fatfs_is_boot_sector(bootSector)) && (!fatfs_find_partition(bootSector)))
+    {
+        fprintf(stderr, "Error: No FAT volume found in the image\n");
+        result = FAT_ERROR; /** Indicate that the image holds no FAT volume */
+    }
     else
     {
-        memcpy(&s_FAT12Info, bootSector, sizeof(s_FAT12Info)); /** Copy the boot sector data into the global FAT12 info structure */
+        memcpy(&s_FAT12Info, bootSector, sizeof(s_FAT12Info)); /** Copy the boot sector data into the global boot sector structure */
 
-        if (kmc_update_sector_size(s_FAT12Info.bytes_per_sector) != 0) /** Update the sector size */
+        if (fatfs_load_geometry(bootSector) != FAT_OK)
+        {
+            fprintf(stderr, "Error: Invalid layout in the boot sector\n");
+            result = FAT_ERROR; /** Indicate that the volume can not be read */
+        }
+        else if (kmc_update_sector_size(s_FAT12Info.bytes_per_sector) != 0) /** Update the sector size */
         {
             fprintf(stderr, "Error: Failed to update sector size\n");
             result = FAT_ERROR; /** Indicate failure to update sector size */
         }
+        else if (fatfs_load_fat() != FAT_OK)
+        {
+            result = FAT_ERROR; /** Indicate failure to load the FAT table */
+        }
         else
         {
-            /** Allocate memory for the FAT table */
-            s_fat_table = malloc(s_FAT12Info.fat_size_16 * s_FAT12Info.bytes_per_sector);
-            if (!s_fat_table)
+            fatfs_free_init(); /** Free space from the FAT, or from the FSInfo hint on a large FAT32 */
+            if ((kmc_cache_enabled()) && (s_geo.root_sectors > 0))
             {
-                fprintf(stderr, "Error: Failed to allocate memory for FAT table\n");
-                result = FAT_ERROR; /** Indicate failure to allocate memory */
-            }
-            else
-            {
-                /** Read the FAT table into memory */
-                if (kmc_read_multi_sector(s_FAT12Info.reserved_sectors, s_FAT12Info.fat_size_16, s_fat_table) != (s_FAT12Info.fat_size_16 * s_FAT12Info.bytes_per_sector))
-                {
-                    fprintf(stderr, "Error: Failed to read FAT table\n");
-                    free(s_fat_table);  /** Free the allocated memory on failure */
-                    result = FAT_ERROR; /** Indicate failure to read the FAT table */
-                }
+                /** The root directory is listed on every "back to root", keep it in memory */
+                (void)kmc_cache_pin(s_geo.root_start, s_geo.root_sectors);
             }
         }
     }
+    if (result != FAT_OK)
+    {
+        fatfs_free_fat(); /** Release the FAT, then the image with its cache, buffers and workers */
+        kmc_deinit();
+        memset(&s_geo, 0, sizeof(s_geo));
+    }
 
     return result; /** Return the result of initialization */
 }
 
 /**
- * @brief Get a directory entry by its index
+ * @brief Set the memory given to the FAT of the next volume opened
+ *
+ * @param budgetBytes Memory in bytes, 0 selects FATFS_FAT_BUDGET_DEFAULT
+ */
+void fatfs_set_fat_budget(uint32_t budgetBytes)
+{
+    s_fat_budget = (0 == budgetBytes) ? FATFS_FAT_BUDGET_DEFAULT : budgetBytes;
+}
+
+/**
+ * @brief Unpack the FAT, or set up its window when over budget
  *
- * @param head Pointer to the head of the linked list of directory entries
- * @param index Index of the entry to retrieve
- * @return DirEntry* Pointer to the directory entry at the specified index
+ * A FAT whose unpacked entries fit in the budget is read and unpacked at once, every chain walk
+ * is then a single load. A larger one is not read at mount: its sectors are loaded into a window
+ * of budget / bytes_per_sector slots as chains reach them.
+ *
+ * @return FAT_status_t FAT_OK on success, FAT_ERROR on a read or allocation error
  */
-DirEntry *get_index(DirEntry *DirEntryList, int index)
+static FAT_status_t fatfs_load_fat(void)
 {
-    int count = (int)FAT_INDEX;  /** Counter for the list */
-    FAT_status_t found = FAT_OK; /** Flag to indicate if entry is found */
-    DirEntry *result = NULL;     /** Pointer to store the result */
+    FAT_status_t result = FAT_OK;                                    /** Status of the load */
+    uint32_t fat_bytes = s_geo.fat_sectors * s_geo.bytes_per_sector; /** Size of one FAT in bytes */
+    uint8_t *fat_table = NULL;                                       /** FAT as stored on disk, only needed until it is unpacked */
+    uint32_t i = 0;                                                  /** Used as an index of operation */
+
+    s_fat_entries = (uint32_t)((uint64_t)fat_bytes * 8U / s_geo.type);
+    if (s_fat_entries > s_geo.cluster_count + 2U)
+    {
+        s_fat_entries = s_geo.cluster_count + 2U; /** Entries past the last cluster are not used */
+    }
 
-    while ((DirEntryList) && (found == FAT_OK))
+    if ((uint64_t)s_fat_entries * sizeof(uint32_t) <= s_fat_budget)
     {
-        if (count == index)
+        /** Allocate memory for the FAT table, packed as on disk, and for the unpacked entries */
+        fat_table = malloc(fat_bytes);
+        s_fat_next = (uint32_t *)malloc((size_t)s_fat_entries * sizeof(uint32_t));
+        if ((!fat_table) || (!s_fat_next))
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for FAT table\n");
+            result = FAT_ERROR; /** Indicate failure to allocate memory */
+        }
+        /** Read the FAT table into memory */
+        else if (kmc_read_multi_sector(s_geo.fat_start, s_geo.fat_sectors, fat_table) != (int32_t)fat_bytes)
         {
-            result = DirEntryList; /** Store the result */
-            found = FAT_INDEX;     /** Set the flag to indicate the entry is found */
+            fprintf(stderr, "Error: Failed to read FAT table\n");
+            result = FAT_ERROR; /** Indicate failure to read the FAT table */
         }
         else
         {
-            count++;                           /** Increment the count by 1 */
-            DirEntryList = DirEntryList->next; /** Move the next entry in linked list */
+            fatfs_unpack(fat_table, s_fat_next, s_fat_entries); /** Every chain walk is one load from now on */
+        }
+        free(fat_table); /** The packed entries are no longer needed */
+    }
+    else
+    {
+        s_fat_window_slots = s_fat_budget / s_geo.bytes_per_sector;
+        s_fat_window_slots = (s_fat_window_slots < FATFS_FAT_WINDOW_MIN) ? FATFS_FAT_WINDOW_MIN : s_fat_window_slots;
+        s_fat_window_slots = (s_fat_window_slots > s_geo.fat_sectors) ? s_geo.fat_sectors : s_fat_window_slots;
+        s_fat_window = (fatfs_fat_slot_t *)calloc(s_fat_window_slots, sizeof(fatfs_fat_slot_t));
+        for (i = 0; (s_fat_window != NULL) && (i < s_fat_window_slots); i++)
+        {
+            s_fat_window[i].sector = FATFS_NO_SECTOR;
+            s_fat_window[i].data = (uint8_t *)malloc(s_geo.bytes_per_sector);
+            result = (NULL == s_fat_window[i].data) ? FAT_ERROR : result;
+        }
+        if ((NULL == s_fat_window) || (result != FAT_OK))
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for FAT window\n");
+            result = FAT_ERROR; /** Indicate failure to allocate memory */
         }
     }
 
-    return result; /** Return the result (NULL if not found) */
+    return result;
 }
 
 /**
- * @brief Calculate the offset for a given cluster in the file
+ * @brief Get a sector of the FAT from the window, loading it on a miss
  *
- * @param cluster Cluster number
- * @return int Return cluster which the offset is to be calculate
+ * The window is direct mapped: sector n of the FAT goes to slot n % slots, so the consecutive
+ * sectors walked by a chain never evict each other. A mapped image is read in place.
+ *
+ * @param sector Sector of the FAT, relative to its first sector
+ * @return const uint8_t* Data of the sector, or NULL on a read error
  */
-static int offsetCluster(uint32_t cluster)
+static const uint8_t *fatfs_fat_sector(uint32_t sector)
 {
-    uint16_t fat_entry = (uint16_t)FAT_OK; /** Used to store the FAT entry value, init to FAT_OK status  */
-    uint8_t high_byte = (uint8_t)FAT_OK;   /** Used to store the high byte of a FAT entry, init to FAT_OK status */
-    uint8_t low_byte = (uint8_t)FAT_OK;    /** Used to store the low byte of a FAT entry, init to FAT_OK status */
-
-    fat_entry = (cluster * 3) / 2;         /** Find the byte offset */
-    high_byte = s_fat_table[fat_entry];    /** Read the high byte from FAT */
-    low_byte = s_fat_table[fat_entry + 1]; /** Read the low byte from FAT */
+    const uint8_t *data = kmc_get_sector_ptr(s_geo.fat_start + sector, 1); /** Try the zero-copy path first */
+    fatfs_fat_slot_t *slot = &s_fat_window[sector % s_fat_window_slots];   /** Only slot that can hold the sector */
 
-    /** Check if the cluster number is even or odd */
-    if (0 == (cluster % 2))
-    { /** Taking the lower 4 bits of the hige byte and combining them with the low byte*/
-        cluster = (high_byte & 0x0F) << 8 | low_byte;
-    }
-    else
-    { /** Taking the upper 4 bits of highbyte, and combining them with the low byte*/
-        cluster = (high_byte >> 4) | ((low_byte & 0xFF) << 8);
+    if (NULL == data)
+    {
+        if (slot->sector != sector)
+        {
+            slot->sector = (kmc_read_sector(s_geo.fat_start + sector, slot->data) == (int32_t)s_geo.bytes_per_sector) ? sector : FATFS_NO_SECTOR;
+        }
+        if (slot->sector == sector)
+        {
+            data = slot->data;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Failed to read sector %u of FAT table\n", s_geo.fat_start + sector);
+        }
     }
 
-    return cluster;
+    return data;
 }
 
 /**
- * @brief Read the contents of a directory starting from a specific cluster
+ * @brief Decode one FAT entry through the window
  *
- * @param start_cluster Cluster number where the directory starts
- * @param head Pointer to a pointer to the head of the linked list of directory entries (will be updated)
+ * @param cluster Cluster number, below the number of entries of the FAT
+ * @return uint32_t The entry, or an end of chain value when its sector can not be read
+ */
+static uint32_t fatfs_fat_entry(uint32_t cluster)
+{
+    return s_kernel->fat_entry(cluster);
+}
+
+/**
+ * @brief Release the FAT and its window
  */
-void fatfs_read_dir(uint32_t start_cluster, DirEntry **DirEntryList)
+static void fatfs_free_fat(void)
 {
-    uint32_t cluster_physical = 0;                                /** Assign cluster physical to 0 */
-    uint8_t sector[DEFAULT_SECTOR_SIZE];                          /** Buffer to hold sector data */
-    uint32_t root_dir_sector = ROOT_DIR_SECTOR;                   /** The number of sectors used by the root directory */
-    uint32_t first_sector_of_root_dir = FIRST_SECTOR_OF_ROOT_DIR; /** The sector number where the root directory start */
+    uint32_t i = 0; /** Used as an index of operation */
 
-    bool varReturn = true;         /** indicating the success status of operation */
-    uint32_t i = (uint32_t)FAT_OK; /** Used as an index of operation */
-    uint32_t j = (uint32_t)FAT_OK; /** Used as an index of operation */
+    for (i = 0; (s_fat_window != NULL) && (i < s_fat_window_slots); i++)
+    {
+        free(s_fat_window[i].data);
+    }
+    free(s_fat_window);
+    s_fat_window = NULL;
+    s_fat_window_slots = 0;
+    free(s_fat_next);
+    s_fat_next = NULL;
+    s_fat_entries = 0;
+}
 
-    /** Read root directory if start cluster is 0 */
-    if (0 == start_cluster)
+/**
+ * @brief Set up the free space of the volume at mount
+ *
+ * A FAT unpacked at mount is scanned at once. A FAT loaded on demand is only scanned on the
+ * first query needing the bitmap: on FAT32 the free count and the next free cluster of the
+ * FSInfo sector answer until then.
+ */
+static void fatfs_free_init(void)
+{
+    uint8_t *sector = NULL;              /** Buffer of the FSInfo sector */
+    const fatfs_fsinfo_t *fsinfo = NULL; /** View of the FSInfo sector */
+
+    s_free_cursor = 2;
+    if ((FAT_TYPE_32 == s_geo.type) && (s_geo.fs_info_sector != 0))
+    {
+        sector = (uint8_t *)malloc(s_geo.bytes_per_sector);
+    }
+    if ((sector != NULL) && (kmc_read_sector(s_geo.fs_info_sector, sector) == (int32_t)s_geo.bytes_per_sector))
     {
-        for (i = 0; i < root_dir_sector; i++)
+        fsinfo = (const fatfs_fsinfo_t *)sector;
+        if ((FATFS_FSINFO_LEAD_SIG == fsinfo->lead_signature) && (FATFS_FSINFO_STRUCT_SIG == fsinfo->struct_signature))
         {
-            /** Read each sector of the root directory */
-            if (kmc_read_multi_sector(first_sector_of_root_dir + i, s_FAT12Info.sectors_per_cluster, sector) != DEFAULT_SECTOR_SIZE)
+            /** The hints are 0xFFFFFFFF when unknown, and may be stale: they are only kept when in range */
+            if (fsinfo->free_count <= s_geo.cluster_count)
             {
-                fprintf(stderr, "Error: Failed to read root directory sector %d\n", i);
+                s_free_count = fsinfo->free_count;
+                s_free_known = true;
             }
-            else
+            if ((fsinfo->next_free >= 2) && (fsinfo->next_free < s_geo.cluster_count + 2U))
             {
-                fatfs_dir_entry_t *dir = (fatfs_dir_entry_t *)sector; /** Pointer to directory entries in the sector */
-
-                for (j = 0; (j < DEFAULT_SECTOR_SIZE / sizeof(fatfs_dir_entry_t)) && (varReturn); ++j)
-                {
-                    /** Check if the directory entry is empty */
-                    if (dir[j].name[0] == 0x00)
-                    {
-                        varReturn = false;
-                    }
-                    /** Check if the entry is deleted or a long file name */
-                    else if ((dir[j].name[0] == 0xE5) || ((dir[j].attr & 0x0F) == 0x0F))
-                    {
-                        /** do noting */
-                    }
-                    else
-                    {
-                        DirEntry *entry = (DirEntry *)malloc(sizeof(DirEntry)); /** Allocate and initialize a new DirEntry */
-                        memcpy(entry->name, dir[j].name, 11);                   /** Copy the name */
-                        entry->name[11] = '\0';                                 /** Null-terminate the name */
-                        entry->size = dir[j].file_size;                         /** File size */
-                        (entry->is_dir = (dir[j].attr & 0x10)) != 0;            /** Check if it's a directory */
-                        entry->first_cluster = dir[j].first_cluster_low;        /** First cluster of the file or directory */
-                        entry->modified_time = dir[j].write_time;               /** Last write time of the file or directory */
-                        entry->modified_date = dir[j].write_date;               /** Last write date of the file or directory */
-                        entry->next = NULL;                                     /** Initialize next pointer to NULL */
-
-                        /** Add the new entry to the linked list */
-                        if (*DirEntryList == NULL)
-                        {
-                            *DirEntryList = entry; /** If the head is NULL, assign new entry to head */
-                        }
-                        else
-                        {
-                            DirEntry *tail = *DirEntryList; /** If the linked list is not empty, find the last element of the list */
-                            while (tail->next != NULL)
-                            {
-                                tail = tail->next; /** Move the tail pointer to the next element */
-                            }
-                            tail->next = entry; /** Assign the new entry to the next pointer of the last element */
-                        }
-                    }
-                }
+                s_free_cursor = fsinfo->next_free;
             }
         }
     }
-    else
+    free(sector);
+
+    if (s_fat_next != NULL)
     {
-        varReturn = true; /** Set return status to indicate true */
+        (void)fatfs_free_build(); /** Cheap from the unpacked entries, exact count from the start */
+    }
+}
 
-        while (start_cluster < 0xFF8)
-        {
-            cluster_physical = first_sector_of_root_dir + root_dir_sector + (start_cluster - 2) * s_FAT12Info.sectors_per_cluster; /** The cluster numbering starting */
+/**
+ * @brief Build the free cluster bitmap from the FAT
+ *
+ * @return FAT_status_t FAT_OK on success, FAT_ERROR if the bitmap can not be allocated
+ */
+static FAT_status_t fatfs_free_build(void)
+{
+    uint32_t end = s_geo.cluster_count + 2U; /** One past the last cluster */
+    uint32_t words = (end + 63U) / 64U;      /** Words of the bitmap */
+    uint32_t cluster = 0;                    /** Used as an index of operation */
+    uint32_t count = 0;                      /** Free clusters found */
+    FAT_status_t result = FAT_OK;            /** Status of the build */
 
-            /** Read sector of the current cluster */
-            if (kmc_read_multi_sector(cluster_physical, s_FAT12Info.sectors_per_cluster, sector) != DEFAULT_SECTOR_SIZE)
+    s_free_map = (uint64_t *)calloc(words, sizeof(uint64_t));
+    if ((NULL == s_free_map) || (s_fat_entries < end))
+    {
+        free(s_free_map);
+        s_free_map = NULL;
+        result = FAT_ERROR; /** No memory, or no volume */
+    }
+    else if (s_fat_next != NULL)
+    {
+        fatfs_free_mark_zero(s_fat_next, s_free_map, end);
+    }
+    else
+    {
+        for (cluster = 2; cluster < end; cluster++)
+        {
+            if (0 == fatfs_fat_entry(cluster))
             {
-                fprintf(stderr, "Error: Failed to read sector %d of subdirectory\n", cluster_physical);
+                s_free_map[cluster / 64U] |= 1ULL << (cluster % 64U); /** FAT loaded on demand: one entry at a time */
             }
-            else
-            {
+        }
+    }
 
-                /** Pointer to directory entries in the sector */
-                fatfs_dir_entry_t *dir = (fatfs_dir_entry_t *)sector;
+    if (FAT_OK == result)
+    {
+        s_free_map[0] &= ~3ULL; /** Entries 0 and 1 are reserved, not clusters */
+        for (cluster = 0; cluster < words; cluster++)
+        {
+            count += (uint32_t)__builtin_popcountll(s_free_map[cluster]);
+        }
+        s_free_count = count;
+        s_free_known = true;
+        s_free_largest_valid = false;
+    }
 
-                for (j = 0; j < (DEFAULT_SECTOR_SIZE / sizeof(fatfs_dir_entry_t)) && (varReturn); ++j)
-                {
-                    /** Check if the directory entry is empty */
-                    if (dir[j].name[0] == 0x00)
-                    {
-                        varReturn = false; /** Set return status to indicate false */
-                    }
-                    else if ((dir[j].name[0] == 0xE5) || ((dir[j].attr & 0x0F) == 0x0F))
-                    {
-                        /**do nothing */
-                    }
-                    else
-                    {
-                        DirEntry *entry = (DirEntry *)malloc(sizeof(DirEntry)); /** Allocate and initialize a new DirEntry */
-                        memcpy(entry->name, dir[j].name, 11);                   /** Copy the name */
-                        entry->name[11] = '\0';                                 /** Null-terminate the name */
-                        entry->size = dir[j].file_size;                         /** File size */
-                        entry->is_dir = (dir[j].attr & 0x10) != 0;              /** Check if it's a directory */
-                        entry->first_cluster = dir[j].first_cluster_low;        /** First cluster of the file or directory */
-                        entry->modified_time = dir[j].write_time;               /** Last write time of the file or directory */
-                        entry->modified_date = dir[j].write_date;               /** Last write time of the file or directory */
-                        entry->next = NULL;                                     /** Initialize next pointer to NULL */
-
-                        /** Add the new entry to the linked list */
-                        if (*DirEntryList == NULL)
-                        {
-                            *DirEntryList = entry; /** If the linked list is empty, assign the new entry to head*/
-                        }
-                        else
-                        {
-                            DirEntry *tail = *DirEntryList; /** If the linked list is not empty, find the last element of the list */
-                            while (tail->next != NULL)
-                            {
-                                tail = tail->next; /** Move the tail pointer to the next element */
-                            }
-                            tail->next = entry; /** Assign the new entry to the next pointer of the last element */
-                        }
-                    }
-                }
-            }
+    return result;
+}
 
-            start_cluster = offsetCluster(start_cluster); /** Assign start_cluster for return the offsetCluster of start_cluster*/
+/**
+ * @brief Set the bit of every zero entry, 64 entries per word of the bitmap
+ *
+ * The SSE2 path compares four entries with zero per instruction and packs the results with
+ * movemask, the words are then counted with popcount.
+ *
+ * @param next Unpacked FAT entries
+ * @param map Bitmap of at least count bits, cleared by the caller
+ * @param count Number of entries to check
+ */
+static void fatfs_free_mark_zero(const uint32_t *next, uint64_t *map, uint32_t count)
+{
+    uint32_t cluster = 0; /** Used as an index of operation */
+    uint32_t k = 0;       /** Entry of the current word */
+    uint64_t word = 0;    /** Bits of 64 entries */
+
+#if defined(FATFS_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128(); /** Value of a free entry */
+
+    for (cluster = 0; cluster + 64U <= count; cluster += 64U)
+    {
+        word = 0;
+        for (k = 0; k < 64U; k += 4U)
+        {
+            __m128i v = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(next + cluster + k)), zero);
+
+            word |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(v)) << k;
         }
+        map[cluster / 64U] = word;
+    }
+#endif
+    for (; cluster < count; cluster++)
+    {
+        map[cluster / 64U] |= (uint64_t)(0 == next[cluster]) << (cluster % 64U);
     }
 }
 
 /**
- * @brief Read a file from the filesystem
+ * @brief Make sure the bitmap exists, building it on the first use
  *
- * @param filepath Path of the file to read
- * @param start_cluster Cluster number where the file starts
+ * @return bool true when the bitmap can be used
  */
-void fatfs_read_file(const char *filepath, uint32_t start_cluster)
+static bool fatfs_free_ready(void)
 {
-    uint8_t sector[DEFAULT_SECTOR_SIZE];                          /** Buffer to hold sector data */
-    uint32_t root_dir_sector = ROOT_DIR_SECTOR;                   /** The number of sectors used by the root directory */
-    uint32_t first_sector_of_root_dir = FIRST_SECTOR_OF_ROOT_DIR; /** The sector number where the root directory start */
+    return (s_free_map != NULL) || ((s_fat_entries != 0) && (fatfs_free_build() == FAT_OK));
+}
 
-    bool readSuccess = true;       /** Flag to track read success */
-    uint32_t cluster_physical = 0; /** Assign cluster physical to 0 */
+/**
+ * @brief Find the next free cluster
+ *
+ * @param cluster First cluster to check
+ * @param end One past the last cluster to check
+ * @return uint32_t The free cluster, or end when there is none
+ */
+static uint32_t fatfs_free_next(uint32_t cluster, uint32_t end)
+{
+    uint64_t word = 0; /** Free bits of the current word at or after cluster */
 
-    while ((start_cluster < 0xFF8) && (readSuccess))
+    while (cluster < end)
     {
-        cluster_physical = first_sector_of_root_dir + root_dir_sector + (start_cluster - 2) * s_FAT12Info.sectors_per_cluster; /** The cluster numbering starting */
+        word = s_free_map[cluster / 64U] >> (cluster % 64U);
+        if (0 == word)
+        {
+            cluster = (cluster / 64U + 1U) * 64U; /** Whole word in use, skip it */
+        }
+        else
+        {
+            cluster += (uint32_t)__builtin_ctzll(word);
+            end = (cluster < end) ? cluster : end; /** Found, or past the end */
+        }
+    }
+
+    return end;
+}
+
+/**
+ * @brief Measure the run of free clusters starting at a cluster
+ *
+ * @param cluster First cluster of the run, free
+ * @param end One past the last cluster to check
+ * @return uint32_t Number of free clusters of the run
+ */
+static uint32_t fatfs_free_run(uint32_t cluster, uint32_t end)
+{
+    uint32_t first = cluster; /** Start of the run */
+    uint64_t word = 0;        /** Used bits of the current word at or after cluster */
 
-        /** Read sector of current cluster */
-        if (kmc_read_multi_sector(cluster_physical, s_FAT12Info.sectors_per_cluster, sector) != DEFAULT_SECTOR_SIZE)
+    while (cluster < end)
+    {
+        word = (~s_free_map[cluster / 64U]) >> (cluster % 64U);
+        if (0 == word)
         {
-            fprintf(stderr, "Error: Failed to read sector %d of file\n", cluster_physical);
+            cluster = (cluster / 64U + 1U) * 64U; /** Rest of the word free */
+        }
+        else
+        {
+            cluster += (uint32_t)__builtin_ctzll(word);
+            end = (cluster < end) ? cluster : end; /** First used cluster ends the run */
+        }
+    }
 
-            readSuccess = false; /** Flag to track read fault */
+    return end - first;
+}
+
+/**
+ * @brief Get the number of free clusters
+ *
+ * @return uint32_t Free clusters of the volume, 0 when no volume is open
+ */
+uint32_t fatfs_free_clusters(void)
+{
+    if (!s_free_known)
+    {
+        (void)fatfs_free_ready();
+    }
+
+    return s_free_known ? s_free_count : 0;
+}
+
+/**
+ * @brief Get the largest run of free clusters
+ *
+ * @param first_cluster Receives the first cluster of the run, 0 when the volume is full
+ * @param length Receives the number of clusters of the run
+ * @return int 0 on success, or -1 when no volume is open
+ */
+int fatfs_largest_free_extent(uint32_t *first_cluster, uint32_t *length)
+{
+    uint32_t end = s_geo.cluster_count + 2U; /** One past the last cluster */
+    uint32_t cluster = 2;                    /** Start of the run being measured */
+    uint32_t run = 0;                        /** Length of the run */
+    int result = FAT_ERROR;                  /** Status of the query */
+
+    if (fatfs_free_ready())
+    {
+        if (!s_free_largest_valid)
+        {
+            s_free_largest_first = 0;
+            s_free_largest_length = 0;
+            cluster = fatfs_free_next(cluster, end);
+            while (cluster < end)
+            {
+                run = fatfs_free_run(cluster, end);
+                if (run > s_free_largest_length)
+                {
+                    s_free_largest_first = cluster;
+                    s_free_largest_length = run;
+                }
+                cluster = fatfs_free_next(cluster + run, end);
+            }
+            s_free_largest_valid = true; /** Kept until the bitmap changes */
+        }
+        *first_cluster = s_free_largest_first;
+        *length = s_free_largest_length;
+        result = FAT_OK;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Find free clusters with the next-fit policy
+ *
+ * The search starts where the previous one stopped, or at the next free hint of the FSInfo
+ * sector, and wraps around once.
+ *
+ * @param count Number of contiguous free clusters wanted
+ * @return uint32_t First cluster of the run, or 0 when no run is long enough
+ */
+uint32_t fatfs_next_fit(uint32_t count)
+{
+    uint32_t end = s_geo.cluster_count + 2U; /** One past the last cluster */
+    uint32_t cluster = s_free_cursor;        /** Start of the run being measured */
+    uint32_t limit = end;                    /** End of the current pass */
+    uint32_t run = 0;                        /** Length of the run */
+    uint32_t found = 0;                      /** First cluster of the run found */
+    uint32_t pass = 0;                       /** 0 from the cursor to the end, 1 from the start to the cursor */
+
+    while ((0 == found) && (count > 0) && (pass < 2) && (fatfs_free_ready()))
+    {
+        cluster = fatfs_free_next(cluster, limit);
+        run = (cluster < limit) ? fatfs_free_run(cluster, end) : 0;
+        if (cluster >= limit)
+        {
+            limit = s_free_cursor; /** Second pass: the runs starting before the cursor */
+            cluster = 2;
+            pass++;
+        }
+        else if (run >= count)
+        {
+            found = cluster;
         }
         else
         {
-            fwrite(sector, 1, DEFAULT_SECTOR_SIZE, stdout); /** Output the sector data to stdout. */
-            start_cluster = offsetCluster(start_cluster);   /** Assign start_cluster for return the offsetCluster of start_cluster*/
+            cluster += run; /** Too short, continue after it */
         }
     }
+    if (found != 0)
+    {
+        s_free_cursor = (found + count < end) ? (found + count) : 2U;
+    }
+
+    return found;
 }
 
 /**
- * @brief Free the memory allocated for directory entries
+ * @brief Record that clusters were allocated or freed
+ *
+ * This reader never changes the FAT: the call is for a writer built over it, after it changed
+ * the FAT entries. The bitmap and the free count follow in O(count), reserved entries and
+ * clusters past the end are ignored. The cached listings of the directories starting in a
+ * freed run are dropped.
  *
- * @param head Pointer to the head of the linked list of directory entries
+ * @param first_cluster First cluster of the run
+ * @param count Number of clusters of the run
+ * @param used true when the clusters were allocated, false when they were freed
  */
-void free_entries(DirEntry *DirEntryList)
+void fatfs_mark_clusters(uint32_t first_cluster, uint32_t count, bool used)
 {
-    while (DirEntryList)
+    uint32_t cluster = 0;                  /** Used as an index of operation */
+    uint64_t bit = 0;                      /** Bit of the cluster */
+    bool wasFree = false;                  /** State of the cluster before the change */
+    bool ready = fatfs_free_ready();       /** The count is only exact with the bitmap */
+    fatfs_dentry_t *dentry = s_dcache_mru; /** Used as an iterator over the cached listings */
+    fatfs_dentry_t *next = NULL;           /** Following listing, kept before a detach */
+
+    for (cluster = first_cluster; (ready) && (cluster - first_cluster < count) && (cluster < s_geo.cluster_count + 2U); cluster++)
+    {
+        bit = 1ULL << (cluster % 64U);
+        wasFree = (s_free_map[cluster / 64U] & bit) != 0;
+        if ((cluster >= 2) && (used) && (wasFree))
+        {
+            s_free_map[cluster / 64U] &= ~bit;
+            s_free_count--;
+        }
+        else if ((cluster >= 2) && (!used) && (!wasFree))
+        {
+            s_free_map[cluster / 64U] |= bit;
+            s_free_count++;
+        }
+    }
+    s_free_largest_valid = false; /** Measured again on the next query */
+    while ((!used) && (dentry != NULL))
     {
-        DirEntry *next = DirEntryList->next; /** Store the next entry */
-        free(DirEntryList);                  /** Free the DirEntryList entry */
-        DirEntryList = next;                 /** Move to the next entry */
+        next = dentry->lru_next;
+        if ((dentry->start_cluster >= first_cluster) && (dentry->start_cluster - first_cluster < count))
+        {
+            fatfs_dcache_detach(dentry); /** A directory whose first cluster is freed was deleted */
+        }
+        dentry = next;
     }
 }
 
 /**
- * @brief Deinitialize the filesystem and release resources
+ * @brief Release the free cluster bitmap
+ */
+static void fatfs_free_deinit(void)
+{
+    free(s_free_map);
+    s_free_map = NULL;
+    s_free_count = 0;
+    s_free_known = false;
+    s_free_largest_valid = false;
+    s_free_cursor = 2;
+}
+
+/**
+ * @brief Compute the layout of the volume from its boot sector
  *
- * This function closes the image file and cleans up any allocated resources.
+ * A BPB without a 16-bit FAT size is FAT32, as the Linux driver decides. The others are FAT12
+ * below 4085 clusters and FAT16 above, as in the Microsoft specification.
+ *
+ * @param sector The boot sector of the volume
+ * @return FAT_status_t FAT_OK when the regions fit in the volume, FAT_ERROR otherwise
  */
-void fatfs_deinit(void)
+static FAT_status_t fatfs_load_geometry(const uint8_t *sector)
 {
-    if (s_fat_table)
+    const fatfs_bootsector_struct_t *boot = (const fatfs_bootsector_struct_t *)sector;     /** Common part of the BPB */
+    const fatfs_bpb32_t *bpb32 = (const fatfs_bpb32_t *)(sector + FATFS_BPB32_OFFSET);      /** FAT32 part of the BPB */
+    uint32_t total_sectors = (boot->total_sectors_16 != 0) ? boot->total_sectors_16 : boot->total_sectors_32; /** Sectors of the volume */
+    FAT_status_t result = FAT_OK;                                                          /** Status of the layout */
+
+    memset(&s_geo, 0, sizeof(s_geo));
+    s_geo.bytes_per_sector = boot->bytes_per_sector;
+    s_geo.sectors_per_cluster = boot->sectors_per_cluster;
+    s_geo.fat_start = boot->reserved_sectors;
+    s_geo.fat_sectors = (boot->fat_size_16 != 0) ? boot->fat_size_16 : bpb32->fat_size_32;
+    s_geo.fat_count = boot->fat_count;
+    s_geo.root_start = s_geo.fat_start + boot->fat_count * s_geo.fat_sectors;
+    s_geo.root_sectors = (boot->root_entry_count * FATFS_DIR_ENTRY_SIZE + s_geo.bytes_per_sector - 1) / s_geo.bytes_per_sector;
+    s_geo.data_start = s_geo.root_start + s_geo.root_sectors;
+
+    if ((0 == s_geo.fat_sectors) || (s_geo.data_start >= total_sectors))
+    {
+        result = FAT_ERROR; /** No FAT, or no room left for the data */
+    }
+    else
+    {
+        s_geo.cluster_count = (total_sectors - s_geo.data_start) / s_geo.sectors_per_cluster;
+        if (0 == boot->fat_size_16)
+        {
+            s_geo.type = FAT_TYPE_32;
+            s_geo.root_cluster = bpb32->root_cluster & FATFS_FAT32_MASK;
+            s_geo.fs_info_sector = ((bpb32->fs_info != 0) && (bpb32->fs_info < boot->reserved_sectors)) ? bpb32->fs_info : 0;
+            s_geo.eoc = 0x0FFFFFF8U;
+            if ((s_geo.root_sectors != 0) || (s_geo.root_cluster < 2))
+            {
+                result = FAT_ERROR; /** FAT32 keeps its root directory in a cluster chain */
+            }
+        }
+        else if (s_geo.cluster_count < FATFS_FAT12_CLUSTERS)
+        {
+            s_geo.type = FAT_TYPE_12;
+            s_geo.eoc = 0xFF8U;
+        }
+        else
+        {
+            s_geo.type = FAT_TYPE_16;
+            s_geo.eoc = 0xFFF8U;
+        }
+        /** The FAT must hold one entry per cluster, plus the two reserved entries */
+        if ((uint64_t)s_geo.fat_sectors * s_geo.bytes_per_sector * 8U < ((uint64_t)s_geo.cluster_count + 2U) * s_geo.type)
+        {
+            s_geo.cluster_count = (uint32_t)((uint64_t)s_geo.fat_sectors * s_geo.bytes_per_sector * 8U / s_geo.type) - 2U;
+        }
+    }
+    if (result != FAT_OK)
+    {
+        memset(&s_geo, 0, sizeof(s_geo));
+    }
+    s_kernel = fatfs_select_kernel();
+
+    return result;
+}
+
+/**
+ * @brief Select the kernels of the layout of the volume
+ *
+ * A standard floppy gets the kernels generated for its layout, where the cluster arithmetic
+ * uses constants. Any other volume gets the kernels of its FAT type.
+ *
+ * @return const fatfs_kernel_t* The kernels, those of FAT12 when no volume is open
+ */
+static const fatfs_kernel_t *fatfs_select_kernel(void)
+{
+    static const fatfs_kernel_t *const kernels[] = {&s_kernel_floppy720, &s_kernel_floppy1440, &s_kernel_floppy2880,
+                                                    &s_kernel_fat16, &s_kernel_fat32, &s_kernel_fat12}; /** Fixed layouts first */
+    const fatfs_kernel_t *result = NULL; /** Kernels found */
+    uint32_t i = 0;                      /** Used as an index of operation */
+
+    for (i = 0; (NULL == result) && (i < sizeof(kernels) / sizeof(kernels[0])); i++)
+    {
+        if (0 == kernels[i]->cluster_count)
+        {
+            result = (kernels[i]->bits == (uint32_t)s_geo.type) ? kernels[i] : NULL;
+        }
+        else if ((FAT_TYPE_12 == s_geo.type) && (DEFAULT_SECTOR_SIZE == s_geo.bytes_per_sector) &&
+                 (kernels[i]->sectors_per_cluster == s_geo.sectors_per_cluster) &&
+                 (kernels[i]->data_start == s_geo.data_start) && (kernels[i]->cluster_count == s_geo.cluster_count))
+        {
+            result = kernels[i];
+        }
+    }
+
+    return (result != NULL) ? result : &s_kernel_fat12;
+}
+
+/**
+ * @brief Get the layout of the volume
+ *
+ * @return const fatfs_geometry_t* The layout computed by fatfs_init, all zero before it
+ */
+const fatfs_geometry_t *fatfs_get_geometry(void)
+{
+    return &s_geo;
+}
+
+/**
+ * @brief Check if a sector holds a FAT boot sector
+ *
+ * @param sector The sector to check
+ * @return bool true when the jump code and the BIOS parameter block look valid
+ */
+static bool fatfs_is_boot_sector(const uint8_t *sector)
+{
+    const fatfs_bootsector_struct_t *boot = (const fatfs_bootsector_struct_t *)sector; /** View of the sector as a boot sector */
+    uint16_t bytes = boot->bytes_per_sector;                                          /** Must be a power of two from 512 to 4096 */
+
+    return ((0xEB == boot->jump_code[0]) || (0xE9 == boot->jump_code[0])) &&
+           (bytes >= 512) && (bytes <= 4096) && (0 == (bytes & (bytes - 1))) &&
+           (boot->sectors_per_cluster != 0) && (boot->fat_count != 0);
+}
+
+/**
+ * @brief Move to the first FAT partition of a disk dump
+ *
+ * The partition table of the master boot record is searched for a FAT12, FAT16 or FAT32 partition,
+ * the HAL is set to start there and its boot sector is read into the buffer.
+ *
+ * @param sector Holds the master boot record, receives the boot sector of the partition
+ * @return bool true when a FAT partition is found and its boot sector is read
+ */
+static bool fatfs_find_partition(uint8_t *sector)
+{
+    fatfs_mbr_partition_t part[FATFS_MBR_ENTRIES]; /** Copy of the partition table */
+    bool found = false;                            /** Set when a FAT partition is opened */
+    uint8_t type = 0;                              /** Type of the partition being checked */
+    uint32_t i = 0;                                /** Used as an index of operation */
+
+    if ((0x55 == sector[510]) && (0xAA == sector[511]))
+    {
+        memcpy(part, sector + FATFS_MBR_TABLE, sizeof(part));
+        for (i = 0; (i < FATFS_MBR_ENTRIES) && (!found); i++)
+        {
+            type = part[i].type;
+            /** FAT12, FAT16 below 32 MiB, FAT16, FAT32, FAT32 LBA, FAT16 LBA */
+            if ((0x01 == type) || (0x04 == type) || (0x06 == type) || (0x0B == type) || (0x0C == type) || (0x0E == type))
+            {
+                found = (kmc_set_base_offset((uint64_t)part[i].first_lba * FATFS_MBR_SECTOR) == 0) &&
+                        (kmc_read_bytes(0, sector, DEFAULT_SECTOR_SIZE) == DEFAULT_SECTOR_SIZE) && (fatfs_is_boot_sector(sector));
+            }
+        }
+        if (!found)
+        {
+            (void)kmc_set_base_offset(0); /** Back to the whole disk */
+        }
+    }
+
+    return found; /** Return true when the volume is found */
+}
+
+/**
+ * @brief Get a directory entry by its index
+ *
+ * @param list Listing filled by fatfs_read_dir
+ * @param index Index of the entry to retrieve, from 1
+ * @return DirEntry* Pointer to the directory entry at the specified index, NULL when out of range
+ */
+DirEntry *get_index(const DirList *list, int index)
+{
+    DirEntry *result = NULL; /** Pointer to store the result */
+
+    if ((index >= (int)FAT_INDEX) && ((uint32_t)index <= list->count))
+    {
+        result = &list->entries[index - (int)FAT_INDEX]; /** Indexes shown to the user start at 1 */
+    }
+
+    return result; /** Return the result (NULL if not found) */
+}
+
+/**
+ * @brief Get the long name of an entry
+ *
+ * @param list The listing holding the entry
+ * @param entry Entry of the listing
+ * @return const char* The long name in UTF-8, valid while the listing is, or NULL when the entry has none
+ */
+const char *fatfs_long_name(const DirList *list, const DirEntry *entry)
+{
+    return (entry->long_name != FATFS_NO_LONG_NAME) ? (list->names + entry->long_name) : NULL;
+}
+
+/**
+ * @brief Calculate the offset for a given cluster in the file
+ *
+ * @param cluster Cluster number
+ * @return uint32_t Return cluster which the offset is to be calculate
+ */
+static uint32_t offsetCluster(uint32_t cluster)
+{
+    return s_kernel->next(cluster);
+}
+
+/**
+ * @brief Check if a FAT entry ends a chain
+ *
+ * Besides the end of chain markers, a free, reserved or bad cluster, or one past the end of the
+ * volume, ends the chain: there is no data to follow there.
+ *
+ * @param cluster Value of the FAT entry
+ * @return bool true when the chain has no cluster after this entry
+ */
+static bool fatfs_end_of_chain(uint32_t cluster)
+{
+    return s_kernel->end_of_chain(cluster);
+}
+
+/**
+ * @brief Unpack the FAT with the kernel of its type, the fastest one of the CPU for FAT12
+ *
+ * @param fat FAT as stored on disk
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to unpack, the FAT holds at least count entries
+ */
+static void fatfs_unpack(const uint8_t *fat, uint32_t *next, uint32_t count)
+{
+    if (FAT_TYPE_32 == s_geo.type)
+    {
+        fatfs_unpack_fat32(fat, next, count);
+    }
+    else if (FAT_TYPE_16 == s_geo.type)
+    {
+        fatfs_unpack_fat16(fat, next, count);
+    }
+#if defined(FATFS_HAVE_SSSE3)
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        fatfs_unpack_fat12_ssse3(fat, next, count);
+    }
+#endif
+    else
+    {
+        fatfs_unpack_fat12(fat, next, count);
+    }
+}
+
+/**
+ * @brief Decode FAT entries of the open volume as stored on disk
+ *
+ * @param fat Bytes of the first entry to decode, an entry of even index on FAT12
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to decode
+ */
+void fatfs_decode_fat(const uint8_t *fat, uint32_t *next, uint32_t count)
+{
+    fatfs_unpack(fat, next, count);
+}
+
+/**
+ * @brief Unpack 12-bit FAT entries, two entries from every three bytes
+ *
+ * @param fat FAT as stored on disk
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to unpack
+ */
+static void fatfs_unpack_fat12(const uint8_t *fat, uint32_t *next, uint32_t count)
+{
+    uint32_t cluster = 0; /** Used as an index of operation */
+
+    for (cluster = 0; cluster + 1 < count; cluster += 2)
+    {
+        const uint8_t *bytes = fat + cluster * 3 / 2; /** Three bytes holding the pair */
+
+        next[cluster] = (uint32_t)(bytes[0] | ((bytes[1] & 0x0F) << 8)); /** Even entry: low byte, then low nibble */
+        next[cluster + 1] = (uint32_t)((bytes[1] >> 4) | (bytes[2] << 4)); /** Odd entry: high nibble, then high byte */
+    }
+    if (cluster < count)
+    {
+        next[cluster] = (uint32_t)(fat[cluster * 3 / 2] | ((fat[cluster * 3 / 2 + 1] & 0x0F) << 8));
+    }
+}
+
+/**
+ * @brief Unpack 16-bit FAT entries, stored little endian
+ *
+ * @param fat FAT as stored on disk
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to unpack
+ */
+static void fatfs_unpack_fat16(const uint8_t *fat, uint32_t *next, uint32_t count)
+{
+    uint32_t cluster = 0; /** Used as an index of operation */
+
+    for (cluster = 0; cluster < count; cluster++)
+    {
+        next[cluster] = (uint32_t)(fat[cluster * 2] | (fat[cluster * 2 + 1] << 8));
+    }
+}
+
+/**
+ * @brief Unpack 32-bit FAT entries, stored little endian, keeping their low 28 bits
+ *
+ * @param fat FAT as stored on disk
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to unpack
+ */
+static void fatfs_unpack_fat32(const uint8_t *fat, uint32_t *next, uint32_t count)
+{
+    uint32_t cluster = 0; /** Used as an index of operation */
+
+    for (cluster = 0; cluster < count; cluster++)
+    {
+        const uint8_t *bytes = fat + cluster * 4; /** Four bytes of the entry */
+
+        next[cluster] = ((uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24)) & FATFS_FAT32_MASK;
+    }
+}
+
+#if defined(FATFS_HAVE_SSSE3)
+/**
+ * @brief Unpack 12-bit FAT entries, eight entries from every twelve bytes with one shuffle
+ *
+ * The shuffle puts the two bytes holding each entry in its 16-bit lane, even lanes then keep
+ * their low 12 bits and odd lanes drop their low nibble.
+ *
+ * @param fat FAT as stored on disk
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to unpack
+ */
+__attribute__((target("ssse3"))) static void fatfs_unpack_fat12_ssse3(const uint8_t *fat, uint32_t *next, uint32_t count)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11); /** Two source bytes per lane */
+    const __m128i even = _mm_setr_epi16(0x0FFF, 0, 0x0FFF, 0, 0x0FFF, 0, 0x0FFF, 0);           /** Keeps the even entries */
+    const __m128i odd = _mm_setr_epi16(0, 0x0FFF, 0, 0x0FFF, 0, 0x0FFF, 0, 0x0FFF);            /** Keeps the odd entries */
+    uint32_t cluster = 0;                                                                      /** Used as an index of operation */
+
+    /** The load reads 16 bytes for the 12 of the group, the last groups are left to the tail */
+    for (cluster = 0; cluster * 3 / 2 + 16 <= count * 3 / 2; cluster += 8)
+    {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(fat + cluster * 3 / 2)), shuffle);
+
+        v = _mm_or_si128(_mm_and_si128(v, even), _mm_and_si128(_mm_srli_epi16(v, 4), odd));
+        _mm_storeu_si128((__m128i *)(next + cluster), _mm_unpacklo_epi16(v, _mm_setzero_si128())); /** Widen to 32 bits */
+        _mm_storeu_si128((__m128i *)(next + cluster + 4), _mm_unpackhi_epi16(v, _mm_setzero_si128()));
+    }
+    fatfs_unpack_fat12(fat + cluster * 3 / 2, next + cluster, count - cluster); /** Tail, cluster is even */
+}
+#endif
+
+/**
+ * @brief Get the data of consecutive sectors
+ *
+ * When the image is memory-mapped the data is returned in place, otherwise it is read into buff.
+ *
+ * @param index Index of the first sector
+ * @param num Number of sectors
+ * @param buff Buffer of at least num sectors, used when the image is not mapped
+ * @return const uint8_t* Pointer to the sector data, or NULL if the sectors can not be read
+ */
+static const uint8_t *fatfs_get_sectors(uint32_t index, uint32_t num, uint8_t *buff)
+{
+    const uint8_t *data = kmc_get_sector_ptr(index, num); /** Try the zero-copy path first */
+
+    if (NULL == data)
+    {
+        /** Fall back to reading the sectors into the caller buffer */
+        if (kmc_read_multi_sector(index, num, buff) == (int32_t)(num * s_geo.bytes_per_sector))
+        {
+            data = buff;
+        }
+    }
+
+    return data; /** Return the sector data */
+}
+
+/**
+ * @brief Read the contents of a directory starting from a specific cluster
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @param list Listing receiving the entries, empty ({0}) or filled by a previous call
+ * @return int 0 on success, -1 on a read or allocation error: the listing then misses entries
+ */
+int fatfs_read_dir(uint32_t start_cluster, DirList *list)
+{
+    return fatfs_scan_dir(start_cluster, list, NULL);
+}
+
+/**
+ * @brief Read the contents of a directory into columns
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @param columns Listing receiving the entries, empty ({0}) or filled by a previous call
+ * @return int 0 on success, -1 on a read or allocation error: the listing then misses entries
+ */
+int fatfs_read_dir_columns(uint32_t start_cluster, fatfs_dir_columns_t *columns)
+{
+    return fatfs_scan_dir(start_cluster, NULL, columns);
+}
+
+/**
+ * @brief Read the blocks of a directory and append their entries to a listing
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @param list Listing receiving DirEntry records, NULL when columns is given
+ * @param columns Listing receiving columns, used when list is NULL
+ * @return int 0 on success, -1 on a read or allocation error
+ */
+static int fatfs_scan_dir(uint32_t start_cluster, DirList *list, fatfs_dir_columns_t *columns)
+{
+    uint32_t cluster_physical = 0;                                              /** Assign cluster physical to 0 */
+    uint32_t cluster_bytes = s_geo.sectors_per_cluster * s_geo.bytes_per_sector; /** Size of one cluster */
+    uint8_t *buffer = NULL;                                                     /** Buffer of one cluster, or of the root directory */
+    uint32_t hops = 0;                                                          /** Clusters read, bounds a looping chain */
+    fatfs_scan_t scan = FATFS_SCAN_MORE;                                        /** Outcome of the last block */
+    int result = FAT_OK;                                                        /** Status of the read */
+    fatfs_lfn_t lfn;                                                            /** Long name spanning blocks */
+
+    lfn.entries = 0; /** No long name pending */
+    lfn.remaining = 0;
+    /** On FAT32 the root directory is a cluster chain like any other directory */
+    if ((0 == start_cluster) && (FAT_TYPE_32 == s_geo.type))
+    {
+        start_cluster = s_geo.root_cluster;
+    }
+
+    /** Read root directory if start cluster is 0 */
+    if (0 == start_cluster)
+    {
+        buffer = (uint8_t *)malloc((size_t)s_geo.root_sectors * s_geo.bytes_per_sector);
+        /** Read all the sectors of the root directory at once */
+        const uint8_t *data = (buffer != NULL) ? fatfs_get_sectors(s_geo.root_start, s_geo.root_sectors, buffer) : NULL;
+
+        if (NULL == data)
+        {
+            fprintf(stderr, "Error: Failed to read root directory sectors %u to %u\n", s_geo.root_start,
+                    s_geo.root_start + s_geo.root_sectors - 1);
+            result = FAT_ERROR;
+        }
+        else
+        {
+            scan = (list != NULL) ? fatfs_add_entries(data, s_geo.root_sectors * s_geo.bytes_per_sector, list, &lfn)
+                                  : s_kernel->add_columns(data, s_geo.root_sectors * s_geo.bytes_per_sector, columns);
+            result = (FATFS_SCAN_ERROR == scan) ? FAT_ERROR : FAT_OK;
+        }
+    }
+    else
+    {
+        buffer = (uint8_t *)malloc(cluster_bytes);
+        result = (buffer != NULL) ? FAT_OK : FAT_ERROR;
+
+        while ((FATFS_SCAN_MORE == scan) && (FAT_OK == result) && (!fatfs_end_of_chain(start_cluster)) && (hops < s_fat_entries))
+        {
+            cluster_physical = fatfs_cluster_sector(start_cluster); /** The cluster numbering starting */
+
+            /** Read every sector of the current cluster */
+            const uint8_t *data = fatfs_get_sectors(cluster_physical, s_geo.sectors_per_cluster, buffer);
+
+            if (NULL == data)
+            {
+                fprintf(stderr, "Error: Failed to read sector %u of subdirectory\n", cluster_physical);
+                result = FAT_ERROR;
+            }
+            else
+            {
+                scan = (list != NULL) ? fatfs_add_entries(data, cluster_bytes, list, &lfn) : s_kernel->add_columns(data, cluster_bytes, columns);
+                result = (FATFS_SCAN_ERROR == scan) ? FAT_ERROR : FAT_OK;
+            }
+
+            start_cluster = offsetCluster(start_cluster); /** Assign start_cluster for return the offsetCluster of start_cluster*/
+            hops++;
+        }
+    }
+    free(buffer);
+
+    return result;
+}
+
+/**
+ * @brief Read the entries of some clusters of a directory, given in chain order
+ *
+ * @param clusters Clusters to read, in chain order
+ * @param count Number of clusters
+ * @param skip Number of first clusters whose entries are not appended, only their long name entries are used
+ * @param list Listing receiving the entries, empty ({0}) or filled by a previous call
+ * @return int 1 when the end of the directory is found, 0 when the next clusters must be read, -1 on a read or allocation error
+ */
+int fatfs_read_dir_clusters(const uint32_t *clusters, uint32_t count, uint32_t skip, DirList *list)
+{
+    uint32_t cluster_bytes = s_geo.sectors_per_cluster * s_geo.bytes_per_sector; /** Size of one cluster */
+    uint8_t *buffer = (uint8_t *)malloc(cluster_bytes);                         /** Buffer of one cluster, private to the caller */
+    const uint8_t *data = NULL;                                                 /** Entries of the cluster */
+    uint32_t kept = list->count;                                                /** Entries of the listing before the call */
+    uint32_t keptNames = list->names_used;                                      /** Bytes of long names before the call */
+    uint32_t i = 0;                                                             /** Used as an index of operation */
+    fatfs_scan_t scan = FATFS_SCAN_MORE;                                        /** Outcome of the last cluster */
+    int result = (buffer != NULL) ? 0 : FAT_ERROR;                              /** Status of the read */
+    fatfs_lfn_t lfn;                                                            /** Long name spanning clusters */
+
+    lfn.entries = 0; /** No long name pending */
+    lfn.remaining = 0;
+    for (i = 0; (0 == result) && (FATFS_SCAN_MORE == scan) && (i < count); i++)
+    {
+        data = fatfs_get_sectors(fatfs_cluster_sector(clusters[i]), s_geo.sectors_per_cluster, buffer);
+        if (NULL == data)
+        {
+            fprintf(stderr, "Error: Failed to read cluster %u of subdirectory\n", clusters[i]);
+            result = FAT_ERROR;
+        }
+        else
+        {
+            scan = fatfs_add_entries(data, cluster_bytes, list, &lfn);
+            result = (FATFS_SCAN_ERROR == scan) ? FAT_ERROR : 0;
+        }
+        if (i < skip)
+        {
+            list->count = kept; /** Only the long name carried over is kept from the first clusters */
+            list->names_used = keptNames;
+        }
+    }
+    result = ((0 == result) && (FATFS_SCAN_END == scan)) ? 1 : result;
+    free(buffer);
+
+    return result;
+}
+
+/**
+ * @brief Append the entries of a block of a directory to the list
+ *
+ * @param data Directory entries as stored on disk
+ * @param bytes Size of the block
+ * @param list Listing receiving the entries
+ * @param lfn Long name being assembled, carried over from the previous block
+ * @return fatfs_scan_t FATFS_SCAN_MORE when the next block must be read, FATFS_SCAN_END at the end of the directory, FATFS_SCAN_ERROR on an allocation error
+ */
+static fatfs_scan_t fatfs_add_entries(const uint8_t *data, uint32_t bytes, DirList *list, fatfs_lfn_t *lfn)
+{
+    return s_kernel->add_entries(data, bytes, list, lfn);
+}
+
+/**
+ * @brief Make room for more entries in a listing
+ *
+ * The capacity at least doubles, so appending n entries costs O(n) in total.
+ *
+ * @param list Listing to grow
+ * @param count Number of entries about to be appended
+ * @return bool true on success, false if the memory can not be allocated (the listing is kept)
+ */
+static bool fatfs_reserve_entries(DirList *list, uint32_t count)
+{
+    uint32_t capacity = (list->capacity < 16U) ? 16U : (list->capacity * 2U); /** New room */
+    DirEntry *grown = NULL;                                                    /** Array after realloc */
+    bool result = true;                                                        /** Status of the growth */
+
+    if (list->count + count > list->capacity)
+    {
+        capacity = (capacity < list->count + count) ? (list->count + count) : capacity;
+        grown = (DirEntry *)realloc(list->entries, (size_t)capacity * sizeof(DirEntry));
+        result = (grown != NULL);
+        if (result)
+        {
+            list->entries = grown;
+            list->capacity = capacity;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for %u directory entries\n", capacity);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Make room for more long names in a listing
+ *
+ * @param list Listing to grow
+ * @param bytes Number of bytes about to be appended
+ * @return bool true on success, false if the memory can not be allocated (the listing is kept)
+ */
+static bool fatfs_reserve_names(DirList *list, uint32_t bytes)
+{
+    uint32_t capacity = (list->names_capacity < 256U) ? 256U : (list->names_capacity * 2U); /** New room */
+    char *grown = NULL;                                                                     /** Names after realloc */
+    bool result = true;                                                                     /** Status of the growth */
+
+    if (list->names_used + bytes > list->names_capacity)
+    {
+        capacity = (capacity < list->names_used + bytes) ? (list->names_used + bytes) : capacity;
+        grown = (char *)realloc(list->names, capacity);
+        result = (grown != NULL);
+        if (result)
+        {
+            list->names = grown;
+            list->names_capacity = capacity;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for %u bytes of long names\n", capacity);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Add a long name entry to the name being assembled
+ *
+ * The entries of a long name precede its short entry on disk, from the end of the name to its
+ * start, and repeat the checksum of the short name. An entry out of sequence drops the name.
+ *
+ * @param lfn Long name being assembled
+ * @param raw Long name entry as stored on disk
+ */
+static void fatfs_lfn_collect(fatfs_lfn_t *lfn, const uint8_t *raw)
+{
+    static const uint8_t offsets[FATFS_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30}; /** Characters in the entry */
+    uint32_t order = raw[0] & 0x1FU;                                                                 /** Position of the entry in the name, from 1 */
+    uint32_t i = 0;                                                                                  /** Used as an index of operation */
+
+    if ((raw[0] & FATFS_LFN_LAST) != 0)
+    {
+        lfn->entries = ((order >= 1U) && (order <= FATFS_LFN_MAX_ENTRIES)) ? (uint8_t)order : 0U; /** Start of a new name */
+        lfn->remaining = lfn->entries;
+        lfn->checksum = raw[13];
+    }
+    else if ((0 == lfn->remaining) || (order != lfn->remaining) || (raw[13] != lfn->checksum))
+    {
+        lfn->entries = 0; /** Orphan or out of sequence */
+        lfn->remaining = 0;
+    }
+    if ((lfn->remaining != 0) && (order == lfn->remaining))
+    {
+        for (i = 0; i < FATFS_LFN_CHARS; i++)
+        {
+            lfn->chars[(order - 1U) * FATFS_LFN_CHARS + i] = (uint16_t)(raw[offsets[i]] | (raw[offsets[i] + 1U] << 8));
+        }
+        lfn->remaining--;
+    }
+}
+
+/**
+ * @brief Give the long name assembled to its short entry, when complete and of the same checksum
+ *
+ * @param lfn Long name being assembled, reset for the next entry
+ * @param raw Short entry as stored on disk
+ * @param list Listing receiving the name
+ * @param entry Entry of the listing made from the short entry
+ * @return bool false when the names could not be grown to hold the long name
+ */
+static bool fatfs_lfn_attach(fatfs_lfn_t *lfn, const uint8_t *raw, DirList *list, DirEntry *entry)
+{
+    uint32_t length = 0;   /** UTF-16 characters of the name, up to its terminator */
+    bool varReturn = true; /** Status of the name */
+
+    entry->long_name = FATFS_NO_LONG_NAME;
+    if ((lfn->entries != 0) && (0 == lfn->remaining) && (fatfs_lfn_checksum(raw) == lfn->checksum))
+    {
+        while ((length < lfn->entries * FATFS_LFN_CHARS) && (length < FATFS_LFN_MAX_LENGTH) && (lfn->chars[length] != 0x0000U))
+        {
+            length++;
+        }
+        /** A UTF-16 character takes at most 3 bytes in UTF-8, a surrogate pair 4 */
+        varReturn = (0 == length) || (fatfs_reserve_names(list, length * 3U + 1U));
+        if ((length > 0) && (varReturn))
+        {
+            entry->long_name = list->names_used;
+            list->names_used += fatfs_utf16_to_utf8(lfn->chars, length, list->names + list->names_used) + 1U;
+        }
+    }
+    lfn->entries = 0;
+    lfn->remaining = 0;
+
+    return varReturn;
+}
+
+/**
+ * @brief Checksum of a short name, stored in each of its long name entries
+ *
+ * @param shortName The 11 characters of the short name as stored on disk
+ * @return uint8_t The checksum
+ */
+static uint8_t fatfs_lfn_checksum(const uint8_t *shortName)
+{
+    uint8_t sum = 0; /** Rotated right and added character by character */
+    uint32_t i = 0;  /** Used as an index of operation */
+
+    for (i = 0; i < 11U; i++)
+    {
+        sum = (uint8_t)(((sum & 1U) << 7) + (sum >> 1) + shortName[i]);
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Convert a long name from UTF-16 to UTF-8
+ *
+ * @param chars UTF-16 characters, an unpaired surrogate becomes U+FFFD
+ * @param count Number of characters
+ * @param out Receives the terminated UTF-8 string, room for count * 3 + 1 bytes
+ * @return uint32_t Bytes written, the terminator excluded
+ */
+static uint32_t fatfs_utf16_to_utf8(const uint16_t *chars, uint32_t count, char *out)
+{
+    uint32_t code = 0; /** Code point */
+    uint32_t used = 0; /** Bytes written */
+    uint32_t i = 0;    /** Used as an index of operation */
+
+    for (i = 0; i < count; i++)
+    {
+        code = chars[i];
+        if ((code >= 0xD800U) && (code <= 0xDBFFU) && (i + 1U < count) && (chars[i + 1U] >= 0xDC00U) && (chars[i + 1U] <= 0xDFFFU))
+        {
+            code = 0x10000U + ((code - 0xD800U) << 10) + (chars[i + 1U] - 0xDC00U);
+            i++; /** The low surrogate is consumed */
+        }
+        else if ((code >= 0xD800U) && (code <= 0xDFFFU))
+        {
+            code = 0xFFFDU;
+        }
+
+        if (code < 0x80U)
+        {
+            out[used++] = (char)code;
+        }
+        else if (code < 0x800U)
+        {
+            out[used++] = (char)(0xC0U | (code >> 6));
+            out[used++] = (char)(0x80U | (code & 0x3FU));
+        }
+        else if (code < 0x10000U)
+        {
+            out[used++] = (char)(0xE0U | (code >> 12));
+            out[used++] = (char)(0x80U | ((code >> 6) & 0x3FU));
+            out[used++] = (char)(0x80U | (code & 0x3FU));
+        }
+        else
+        {
+            out[used++] = (char)(0xF0U | (code >> 18));
+            out[used++] = (char)(0x80U | ((code >> 12) & 0x3FU));
+            out[used++] = (char)(0x80U | ((code >> 6) & 0x3FU));
+            out[used++] = (char)(0x80U | (code & 0x3FU));
+        }
+    }
+    out[used] = '\0';
+
+    return used;
+}
+
+/**
+ * @brief Make room for more entries in a listing stored by columns
+ *
+ * The columns move together to a new allocation of at least twice the capacity, rounded to a
+ * multiple of 64 so that every column stays 16-byte aligned and the bitmap has whole words.
+ *
+ * @param columns Listing to grow
+ * @param count Number of entries about to be appended
+ * @return bool true on success, false if the memory can not be allocated (the listing is kept)
+ */
+static bool fatfs_reserve_columns(fatfs_dir_columns_t *columns, uint32_t count)
+{
+    uint32_t capacity = (columns->capacity < 64U) ? 64U : (columns->capacity * 2U); /** New room */
+    uint8_t *block = NULL;                                                           /** New allocation */
+    bool result = true;                                                              /** Status of the growth */
+
+    if (columns->count + count > columns->capacity)
+    {
+        capacity = (capacity < columns->count + count) ? ((columns->count + count + 63U) & ~63U) : capacity;
+        block = (uint8_t *)malloc((size_t)capacity * (3U * sizeof(uint32_t) + 11U) + capacity / 8U);
+        result = (block != NULL);
+        if (!result)
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for %u directory entries\n", capacity);
+        }
+        else
+        {
+            memset(block + (size_t)capacity * 3U * sizeof(uint32_t), 0, capacity / 8U); /** No directory yet */
+            if (columns->count > 0)
+            {
+                memcpy(block, columns->sizes, (size_t)columns->count * sizeof(uint32_t));
+                memcpy(block + (size_t)capacity * sizeof(uint32_t), columns->clusters, (size_t)columns->count * sizeof(uint32_t));
+                memcpy(block + (size_t)capacity * 2U * sizeof(uint32_t), columns->mtimes, (size_t)columns->count * sizeof(uint32_t));
+                memcpy(block + (size_t)capacity * 3U * sizeof(uint32_t), columns->dirs, (size_t)columns->capacity / 8U);
+                memcpy(block + (size_t)capacity * 3U * sizeof(uint32_t) + capacity / 8U, columns->names, (size_t)columns->count * 11U);
+            }
+            free(columns->sizes);
+            columns->sizes = (uint32_t *)block;
+            columns->clusters = (uint32_t *)(block + (size_t)capacity * sizeof(uint32_t));
+            columns->mtimes = (uint32_t *)(block + (size_t)capacity * 2U * sizeof(uint32_t));
+            columns->dirs = (uint64_t *)(block + (size_t)capacity * 3U * sizeof(uint32_t));
+            columns->names = (char(*)[11])(block + (size_t)capacity * 3U * sizeof(uint32_t) + capacity / 8U);
+            columns->capacity = capacity;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Read a file from the filesystem
+ *
+ * @param filepath Path of the file to read
+ * @param start_cluster Cluster number where the file starts
+ */
+void fatfs_read_file(const char *filepath, uint32_t start_cluster)
+{
+    uint32_t cluster_bytes = s_geo.sectors_per_cluster * s_geo.bytes_per_sector; /** Size of one cluster */
+    uint8_t *buffer = NULL;                                                     /** Buffer of one cluster */
+    bool readSuccess = true;                                                    /** Flag to track read success */
+    uint32_t cluster_physical = 0;                                              /** Assign cluster physical to 0 */
+    uint32_t hops = 0;                                                          /** Clusters read, bounds a looping chain */
+    const fatfs_extent_t *extents = NULL;                                       /** Extents of the file */
+    uint32_t count = 0;                                                         /** Number of extents */
+
+    if (kmc_async_depth() > 1)
+    {
+        readSuccess = fatfs_read_file_async(start_cluster); /** Keep the cluster reads in flight while walking the chain */
+        start_cluster = 0;                                  /** Nothing left for the synchronous loop */
+    }
+    else if ((extents = fatfs_lookup_extents(start_cluster, &count)) != NULL)
+    {
+        readSuccess = fatfs_read_file_extents(extents, count); /** One read per contiguous run */
+        start_cluster = 0;                                     /** Nothing left for the synchronous loop */
+    }
+    else if (!fatfs_end_of_chain(start_cluster))
+    {
+        buffer = (uint8_t *)malloc(cluster_bytes); /** The extents could not be allocated, read cluster by cluster */
+        readSuccess = (buffer != NULL);
+    }
+
+    while ((!fatfs_end_of_chain(start_cluster)) && (readSuccess) && (hops < s_fat_entries))
+    {
+        cluster_physical = fatfs_cluster_sector(start_cluster); /** The cluster numbering starting */
+
+        /** Read every sector of current cluster */
+        const uint8_t *data = fatfs_get_sectors(cluster_physical, s_geo.sectors_per_cluster, buffer);
+
+        if (NULL == data)
+        {
+            fprintf(stderr, "Error: Failed to read sector %u of file\n", cluster_physical);
+
+            readSuccess = false; /** Flag to track read fault */
+        }
+        else
+        {
+            fwrite(data, 1, cluster_bytes, stdout);       /** Output the cluster data to stdout. */
+            start_cluster = offsetCluster(start_cluster); /** Assign start_cluster for return the offsetCluster of start_cluster*/
+            hops++;
+        }
+    }
+    free(buffer);
+}
+
+/**
+ * @brief Get the first sector of a data cluster
+ *
+ * @param cluster Cluster number, 2 or more
+ * @return uint32_t Index of the first sector of the cluster
+ */
+static uint32_t fatfs_cluster_sector(uint32_t cluster)
+{
+    return s_kernel->cluster_sector(cluster);
+}
+
+/**
+ * @brief Walk a cluster chain and merge the contiguous clusters into extents
+ *
+ * @param start_cluster First cluster of the chain
+ * @param count Receives the number of extents
+ * @return fatfs_extent_t* Array of extents to be freed by the caller, NULL on an empty chain or allocation failure
+ */
+static fatfs_extent_t *fatfs_build_extents(uint32_t start_cluster, uint32_t *count)
+{
+    return s_kernel->build_extents(start_cluster, count);
+}
+
+/**
+ * @brief Get the extents of a file from the cache, building them on a miss
+ *
+ * @param start_cluster First cluster of the file
+ * @param count Receives the number of extents
+ * @return const fatfs_extent_t* The extents, valid until the next call, NULL when the chain is empty
+ */
+static const fatfs_extent_t *fatfs_lookup_extents(uint32_t start_cluster, uint32_t *count)
+{
+    fatfs_extent_map_t *slot = &s_extent_maps[0]; /** Slot of the file, or the least recently used one */
+    const fatfs_extent_t *extents = NULL;         /** Extents to return */
+    uint32_t i = 0;                               /** Used as an index of operation */
+
+    *count = 0;
+    s_extent_clock++;
+    for (i = 0; (i < FATFS_EXTENT_MAPS) && (NULL == extents); i++)
+    {
+        if ((s_extent_maps[i].extents != NULL) && (s_extent_maps[i].start_cluster == start_cluster))
+        {
+            s_extent_maps[i].last_use = s_extent_clock;
+            extents = s_extent_maps[i].extents;
+            *count = s_extent_maps[i].count;
+        }
+        else if (s_extent_maps[i].last_use < slot->last_use)
+        {
+            slot = &s_extent_maps[i];
+        }
+    }
+
+    if (NULL == extents)
+    {
+        free(slot->extents); /** Replace the least recently used map */
+        slot->extents = fatfs_build_extents(start_cluster, &slot->count);
+        slot->start_cluster = start_cluster;
+        slot->last_use = (slot->extents != NULL) ? s_extent_clock : 0;
+        extents = slot->extents;
+        *count = slot->count;
+    }
+
+    return extents;
+}
+
+/**
+ * @brief Get the extents of a file
+ *
+ * @param start_cluster First cluster of the file
+ * @param extents Array receiving the extents, may be NULL when max_count is 0
+ * @param max_count Capacity of the array
+ * @return int Total number of extents of the file (more than max_count when the array is too small), or -1 on error
+ */
+int fatfs_get_extents(uint32_t start_cluster, fatfs_extent_t *extents, uint32_t max_count)
+{
+    const fatfs_extent_t *map = NULL; /** Cached extents of the file */
+    uint32_t count = 0;               /** Number of extents of the file */
+    int result = FAT_ERROR;           /** Number of extents or error */
+
+    if (s_fat_entries != 0)
+    {
+        map = fatfs_lookup_extents(start_cluster, &count);
+        if ((map != NULL) && (extents != NULL))
+        {
+            memcpy(extents, map, ((count < max_count) ? count : max_count) * sizeof(fatfs_extent_t));
+        }
+        result = (int)count;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Read bytes from anywhere in a file
+ *
+ * The extent holding the offset is found by binary search, then every extent is read with
+ * one call: only the partial sectors at both ends go through a sector buffer.
+ *
+ * @param start_cluster First cluster of the file
+ * @param file_size Size of the file in bytes, the read stops there
+ * @param offset Position in the file of the first byte to read
+ * @param buff Buffer receiving the data
+ * @param length Number of bytes to read
+ * @return int32_t Number of bytes read, 0 at the end of the file, or -1 on error
+ */
+int32_t fatfs_read_at(uint32_t start_cluster, uint32_t file_size, uint32_t offset, uint8_t *buff, uint32_t length)
+{
+    const fatfs_extent_t *extents = NULL; /** Extents of the file */
+    uint32_t count = 0;                   /** Number of extents */
+    uint32_t cluster_bytes = s_geo.sectors_per_cluster * s_geo.bytes_per_sector; /** Size of one cluster */
+    uint32_t low = 0;                     /** Binary search: first candidate extent */
+    uint32_t high = 0;                    /** Binary search: one past the last candidate */
+    uint32_t mid = 0;                     /** Binary search: extent being tested */
+    uint32_t done = 0;                    /** Bytes read so far */
+    uint32_t chunk = 0;                   /** Bytes read from the current extent */
+    uint64_t extent_end = 0;              /** Position in the file following the current extent */
+    int32_t result = FAT_ERROR;           /** Bytes read or error */
+
+    extents = (s_fat_entries != 0) ? fatfs_lookup_extents(start_cluster, &count) : NULL;
+    if ((NULL == extents) || (offset >= file_size))
+    {
+        result = (offset >= file_size) ? 0 : FAT_ERROR; /** End of file, or no cluster to read */
+    }
+    else
+    {
+        length = (length < file_size - offset) ? length : (file_size - offset);
+        high = count;
+        while (high - low > 1)
+        {
+            mid = (low + high) / 2;
+            if (extents[mid].file_cluster <= offset / cluster_bytes)
+            {
+                low = mid; /** The offset is in this extent or a later one */
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+
+        result = FAT_OK;
+        while ((FAT_OK == result) && (done < length) && (low < count))
+        {
+            extent_end = (uint64_t)(extents[low].file_cluster + extents[low].length) * cluster_bytes;
+            if (extent_end <= (uint64_t)offset + done)
+            {
+                low = count; /** The chain ends before the size: the read is short */
+            }
+            else
+            {
+                chunk = (extent_end - (offset + done) < (uint64_t)(length - done)) ? (uint32_t)(extent_end - (offset + done)) : (length - done);
+                if (fatfs_read_bytes(fatfs_cluster_sector(extents[low].first_cluster),
+                                     offset + done - extents[low].file_cluster * cluster_bytes, buff + done, chunk) != FAT_OK)
+                {
+                    result = FAT_ERROR;
+                }
+                done += chunk;
+                low++;
+            }
+        }
+        result = (FAT_OK == result) ? (int32_t)done : FAT_ERROR; /** Short when the chain ends before the size */
+    }
+
+    return result;
+}
+
+/**
+ * @brief Read bytes from consecutive sectors, whole sectors straight into the buffer
+ *
+ * @param first_sector First sector of the run
+ * @param offset Byte offset in the run
+ * @param buff Buffer receiving the data
+ * @param length Number of bytes
+ * @return FAT_status_t FAT_OK on success, FAT_ERROR on a read error
+ */
+static FAT_status_t fatfs_read_bytes(uint32_t first_sector, uint32_t offset, uint8_t *buff, uint32_t length)
+{
+    uint8_t *sector = NULL;                        /** Buffer of the partial sectors */
+    uint32_t bytes = s_geo.bytes_per_sector;      /** Size of one sector */
+    uint32_t index = first_sector + offset / bytes; /** Sector holding the current byte */
+    uint32_t skip = offset % bytes;                 /** Bytes to skip in the first sector */
+    uint32_t whole = 0;                            /** Number of whole sectors of the middle part */
+    uint32_t chunk = 0;                            /** Bytes taken from a partial sector */
+    FAT_status_t result = FAT_OK;                  /** Status of the reads */
+
+    if ((skip != 0) || (length % bytes != 0))
+    {
+        sector = (uint8_t *)malloc(bytes);
+        result = (sector != NULL) ? FAT_OK : FAT_ERROR;
+    }
+    if ((FAT_OK == result) && (skip != 0))
+    {
+        chunk = (bytes - skip < length) ? (bytes - skip) : length;
+        result = (kmc_read_sector(index, sector) == (int32_t)bytes) ? FAT_OK : FAT_ERROR;
+        memcpy(buff, sector + skip, chunk);
+        buff += chunk;
+        length -= chunk;
+        index++;
+    }
+    whole = length / bytes;
+    if ((FAT_OK == result) && (whole > 0))
+    {
+        result = (kmc_read_multi_sector(index, whole, buff) == (int32_t)(whole * bytes)) ? FAT_OK : FAT_ERROR;
+        buff += whole * bytes;
+        length -= whole * bytes;
+        index += whole;
+    }
+    if ((FAT_OK == result) && (length > 0))
+    {
+        result = (kmc_read_sector(index, sector) == (int32_t)bytes) ? FAT_OK : FAT_ERROR;
+        memcpy(buff, sector, length);
+    }
+    free(sector);
+
+    return result;
+}
+
+/**
+ * @brief Stream a file to stdout extent by extent
+ *
+ * An image held in memory is written straight from the mapping, one fwrite per extent.
+ * Otherwise the extents are cut to fit an aligned buffer of the pool and every buffer is
+ * filled with a single kmc_readv: a contiguous run is one range, however many clusters it has.
+ *
+ * @param extents Extents of the file
+ * @param count Number of extents
+ * @return bool true if the whole chain was read, false on a read error
+ */
+static bool fatfs_read_file_extents(const fatfs_extent_t *extents, uint32_t count)
+{
+    kmc_range_t ranges[FATFS_READV_WINDOW];                                                  /** Ranges of the window */
+    uint32_t cluster_bytes = s_geo.sectors_per_cluster * s_geo.bytes_per_sector; /** Size of one cluster */
+    uint32_t window = 0;                                                                     /** Clusters that fit in the buffer */
+    uint32_t ranges_used = 0;                                                                /** Number of ranges of the window */
+    uint32_t clusters = 0;                                                                   /** Number of clusters of the window */
+    uint32_t e = 0;                                                                          /** Extent being read */
+    uint32_t done = 0;                                                                       /** Clusters of the extent already read */
+    uint32_t take = 0;                                                                       /** Clusters of the extent added to the window */
+    const uint8_t *data = NULL;                                                              /** Extent in the mapped image */
+    uint8_t *buffer = NULL;                                                                  /** Data of the window, clusters in file order */
+    bool pooled = false;                                                                     /** Set when the buffer comes from the aligned pool */
+    bool readSuccess = true;                                                                 /** Flag to track read success */
+
+    if (kmc_get_sector_ptr(0, 1) != NULL)
+    {
+        for (e = 0; (e < count) && (readSuccess); e++)
+        {
+            data = kmc_get_sector_ptr(fatfs_cluster_sector(extents[e].first_cluster), extents[e].length * s_geo.sectors_per_cluster);
+            if (NULL == data)
+            {
+                fprintf(stderr, "Error: Failed to read cluster %u of file\n", extents[e].first_cluster);
+                readSuccess = false;
+            }
+            else
+            {
+                fwrite(data, 1, (size_t)extents[e].length * cluster_bytes, stdout); /** Output the whole extent to stdout */
+            }
+        }
+        count = 0; /** Nothing left for the buffered loop */
+    }
+    else if (cluster_bytes <= KMC_POOL_BUFFER_BYTES)
+    {
+        /** Whole clusters in an aligned buffer: with direct I/O they go from the disk straight into it */
+        buffer = kmc_pool_get();
+        pooled = (buffer != NULL);
+        window = KMC_POOL_BUFFER_BYTES / cluster_bytes;
+    }
+    else
+    {
+        buffer = (uint8_t *)malloc(cluster_bytes);
+        window = 1;
+    }
+    if ((count > 0) && (NULL == buffer))
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for file buffers\n");
+        readSuccess = false;
+    }
+
+    while ((readSuccess) && (e < count))
+    {
+        ranges_used = 0;
+        clusters = 0;
+        while ((e < count) && (clusters < window) && (ranges_used < FATFS_READV_WINDOW))
+        {
+            take = extents[e].length - done;
+            take = (take < window - clusters) ? take : (window - clusters);
+            ranges[ranges_used].index = fatfs_cluster_sector(extents[e].first_cluster + done);
+            ranges[ranges_used].num = take * s_geo.sectors_per_cluster;
+            ranges[ranges_used].buff = buffer + (size_t)clusters * cluster_bytes;
+            ranges_used++;
+            clusters += take;
+            done += take;
+            if (done == extents[e].length)
+            {
+                e++; /** Extent complete, continue with the next one */
+                done = 0;
+            }
+        }
+
+        if (kmc_readv(ranges, ranges_used) != (int32_t)(clusters * cluster_bytes))
+        {
+            fprintf(stderr, "Error: Failed to read sectors %u to %u of file\n", ranges[0].index,
+                    ranges[ranges_used - 1].index + ranges[ranges_used - 1].num - 1);
+            readSuccess = false; /** Flag to track read fault */
+        }
+        else
+        {
+            fwrite(buffer, 1, (size_t)clusters * cluster_bytes, stdout); /** Output the clusters to stdout */
+        }
+    }
+    if (pooled)
+    {
+        kmc_pool_put(buffer);
+    }
+    else
+    {
+        free(buffer);
+    }
+
+    return readSuccess;
+}
+
+/**
+ * @brief Stream a file to stdout with many cluster reads in flight
+ *
+ * The chain is walked ahead of the data: up to the queue depth of the asynchronous HAL clusters
+ * are submitted, and they are written out in chain order as they complete.
+ *
+ * @param start_cluster Cluster number where the file starts
+ * @return bool true if the whole chain was read, false on a read error
+ */
+static bool fatfs_read_file_async(uint32_t start_cluster)
+{
+    kmc_async_req_t reqs[FATFS_ASYNC_WINDOW];                     /** One request per slot of the window */
+    kmc_async_req_t *done[FATFS_ASYNC_WINDOW];                    /** Completions returned by the HAL */
+    bool completed[FATFS_ASYNC_WINDOW];                           /** Completion flag of each slot */
+    uint32_t cluster_bytes = 0;                                   /** Size of one cluster */
+    uint32_t window = kmc_async_depth();                          /** Number of slots used */
+    uint8_t *buffers = NULL;                                      /** One cluster buffer per slot */
+    uint32_t head = 0;                                            /** Oldest request, next to be written */
+    uint32_t tail = 0;                                            /** Next request to be submitted */
+    uint32_t pending = 0;                                         /** Requests submitted and not written yet */
+    uint32_t hops = 0;                                            /** Clusters submitted, bounds a looping chain */
+    uint32_t inFlight = 0;                                        /** Requests submitted and not completed, once the read stops */
+    bool readSuccess = true;                                      /** Flag to track read success */
+    int reaped = 0;                                               /** Number of completions returned */
+    int i = 0;                                                    /** Used as an index of operation */
+
+    cluster_bytes = s_geo.sectors_per_cluster * s_geo.bytes_per_sector;
+    if (window > FATFS_ASYNC_WINDOW)
+    {
+        window = FATFS_ASYNC_WINDOW;
+    }
+    buffers = (uint8_t *)malloc((size_t)window * cluster_bytes);
+    if (NULL == buffers)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for file buffers\n");
+        readSuccess = false;
+    }
+
+    while ((readSuccess) && ((!fatfs_end_of_chain(start_cluster)) || (pending > 0)))
+    {
+        /** Fill the window: walk the chain ahead and submit every free slot */
+        while ((!fatfs_end_of_chain(start_cluster)) && (pending < window) && (hops < s_fat_entries))
+        {
+            kmc_async_req_t *req = &reqs[tail];
+
+            req->index = fatfs_cluster_sector(start_cluster);
+            req->num = s_geo.sectors_per_cluster;
+            req->buff = buffers + (size_t)tail * cluster_bytes;
+            req->userData = &completed[tail];
+            completed[tail] = false;
+            if (kmc_async_submit(&req, 1) != 1)
+            {
+                fprintf(stderr, "Error: Failed to submit read of sector %u of file\n", req->index);
+                start_cluster = 0; /** Stop walking, drain what is in flight */
+                readSuccess = false;
+            }
+            else
+            {
+                tail = (tail + 1) % window;
+                pending++;
+                hops++;
+                start_cluster = offsetCluster(start_cluster); /** Next cluster of the chain */
+                start_cluster = (hops < s_fat_entries) ? start_cluster : 0U; /** A longer chain is a loop: stop as the synchronous loop does */
+            }
+        }
+
+        /** Wait for at least one completion, then write out every finished cluster in chain order */
+        reaped = kmc_async_reap(done, FATFS_ASYNC_WINDOW, 1);
+        for (i = 0; i < reaped; i++)
+        {
+            *(bool *)done[i]->userData = true;
+        }
+        if (reaped < 0)
+        {
+            readSuccess = false;
+        }
+        while ((readSuccess) && (pending > 0) && (completed[head]))
+        {
+            if (reqs[head].result != (int32_t)cluster_bytes)
+            {
+                fprintf(stderr, "Error: Failed to read sector %u of file\n", reqs[head].index);
+                readSuccess = false; /** Flag to track read fault, the clusters after it are dropped */
+            }
+            else
+            {
+                fwrite(reqs[head].buff, 1, cluster_bytes, stdout); /** Output the cluster data to stdout */
+                head = (head + 1) % window;
+                pending--;
+            }
+        }
+    }
+
+    /** Error path: the buffers can only be released once the HAL is done with every slot */
+    for (i = 0; i < (int)pending; i++)
+    {
+        inFlight += (completed[(head + (uint32_t)i) % window]) ? 0U : 1U;
+    }
+    while ((inFlight > 0) && (reaped >= 0))
+    {
+        reaped = kmc_async_reap(done, FATFS_ASYNC_WINDOW, 1);
+        inFlight -= (reaped > 0) ? (uint32_t)reaped : 0U;
+    }
+    if (0 == inFlight)
+    {
+        free(buffers);
+    }
+    else
+    {
+        fprintf(stderr, "Error: %u reads of file still in flight, their buffers are kept\n", inFlight);
+    }
+
+    return readSuccess;
+}
+
+/**
+ * @brief Free the memory allocated for directory entries
+ *
+ * @param list Listing to release, left empty and ready for reuse
+ */
+void free_entries(DirList *list)
+{
+    free(list->entries); /** One allocation holds every entry */
+    free(list->names);   /** And one every long name */
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * @brief Count the directories of a listing stored by columns
+ *
+ * @param columns Listing filled by fatfs_read_dir_columns
+ * @return uint32_t Number of entries whose directory bit is set
+ */
+uint32_t fatfs_columns_dirs(const fatfs_dir_columns_t *columns)
+{
+    uint32_t count = 0; /** Directories found */
+    uint32_t i = 0;     /** Used as an index of operation */
+
+    for (i = 0; i < (columns->count + 63U) / 64U; i++)
+    {
+        count += (uint32_t)__builtin_popcountll(columns->dirs[i]); /** Bits past count are never set */
+    }
+
+    return count;
+}
+
+/**
+ * @brief Add up a column, such as the sizes of a listing
+ *
+ * @param column Column of a listing: sizes, clusters or mtimes
+ * @param count Number of entries of the listing
+ * @return uint64_t Sum of the values
+ */
+uint64_t fatfs_column_sum(const uint32_t *column, uint32_t count)
+{
+    uint64_t sum = 0; /** Sum of the values */
+    uint32_t i = 0;   /** Used as an index of operation */
+
+#if defined(FATFS_HAVE_SSE2)
+    const __m128i zero = _mm_setzero_si128(); /** Widens the values to 64 bits */
+    __m128i acc = _mm_setzero_si128();        /** Two 64-bit partial sums */
+    uint64_t lanes[2];                        /** Partial sums stored for the final add */
+
+    /** Four values per load, added as 64-bit lanes so that no sum can wrap */
+    for (i = 0; i + 4U <= count; i += 4U)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(column + i));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++)
+    {
+        sum += column[i];
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Select the entries whose value in a column is within a range
+ *
+ * @param column Column of a listing: sizes, clusters or mtimes
+ * @param count Number of entries of the listing
+ * @param low Smallest value selected
+ * @param high Largest value selected
+ * @param indexes Receives the indexes of the entries selected, in listing order, room for count
+ * @return uint32_t Number of entries selected
+ */
+uint32_t fatfs_column_select(const uint32_t *column, uint32_t count, uint32_t low, uint32_t high, uint32_t *indexes)
+{
+    uint32_t span = high - low; /** A value is in the range when value - low <= span, without sign */
+    uint32_t used = 0;          /** Entries selected */
+    uint32_t i = 0;             /** Used as an index of operation */
+
+    if (low <= high)
+    {
+#if defined(FATFS_HAVE_SSE2)
+        const __m128i bias = _mm_set1_epi32((int)0x80000000U); /** SSE2 only compares signed values: flip the sign bit */
+        const __m128i base = _mm_set1_epi32((int)low);         /** Start of the range */
+        const __m128i limit = _mm_set1_epi32((int)(span ^ 0x80000000U)); /** Width of the range, biased */
+        uint32_t mask = 0;                                      /** One bit per selected value of the group */
+
+        for (i = 0; i + 4U <= count; i += 4U)
+        {
+            __m128i v = _mm_xor_si128(_mm_sub_epi32(_mm_loadu_si128((const __m128i *)(column + i)), base), bias);
+            mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, limit))) ^ 0xFU; /** Not above the range */
+            while (mask != 0)
+            {
+                indexes[used++] = i + (uint32_t)__builtin_ctz(mask);
+                mask &= mask - 1U;
+            }
+        }
+#endif
+        for (; i < count; i++)
+        {
+            if (column[i] - low <= span)
+            {
+                indexes[used++] = i;
+            }
+        }
+    }
+
+    return used;
+}
+
+/**
+ * @brief Sort the entries of a listing by the values of a column
+ *
+ * Least significant byte first, four passes of counting: a pass where every value has the
+ * same byte is skipped.
+ *
+ * @param column Column of a listing: sizes, clusters or mtimes
+ * @param count Number of entries of the listing
+ * @param order Receives the indexes of the entries in ascending order of value, room for count
+ * @return int 0 on success, -1 if the memory can not be allocated
+ */
+int fatfs_column_sort(const uint32_t *column, uint32_t count, uint32_t *order)
+{
+    uint32_t *scratch = (uint32_t *)malloc(((size_t)count + 1U) * sizeof(uint32_t)); /** Order after the pass */
+    uint32_t *from = order;   /** Order before the pass */
+    uint32_t *to = scratch;   /** Order after the pass */
+    uint32_t *swap = NULL;    /** Used to exchange the buffers */
+    uint32_t counts[256];     /** Entries per byte value, then first position of each value */
+    uint32_t shift = 0;       /** Byte of the pass */
+    uint32_t total = 0;       /** Running position */
+    uint32_t i = 0;           /** Used as an index of operation */
+    int result = FAT_OK;      /** Status of the sort */
+
+    if (NULL == scratch)
+    {
+        result = FAT_ERROR;
+    }
+    else
+    {
+        for (i = 0; i < count; i++)
+        {
+            order[i] = i; /** Listing order, kept among equal values */
+        }
+        for (shift = 0; shift < 32U; shift += 8U)
+        {
+            memset(counts, 0, sizeof(counts));
+            for (i = 0; i < count; i++)
+            {
+                counts[(column[i] >> shift) & 0xFFU]++;
+            }
+            if ((count > 0) && (counts[(column[0] >> shift) & 0xFFU] != count))
+            {
+                total = 0;
+                for (i = 0; i < 256U; i++)
+                {
+                    uint32_t n = counts[i]; /** Entries with this byte */
+                    counts[i] = total;
+                    total += n;
+                }
+                for (i = 0; i < count; i++)
+                {
+                    to[counts[(column[from[i]] >> shift) & 0xFFU]++] = from[i];
+                }
+                swap = from;
+                from = to;
+                to = swap;
+            }
+        }
+        if (from != order)
+        {
+            memcpy(order, from, (size_t)count * sizeof(uint32_t));
+        }
+    }
+    free(scratch);
+
+    return result;
+}
+
+/**
+ * @brief Free the memory of a listing stored by columns
+ *
+ * @param columns Listing to release, left empty and ready for reuse
+ */
+void fatfs_free_columns(fatfs_dir_columns_t *columns)
+{
+    free(columns->sizes); /** One allocation holds every column */
+    memset(columns, 0, sizeof(*columns));
+}
+
+/**
+ * @brief Get the listing of a directory from the dentry cache, reading it on a miss
+ *
+ * A cached listing is returned without any read or allocation. It stays valid, and is not
+ * evicted, until it is given back with fatfs_dir_release.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @return const DirList* The listing, or NULL when no volume is open or on a read or allocation error
+ */
+const DirList *fatfs_dir_acquire(uint32_t start_cluster)
+{
+    fatfs_dentry_t *dentry = fatfs_dcache_find(start_cluster); /** Listing of the directory */
+    fatfs_dentry_t **bucket = &s_dcache[start_cluster % FATFS_DCACHE_BUCKETS]; /** Chain of the directory */
+
+    if ((NULL == dentry) && (s_geo.bytes_per_sector != 0))
+    {
+        dentry = (fatfs_dentry_t *)calloc(1, sizeof(fatfs_dentry_t));
+        if (NULL == dentry)
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for the listing of cluster %u\n", start_cluster);
+        }
+        else if (fatfs_read_dir(start_cluster, &dentry->list) != FAT_OK)
+        {
+            free_entries(&dentry->list); /** A partial listing is not cached */
+            free(dentry);
+            dentry = NULL;
+        }
+        else
+        {
+            dentry->start_cluster = start_cluster;
+            dentry->bytes = (uint32_t)(sizeof(fatfs_dentry_t) + dentry->list.capacity * sizeof(DirEntry) + dentry->list.names_capacity);
+            dentry->hash_next = *bucket;
+            *bucket = dentry;
+            dentry->lru_next = s_dcache_mru; /** Linked at the most recent end */
+            s_dcache_mru = dentry;
+            s_dcache_lru = (NULL == s_dcache_lru) ? dentry : s_dcache_lru;
+            if (dentry->lru_next != NULL)
+            {
+                dentry->lru_next->lru_prev = dentry;
+            }
+            s_dcache_bytes += dentry->bytes;
+        }
+    }
+    else if ((dentry != NULL) && (dentry != s_dcache_mru))
+    {
+        /** Move to the front of the LRU list */
+        dentry->lru_prev->lru_next = dentry->lru_next;
+        if (dentry->lru_next != NULL)
+        {
+            dentry->lru_next->lru_prev = dentry->lru_prev;
+        }
+        else
+        {
+            s_dcache_lru = dentry->lru_prev;
+        }
+        dentry->lru_prev = NULL;
+        dentry->lru_next = s_dcache_mru;
+        s_dcache_mru->lru_prev = dentry;
+        s_dcache_mru = dentry;
+    }
+    if (dentry != NULL)
+    {
+        dentry->refs++;
+        fatfs_dcache_trim(); /** A new listing may push older ones out */
+    }
+
+    return (dentry != NULL) ? &dentry->list : NULL;
+}
+
+/**
+ * @brief Give back a listing got from fatfs_dir_acquire
+ *
+ * @param list The listing, may be NULL
+ */
+void fatfs_dir_release(const DirList *list)
+{
+    fatfs_dentry_t *dentry = (fatfs_dentry_t *)list; /** The listing is the first member of its dentry */
+
+    if ((dentry != NULL) && (dentry->refs > 0))
+    {
+        dentry->refs--;
+        if ((0 == dentry->refs) && (dentry->stale))
+        {
+            fatfs_dcache_free(dentry); /** Already out of the cache */
+        }
+        else if (0 == dentry->refs)
+        {
+            fatfs_dcache_trim(); /** It may have been kept over budget while in use */
+        }
+    }
+}
+
+/**
+ * @brief Find a file or directory by its path
+ *
+ * Components are separated by '/' and matched without case against the 8.3 names, "." and ".."
+ * included. Every directory crossed is taken from the dentry cache, where a hash of its names
+ * is built on the first lookup: a component costs one probe instead of a scan of the listing.
+ *
+ * @param path Path from the root directory, such as "/DIR1/SUB/FILE.TXT"
+ * @param entry Receives the entry found, a directory of first cluster 0 for the root itself
+ * @return int 0 on success, -1 when the path does not exist, no volume is open or on an allocation error
+ */
+int fatfs_lookup(const char *path, DirEntry *entry)
+{
+    const DirList *list = NULL;                                      /** Listing of the directory crossed */
+    const DirEntry *found = NULL;                                    /** Entry matching the component */
+    const char *name = path;                                         /** Start of the component */
+    uint32_t length = 0;                                             /** Length of the component */
+    int result = (s_geo.bytes_per_sector != 0) ? FAT_OK : FAT_ERROR; /** Status of the lookup */
+
+    memset(entry, 0, sizeof(*entry));
+    entry->name[0] = '/';
+    entry->is_dir = 1; /** The walk starts at the root directory */
+    while ((FAT_OK == result) && (*name != '\0'))
+    {
+        name += strspn(name, "/");
+        length = (uint32_t)strcspn(name, "/");
+        if (0 == length)
+        {
+            /** Trailing separators */
+        }
+        else if ((!entry->is_dir) || (length > FATFS_LFN_MAX_LENGTH * 3U))
+        {
+            result = FAT_ERROR; /** Below a file, or longer than any name */
+        }
+        else if (NULL == (list = fatfs_dir_acquire(entry->first_cluster)))
+        {
+            result = FAT_ERROR;
+        }
+        else
+        {
+            found = fatfs_dcache_match((fatfs_dentry_t *)list, name, length);
+            if (found != NULL)
+            {
+                *entry = *found; /** Copied: the listing may be evicted once released */
+            }
+            else
+            {
+                result = FAT_ERROR;
+            }
+            fatfs_dir_release(list);
+        }
+        name += length;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Drop the cached listing of a directory, to be called after changing the directory
+ *
+ * A listing still in use stays valid for its users and is freed on its last release.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ */
+void fatfs_dir_invalidate(uint32_t start_cluster)
+{
+    fatfs_dentry_t *dentry = fatfs_dcache_find(start_cluster); /** Listing of the directory */
+
+    if (dentry != NULL)
+    {
+        fatfs_dcache_detach(dentry);
+    }
+}
+
+/**
+ * @brief Drop every cached listing
+ */
+void fatfs_dir_invalidate_all(void)
+{
+    while (s_dcache_mru != NULL)
+    {
+        fatfs_dcache_detach(s_dcache_mru);
+    }
+}
+
+/**
+ * @brief Set the memory given to the cached listings
+ *
+ * The least recently used listings not in use are dropped while the cache is over budget.
+ *
+ * @param budgetBytes Memory in bytes, 0 selects FATFS_DCACHE_BUDGET_DEFAULT
+ */
+void fatfs_set_dcache_budget(uint32_t budgetBytes)
+{
+    s_dcache_budget = (0 == budgetBytes) ? FATFS_DCACHE_BUDGET_DEFAULT : budgetBytes;
+    fatfs_dcache_trim();
+}
+
+/**
+ * @brief Find a cached listing
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @return fatfs_dentry_t* The dentry of the directory, NULL when it is not cached
+ */
+static fatfs_dentry_t *fatfs_dcache_find(uint32_t start_cluster)
+{
+    fatfs_dentry_t *dentry = s_dcache[start_cluster % FATFS_DCACHE_BUCKETS]; /** Used as an iterator over the bucket */
+
+    while ((dentry != NULL) && (dentry->start_cluster != start_cluster))
+    {
+        dentry = dentry->hash_next;
+    }
+
+    return dentry;
+}
+
+/**
+ * @brief Remove a listing from the cache, freeing it unless it is in use
+ *
+ * @param dentry Cached listing
+ */
+static void fatfs_dcache_detach(fatfs_dentry_t *dentry)
+{
+    fatfs_dentry_t **link = &s_dcache[dentry->start_cluster % FATFS_DCACHE_BUCKETS]; /** Pointer to the dentry in its bucket */
+
+    while (*link != dentry)
+    {
+        link = &(*link)->hash_next;
+    }
+    *link = dentry->hash_next;
+    if (dentry->lru_prev != NULL)
+    {
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    }
+    else
+    {
+        s_dcache_mru = dentry->lru_next;
+    }
+    if (dentry->lru_next != NULL)
+    {
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    }
+    else
+    {
+        s_dcache_lru = dentry->lru_prev;
+    }
+    s_dcache_bytes -= dentry->bytes;
+    if (0 == dentry->refs)
+    {
+        fatfs_dcache_free(dentry);
+    }
+    else
+    {
+        dentry->stale = true; /** Freed by fatfs_dir_release */
+        dentry->hash_next = NULL;
+        dentry->lru_prev = NULL;
+        dentry->lru_next = NULL;
+    }
+}
+
+/**
+ * @brief Evict the least recently used listings not in use until the cache fits its budget
+ *
+ * The listing used last is kept even alone over budget, so that a directory larger than the
+ * budget is not read again on every lookup.
+ */
+static void fatfs_dcache_trim(void)
+{
+    fatfs_dentry_t *dentry = s_dcache_lru; /** Candidate for eviction, from the least recent */
+    fatfs_dentry_t *prev = NULL;           /** More recent listing, kept before a detach */
+
+    while ((dentry != NULL) && (dentry != s_dcache_mru) && (s_dcache_bytes > s_dcache_budget))
+    {
+        prev = dentry->lru_prev;
+        if (0 == dentry->refs)
+        {
+            fatfs_dcache_detach(dentry);
+        }
+        dentry = prev;
+    }
+}
+
+/**
+ * @brief Free a listing out of the cache
+ *
+ * @param dentry Listing detached from the cache and no longer in use
+ */
+static void fatfs_dcache_free(fatfs_dentry_t *dentry)
+{
+    free(dentry->index);
+    free_entries(&dentry->list);
+    free(dentry);
+}
+
+/**
+ * @brief Build the name hash of a listing, with open addressing and linear probing
+ *
+ * Every entry is added under its 8.3 name, and under its long name when it has one. The table
+ * has at least twice as many slots as names, so probes stay short. A name found twice in a
+ * damaged directory resolves to its first entry, as a scan would.
+ *
+ * @param dentry Cached listing
+ * @return bool true on success, false if the memory can not be allocated
+ */
+static bool fatfs_dcache_index(fatfs_dentry_t *dentry)
+{
+    const DirList *list = &dentry->list;    /** Listing indexed */
+    const char *longName = NULL;            /** Long name of an entry */
+    uint32_t names = list->count;           /** Names to add */
+    uint32_t slots = FATFS_INDEX_MIN_SLOTS; /** Size of the table */
+    uint32_t i = 0;                         /** Used as an index of operation */
+
+    for (i = 0; i < list->count; i++)
+    {
+        names += (list->entries[i].long_name != FATFS_NO_LONG_NAME) ? 1U : 0U;
+    }
+    while (slots < names * 2U)
+    {
+        slots *= 2U;
+    }
+    dentry->index = (uint32_t *)calloc(slots, sizeof(uint32_t));
+    if (dentry->index != NULL)
+    {
+        dentry->index_mask = slots - 1U;
+        for (i = 0; i < list->count; i++)
+        {
+            fatfs_dcache_insert(dentry, fatfs_name_hash(list->entries[i].name, 11U), i);
+            longName = fatfs_long_name(list, &list->entries[i]);
+            if (longName != NULL)
+            {
+                fatfs_dcache_insert(dentry, fatfs_name_hash(longName, (uint32_t)strlen(longName)), i);
+            }
+        }
+        dentry->bytes += slots * (uint32_t)sizeof(uint32_t); /** Counted against the budget with its listing */
+        s_dcache_bytes += (dentry->stale) ? 0U : slots * (uint32_t)sizeof(uint32_t);
+    }
+
+    return (dentry->index != NULL);
+}
+
+/**
+ * @brief Add an entry to the name hash of a listing
+ *
+ * @param dentry Cached listing whose hash has a free slot
+ * @param hash Hash of one of the names of the entry
+ * @param index Index of the entry in the listing
+ */
+static void fatfs_dcache_insert(fatfs_dentry_t *dentry, uint32_t hash, uint32_t index)
+{
+    uint32_t slot = hash & dentry->index_mask; /** Slot probed */
+
+    while (dentry->index[slot] != 0)
+    {
+        slot = (slot + 1U) & dentry->index_mask;
+    }
+    dentry->index[slot] = index + 1U;
+}
+
+/**
+ * @brief Find a component of a path in a listing, building its hash on the first call
+ *
+ * @param dentry Cached listing
+ * @param name Component, not terminated
+ * @param length Length of the component
+ * @return const DirEntry* The entry, by 8.3 name first and long name then, NULL when the listing has no such name
+ */
+static const DirEntry *fatfs_dcache_match(fatfs_dentry_t *dentry, const char *name, uint32_t length)
+{
+    const DirEntry *found = NULL; /** Entry matching the name */
+    char shortName[11];           /** Component as stored on disk */
+
+    if (NULL == dentry->index)
+    {
+        (void)fatfs_dcache_index(dentry); /** Without memory for the hash, the listing is scanned */
+    }
+    if (fatfs_short_name(name, length, shortName))
+    {
+        found = fatfs_dcache_probe(dentry, shortName, 11U, false);
+    }
+    if (NULL == found)
+    {
+        found = fatfs_dcache_probe(dentry, name, length, true);
+    }
+
+    return found;
+}
+
+/**
+ * @brief Find a short or a long name in a listing, through its hash when built
+ *
+ * @param dentry Cached listing
+ * @param name Name, an 8.3 name as stored on disk or a long name, not terminated
+ * @param length Length of the name
+ * @param isLong true to compare with the long names, false with the 8.3 names
+ * @return const DirEntry* The entry, NULL when the listing has no such name
+ */
+static const DirEntry *fatfs_dcache_probe(fatfs_dentry_t *dentry, const char *name, uint32_t length, bool isLong)
+{
+    const DirList *list = &dentry->list; /** Listing searched */
+    const DirEntry *candidate = NULL;    /** Entry compared */
+    const DirEntry *found = NULL;        /** Entry matching the name */
+    const char *text = NULL;             /** Name of the candidate */
+    uint32_t slot = 0;                   /** Slot probed */
+    uint32_t i = 0;                      /** Used as an index of operation */
+
+    slot = (dentry->index != NULL) ? (fatfs_name_hash(name, length) & dentry->index_mask) : 0U;
+    while ((NULL == found) && ((dentry->index != NULL) ? (dentry->index[slot] != 0) : (i < list->count)))
+    {
+        candidate = (dentry->index != NULL) ? &list->entries[dentry->index[slot] - 1U] : &list->entries[i];
+        text = isLong ? fatfs_long_name(list, candidate) : candidate->name;
+        if ((text != NULL) && (strlen(text) == length) && (fatfs_same_name(text, name, length)))
+        {
+            found = candidate;
+        }
+        slot = (slot + 1U) & dentry->index_mask;
+        i++;
+    }
+
+    return found;
+}
+
+/**
+ * @brief Hash a name without case (FNV-1a)
+ *
+ * @param name Name, not terminated
+ * @param length Length of the name
+ * @return uint32_t Hash of the name, equal for names differing only by the case of ASCII letters
+ */
+uint32_t fatfs_name_hash(const char *name, uint32_t length)
+{
+    uint32_t hash = 2166136261U; /** FNV offset basis */
+    uint32_t i = 0;              /** Used as an index of operation */
+
+    for (i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)(((name[i] >= 'a') && (name[i] <= 'z')) ? (name[i] - 'a' + 'A') : name[i])) * 16777619U;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Compare two names without case
+ *
+ * @param a Name
+ * @param b Name
+ * @param length Length of both names
+ * @return bool true when the names only differ by the case of ASCII letters
+ */
+bool fatfs_same_name(const char *a, const char *b, uint32_t length)
+{
+    uint32_t i = 0; /** Used as an index of operation */
+
+    while ((i < length) && ((a[i] == b[i]) || (((a[i] ^ b[i]) == 0x20) && (((a[i] | 0x20) >= 'a') && ((a[i] | 0x20) <= 'z')))))
+    {
+        i++;
+    }
+
+    return (length == i);
+}
+
+/**
+ * @brief Convert a component of a path to an 8.3 name as stored on disk
+ *
+ * @param name Component, not terminated
+ * @param length Length of the component
+ * @param shortName Receives the 11 characters of the name, in upper case and padded with spaces
+ * @return bool false when the component has no 8.3 form: too long, or with more than one dot
+ */
+bool fatfs_short_name(const char *name, uint32_t length, char *shortName)
+{
+    uint32_t dot = length; /** Position of the dot, length when there is none */
+    uint32_t i = 0;        /** Used as an index of operation */
+    bool result = true;    /** The component fits in 8.3 */
+
+    memset(shortName, ' ', 11);
+    if ((length <= 2U) && (0 == strncmp(name, "..", length)))
+    {
+        memcpy(shortName, name, length); /** "." and ".." are stored as they are */
+    }
+    else
+    {
+        for (i = 0; i < length; i++)
+        {
+            result = ((name[i] == '.') && (dot != length)) ? false : result; /** A second dot */
+            dot = ((name[i] == '.') && (dot == length)) ? i : dot;
+        }
+        result = (result) && (dot >= 1U) && (dot <= 8U) && (length - dot <= 4U); /** "NAME." has an empty extension */
+        for (i = 0; (result) && (i < length); i++)
+        {
+            if (i != dot)
+            {
+                shortName[(i < dot) ? i : (8U + i - dot - 1U)] = ((name[i] >= 'a') && (name[i] <= 'z')) ? (char)(name[i] - 'a' + 'A') : name[i];
+            }
+        }
+        shortName[0] = ((uint8_t)shortName[0] == 0xE5U) ? (char)0x05 : shortName[0]; /** 0xE5 marks a deleted entry on disk */
+    }
+
+    return result;
+}
+
+/**
+ * @brief Write an 8.3 name as NAME.EXT, without its padding
+ *
+ * @param shortName The 11 characters of the name, padded with spaces
+ * @param out Receives the terminated name, 13 bytes at most
+ * @return uint32_t Length of the name
+ */
+uint32_t fatfs_format_name(const char *shortName, char *out)
+{
+    uint32_t length = 0; /** Length of the name */
+    uint32_t i = 0;      /** Used as an index of operation */
+
+    for (i = 0; (i < 8U) && (shortName[i] != ' ') && (shortName[i] != '\0'); i++)
+    {
+        out[length++] = shortName[i];
+    }
+    if ((shortName[8] != ' ') && (shortName[8] != '\0'))
+    {
+        out[length++] = '.';
+        for (i = 8; (i < 11U) && (shortName[i] != ' ') && (shortName[i] != '\0'); i++)
+        {
+            out[length++] = shortName[i];
+        }
+    }
+    out[length] = '\0';
+
+    return length;
+}
+
+/**
+ * @brief Make room for at least needed elements in a growing array
+ *
+ * @param array Array to grow, NULL for a new one
+ * @param capacity Room of the array, updated
+ * @param needed Number of elements the array must hold
+ * @param size Size of one element
+ * @return bool true on success, false on an allocation error (the array is kept)
+ */
+bool fatfs_grow(void **array, uint32_t *capacity, uint32_t needed, size_t size)
+{
+    uint32_t room = (*capacity != 0) ? *capacity : FATFS_GROW_MIN_CAPACITY; /** New capacity */
+    void *grown = NULL;                                                     /** Array after realloc */
+    bool result = true;                                                     /** Status of the growth */
+
+    if ((needed > *capacity) || (NULL == *array))
+    {
+        while (room < needed)
+        {
+            room *= 2U;
+        }
+        grown = realloc(*array, (size_t)room * size);
+        result = (grown != NULL);
+        if (result)
+        {
+            *array = grown;
+            *capacity = room;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Deinitialize the filesystem and release resources
+ *
+ * This function closes the image file and cleans up any allocated resources.
+ */
+void fatfs_deinit(void)
+{
+    uint32_t i = 0; /** Used as an index of operation */
+
+    for (i = 0; i < FATFS_EXTENT_MAPS; i++)
     {
-        free(s_fat_table);  /** Free the allocated memory for the FAT table */
-        s_fat_table = NULL; /** Set the pointer to NULL */
+        free(s_extent_maps[i].extents); /** Extents belong to this volume */
     }
+    memset(s_extent_maps, 0, sizeof(s_extent_maps));
+    fatfs_dir_invalidate_all(); /** Listings belong to this volume, those in use are freed on release */
+    fatfs_free_deinit();
+    fatfs_free_fat(); /** Free the allocated memory for the FAT table */
     kmc_deinit();
 }
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include "HAL.h"
 
 /*******************************************************************************
  * Definitions
@@ -19,6 +20,21 @@ typedef enum
     FAT_INDEX = 1   /**  Status code indicating find index*/
 } FAT_status_t;     /**  Define the type name for the enumeration */
 
+/** Define enumeration to represent the width of the FAT entries of a volume */
+typedef enum
+{
+    FAT_TYPE_12 = 12, /** 12-bit entries, floppies and small volumes */
+    FAT_TYPE_16 = 16, /** 16-bit entries */
+    FAT_TYPE_32 = 32  /** 32-bit entries of which the low 28 bits are used */
+} fatfs_type_t;
+
+#define FATFS_BPB32_OFFSET 36U                      /** Offset of the FAT32 extended BIOS parameter block in the boot sector */
+#define FATFS_FAT_BUDGET_DEFAULT (1024U * 1024U)    /** Memory given to the FAT: up to 256K clusters are unpacked at mount */
+#define FATFS_DCACHE_BUDGET_DEFAULT (2048U * 1024U) /** Memory given to the cached listings: about 60000 entries with their hash */
+#define FATFS_NO_LONG_NAME 0xFFFFFFFFU /** Long name offset of an entry without a long name */
+#define FATFS_FSINFO_LEAD_SIG 0x41615252U           /** First signature of the FSInfo sector */
+#define FATFS_FSINFO_STRUCT_SIG 0x61417272U         /** Signature of the FSInfo fields */
+
 /**
  * @brief  Define the structure for the FAT filesystem boot sector
  */
@@ -49,6 +65,79 @@ typedef struct
 } fatfs_bootsector_struct_t;
 #pragma pack(pop)
 
+/**
+ * @brief  Define the structure of the FAT32 extended BIOS parameter block, found at FATFS_BPB32_OFFSET
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t fat_size_32;        /** Sectors per FAT */
+    uint16_t ext_flags;          /** Mirroring flags */
+    uint16_t fs_version;         /** Version of the filesystem, must be 0 */
+    uint32_t root_cluster;       /** First cluster of the root directory */
+    uint16_t fs_info;            /** Sector of the FSInfo structure */
+    uint16_t backup_boot_sector; /** Sector of the copy of the boot sector */
+    uint8_t reserved[12];        /** Reserved */
+    uint8_t drive_number;        /** Drive number */
+    uint8_t reserved1;           /** Reserved */
+    uint8_t boot_signature;      /** Boot signature */
+    uint32_t volume_id;          /** Volume ID */
+    char volume_label[11];       /** Volume label */
+    char filesystem_type[8];     /** Filesystem type */
+} fatfs_bpb32_t;
+#pragma pack(pop)
+
+/**
+ * @brief  Define the structure of the FSInfo sector of a FAT32 volume
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t lead_signature;   /** FATFS_FSINFO_LEAD_SIG */
+    uint8_t reserved1[480];    /** Reserved */
+    uint32_t struct_signature; /** FATFS_FSINFO_STRUCT_SIG */
+    uint32_t free_count;       /** Last known number of free clusters, 0xFFFFFFFF when unknown */
+    uint32_t next_free;        /** Hint of where to look for a free cluster, 0xFFFFFFFF when unknown */
+    uint8_t reserved2[12];     /** Reserved */
+    uint32_t trail_signature;  /** 0xAA550000 */
+} fatfs_fsinfo_t;
+#pragma pack(pop)
+
+/**
+ * @brief  Define the layout of a volume, computed from the boot sector at init
+ */
+typedef struct
+{
+    fatfs_type_t type;            /** Width of the FAT entries */
+    uint32_t bytes_per_sector;    /** Bytes per sector */
+    uint32_t sectors_per_cluster; /** Sectors per cluster */
+    uint32_t fat_start;           /** First sector of the first FAT */
+    uint32_t fat_sectors;         /** Sectors per FAT */
+    uint32_t fat_count;           /** Number of FAT copies */
+    uint32_t root_start;          /** First sector of the root directory on FAT12 and FAT16 */
+    uint32_t root_sectors;        /** Sectors of the root directory on FAT12 and FAT16, 0 on FAT32 */
+    uint32_t root_cluster;        /** First cluster of the root directory on FAT32, 0 otherwise */
+    uint32_t data_start;          /** First sector of cluster 2 */
+    uint32_t cluster_count;       /** Number of data clusters, numbered from 2 */
+    uint32_t eoc;                 /** Smallest end of chain marker of the FAT type */
+    uint32_t fs_info_sector;      /** Sector of the FSInfo structure on FAT32, 0 when there is none */
+} fatfs_geometry_t;
+
+/**
+ * @brief  Define the structure of a primary partition entry of the master boot record
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    uint8_t boot_flag;     /** 0x80 for the active partition */
+    uint8_t chs_first[3];  /** CHS address of the first sector, not used */
+    uint8_t type;          /** Partition type */
+    uint8_t chs_last[3];   /** CHS address of the last sector, not used */
+    uint32_t first_lba;    /** First sector of the partition */
+    uint32_t sector_count; /** Number of sectors of the partition */
+} fatfs_mbr_partition_t;
+#pragma pack(pop)
+
 /**
  * @brief Define the structure for a directory entry in the FAT filesystem
  */
@@ -69,7 +158,7 @@ typedef struct
 } fatfs_dir_entry_t;
 
 /**
- * @brief  Define the structure for a directory entry in the linked list
+ * @brief  Define the structure for a directory entry of a listing
  */
 typedef struct DirEntry
 {
@@ -79,9 +168,77 @@ typedef struct DirEntry
     uint16_t modified_time;
     uint16_t modified_date;
     uint32_t first_cluster; /** First cluster number of the file/directory */
-    struct DirEntry *next;  /** Pointer to the next directory entry in the lists */
+    uint32_t long_name;     /** Offset of the UTF-8 long name in the names of the listing, FATFS_NO_LONG_NAME when none */
 } DirEntry;
 
+/**
+ * @brief  Define the structure of a directory listing: its entries and their long names in two growable arrays
+ */
+typedef struct
+{
+    DirEntry *entries;       /** Entries in directory order, a single allocation */
+    uint32_t count;          /** Number of entries */
+    uint32_t capacity;       /** Room of entries */
+    char *names;             /** Long names of the entries, terminated UTF-8 strings one after the other */
+    uint32_t names_used;     /** Bytes of names in use */
+    uint32_t names_capacity; /** Room of names */
+} DirList;
+
+/**
+ * @brief  Define the structure of a directory listing stored by columns
+ *
+ * Each column is a dense array indexed by entry, and the columns share one allocation that
+ * starts at sizes. An entry takes 23 bytes and a bit, where a DirEntry takes 28.
+ */
+typedef struct
+{
+    uint32_t count;     /** Number of entries */
+    uint32_t capacity;  /** Room of every column, a multiple of 64 */
+    uint32_t *sizes;    /** Size in bytes of every entry, start of the allocation */
+    uint32_t *clusters; /** First cluster of every entry */
+    uint32_t *mtimes;   /** Last write date in the high half and time in the low half: orders as a time stamp */
+    uint64_t *dirs;     /** One bit per entry, set for a directory */
+    char (*names)[11];  /** 8.3 names as stored on disk, padded with spaces and not terminated */
+} fatfs_dir_columns_t;
+
+/**
+ * @brief  Define the structure of one extent: a run of contiguous clusters of a file
+ */
+typedef struct
+{
+    uint32_t file_cluster;  /** Position of the first cluster of the run in the file, in clusters */
+    uint32_t first_cluster; /** First cluster of the run on the volume */
+    uint32_t length;        /** Number of clusters of the run */
+} fatfs_extent_t;
+
+/**
+ * @brief  Define the structure holding the extents of one file in the extent cache
+ */
+typedef struct
+{
+    uint32_t start_cluster;  /** First cluster of the file, the key of the cache */
+    uint32_t count;          /** Number of extents */
+    uint32_t last_use;       /** Clock of the last lookup, 0 when the slot is free */
+    fatfs_extent_t *extents; /** Extents in file order */
+} fatfs_extent_map_t;
+
+/**
+ * @brief  Define the structure holding the listing of one directory in the dentry cache
+ */
+typedef struct fatfs_dentry
+{
+    DirList list;                   /** Listing handed out, first so that the listing gives back its dentry */
+    uint32_t start_cluster;         /** First cluster of the directory, 0 for the FAT12/16 root: the key of the cache */
+    uint32_t refs;                  /** Listings handed out and not released yet */
+    uint32_t bytes;                 /** Memory held, counted against the budget */
+    bool stale;                     /** Invalidated while in use: freed on the last release */
+    uint32_t *index;                /** Hash of the names, entry index + 1 per slot and 0 when empty, built on the first lookup */
+    uint32_t index_mask;            /** Number of slots of index minus one, a power of two minus one */
+    struct fatfs_dentry *hash_next; /** Next dentry of the same bucket */
+    struct fatfs_dentry *lru_prev;  /** Dentry used more recently */
+    struct fatfs_dentry *lru_next;  /** Dentry used less recently */
+} fatfs_dentry_t;
+
 /*******************************************************************************
  * Prototypes
  ******************************************************************************/
@@ -94,22 +251,174 @@ typedef struct DirEntry
  */
 int fatfs_init(const char *image_path);
 
+/**
+ * @brief Initialize the filesystem with an explicit configuration of the HAL
+ *
+ * @param image_path path of the file to init
+ * @param config Access mode of the image (stdio, mmap, ...), NULL selects the default
+ * @return int Status code indicating success (0) or failure (-1)
+ */
+int fatfs_init_ex(const char *image_path, const kmc_config_t *config);
+
+/**
+ * @brief Set the memory given to the FAT of the next volume opened
+ *
+ * A FAT that fits is unpacked at mount. A larger one is not read at mount: its sectors are
+ * loaded on demand into a window of budget / bytes_per_sector sectors, two at least.
+ *
+ * @param budgetBytes Memory in bytes, 0 selects FATFS_FAT_BUDGET_DEFAULT
+ */
+void fatfs_set_fat_budget(uint32_t budgetBytes);
+
+/**
+ * @brief Get the number of free clusters
+ *
+ * On a FAT32 volume whose FAT is loaded on demand, the count of the FSInfo sector is returned
+ * until the free cluster bitmap is built by one of the other queries.
+ *
+ * @return uint32_t Free clusters of the volume, 0 when no volume is open
+ */
+uint32_t fatfs_free_clusters(void);
+
+/**
+ * @brief Get the largest run of free clusters
+ *
+ * @param first_cluster Receives the first cluster of the run, 0 when the volume is full
+ * @param length Receives the number of clusters of the run
+ * @return int 0 on success, or -1 when no volume is open
+ */
+int fatfs_largest_free_extent(uint32_t *first_cluster, uint32_t *length);
+
+/**
+ * @brief Find free clusters with the next-fit policy
+ *
+ * The search starts where the previous one stopped, or at the next free hint of the FSInfo
+ * sector, and wraps around once. The clusters are not allocated: see fatfs_mark_clusters.
+ *
+ * @param count Number of contiguous free clusters wanted
+ * @return uint32_t First cluster of the run, or 0 when no run is long enough
+ */
+uint32_t fatfs_next_fit(uint32_t count);
+
+/**
+ * @brief Record that clusters were allocated or freed
+ *
+ * Nothing in this reader changes the FAT: a writer calls it after changing FAT entries, so the
+ * free count, fatfs_next_fit and fatfs_largest_free_extent follow without a new scan.
+ *
+ * @param first_cluster First cluster of the run
+ * @param count Number of clusters of the run
+ * @param used true when the clusters were allocated, false when they were freed
+ */
+void fatfs_mark_clusters(uint32_t first_cluster, uint32_t count, bool used);
+
 /**
  * @brief Get a directory entry by its index
  *
- * @param head Pointer to the head of the linked list of directory entries
- * @param index Index of the entry to retrieve
- * @return DirEntry* Pointer to the directory entry at the specified index
+ * @param list Listing filled by fatfs_read_dir
+ * @param index Index of the entry to retrieve, from 1
+ * @return DirEntry* Pointer to the directory entry at the specified index, NULL when out of range
+ */
+DirEntry *get_index(const DirList *list, int index);
+
+/**
+ * @brief Get the long name of an entry
+ *
+ * @param list The listing holding the entry
+ * @param entry Entry of the listing
+ * @return const char* The long name in UTF-8, valid while the listing is, or NULL when the entry has none
  */
-DirEntry *get_index(DirEntry *head, int index);
+const char *fatfs_long_name(const DirList *list, const DirEntry *entry);
 
 /**
  * @brief Read the contents of a directory starting from a specific cluster
  *
- * @param start_cluster Cluster number where the directory starts
- * @param head Pointer to a pointer to the head of the linked list of directory entries (will be updated)
+ * The entries are appended to the listing, which grows by whole directory blocks: a directory
+ * of n entries is listed in O(n) with a handful of reallocations. The VFAT long name of an entry
+ * is assembled in the same pass, checked against the checksum of its short name, and stored in
+ * UTF-8 in the names of the listing.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @param list Listing receiving the entries, empty ({0}) or filled by a previous call
+ * @return int 0 on success, -1 on a read or allocation error: the listing then misses entries
  */
-void fatfs_read_dir(uint32_t start_cluster, DirEntry **head);
+int fatfs_read_dir(uint32_t start_cluster, DirList *list);
+
+/**
+ * @brief Read the entries of some clusters of a directory, given in chain order
+ *
+ * Unlike fatfs_read_dir, the chain is not followed: the caller walks it, so several threads may
+ * list parts of one directory at once. The first clusters given may be read only for the long
+ * names that end after them, as the long name entries of a short entry can start up to 640 bytes
+ * before it.
+ *
+ * @param clusters Clusters to read, in chain order
+ * @param count Number of clusters
+ * @param skip Number of first clusters whose entries are not appended, only their long name entries are used
+ * @param list Listing receiving the entries, empty ({0}) or filled by a previous call
+ * @return int 1 when the end of the directory is found, 0 when the next clusters must be read, -1 on a read or allocation error
+ */
+int fatfs_read_dir_clusters(const uint32_t *clusters, uint32_t count, uint32_t skip, DirList *list);
+
+/**
+ * @brief Read the contents of a directory into columns
+ *
+ * Same walk as fatfs_read_dir, for listings too large to hold as DirEntry records. Only the
+ * 8.3 names are kept: the long names are skipped.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @param columns Listing receiving the entries, empty ({0}) or filled by a previous call
+ * @return int 0 on success, -1 on a read or allocation error: the listing then misses entries
+ */
+int fatfs_read_dir_columns(uint32_t start_cluster, fatfs_dir_columns_t *columns);
+
+/**
+ * @brief Count the directories of a listing stored by columns
+ *
+ * @param columns Listing filled by fatfs_read_dir_columns
+ * @return uint32_t Number of entries whose directory bit is set
+ */
+uint32_t fatfs_columns_dirs(const fatfs_dir_columns_t *columns);
+
+/**
+ * @brief Add up a column, such as the sizes of a listing
+ *
+ * @param column Column of a listing: sizes, clusters or mtimes
+ * @param count Number of entries of the listing
+ * @return uint64_t Sum of the values
+ */
+uint64_t fatfs_column_sum(const uint32_t *column, uint32_t count);
+
+/**
+ * @brief Select the entries whose value in a column is within a range
+ *
+ * @param column Column of a listing: sizes, clusters or mtimes
+ * @param count Number of entries of the listing
+ * @param low Smallest value selected
+ * @param high Largest value selected
+ * @param indexes Receives the indexes of the entries selected, in listing order, room for count
+ * @return uint32_t Number of entries selected
+ */
+uint32_t fatfs_column_select(const uint32_t *column, uint32_t count, uint32_t low, uint32_t high, uint32_t *indexes);
+
+/**
+ * @brief Sort the entries of a listing by the values of a column
+ *
+ * The sort is a radix sort, stable, so entries with equal values keep the listing order.
+ *
+ * @param column Column of a listing: sizes, clusters or mtimes
+ * @param count Number of entries of the listing
+ * @param order Receives the indexes of the entries in ascending order of value, room for count
+ * @return int 0 on success, -1 if the memory can not be allocated
+ */
+int fatfs_column_sort(const uint32_t *column, uint32_t count, uint32_t *order);
+
+/**
+ * @brief Free the memory of a listing stored by columns
+ *
+ * @param columns Listing to release, left empty and ready for reuse
+ */
+void fatfs_free_columns(fatfs_dir_columns_t *columns);
 
 /**
  * @brief Read a file from the filesystem
@@ -119,12 +428,163 @@ void fatfs_read_dir(uint32_t start_cluster, DirEntry **head);
  */
 void fatfs_read_file(const char *filepath, uint32_t start_cluster);
 
+/**
+ * @brief Get the layout of the volume
+ *
+ * @return const fatfs_geometry_t* The layout computed by fatfs_init, all zero before it
+ */
+const fatfs_geometry_t *fatfs_get_geometry(void);
+
+/**
+ * @brief Decode FAT entries of the open volume as stored on disk
+ *
+ * Used by the tools reading the FAT themselves, such as fatfs_check (FATfs_check.h).
+ *
+ * @param fat Bytes of the first entry to decode, an entry of even index on FAT12
+ * @param next Receives one entry per cluster
+ * @param count Number of entries to decode
+ */
+void fatfs_decode_fat(const uint8_t *fat, uint32_t *next, uint32_t count);
+
+/**
+ * @brief Get the extents of a file, like the FIEMAP ioctl
+ *
+ * The contiguous clusters of the chain are merged into extents, which are cached per file.
+ *
+ * @param start_cluster First cluster of the file
+ * @param extents Array receiving the extents, may be NULL when max_count is 0
+ * @param max_count Capacity of the array
+ * @return int Total number of extents of the file (more than max_count when the array is too small), or -1 on error
+ */
+int fatfs_get_extents(uint32_t start_cluster, fatfs_extent_t *extents, uint32_t max_count);
+
+/**
+ * @brief Read bytes from anywhere in a file
+ *
+ * The position is found with a binary search over the extents, not by walking the chain.
+ *
+ * @param start_cluster First cluster of the file
+ * @param file_size Size of the file in bytes, the read stops there
+ * @param offset Position in the file of the first byte to read
+ * @param buff Buffer receiving the data
+ * @param length Number of bytes to read
+ * @return int32_t Number of bytes read, 0 at the end of the file, or -1 on error
+ */
+int32_t fatfs_read_at(uint32_t start_cluster, uint32_t file_size, uint32_t offset, uint8_t *buff, uint32_t length);
+
 /**
  * @brief Free the memory allocated for directory entries
  *
- * @param head Pointer to the head of the linked list of directory entries
+ * @param list Listing to release, left empty and ready for reuse
+ */
+void free_entries(DirList *list);
+
+/**
+ * @brief Get the listing of a directory from the dentry cache, reading it on a miss
+ *
+ * A cached listing is returned without any read or allocation. It stays valid, and is not
+ * evicted, until it is given back with fatfs_dir_release.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ * @return const DirList* The listing, or NULL when no volume is open or on a read or allocation error
+ */
+const DirList *fatfs_dir_acquire(uint32_t start_cluster);
+
+/**
+ * @brief Give back a listing got from fatfs_dir_acquire
+ *
+ * @param list The listing, may be NULL
+ */
+void fatfs_dir_release(const DirList *list);
+
+/**
+ * @brief Convert a component of a path to an 8.3 name as stored on disk
+ *
+ * @param name Component, not terminated
+ * @param length Length of the component
+ * @param shortName Receives the 11 characters of the name, in upper case and padded with spaces
+ * @return bool false when the component has no 8.3 form: too long, or with more than one dot
+ */
+bool fatfs_short_name(const char *name, uint32_t length, char *shortName);
+
+/**
+ * @brief Write an 8.3 name as NAME.EXT, without its padding
+ *
+ * @param shortName The 11 characters of the name, padded with spaces
+ * @param out Receives the terminated name, 13 bytes at most
+ * @return uint32_t Length of the name
+ */
+uint32_t fatfs_format_name(const char *shortName, char *out);
+
+/**
+ * @brief Hash a name without case (FNV-1a)
+ *
+ * @param name Name, not terminated
+ * @param length Length of the name
+ * @return uint32_t Hash of the name, equal for names differing only by the case of ASCII letters
+ */
+uint32_t fatfs_name_hash(const char *name, uint32_t length);
+
+/**
+ * @brief Compare two names without case
+ *
+ * @param a Name
+ * @param b Name
+ * @param length Length of both names
+ * @return bool true when the names only differ by the case of ASCII letters
+ */
+bool fatfs_same_name(const char *a, const char *b, uint32_t length);
+
+/**
+ * @brief Make room for at least needed elements in a growing array
+ *
+ * The capacity starts at 64 elements and doubles.
+ *
+ * @param array Array to grow, NULL for a new one
+ * @param capacity Room of the array, updated
+ * @param needed Number of elements the array must hold
+ * @param size Size of one element
+ * @return bool true on success, false on an allocation error (the array is kept)
+ */
+bool fatfs_grow(void **array, uint32_t *capacity, uint32_t needed, size_t size);
+
+/**
+ * @brief Find a file or directory by its path
+ *
+ * Components are separated by '/' and matched without case against the 8.3 names, "." and ".."
+ * included, then against the long names (ASCII letters without case, other characters exactly).
+ * Every directory crossed is taken from the dentry cache, where a hash of its names
+ * is built on the first lookup: a component costs one probe instead of a scan of the listing.
+ *
+ * @param path Path from the root directory, such as "/DIR1/SUB/FILE.TXT"
+ * @param entry Receives the entry found, a directory of first cluster 0 for the root itself
+ * @return int 0 on success, -1 when the path does not exist, no volume is open or on an allocation error
+ */
+int fatfs_lookup(const char *path, DirEntry *entry);
+
+/**
+ * @brief Drop the cached listing of a directory, to be called after changing the directory
+ *
+ * A listing still in use stays valid for its users and is freed on its last release.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory
+ */
+void fatfs_dir_invalidate(uint32_t start_cluster);
+
+/**
+ * @brief Drop every cached listing
+ */
+void fatfs_dir_invalidate_all(void);
+
+/**
+ * @brief Set the memory given to the cached listings
+ *
+ * The least recently used listings not in use are dropped while the cache is over budget,
+ * except the listing used last.
+ *
+ * @param budgetBytes Memory in bytes, 0 selects FATFS_DCACHE_BUDGET_DEFAULT
  */
-void free_entries(DirEntry *head);
+void fatfs_set_dcache_budget(uint32_t budgetBytes);
 
 /**
  * @brief Deinitialize the filesystem and release resources
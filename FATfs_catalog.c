@@ -0,0 +1,984 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "FATfs_catalog.h"
+#include "HAL.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define FATFS_CATALOG_MAGIC "FATCATLG"     /** First bytes of a catalog file */
+#define FATFS_CATALOG_HEAD_BYTES 4096U     /** Bytes of the image hashed into the fingerprint: boot sector, FSInfo and backup */
+#define FATFS_CATALOG_ALIGN 8U             /** Alignment of every section in the file */
+#define FATFS_CATALOG_MIN_SLOTS 16U        /** Fewest slots of the name hash */
+#define FATFS_CATALOG_TEMP_SUFFIX ".tmp"   /** Appended to the catalog path while it is written */
+
+/** Define enumeration to represent the sections of a catalog file, in file order */
+typedef enum
+{
+    FATFS_CATALOG_DIRS = 0,    /** Directories sorted by first cluster */
+    FATFS_CATALOG_ENTRIES = 1, /** Entries, those of one directory together, the root first */
+    FATFS_CATALOG_EXTENTS = 2, /** Runs of clusters of the entries */
+    FATFS_CATALOG_INDEX = 3,   /** Hash of the names, entry index + 1 per slot and 0 when empty */
+    FATFS_CATALOG_FAT = 4,     /** Decoded FAT */
+    FATFS_CATALOG_STRINGS = 5, /** Long names and paths, terminated strings one after the other */
+    FATFS_CATALOG_SECTIONS = 6 /** Number of sections */
+} fatfs_catalog_section_id_t;
+
+/**
+ * @brief  Define the structure locating one section in the catalog file
+ */
+typedef struct
+{
+    uint64_t offset; /** Offset from the start of the file, a multiple of FATFS_CATALOG_ALIGN */
+    uint32_t count;  /** Number of elements */
+    uint32_t size;   /** Size of one element, checks the layout */
+} fatfs_catalog_section_t;
+
+/**
+ * @brief  Define the structure of the header of a catalog file
+ */
+typedef struct
+{
+    char magic[8];                                            /** FATFS_CATALOG_MAGIC */
+    uint32_t version;                                         /** FATFS_CATALOG_VERSION */
+    uint32_t header_bytes;                                    /** Size of this header, checks the layout */
+    uint64_t file_bytes;                                      /** Size of the whole file */
+    uint64_t image_bytes;                                     /** Fingerprint: size of the image */
+    uint64_t image_mtime;                                     /** Fingerprint: last write time of the image, in nanoseconds */
+    uint64_t image_hash;                                      /** Fingerprint: FNV-1a of the first bytes of the image */
+    fatfs_geometry_t geometry;                                /** Layout of the volume */
+    uint32_t reserved;                                        /** Keeps the sections 8-byte aligned */
+    fatfs_catalog_section_t sections[FATFS_CATALOG_SECTIONS]; /** Sections of the file */
+} fatfs_catalog_header_t;
+
+/**
+ * @brief  Define the structure of one directory of the catalog
+ */
+typedef struct
+{
+    uint32_t cluster;     /** First cluster of the directory, 0 for the root: the key */
+    uint32_t entry;       /** Index of the entry of the directory itself, 0 for the root */
+    uint32_t first_entry; /** Index of the first entry of the directory */
+    uint32_t count;       /** Number of entries of the directory */
+} fatfs_catalog_dir_t;
+
+/**
+ * @brief  Define the structure of a catalog being built
+ */
+typedef struct
+{
+    fatfs_catalog_dir_t *dirs;        /** Directories, in the order they are listed */
+    uint32_t dir_count;               /** Number of directories */
+    uint32_t dir_capacity;            /** Room of dirs */
+    fatfs_catalog_entry_t *entries;   /** Entries, the root first */
+    uint32_t entry_count;             /** Number of entries */
+    uint32_t entry_capacity;          /** Room of entries */
+    fatfs_extent_t *extents;          /** Runs of clusters of the entries */
+    uint32_t extent_count;            /** Number of runs */
+    uint32_t extent_capacity;         /** Room of extents */
+    char *strings;                    /** Long names and paths */
+    uint32_t string_bytes;            /** Bytes used in strings */
+    uint32_t string_capacity;         /** Room of strings */
+    uint32_t *index;                  /** Hash of the names */
+    uint32_t index_slots;             /** Number of slots of index, a power of two */
+    uint32_t *fat;                    /** Decoded FAT */
+    uint32_t fat_count;               /** Number of entries of fat */
+} fatfs_catalog_build_t;
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static uint8_t *s_catalog_base = NULL;                        /** Catalog file in memory */
+static uint64_t s_catalog_bytes = 0;                          /** Size of the catalog file */
+static bool s_catalog_mapped = false;                         /** Set when s_catalog_base is mapped, read into memory otherwise */
+static const fatfs_catalog_header_t *s_catalog_header = NULL; /** Header of the open catalog, NULL when none is open */
+static const fatfs_catalog_dir_t *s_catalog_dirs = NULL;      /** Directories of the open catalog */
+static const fatfs_catalog_entry_t *s_catalog_entries = NULL; /** Entries of the open catalog */
+static const fatfs_extent_t *s_catalog_extents = NULL;        /** Runs of the open catalog */
+static const uint32_t *s_catalog_index = NULL;                /** Hash of the names of the open catalog */
+static const uint32_t *s_catalog_fat = NULL;                  /** Decoded FAT of the open catalog */
+static const char *s_catalog_strings = NULL;                  /** Strings of the open catalog */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool fatfs_catalog_add(fatfs_catalog_build_t *build, const DirList *list, const DirEntry *entry, uint32_t directory, uint32_t parent); /** Add an entry */
+static bool fatfs_catalog_add_extents(fatfs_catalog_build_t *build, fatfs_catalog_entry_t *record); /** Add the runs of an entry */
+static uint32_t fatfs_catalog_add_string(fatfs_catalog_build_t *build, const char *text, uint32_t length); /** Add a string */
+static bool fatfs_catalog_index(fatfs_catalog_build_t *build);                                /** Build the hash of the names */
+static bool fatfs_catalog_read_fat(fatfs_catalog_build_t *build, const fatfs_geometry_t *geo); /** Decode the FAT of the volume */
+static bool fatfs_catalog_write(const fatfs_catalog_build_t *build, const fatfs_catalog_header_t *header, const char *catalog_path); /** Write the file */
+static bool fatfs_catalog_write_section(FILE *out, const void *data, uint64_t bytes, uint64_t *offset); /** Write a padded section */
+static void fatfs_catalog_free_build(fatfs_catalog_build_t *build);                           /** Release a catalog being built */
+static int fatfs_catalog_compare(const void *a, const void *b);                               /** Order directories by first cluster */
+static bool fatfs_catalog_fingerprint(const char *image_path, fatfs_catalog_header_t *header); /** Fingerprint of an image */
+static bool fatfs_catalog_valid(const char *image_path);                                      /** Check the mapped catalog */
+static const fatfs_catalog_entry_t *fatfs_catalog_find(uint32_t directory, const char *name, uint32_t length, bool isLong); /** Find a name */
+static uint32_t fatfs_catalog_hash(uint32_t directory, const char *name, uint32_t length);    /** Hash a name of a directory */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Write the catalog of the open volume to a file.
+ *
+ * @param image_path Path of the image opened by fatfs_init, for its fingerprint.
+ * @param catalog_path Path of the catalog file, replaced when it exists.
+ * @return int 0 on success, -1 when no volume is open, on a read, write or allocation error.
+ */
+int fatfs_catalog_build(const char *image_path, const char *catalog_path)
+{
+    const fatfs_geometry_t *geo = fatfs_get_geometry(); /** Layout of the volume */
+    fatfs_catalog_build_t build;                        /** Catalog being built */
+    fatfs_catalog_header_t header;                      /** Header of the file */
+    fatfs_catalog_entry_t *root = NULL;                 /** Entry of the root directory */
+    uint8_t *listed = NULL;                             /** One bit per cluster: directory already listed */
+    DirList list = {0};                                 /** Entries of the directory, reused for every directory */
+    const DirEntry *entry = NULL;                       /** Entry being added */
+    uint32_t d = 0;                                     /** Directory being listed */
+    uint32_t e = 0;                                     /** Used as an index of operation */
+    int status = FAT_OK;                                /** Status of the build */
+
+    memset(&build, 0, sizeof(build));
+    memset(&header, 0, sizeof(header));
+    if (0 == geo->type)
+    {
+        status = FAT_ERROR; /** No volume open */
+    }
+    else
+    {
+        listed = (uint8_t *)calloc((geo->cluster_count + 2U + 7U) / 8U, 1);
+        status = ((listed != NULL) && (fatfs_catalog_fingerprint(image_path, &header)) &&
+                  fatfs_grow((void **)&build.dirs, &build.dir_capacity, 1, sizeof(fatfs_catalog_dir_t)) &&
+                  fatfs_grow((void **)&build.entries, &build.entry_capacity, 1, sizeof(fatfs_catalog_entry_t)))
+                     ? FAT_OK
+                     : FAT_ERROR;
+    }
+
+    if (FAT_OK == status)
+    {
+        root = &build.entries[0];
+        memset(root, 0, sizeof(*root));
+        memset(root->name, ' ', sizeof(root->name));
+        root->name[0] = '/';
+        root->is_dir = 1;
+        root->first_cluster = geo->root_cluster; /** 0 for the fixed root of FAT12 and FAT16 */
+        root->long_name = FATFS_CATALOG_NONE;
+        root->path = fatfs_catalog_add_string(&build, "/", 1);
+        build.entry_count = 1;
+        memset(&build.dirs[0], 0, sizeof(build.dirs[0]));
+        build.dir_count = 1;
+        if (geo->root_cluster >= 2U)
+        {
+            listed[geo->root_cluster / 8U] |= (uint8_t)(1U << (geo->root_cluster % 8U)); /** A subdirectory pointing to the root is not listed again */
+        }
+        status = ((root->path != FATFS_CATALOG_NONE) && (fatfs_catalog_add_extents(&build, &build.entries[0]))) ? FAT_OK : FAT_ERROR;
+    }
+
+    /** Breadth first: the directories are listed in the order they are found */
+    for (d = 0; (FAT_OK == status) && (d < build.dir_count); d++)
+    {
+        list.count = 0; /** Keep the room of the previous directory */
+        list.names_used = 0;
+        status = fatfs_read_dir(build.dirs[d].cluster, &list); /** A partial listing is not written: the old catalog is kept */
+        build.dirs[d].first_entry = build.entry_count;
+        build.dirs[d].count = list.count;
+
+        for (e = 0; (FAT_OK == status) && (e < list.count); e++)
+        {
+            entry = &list.entries[e];
+            status = fatfs_catalog_add(&build, &list, entry, build.dirs[d].cluster, build.entries[build.dirs[d].entry].path) ? FAT_OK : FAT_ERROR;
+            if ((FAT_OK == status) && (entry->is_dir) && ('.' != entry->name[0]) && (entry->first_cluster >= 2U) &&
+                (entry->first_cluster < geo->cluster_count + 2U) &&
+                (0 == (listed[entry->first_cluster / 8U] & (1U << (entry->first_cluster % 8U)))))
+            {
+                listed[entry->first_cluster / 8U] |= (uint8_t)(1U << (entry->first_cluster % 8U)); /** A loop in the tree is listed once */
+                status = fatfs_grow((void **)&build.dirs, &build.dir_capacity, build.dir_count + 1U, sizeof(fatfs_catalog_dir_t)) ? FAT_OK : FAT_ERROR;
+                if (FAT_OK == status)
+                {
+                    build.dirs[build.dir_count].cluster = entry->first_cluster;
+                    build.dirs[build.dir_count].entry = build.entry_count - 1U;
+                    build.dirs[build.dir_count].first_entry = 0;
+                    build.dirs[build.dir_count].count = 0;
+                    build.dir_count++;
+                }
+            }
+        }
+    }
+    free_entries(&list);
+
+    if (FAT_OK == status)
+    {
+        qsort(build.dirs, build.dir_count, sizeof(fatfs_catalog_dir_t), fatfs_catalog_compare);
+        header.geometry = *geo;
+        status = (fatfs_catalog_index(&build) && fatfs_catalog_read_fat(&build, geo) && fatfs_catalog_write(&build, &header, catalog_path)) ? FAT_OK : FAT_ERROR;
+    }
+
+    free(listed);
+    fatfs_catalog_free_build(&build);
+    if (status != FAT_OK)
+    {
+        fprintf(stderr, "Error: Failed to build the catalog %s\n", catalog_path);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Open the catalog of an image, without reading the metadata of the image.
+ *
+ * @param image_path Path of the image described by the catalog.
+ * @param catalog_path Path of the catalog file.
+ * @return int 0 on success, -1 when the catalog is missing, damaged, of another version or stale: build it again.
+ */
+int fatfs_catalog_open(const char *image_path, const char *catalog_path)
+{
+#if !defined(_WIN32)
+    struct stat st;         /** Size of the catalog */
+    int fd = -1;            /** Descriptor of the catalog */
+    void *map = MAP_FAILED; /** Address returned by mmap */
+#else
+    FILE *in = NULL;        /** Catalog read into memory, Windows has no mmap */
+    long size = 0;          /** Size of the catalog */
+#endif
+    int status = FAT_ERROR; /** Status of the open */
+
+    fatfs_catalog_close();
+#if !defined(_WIN32)
+    fd = open(catalog_path, O_RDONLY);
+    if ((fd >= 0) && (fstat(fd, &st) == 0) && (st.st_size >= (off_t)sizeof(fatfs_catalog_header_t)))
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (map != MAP_FAILED)
+    {
+        s_catalog_base = (uint8_t *)map;
+        s_catalog_bytes = (uint64_t)st.st_size;
+        s_catalog_mapped = true;
+    }
+    if (fd >= 0)
+    {
+        close(fd); /** The mapping stays valid */
+    }
+#else
+    in = fopen(catalog_path, "rb");
+    if ((in != NULL) && (fseek(in, 0, SEEK_END) == 0) && ((size = ftell(in)) >= (long)sizeof(fatfs_catalog_header_t)) &&
+        (fseek(in, 0, SEEK_SET) == 0))
+    {
+        s_catalog_base = (uint8_t *)malloc((size_t)size);
+        if ((s_catalog_base != NULL) && (fread(s_catalog_base, 1, (size_t)size, in) == (size_t)size))
+        {
+            s_catalog_bytes = (uint64_t)size;
+        }
+    }
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+#endif
+
+    if ((s_catalog_bytes != 0) && (fatfs_catalog_valid(image_path)))
+    {
+        status = FAT_OK;
+    }
+    else
+    {
+        fatfs_catalog_close(); /** Missing, damaged or stale */
+    }
+
+    return status;
+}
+
+/**
+ * @brief Get the listing of a directory from the catalog.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory.
+ * @param entries Receives the entries, in the order of fatfs_read_dir.
+ * @param count Receives the number of entries.
+ * @return int 0 on success, -1 when no catalog is open or the directory is not in it.
+ */
+int fatfs_catalog_list(uint32_t start_cluster, const fatfs_catalog_entry_t **entries, uint32_t *count)
+{
+    uint32_t low = 0;       /** Binary search: first candidate directory */
+    uint32_t high = 0;      /** Binary search: one past the last candidate */
+    uint32_t mid = 0;       /** Binary search: directory being tested */
+    int result = FAT_ERROR; /** Found or not */
+
+    *entries = NULL;
+    *count = 0;
+    if (s_catalog_header != NULL)
+    {
+        start_cluster = (start_cluster == s_catalog_header->geometry.root_cluster) ? 0U : start_cluster; /** The FAT32 root is keyed 0 */
+        high = s_catalog_header->sections[FATFS_CATALOG_DIRS].count;
+        while (low < high)
+        {
+            mid = (low + high) / 2U;
+            if (s_catalog_dirs[mid].cluster < start_cluster)
+            {
+                low = mid + 1U;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        if ((low < s_catalog_header->sections[FATFS_CATALOG_DIRS].count) && (s_catalog_dirs[low].cluster == start_cluster))
+        {
+            *entries = &s_catalog_entries[s_catalog_dirs[low].first_entry];
+            *count = s_catalog_dirs[low].count;
+            result = FAT_OK;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Find a file or directory of the catalog by its path.
+ *
+ * @param path Path from the root directory, such as "/DIR1/SUB/FILE.TXT".
+ * @param entry Receives the entry, the root directory itself for "/".
+ * @return int 0 on success, -1 when no catalog is open or the path does not exist.
+ */
+int fatfs_catalog_lookup(const char *path, const fatfs_catalog_entry_t **entry)
+{
+    const fatfs_catalog_entry_t *found = s_catalog_entries;       /** Entry reached, the root first */
+    const char *name = path;                                      /** Start of the component */
+    uint32_t length = 0;                                          /** Length of the component */
+    uint32_t directory = 0;                                       /** First cluster of the directory searched */
+    char shortName[11];                                           /** Component as stored on disk */
+    int result = (s_catalog_header != NULL) ? FAT_OK : FAT_ERROR; /** Status of the lookup */
+
+    while ((FAT_OK == result) && (*name != '\0'))
+    {
+        name += strspn(name, "/");
+        length = (uint32_t)strcspn(name, "/");
+        if (0 == length)
+        {
+            /** Trailing separators */
+        }
+        else if (!found->is_dir)
+        {
+            result = FAT_ERROR; /** Below a file */
+        }
+        else
+        {
+            directory = (found == s_catalog_entries) ? 0U : found->first_cluster;
+            directory = (directory == s_catalog_header->geometry.root_cluster) ? 0U : directory; /** ".." of a child of the root holds 0 */
+            found = fatfs_short_name(name, length, shortName) ? fatfs_catalog_find(directory, shortName, 11U, false) : NULL;
+            found = (NULL == found) ? fatfs_catalog_find(directory, name, length, true) : found;
+            result = (found != NULL) ? FAT_OK : FAT_ERROR;
+        }
+        name += length;
+    }
+    *entry = (FAT_OK == result) ? found : NULL;
+
+    return result;
+}
+
+/**
+ * @brief Get the long name of an entry of the catalog.
+ *
+ * @param entry Entry of the open catalog.
+ * @return const char* The UTF-8 long name, NULL when the entry has none.
+ */
+const char *fatfs_catalog_long_name(const fatfs_catalog_entry_t *entry)
+{
+    return (entry->long_name != FATFS_CATALOG_NONE) ? (s_catalog_strings + entry->long_name) : NULL;
+}
+
+/**
+ * @brief Get the path of an entry of the catalog.
+ *
+ * @param entry Entry of the open catalog.
+ * @return const char* The path, made of the long names when there are some.
+ */
+const char *fatfs_catalog_path(const fatfs_catalog_entry_t *entry)
+{
+    return s_catalog_strings + entry->path;
+}
+
+/**
+ * @brief Get the runs of clusters of an entry of the catalog.
+ *
+ * @param entry Entry of the open catalog.
+ * @param count Receives the number of runs.
+ * @return const fatfs_extent_t* The runs in file order, NULL when the entry has none.
+ */
+const fatfs_extent_t *fatfs_catalog_extents(const fatfs_catalog_entry_t *entry, uint32_t *count)
+{
+    *count = entry->extent_count;
+
+    return (entry->extent_count != 0) ? &s_catalog_extents[entry->first_extent] : NULL;
+}
+
+/**
+ * @brief Get the decoded FAT stored in the catalog.
+ *
+ * @param count Receives the number of entries, clusters 0 and 1 included.
+ * @return const uint32_t* Next cluster of every cluster, NULL when no catalog is open.
+ */
+const uint32_t *fatfs_catalog_fat(uint32_t *count)
+{
+    *count = (s_catalog_header != NULL) ? s_catalog_header->sections[FATFS_CATALOG_FAT].count : 0U;
+
+    return s_catalog_fat;
+}
+
+/**
+ * @brief Get the layout of the volume described by the catalog.
+ *
+ * @return const fatfs_geometry_t* The layout, NULL when no catalog is open.
+ */
+const fatfs_geometry_t *fatfs_catalog_geometry(void)
+{
+    return (s_catalog_header != NULL) ? &s_catalog_header->geometry : NULL;
+}
+
+/**
+ * @brief Close the catalog and unmap its file.
+ */
+void fatfs_catalog_close(void)
+{
+#if !defined(_WIN32)
+    if ((s_catalog_base != NULL) && (s_catalog_mapped))
+    {
+        munmap(s_catalog_base, (size_t)s_catalog_bytes);
+    }
+    else
+#endif
+    {
+        free(s_catalog_base);
+    }
+    s_catalog_base = NULL;
+    s_catalog_bytes = 0;
+    s_catalog_mapped = false;
+    s_catalog_header = NULL;
+    s_catalog_dirs = NULL;
+    s_catalog_entries = NULL;
+    s_catalog_extents = NULL;
+    s_catalog_index = NULL;
+    s_catalog_fat = NULL;
+    s_catalog_strings = NULL;
+}
+
+/**
+ * @brief Add a directory entry, its long name, its path and its runs of clusters to the catalog
+ *
+ * @param build Catalog being built
+ * @param list Listing holding the entry
+ * @param entry Directory entry
+ * @param directory First cluster of the directory holding the entry, 0 for the root
+ * @param parent Offset of the path of the directory in the strings
+ * @return bool true on success, false on an allocation error
+ */
+static bool fatfs_catalog_add(fatfs_catalog_build_t *build, const DirList *list, const DirEntry *entry, uint32_t directory, uint32_t parent)
+{
+    fatfs_catalog_entry_t *record = NULL;                /** The new entry */
+    const char *longName = fatfs_long_name(list, entry); /** Long name of the entry, NULL when none */
+    char *path = NULL;                                   /** Path being written */
+    uint32_t length = 0;                                 /** Length of the path */
+    bool result = fatfs_grow((void **)&build->entries, &build->entry_capacity, build->entry_count + 1U, sizeof(fatfs_catalog_entry_t));
+
+    if (result)
+    {
+        record = &build->entries[build->entry_count];
+        memcpy(record->name, entry->name, sizeof(record->name));
+        record->is_dir = entry->is_dir ? 1U : 0U;
+        record->size = entry->size;
+        record->first_cluster = entry->first_cluster;
+        record->modified_time = entry->modified_time;
+        record->modified_date = entry->modified_date;
+        record->directory = directory;
+        record->first_extent = 0;
+        record->extent_count = 0;
+        record->long_name = (longName != NULL) ? fatfs_catalog_add_string(build, longName, (uint32_t)strlen(longName)) : FATFS_CATALOG_NONE;
+
+        /** Path of the directory + "/" + the long name, or "NAME.EXT" when the entry has none: the 8.3 name loses its padding */
+        length = (uint32_t)strlen(build->strings + parent);
+        path = (char *)malloc((size_t)length + ((longName != NULL) ? strlen(longName) : 12U) + 2U);
+        result = (path != NULL);
+    }
+    if (result)
+    {
+        memcpy(path, build->strings + parent, length);
+        length = (1U == length) ? 0U : length; /** The root is "/" */
+        path[length++] = '/';
+        if (longName != NULL)
+        {
+            memcpy(path + length, longName, strlen(longName));
+            length += (uint32_t)strlen(longName);
+        }
+        else
+        {
+            length += fatfs_format_name(entry->name, path + length);
+        }
+        record->path = fatfs_catalog_add_string(build, path, length);
+        free(path);
+        result = (record->path != FATFS_CATALOG_NONE) && ((NULL == longName) || (record->long_name != FATFS_CATALOG_NONE));
+    }
+    if (result)
+    {
+        build->entry_count++;
+        result = ('.' == entry->name[0]) || (fatfs_catalog_add_extents(build, &build->entries[build->entry_count - 1U])); /** "." and ".." own no chain */
+    }
+
+    return result;
+}
+
+/**
+ * @brief Add the runs of clusters of an entry to the catalog
+ *
+ * @param build Catalog being built
+ * @param record Entry owning the runs, its first_extent and extent_count are set
+ * @return bool true on success, false on an allocation error
+ */
+static bool fatfs_catalog_add_extents(fatfs_catalog_build_t *build, fatfs_catalog_entry_t *record)
+{
+    int count = (record->first_cluster >= 2U) ? fatfs_get_extents(record->first_cluster, NULL, 0) : 0; /** Runs of the chain */
+    bool result = true;                                                                                /** Status of the operation */
+
+    record->first_extent = build->extent_count;
+    record->extent_count = 0;
+    if (count > 0)
+    {
+        result = fatfs_grow((void **)&build->extents, &build->extent_capacity, build->extent_count + (uint32_t)count, sizeof(fatfs_extent_t));
+    }
+    if ((result) && (count > 0))
+    {
+        count = fatfs_get_extents(record->first_cluster, &build->extents[build->extent_count], (uint32_t)count);
+        record->extent_count = (uint32_t)count;
+        build->extent_count += (uint32_t)count;
+    }
+
+    return result; /** A broken chain leaves the entry without runs, as fatfs_check reports it */
+}
+
+/**
+ * @brief Add a terminated string to the strings of the catalog
+ *
+ * @param build Catalog being built
+ * @param text Characters of the string, not necessarily terminated
+ * @param length Number of characters
+ * @return uint32_t Offset of the string, FATFS_CATALOG_NONE on an allocation error
+ */
+static uint32_t fatfs_catalog_add_string(fatfs_catalog_build_t *build, const char *text, uint32_t length)
+{
+    uint32_t offset = FATFS_CATALOG_NONE; /** Offset of the string */
+
+    if (fatfs_grow((void **)&build->strings, &build->string_capacity, build->string_bytes + length + 1U, sizeof(char)))
+    {
+        offset = build->string_bytes;
+        memcpy(build->strings + offset, text, length);
+        build->strings[offset + length] = '\0';
+        build->string_bytes += length + 1U;
+    }
+
+    return offset;
+}
+
+/**
+ * @brief Build the hash of the names: every entry is keyed by its directory and its 8.3 name, and by its long name too
+ *
+ * @param build Catalog being built
+ * @return bool true on success, false on an allocation error
+ */
+static bool fatfs_catalog_index(fatfs_catalog_build_t *build)
+{
+    const fatfs_catalog_entry_t *record = NULL; /** Entry being inserted */
+    const char *name = NULL;                    /** Key being inserted */
+    uint32_t keys = 0;                          /** Number of names to insert */
+    uint32_t slot = 0;                          /** Slot being probed */
+    uint32_t e = 0;                             /** Entry being inserted */
+    uint32_t k = 0;                             /** 0 for the 8.3 name, 1 for the long name */
+    bool result = true;                         /** Status of the operation */
+
+    for (e = 1; e < build->entry_count; e++)
+    {
+        keys += (build->entries[e].long_name != FATFS_CATALOG_NONE) ? 2U : 1U;
+    }
+    build->index_slots = FATFS_CATALOG_MIN_SLOTS;
+    while (build->index_slots < keys * 2U)
+    {
+        build->index_slots *= 2U; /** At most half full: short probes */
+    }
+    build->index = (uint32_t *)calloc(build->index_slots, sizeof(uint32_t));
+    result = (build->index != NULL);
+
+    /** The synthetic root entry has no directory and no name: it is not inserted */
+    for (e = 1; (result) && (e < build->entry_count); e++)
+    {
+        record = &build->entries[e];
+        for (k = 0; k < ((record->long_name != FATFS_CATALOG_NONE) ? 2U : 1U); k++)
+        {
+            name = (0 == k) ? record->name : (build->strings + record->long_name);
+            slot = fatfs_catalog_hash(record->directory, name, (0 == k) ? 11U : (uint32_t)strlen(name)) & (build->index_slots - 1U);
+            while (build->index[slot] != 0)
+            {
+                slot = (slot + 1U) & (build->index_slots - 1U);
+            }
+            build->index[slot] = e + 1U;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Read the first FAT of the volume and decode it for the catalog
+ *
+ * @param build Catalog being built
+ * @param geo Layout of the volume
+ * @return bool true on success, false on a read or allocation error
+ */
+static bool fatfs_catalog_read_fat(fatfs_catalog_build_t *build, const fatfs_geometry_t *geo)
+{
+    uint32_t fat_bytes = geo->fat_sectors * geo->bytes_per_sector; /** Size of one FAT in bytes */
+    uint8_t *fat_table = (uint8_t *)malloc(fat_bytes);             /** FAT as stored on disk */
+    bool result = false;                                           /** Status of the operation */
+
+    build->fat_count = (uint32_t)((uint64_t)fat_bytes * 8U / geo->type);
+    build->fat_count = (build->fat_count > geo->cluster_count + 2U) ? (geo->cluster_count + 2U) : build->fat_count;
+    build->fat = (uint32_t *)malloc((size_t)build->fat_count * sizeof(uint32_t));
+    if ((fat_table != NULL) && (build->fat != NULL) &&
+        (kmc_read_multi_sector(geo->fat_start, geo->fat_sectors, fat_table) == (int32_t)fat_bytes))
+    {
+        fatfs_decode_fat(fat_table, build->fat, build->fat_count);
+        result = true;
+    }
+    free(fat_table);
+
+    return result;
+}
+
+/**
+ * @brief Write the catalog file: a blank header, the sections, then the real header
+ *
+ * The file is written next to the catalog under a temporary name, flushed to the disk, then
+ * renamed over it: a catalog mapped by fatfs_catalog_open is never truncated under the mapping,
+ * and a failed write leaves the old catalog in place.
+ *
+ * @param build Catalog being built
+ * @param header Header with the fingerprint and the layout of the volume, the sections are filled here
+ * @param catalog_path Path of the catalog file
+ * @return bool true on success, false on a write error
+ */
+static bool fatfs_catalog_write(const fatfs_catalog_build_t *build, const fatfs_catalog_header_t *header, const char *catalog_path)
+{
+    fatfs_catalog_header_t final = *header;                        /** Header written last */
+    fatfs_catalog_header_t blank;                                  /** Header written first: no magic, an interrupted write is rejected */
+    const void *data[FATFS_CATALOG_SECTIONS];                      /** Elements of every section */
+    size_t length = strlen(catalog_path);                          /** Length of the path of the catalog */
+    char *temp_path = (char *)malloc(length + sizeof(FATFS_CATALOG_TEMP_SUFFIX)); /** Same directory, so the rename stays on one filesystem */
+    FILE *out = NULL;                                              /** Temporary catalog file */
+    uint64_t offset = sizeof(fatfs_catalog_header_t);              /** Offset of the next section */
+    uint32_t s = 0;                                                /** Section being written */
+    bool result = false;                                           /** Status of the operation */
+
+    if (temp_path != NULL)
+    {
+        memcpy(temp_path, catalog_path, length);
+        memcpy(temp_path + length, FATFS_CATALOG_TEMP_SUFFIX, sizeof(FATFS_CATALOG_TEMP_SUFFIX));
+        out = fopen(temp_path, "wb");
+    }
+    result = (out != NULL);
+
+    memset(&blank, 0, sizeof(blank));
+    memcpy(final.magic, FATFS_CATALOG_MAGIC, sizeof(final.magic));
+    final.version = FATFS_CATALOG_VERSION;
+    final.header_bytes = sizeof(fatfs_catalog_header_t);
+    final.sections[FATFS_CATALOG_DIRS].count = build->dir_count;
+    final.sections[FATFS_CATALOG_DIRS].size = sizeof(fatfs_catalog_dir_t);
+    final.sections[FATFS_CATALOG_ENTRIES].count = build->entry_count;
+    final.sections[FATFS_CATALOG_ENTRIES].size = sizeof(fatfs_catalog_entry_t);
+    final.sections[FATFS_CATALOG_EXTENTS].count = build->extent_count;
+    final.sections[FATFS_CATALOG_EXTENTS].size = sizeof(fatfs_extent_t);
+    final.sections[FATFS_CATALOG_INDEX].count = build->index_slots;
+    final.sections[FATFS_CATALOG_INDEX].size = sizeof(uint32_t);
+    final.sections[FATFS_CATALOG_FAT].count = build->fat_count;
+    final.sections[FATFS_CATALOG_FAT].size = sizeof(uint32_t);
+    final.sections[FATFS_CATALOG_STRINGS].count = build->string_bytes;
+    final.sections[FATFS_CATALOG_STRINGS].size = sizeof(char);
+    data[FATFS_CATALOG_DIRS] = build->dirs;
+    data[FATFS_CATALOG_ENTRIES] = build->entries;
+    data[FATFS_CATALOG_EXTENTS] = build->extents;
+    data[FATFS_CATALOG_INDEX] = build->index;
+    data[FATFS_CATALOG_FAT] = build->fat;
+    data[FATFS_CATALOG_STRINGS] = build->strings;
+
+    result = result && (fwrite(&blank, sizeof(blank), 1, out) == 1);
+    for (s = 0; (result) && (s < FATFS_CATALOG_SECTIONS); s++)
+    {
+        final.sections[s].offset = offset;
+        result = fatfs_catalog_write_section(out, data[s], (uint64_t)final.sections[s].count * final.sections[s].size, &offset);
+    }
+    final.file_bytes = offset;
+    result = result && (fseek(out, 0, SEEK_SET) == 0) && (fwrite(&final, sizeof(final), 1, out) == 1) && (fflush(out) == 0);
+#if !defined(_WIN32)
+    result = result && (fsync(fileno(out)) == 0); /** On the disk before it replaces the old catalog */
+#endif
+    if (out != NULL)
+    {
+        result = (fclose(out) == 0) && result;
+    }
+#if defined(_WIN32)
+    if (result)
+    {
+        (void)remove(catalog_path); /** rename does not replace a file on Windows, where the catalog is read rather than mapped */
+    }
+#endif
+    result = result && (rename(temp_path, catalog_path) == 0);
+    if ((!result) && (out != NULL))
+    {
+        (void)remove(temp_path); /** The old catalog, if any, is untouched */
+    }
+    free(temp_path);
+
+    return result;
+}
+
+/**
+ * @brief Write one section of the catalog file, padded to FATFS_CATALOG_ALIGN bytes
+ *
+ * @param out Catalog file
+ * @param data Elements of the section, may be NULL when bytes is 0
+ * @param bytes Size of the elements
+ * @param offset Offset of the section, updated to the offset of the next one
+ * @return bool true on success, false on a write error
+ */
+static bool fatfs_catalog_write_section(FILE *out, const void *data, uint64_t bytes, uint64_t *offset)
+{
+    static const uint8_t zeros[FATFS_CATALOG_ALIGN] = {0};                                                      /** Padding */
+    uint32_t padding = (uint32_t)((FATFS_CATALOG_ALIGN - (bytes % FATFS_CATALOG_ALIGN)) % FATFS_CATALOG_ALIGN); /** Bytes up to the next section */
+    bool result = true;                                                                                         /** Status of the operation */
+
+    if (bytes != 0)
+    {
+        result = (fwrite(data, 1, (size_t)bytes, out) == (size_t)bytes);
+    }
+    if ((result) && (padding != 0))
+    {
+        result = (fwrite(zeros, 1, padding, out) == padding);
+    }
+    *offset += bytes + padding;
+
+    return result;
+}
+
+/**
+ * @brief Release a catalog being built
+ *
+ * @param build Catalog being built
+ */
+static void fatfs_catalog_free_build(fatfs_catalog_build_t *build)
+{
+    free(build->dirs);
+    free(build->entries);
+    free(build->extents);
+    free(build->strings);
+    free(build->index);
+    free(build->fat);
+    memset(build, 0, sizeof(*build));
+}
+
+/**
+ * @brief Order two directories by first cluster, for qsort
+ *
+ * @param a First directory
+ * @param b Second directory
+ * @return int Negative, zero or positive as a is before, with or after b
+ */
+static int fatfs_catalog_compare(const void *a, const void *b)
+{
+    uint32_t left = ((const fatfs_catalog_dir_t *)a)->cluster;  /** Key of a */
+    uint32_t right = ((const fatfs_catalog_dir_t *)b)->cluster; /** Key of b */
+
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief Compute the fingerprint of an image: its size, its last write time and a hash of its first bytes
+ *
+ * The first bytes hold the boot sector, the FSInfo sector and the backup boot sector: a formatted
+ * again or resized volume changes them even when the size and the time are kept.
+ *
+ * @param image_path Path of the image
+ * @param header Receives the fingerprint
+ * @return bool true on success, false when the image cannot be read
+ */
+static bool fatfs_catalog_fingerprint(const char *image_path, fatfs_catalog_header_t *header)
+{
+    struct stat st;                             /** Size and time of the image */
+    uint8_t head[FATFS_CATALOG_HEAD_BYTES];     /** First bytes of the image */
+    FILE *in = NULL;                            /** Image */
+    size_t read = 0;                            /** Bytes of head read */
+    size_t i = 0;                               /** Used as an index of operation */
+    uint64_t hash = 14695981039346656037ULL;    /** FNV-1a 64 offset basis */
+    bool result = (stat(image_path, &st) == 0); /** Status of the operation */
+
+    if (result)
+    {
+        header->image_bytes = (uint64_t)st.st_size;
+#if !defined(_WIN32)
+        header->image_mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+#else
+        header->image_mtime = (uint64_t)st.st_mtime * 1000000000ULL;
+#endif
+        in = fopen(image_path, "rb");
+        result = (in != NULL);
+    }
+    if (result)
+    {
+        read = fread(head, 1, sizeof(head), in);
+        for (i = 0; i < read; i++)
+        {
+            hash = (hash ^ head[i]) * 1099511628211ULL; /** FNV-1a 64 prime */
+        }
+        header->image_hash = hash;
+        fclose(in);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Check the catalog in memory: header, bounds of every offset and fingerprint of the image
+ *
+ * Sets the section pointers when the catalog is valid, so that no later access leaves the file.
+ *
+ * @param image_path Path of the image described by the catalog
+ * @return bool true when the catalog can be used
+ */
+static bool fatfs_catalog_valid(const char *image_path)
+{
+    static const uint32_t sizes[FATFS_CATALOG_SECTIONS] = {sizeof(fatfs_catalog_dir_t), sizeof(fatfs_catalog_entry_t), sizeof(fatfs_extent_t),
+                                                           sizeof(uint32_t),            sizeof(uint32_t),              sizeof(char)}; /** Element sizes */
+    const fatfs_catalog_header_t *header = (const fatfs_catalog_header_t *)s_catalog_base;                                            /** Header of the file */
+    const fatfs_catalog_section_t *section = NULL;                                                                                    /** Section being checked */
+    const fatfs_catalog_dir_t *dirs = NULL;                                                                                           /** Directories of the file */
+    const fatfs_catalog_entry_t *entries = NULL;                                                                                      /** Entries of the file */
+    const uint32_t *index = NULL;                                                                                                     /** Hash of the file */
+    const char *strings = NULL;                                                                                                       /** Strings of the file */
+    fatfs_catalog_header_t image;                                                                                                     /** Fingerprint of the image now */
+    uint32_t entry_count = 0;                                                                                                         /** Number of entries */
+    uint32_t string_bytes = 0;                                                                                                        /** Bytes of strings */
+    uint32_t i = 0;                                                                                                                   /** Used as an index of operation */
+    bool result = (memcmp(header->magic, FATFS_CATALOG_MAGIC, sizeof(header->magic)) == 0) && (FATFS_CATALOG_VERSION == header->version) &&
+                  (sizeof(fatfs_catalog_header_t) == header->header_bytes) && (header->file_bytes == s_catalog_bytes);                /** Status of the check */
+
+    for (i = 0; (result) && (i < FATFS_CATALOG_SECTIONS); i++)
+    {
+        section = &header->sections[i];
+        result = (sizes[i] == section->size) && (0 == section->offset % FATFS_CATALOG_ALIGN) && (section->offset >= sizeof(fatfs_catalog_header_t)) &&
+                 (section->offset <= s_catalog_bytes) && ((uint64_t)section->count * section->size <= s_catalog_bytes - section->offset);
+    }
+    if (result)
+    {
+        dirs = (const fatfs_catalog_dir_t *)(s_catalog_base + header->sections[FATFS_CATALOG_DIRS].offset);
+        entries = (const fatfs_catalog_entry_t *)(s_catalog_base + header->sections[FATFS_CATALOG_ENTRIES].offset);
+        index = (const uint32_t *)(s_catalog_base + header->sections[FATFS_CATALOG_INDEX].offset);
+        strings = (const char *)(s_catalog_base + header->sections[FATFS_CATALOG_STRINGS].offset);
+        entry_count = header->sections[FATFS_CATALOG_ENTRIES].count;
+        string_bytes = header->sections[FATFS_CATALOG_STRINGS].count;
+        result = (entry_count != 0) && (string_bytes != 0) && ('\0' == strings[string_bytes - 1U]) &&
+                 (header->sections[FATFS_CATALOG_INDEX].count >= FATFS_CATALOG_MIN_SLOTS) &&
+                 (0 == (header->sections[FATFS_CATALOG_INDEX].count & (header->sections[FATFS_CATALOG_INDEX].count - 1U))) &&
+                 (header->sections[FATFS_CATALOG_FAT].count <= header->geometry.cluster_count + 2U);
+    }
+    for (i = 0; (result) && (i < header->sections[FATFS_CATALOG_DIRS].count); i++)
+    {
+        result = (dirs[i].entry < entry_count) && (dirs[i].first_entry <= entry_count) && (dirs[i].count <= entry_count - dirs[i].first_entry);
+    }
+    for (i = 0; (result) && (i < entry_count); i++)
+    {
+        result = (entries[i].path < string_bytes) && ((FATFS_CATALOG_NONE == entries[i].long_name) || (entries[i].long_name < string_bytes)) &&
+                 (entries[i].first_extent <= header->sections[FATFS_CATALOG_EXTENTS].count) &&
+                 (entries[i].extent_count <= header->sections[FATFS_CATALOG_EXTENTS].count - entries[i].first_extent);
+    }
+    for (i = 0; (result) && (i < header->sections[FATFS_CATALOG_INDEX].count); i++)
+    {
+        result = (index[i] <= entry_count);
+    }
+
+    /** Last: the fingerprint reads the image */
+    if (result)
+    {
+        memset(&image, 0, sizeof(image));
+        result = fatfs_catalog_fingerprint(image_path, &image) && (image.image_bytes == header->image_bytes) &&
+                 (image.image_mtime == header->image_mtime) && (image.image_hash == header->image_hash);
+    }
+    if (result)
+    {
+        s_catalog_header = header;
+        s_catalog_dirs = dirs;
+        s_catalog_entries = entries;
+        s_catalog_extents = (const fatfs_extent_t *)(s_catalog_base + header->sections[FATFS_CATALOG_EXTENTS].offset);
+        s_catalog_index = index;
+        s_catalog_fat = (const uint32_t *)(s_catalog_base + header->sections[FATFS_CATALOG_FAT].offset);
+        s_catalog_strings = strings;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Find a name in a directory of the open catalog
+ *
+ * @param directory First cluster of the directory, 0 for the root
+ * @param name 8.3 name as stored on disk, or long name
+ * @param length 11 for an 8.3 name, length of the long name otherwise
+ * @param isLong Set to compare with the long names, with the 8.3 names otherwise
+ * @return const fatfs_catalog_entry_t* The entry, NULL when the name is not in the directory
+ */
+static const fatfs_catalog_entry_t *fatfs_catalog_find(uint32_t directory, const char *name, uint32_t length, bool isLong)
+{
+    uint32_t mask = s_catalog_header->sections[FATFS_CATALOG_INDEX].count - 1U; /** Slots - 1, a power of two - 1 */
+    uint32_t slot = fatfs_catalog_hash(directory, name, length) & mask;         /** Slot being probed */
+    uint32_t probes = 0;                                                        /** Slots probed, bounds a damaged hash */
+    const fatfs_catalog_entry_t *record = NULL;                                 /** Entry of the slot */
+    const char *longName = NULL;                                                /** Long name of the entry */
+    const fatfs_catalog_entry_t *found = NULL;                                  /** Entry found */
+
+    while ((NULL == found) && (probes <= mask) && (s_catalog_index[slot] != 0))
+    {
+        record = &s_catalog_entries[s_catalog_index[slot] - 1U];
+        longName = fatfs_catalog_long_name(record);
+        if ((record->directory == directory) &&
+            ((isLong) ? ((longName != NULL) && (strlen(longName) == length) && fatfs_same_name(longName, name, length))
+                      : fatfs_same_name(record->name, name, 11U)))
+        {
+            found = record;
+        }
+        slot = (slot + 1U) & mask;
+        probes++;
+    }
+
+    return found;
+}
+
+/**
+ * @brief Hash a name of a directory without case, so that any spelling finds the entry
+ *
+ * @param directory First cluster of the directory, 0 for the root
+ * @param name Characters of the name
+ * @param length Number of characters
+ * @return uint32_t The hash
+ */
+static uint32_t fatfs_catalog_hash(uint32_t directory, const char *name, uint32_t length)
+{
+    return fatfs_name_hash(name, length) ^ (directory * 0x9E3779B1U); /** Names of different directories spread apart */
+}
+
@@ -0,0 +1,130 @@
+#ifndef _FATFS_CATALOG_H_
+#define _FATFS_CATALOG_H_
+
+#include <stdint.h>
+#include "FATfs.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define FATFS_CATALOG_VERSION 2U       /** Layout of the catalog file and hash of its index, a catalog of another version is rebuilt */
+#define FATFS_CATALOG_NONE 0xFFFFFFFFU /** Index or offset of nothing */
+
+/**
+ * @brief  Define the structure of one entry of the catalog, as stored in the catalog file
+ */
+typedef struct
+{
+    char name[11];          /** 8.3 name as stored on disk, not terminated */
+    uint8_t is_dir;         /** 1 for a directory */
+    uint32_t size;          /** Size in bytes */
+    uint32_t first_cluster; /** First cluster of the entry, 0 when it owns none */
+    uint16_t modified_time; /** Last write time */
+    uint16_t modified_date; /** Last write date */
+    uint32_t directory;     /** First cluster of the directory holding the entry, 0 for the root */
+    uint32_t long_name;     /** Offset of the UTF-8 long name in the strings, FATFS_CATALOG_NONE when none */
+    uint32_t path;          /** Offset of the path of the entry in the strings */
+    uint32_t first_extent;  /** Index of the first run of the chain of the entry */
+    uint32_t extent_count;  /** Number of runs of the chain, 0 for "." and ".." and for an empty file */
+} fatfs_catalog_entry_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Write the catalog of the open volume to a file.
+ *
+ * The directory tree is walked once. The file holds every entry with its path, long name and
+ * runs of clusters, a hash of the names of every directory and the decoded FAT, behind a header
+ * holding the fingerprint of the image: its size, its last write time and a hash of its first
+ * sectors. The file is written under the catalog path followed by ".tmp", then renamed over
+ * the catalog: a catalog open in this or another process stays valid, and a build that fails,
+ * on a directory that can not be read for instance, leaves the previous catalog in place.
+ *
+ * @param image_path Path of the image opened by fatfs_init, for its fingerprint.
+ * @param catalog_path Path of the catalog file, replaced when it exists.
+ * @return int 0 on success, -1 when no volume is open, on a read, write or allocation error.
+ */
+int fatfs_catalog_build(const char *image_path, const char *catalog_path);
+
+/**
+ * @brief Open the catalog of an image, without reading the metadata of the image.
+ *
+ * The catalog is mapped into memory and checked: version, layout, bounds of every offset, and
+ * fingerprint of the image. A previous catalog is closed first.
+ *
+ * @param image_path Path of the image described by the catalog.
+ * @param catalog_path Path of the catalog file.
+ * @return int 0 on success, -1 when the catalog is missing, damaged, of another version or stale: build it again.
+ */
+int fatfs_catalog_open(const char *image_path, const char *catalog_path);
+
+/**
+ * @brief Get the listing of a directory from the catalog.
+ *
+ * @param start_cluster Cluster number where the directory starts, 0 for the root directory.
+ * @param entries Receives the entries, in the order of fatfs_read_dir.
+ * @param count Receives the number of entries.
+ * @return int 0 on success, -1 when no catalog is open or the directory is not in it.
+ */
+int fatfs_catalog_list(uint32_t start_cluster, const fatfs_catalog_entry_t **entries, uint32_t *count);
+
+/**
+ * @brief Find a file or directory of the catalog by its path.
+ *
+ * Components are matched as by fatfs_lookup: 8.3 names first, then long names, without case.
+ *
+ * @param path Path from the root directory, such as "/DIR1/SUB/FILE.TXT".
+ * @param entry Receives the entry, the root directory itself for "/".
+ * @return int 0 on success, -1 when no catalog is open or the path does not exist.
+ */
+int fatfs_catalog_lookup(const char *path, const fatfs_catalog_entry_t **entry);
+
+/**
+ * @brief Get the long name of an entry of the catalog.
+ *
+ * @param entry Entry of the open catalog.
+ * @return const char* The UTF-8 long name, NULL when the entry has none.
+ */
+const char *fatfs_catalog_long_name(const fatfs_catalog_entry_t *entry);
+
+/**
+ * @brief Get the path of an entry of the catalog.
+ *
+ * @param entry Entry of the open catalog.
+ * @return const char* The path, made of the long names when there are some.
+ */
+const char *fatfs_catalog_path(const fatfs_catalog_entry_t *entry);
+
+/**
+ * @brief Get the runs of clusters of an entry of the catalog.
+ *
+ * @param entry Entry of the open catalog.
+ * @param count Receives the number of runs.
+ * @return const fatfs_extent_t* The runs in file order, NULL when the entry has none.
+ */
+const fatfs_extent_t *fatfs_catalog_extents(const fatfs_catalog_entry_t *entry, uint32_t *count);
+
+/**
+ * @brief Get the decoded FAT stored in the catalog.
+ *
+ * @param count Receives the number of entries, clusters 0 and 1 included.
+ * @return const uint32_t* Next cluster of every cluster, NULL when no catalog is open.
+ */
+const uint32_t *fatfs_catalog_fat(uint32_t *count);
+
+/**
+ * @brief Get the layout of the volume described by the catalog.
+ *
+ * @return const fatfs_geometry_t* The layout, NULL when no catalog is open.
+ */
+const fatfs_geometry_t *fatfs_catalog_geometry(void);
+
+/**
+ * @brief Close the catalog and unmap its file.
+ */
+void fatfs_catalog_close(void);
+
+#endif /** _FATFS_CATALOG_H_ */
@@ -0,0 +1,653 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "FATfs_check.h"
+#include "HAL.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#define FATFS_CHECK_DEFAULT_THREADS 4U /** Threads used when the number of processors is unknown */
+#define FATFS_CHECK_STEP 64U           /** Shards start on a multiple of this cluster, even as FAT12 needs */
+
+#define FATFS_CHECK_MISMATCH 0x01U   /** Entry differs in a copy of the FAT */
+#define FATFS_CHECK_BAD_LINK 0x02U   /** Entry points to a reserved value or past the volume, or is free inside a chain */
+#define FATFS_CHECK_PRED 0x04U       /** Another entry points to this cluster */
+#define FATFS_CHECK_MULTI_PRED 0x08U /** More than one entry points to this cluster */
+#define FATFS_CHECK_CROSS 0x10U      /** Cluster reached by two chains of the directory tree */
+#define FATFS_CHECK_CYCLE 0x20U      /** Chain loops back to this cluster */
+#define FATFS_CHECK_LOST 0x40U       /** Used cluster no directory entry reaches */
+
+/**
+ * @brief  Define the state shared by every pass of a check
+ */
+typedef struct
+{
+    const fatfs_geometry_t *geo;  /** Layout of the volume */
+    uint32_t entries;             /** Entries checked: the clusters and the two reserved entries */
+    uint32_t bad;                 /** Value of a bad cluster */
+    uint32_t *next;               /** First FAT, decoded */
+    uint32_t *seen;               /** Chain that reached each cluster, 0 when none */
+    uint8_t *flags;               /** FATFS_CHECK_* bits of each cluster */
+    fatfs_check_report_t *report; /** Counters */
+    FILE *out;                    /** JSON lines, may be NULL */
+} fatfs_check_t;
+
+/**
+ * @brief  Define the work of one thread: a range of clusters and its counters
+ */
+typedef struct
+{
+    fatfs_check_t *check;    /** Shared state */
+    uint32_t first;          /** First cluster of the shard */
+    uint32_t end;            /** One past the last cluster of the shard */
+    int status;              /** FAT_OK, or FAT_ERROR on a read or allocation error */
+    uint32_t free_clusters;  /** Clusters marked free */
+    uint32_t bad_clusters;   /** Clusters marked bad */
+    uint32_t fat_mismatches; /** Entries differing in a copy */
+    uint32_t bad_links;      /** Entries pointing to a reserved value or past the volume */
+    uint32_t lost_clusters;  /** Used clusters not reached */
+    uint32_t lost_chains;    /** Lost clusters without predecessor */
+    pthread_t thread;        /** Thread running the shard */
+} fatfs_check_shard_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static uint32_t fatfs_check_threads(uint32_t threads);                                             /** Number of threads to use */
+static void fatfs_check_run(fatfs_check_shard_t *shards, uint32_t count, void *(*pass)(void *));   /** Run a pass on every shard */
+static void *fatfs_check_fat(void *arg);                                                            /** Decode and check the FAT entries of a shard */
+static FAT_status_t fatfs_check_read(const fatfs_check_shard_t *shard, uint32_t copy, uint32_t *next); /** Decode a copy of the FAT over a shard */
+static void *fatfs_check_lost(void *arg);                                                           /** Find the lost clusters of a shard */
+static FAT_status_t fatfs_check_tree(fatfs_check_t *check);                                         /** Walk the directory tree */
+static uint32_t fatfs_check_chain(fatfs_check_t *check, uint32_t cluster, uint32_t id, bool *clean); /** Follow one chain */
+static void fatfs_check_entry(fatfs_check_t *check, const char *type, const char *name, uint32_t directory, uint32_t cluster); /** Write a problem of a directory entry */
+static void fatfs_check_findings(fatfs_check_t *check);                                             /** Write the problems of the clusters */
+static void fatfs_check_summary(const fatfs_check_report_t *report, FILE *out);                     /** Write the summary line */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check the consistency of the volume opened by fatfs_init.
+ *
+ * @param threads Number of threads, 0 selects the number of processors.
+ * @param report Receives the counters, may be NULL.
+ * @param out Receives the JSON lines, may be NULL.
+ * @return int 0 when the volume is consistent, 1 when problems are found, -1 on a read or allocation error.
+ */
+int fatfs_check(uint32_t threads, fatfs_check_report_t *report, FILE *out)
+{
+    fatfs_check_t check;                    /** Shared state */
+    fatfs_check_report_t counters;          /** Counters when the caller does not want them */
+    fatfs_check_shard_t *shards = NULL;     /** One shard per thread */
+    uint32_t span = 0;                      /** Clusters per shard */
+    uint32_t i = 0;                         /** Used as an index of operation */
+    int result = FAT_OK;                    /** 0, 1 or -1 */
+
+    memset(&check, 0, sizeof(check));
+    check.report = (report != NULL) ? report : &counters;
+    check.out = out;
+    check.geo = fatfs_get_geometry();
+    memset(check.report, 0, sizeof(*check.report));
+
+    if (0 == check.geo->type)
+    {
+        result = FAT_ERROR; /** No volume open */
+    }
+    else
+    {
+        check.entries = check.geo->cluster_count + 2U;
+        check.bad = check.geo->eoc - 1U;
+        check.next = (uint32_t *)malloc((size_t)check.entries * sizeof(uint32_t));
+        check.seen = (uint32_t *)calloc(check.entries, sizeof(uint32_t));
+        check.flags = (uint8_t *)calloc(check.entries, sizeof(uint8_t));
+
+        threads = fatfs_check_threads(threads);
+        span = (check.entries + threads - 1U) / threads;
+        span = (span + FATFS_CHECK_STEP - 1U) / FATFS_CHECK_STEP * FATFS_CHECK_STEP;
+        threads = (check.entries + span - 1U) / span; /** Rounding may leave the last threads without work */
+        shards = (fatfs_check_shard_t *)calloc(threads, sizeof(fatfs_check_shard_t));
+        if ((NULL == check.next) || (NULL == check.seen) || (NULL == check.flags) || (NULL == shards))
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for the check\n");
+            result = FAT_ERROR;
+        }
+    }
+
+    if (FAT_OK == result)
+    {
+        for (i = 0; i < threads; i++)
+        {
+            shards[i].check = &check;
+            shards[i].first = i * span;
+            shards[i].end = ((i + 1U) * span < check.entries) ? ((i + 1U) * span) : check.entries;
+        }
+        check.report->threads = threads;
+        check.report->clusters = check.geo->cluster_count;
+
+        fatfs_check_run(shards, threads, fatfs_check_fat); /** Pass 1: decode, copies, links, predecessors */
+        for (i = 0; i < threads; i++)
+        {
+            result = (shards[i].status != FAT_OK) ? FAT_ERROR : result;
+        }
+    }
+    if (FAT_OK == result)
+    {
+        result = fatfs_check_tree(&check);                  /** Pass 2: every chain reached from the directories */
+    }
+    if (FAT_OK == result)
+    {
+        fatfs_check_run(shards, threads, fatfs_check_lost); /** Pass 3: used clusters no chain reached */
+        for (i = 0; i < threads; i++)
+        {
+            check.report->free_clusters += shards[i].free_clusters;
+            check.report->bad_clusters += shards[i].bad_clusters;
+            check.report->fat_mismatches += shards[i].fat_mismatches;
+            check.report->bad_links += shards[i].bad_links;
+            check.report->lost_clusters += shards[i].lost_clusters;
+            check.report->lost_chains += shards[i].lost_chains;
+        }
+        fatfs_check_findings(&check);
+        fatfs_check_summary(check.report, out);
+
+        if ((check.report->fat_mismatches != 0) || (check.report->bad_links != 0) || (check.report->cross_links != 0) ||
+            (check.report->cycles != 0) || (check.report->lost_clusters != 0) || (check.report->bad_entries != 0) ||
+            (check.report->size_mismatches != 0))
+        {
+            result = 1; /** Problems found */
+        }
+    }
+
+    free(shards);
+    free(check.flags);
+    free(check.seen);
+    free(check.next);
+
+    return result;
+}
+
+/**
+ * @brief Get the number of threads to use
+ *
+ * @param threads Number asked by the caller, 0 for the number of processors
+ * @return uint32_t Number of threads, from 1 to FATFS_CHECK_MAX_THREADS
+ */
+static uint32_t fatfs_check_threads(uint32_t threads)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long online = sysconf(_SC_NPROCESSORS_ONLN); /** Processors available */
+
+    if (0 == threads)
+    {
+        threads = (online > 0) ? (uint32_t)online : FATFS_CHECK_DEFAULT_THREADS;
+    }
+#else
+    if (0 == threads)
+    {
+        threads = FATFS_CHECK_DEFAULT_THREADS;
+    }
+#endif
+
+    return (threads > FATFS_CHECK_MAX_THREADS) ? FATFS_CHECK_MAX_THREADS : threads;
+}
+
+/**
+ * @brief Run a pass on every shard, one thread per shard
+ *
+ * A shard whose thread can not be started runs on the calling thread.
+ *
+ * @param shards Shards of the check
+ * @param count Number of shards
+ * @param pass Function run on each shard
+ */
+static void fatfs_check_run(fatfs_check_shard_t *shards, uint32_t count, void *(*pass)(void *))
+{
+    bool started[FATFS_CHECK_MAX_THREADS]; /** Set when the shard has its own thread */
+    uint32_t i = 0;                        /** Used as an index of operation */
+
+    for (i = 0; i < count; i++)
+    {
+        started[i] = (count > 1) && (pthread_create(&shards[i].thread, NULL, pass, &shards[i]) == 0);
+        if (!started[i])
+        {
+            (void)pass(&shards[i]);
+        }
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(shards[i].thread, NULL);
+        }
+    }
+}
+
+/**
+ * @brief Decode and check the FAT entries of a shard
+ *
+ * The entries of the shard are decoded from the first FAT, compared with every copy, and each
+ * link is marked on the cluster it points to: a cluster marked twice is the meeting point of
+ * two chains.
+ *
+ * @param arg The shard
+ * @return void* NULL
+ */
+static void *fatfs_check_fat(void *arg)
+{
+    fatfs_check_shard_t *shard = (fatfs_check_shard_t *)arg; /** The shard */
+    fatfs_check_t *check = shard->check;                     /** Shared state */
+    uint32_t *copy = NULL;                                   /** Entries of a copy of the FAT */
+    uint32_t c = 0;                                          /** Index of the FAT copy */
+    uint32_t cluster = 0;                                    /** Used as an index of operation */
+    uint32_t value = 0;                                      /** Entry of the cluster */
+    uint8_t old = 0;                                         /** Flags of the cluster before a flag is set */
+
+    shard->status = fatfs_check_read(shard, 0, check->next + shard->first);
+    if ((FAT_OK == shard->status) && (check->geo->fat_count > 1))
+    {
+        copy = (uint32_t *)malloc((size_t)(shard->end - shard->first) * sizeof(uint32_t));
+        shard->status = (copy != NULL) ? FAT_OK : FAT_ERROR;
+    }
+    for (c = 1; (FAT_OK == shard->status) && (c < check->geo->fat_count); c++)
+    {
+        shard->status = fatfs_check_read(shard, c, copy);
+        for (cluster = shard->first; (FAT_OK == shard->status) && (cluster < shard->end); cluster++)
+        {
+            /** Other shards mark links on these flags at the same time: the flag is set atomically too */
+            old = (copy[cluster - shard->first] != check->next[cluster]) ?
+                  __atomic_fetch_or(&check->flags[cluster], FATFS_CHECK_MISMATCH, __ATOMIC_RELAXED) : FATFS_CHECK_MISMATCH;
+            if (0 == (old & FATFS_CHECK_MISMATCH))
+            {
+                shard->fat_mismatches++; /** Counted once, for the first copy that differs */
+            }
+        }
+    }
+    free(copy);
+
+    for (cluster = (shard->first < 2U) ? 2U : shard->first; (FAT_OK == shard->status) && (cluster < shard->end); cluster++)
+    {
+        value = check->next[cluster];
+        if (0 == value)
+        {
+            shard->free_clusters++;
+        }
+        else if (value == check->bad)
+        {
+            shard->bad_clusters++;
+        }
+        else if (value >= check->geo->eoc)
+        {
+            /** End of chain */
+        }
+        else if ((value < 2U) || (value >= check->entries))
+        {
+            __atomic_fetch_or(&check->flags[cluster], FATFS_CHECK_BAD_LINK, __ATOMIC_RELAXED);
+            shard->bad_links++;
+        }
+        else
+        {
+            /** The target may belong to another shard: the flags are set atomically */
+            old = __atomic_fetch_or(&check->flags[value], FATFS_CHECK_PRED, __ATOMIC_RELAXED);
+            if (old & FATFS_CHECK_PRED)
+            {
+                __atomic_fetch_or(&check->flags[value], FATFS_CHECK_MULTI_PRED, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Decode a copy of the FAT over the clusters of a shard
+ *
+ * @param shard The shard
+ * @param copy Index of the FAT copy, 0 for the first FAT
+ * @param next Receives the entries of the shard
+ * @return FAT_status_t FAT_OK on success, FAT_ERROR on a read or allocation error
+ */
+static FAT_status_t fatfs_check_read(const fatfs_check_shard_t *shard, uint32_t copy, uint32_t *next)
+{
+    const fatfs_geometry_t *geo = shard->check->geo;                                                 /** Layout of the volume */
+    uint32_t bps = geo->bytes_per_sector;                                                             /** Size of one sector */
+    uint64_t low = (FAT_TYPE_12 == geo->type) ? (uint64_t)shard->first * 3U / 2U : (uint64_t)shard->first * (geo->type / 8U); /** First byte */
+    uint64_t high = (FAT_TYPE_12 == geo->type) ? ((uint64_t)shard->end * 3U + 1U) / 2U : (uint64_t)shard->end * (geo->type / 8U); /** One past the last byte */
+    uint32_t sector = (uint32_t)(low / bps);                                                          /** First sector of the shard in the FAT */
+    uint32_t num = (uint32_t)((high + bps - 1U) / bps) - sector;                                      /** Sectors of the shard */
+    uint8_t *data = NULL;                                                                             /** Sectors as stored on disk */
+    FAT_status_t result = FAT_OK;                                                                     /** Status of the read */
+
+    num = (sector + num > geo->fat_sectors) ? (geo->fat_sectors - sector) : num;
+    data = (uint8_t *)malloc((size_t)num * bps);
+    if (NULL == data)
+    {
+        result = FAT_ERROR;
+    }
+    else if (kmc_read_multi_sector(geo->fat_start + copy * geo->fat_sectors + sector, num, data) != (int32_t)(num * bps))
+    {
+        fprintf(stderr, "Error: Failed to read sectors %u to %u of FAT %u\n", sector, sector + num - 1U, copy);
+        result = FAT_ERROR;
+    }
+    else
+    {
+        fatfs_decode_fat(data + (low - (uint64_t)sector * bps), next, shard->end - shard->first);
+    }
+    free(data);
+
+    return result;
+}
+
+/**
+ * @brief Find the used clusters of a shard that no chain of the directory tree reached
+ *
+ * @param arg The shard
+ * @return void* NULL
+ */
+static void *fatfs_check_lost(void *arg)
+{
+    fatfs_check_shard_t *shard = (fatfs_check_shard_t *)arg; /** The shard */
+    fatfs_check_t *check = shard->check;                     /** Shared state */
+    uint32_t cluster = 0;                                    /** Used as an index of operation */
+    uint32_t value = 0;                                      /** Entry of the cluster */
+
+    for (cluster = (shard->first < 2U) ? 2U : shard->first; cluster < shard->end; cluster++)
+    {
+        value = check->next[cluster];
+        if ((value != 0) && (value != check->bad) && (0 == check->seen[cluster]))
+        {
+            check->flags[cluster] |= FATFS_CHECK_LOST; /** Only this shard writes its own clusters now */
+            shard->lost_clusters++;
+            if (0 == (check->flags[cluster] & FATFS_CHECK_PRED))
+            {
+                shard->lost_chains++; /** Head of a lost chain */
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Walk the directory tree and follow the chain of every entry
+ *
+ * The directories are kept in a work list rather than walked recursively, so a deep tree can
+ * not exhaust the stack. A directory is only listed when its own chain is clean.
+ *
+ * @param check Shared state
+ * @return FAT_status_t FAT_OK on success, FAT_ERROR on a read or allocation error
+ */
+static FAT_status_t fatfs_check_tree(fatfs_check_t *check)
+{
+    uint32_t *pending = NULL;                                                       /** Directories left to list */
+    uint32_t *grown = NULL;                                                         /** Work list after a realloc */
+    uint32_t used = 0;                                                              /** Directories in the work list */
+    uint32_t capacity = 16;                                                         /** Room of the work list */
+    uint32_t id = 0;                                                                /** Number of the current chain */
+    uint32_t directory = 0;                                                         /** Directory being listed */
+    uint32_t length = 0;                                                            /** Clusters of a chain */
+    uint32_t cluster_bytes = check->geo->sectors_per_cluster * check->geo->bytes_per_sector; /** Size of one cluster */
+    DirList list = {0};                                                             /** Entries of the directory, reused for every directory */
+    DirEntry *entry = NULL;                                                         /** Entry being checked */
+    uint32_t e = 0;                                                                 /** Used as an index of operation */
+    bool clean = true;                                                              /** Chain without cycle, cross-link or bad link */
+    FAT_status_t result = FAT_OK;                                                   /** Status of the walk */
+
+    pending = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    result = (pending != NULL) ? FAT_OK : FAT_ERROR;
+    if ((FAT_OK == result) && (FAT_TYPE_32 == check->geo->type))
+    {
+        if ((check->geo->root_cluster < 2U) || (check->geo->root_cluster >= check->entries) || (0 == check->next[check->geo->root_cluster]))
+        {
+            clean = false;
+        }
+        else
+        {
+            (void)fatfs_check_chain(check, check->geo->root_cluster, ++id, &clean);
+        }
+        if (!clean)
+        {
+            check->report->bad_entries++; /** The root is not listed: its chain can not be followed safely */
+            fatfs_check_entry(check, "bad_entry", "", 0, check->geo->root_cluster);
+        }
+    }
+    if ((FAT_OK == result) && (clean))
+    {
+        pending[used++] = 0; /** The root directory */
+    }
+
+    while ((FAT_OK == result) && (used > 0))
+    {
+        directory = pending[--used];
+        list.count = 0; /** Keep the room of the previous directory */
+        list.names_used = 0;
+        result = (fatfs_read_dir(directory, &list) == FAT_OK) ? FAT_OK : FAT_ERROR; /** A partial listing would report its files as lost */
+        check->report->directories++;
+
+        for (e = 0; (FAT_OK == result) && (e < list.count); e++)
+        {
+            entry = &list.entries[e];
+            if ('.' == entry->name[0])
+            {
+                /** "." and ".." point back into the tree */
+            }
+            else if (0 == entry->first_cluster)
+            {
+                check->report->files += entry->is_dir ? 0U : 1U;
+                if ((entry->is_dir) || (entry->size != 0))
+                {
+                    check->report->bad_entries += entry->is_dir ? 1U : 0U;
+                    check->report->size_mismatches += entry->is_dir ? 0U : 1U;
+                    fatfs_check_entry(check, entry->is_dir ? "bad_entry" : "size_mismatch", entry->name, directory, 0);
+                }
+            }
+            else if ((entry->first_cluster < 2U) || (entry->first_cluster >= check->entries) || (0 == check->next[entry->first_cluster]))
+            {
+                check->report->files += entry->is_dir ? 0U : 1U;
+                check->report->bad_entries++;
+                fatfs_check_entry(check, "bad_entry", entry->name, directory, entry->first_cluster);
+            }
+            else
+            {
+                clean = true;
+                length = fatfs_check_chain(check, entry->first_cluster, ++id, &clean);
+                if (!entry->is_dir)
+                {
+                    check->report->files++;
+                    if ((clean) && (length != (uint32_t)(((uint64_t)entry->size + cluster_bytes - 1U) / cluster_bytes)))
+                    {
+                        check->report->size_mismatches++;
+                        fatfs_check_entry(check, "size_mismatch", entry->name, directory, entry->first_cluster);
+                    }
+                }
+                else if (clean)
+                {
+                    if (used == capacity)
+                    {
+                        capacity *= 2U;
+                        grown = (uint32_t *)realloc(pending, capacity * sizeof(uint32_t));
+                        result = (grown != NULL) ? FAT_OK : FAT_ERROR;
+                        pending = (grown != NULL) ? grown : pending;
+                    }
+                    if (FAT_OK == result)
+                    {
+                        pending[used++] = entry->first_cluster;
+                    }
+                }
+            }
+        }
+    }
+    free_entries(&list);
+    free(pending);
+
+    return result;
+}
+
+/**
+ * @brief Follow one chain, stopping at the first cluster already reached
+ *
+ * @param check Shared state
+ * @param cluster First cluster of the chain, a data cluster of the volume
+ * @param id Number of the chain, above 0
+ * @param clean Cleared when the chain loops, meets another chain or holds a bad link
+ * @return uint32_t Number of clusters of the chain reached first by this one
+ */
+static uint32_t fatfs_check_chain(fatfs_check_t *check, uint32_t cluster, uint32_t id, bool *clean)
+{
+    uint32_t head = cluster; /** First cluster of the chain */
+    uint32_t length = 0;     /** Clusters marked */
+    uint32_t value = 0;      /** Entry of the cluster */
+    bool walking = true;     /** Cleared at the end of the chain */
+
+    if (check->seen[cluster] != 0)
+    {
+        check->flags[cluster] |= FATFS_CHECK_CROSS; /** Two entries share their first cluster */
+        *clean = false;
+        walking = false;
+    }
+
+    while (walking)
+    {
+        check->seen[cluster] = id;
+        length++;
+        value = check->next[cluster];
+        if ((value >= check->geo->eoc) || (value == check->bad) || (check->flags[cluster] & FATFS_CHECK_BAD_LINK))
+        {
+            *clean = (check->flags[cluster] & FATFS_CHECK_BAD_LINK) ? false : *clean;
+            walking = false; /** End of the chain */
+        }
+        else if (0 == value)
+        {
+            check->flags[cluster] |= FATFS_CHECK_BAD_LINK; /** Marked free while in a chain */
+            check->report->bad_links++;
+            *clean = false;
+            walking = false;
+        }
+        else if (check->seen[value] == id)
+        {
+            check->flags[value] |= FATFS_CHECK_CYCLE;
+            check->report->cycles++;
+            *clean = false;
+            walking = false;
+        }
+        else if (check->seen[value] != 0)
+        {
+            check->flags[value] |= FATFS_CHECK_CROSS; /** Joins a chain walked before */
+            *clean = false;
+            walking = false;
+        }
+        else
+        {
+            cluster = value;
+        }
+    }
+    if ((check->flags[head] & FATFS_CHECK_PRED) && (0 == (check->flags[head] & FATFS_CHECK_CYCLE)))
+    {
+        check->flags[head] |= FATFS_CHECK_CROSS; /** First cluster is also inside another chain */
+        *clean = false;
+    }
+
+    return length;
+}
+
+/**
+ * @brief Write a problem of a directory entry as a JSON line
+ *
+ * @param check Shared state
+ * @param type Kind of problem
+ * @param name Name of the entry, 8.3 with padding
+ * @param directory First cluster of the directory holding the entry, 0 for the root
+ * @param cluster First cluster of the entry
+ */
+static void fatfs_check_entry(fatfs_check_t *check, const char *type, const char *name, uint32_t directory, uint32_t cluster)
+{
+    uint32_t i = 0; /** Used as an index of operation */
+
+    if (check->out != NULL)
+    {
+        fprintf(check->out, "{\"type\":\"%s\",\"name\":\"", type);
+        for (i = 0; name[i] != '\0'; i++)
+        {
+            if (((unsigned char)name[i] < 0x20) || ((unsigned char)name[i] >= 0x7F) || ('"' == name[i]) || ('\\' == name[i]))
+            {
+                fprintf(check->out, "\\u%04x", (unsigned char)name[i]); /** Keep the line valid JSON */
+            }
+            else
+            {
+                fputc(name[i], check->out);
+            }
+        }
+        fprintf(check->out, "\",\"directory\":%u,\"cluster\":%u}\n", directory, cluster);
+    }
+}
+
+/**
+ * @brief Write the problems found on the clusters as JSON lines, in cluster order
+ *
+ * @param check Shared state
+ */
+static void fatfs_check_findings(fatfs_check_t *check)
+{
+    uint32_t cluster = 0; /** Used as an index of operation */
+    uint8_t flags = 0;    /** Problems of the cluster */
+
+    for (cluster = 2; cluster < check->entries; cluster++)
+    {
+        flags = check->flags[cluster];
+        if (flags & (FATFS_CHECK_CROSS | FATFS_CHECK_MULTI_PRED))
+        {
+            check->report->cross_links++;
+        }
+        if ((check->out != NULL) && (flags & (FATFS_CHECK_MISMATCH | FATFS_CHECK_BAD_LINK | FATFS_CHECK_CROSS |
+                                              FATFS_CHECK_MULTI_PRED | FATFS_CHECK_CYCLE | FATFS_CHECK_LOST)))
+        {
+            if (flags & FATFS_CHECK_MISMATCH)
+            {
+                fprintf(check->out, "{\"type\":\"fat_mismatch\",\"cluster\":%u}\n", cluster);
+            }
+            if (flags & FATFS_CHECK_BAD_LINK)
+            {
+                fprintf(check->out, "{\"type\":\"bad_link\",\"cluster\":%u,\"value\":%u}\n", cluster, check->next[cluster]);
+            }
+            if (flags & (FATFS_CHECK_CROSS | FATFS_CHECK_MULTI_PRED))
+            {
+                fprintf(check->out, "{\"type\":\"cross_link\",\"cluster\":%u}\n", cluster);
+            }
+            if (flags & FATFS_CHECK_CYCLE)
+            {
+                fprintf(check->out, "{\"type\":\"cycle\",\"cluster\":%u}\n", cluster);
+            }
+            if ((flags & FATFS_CHECK_LOST) && (0 == (flags & FATFS_CHECK_PRED)))
+            {
+                fprintf(check->out, "{\"type\":\"lost_chain\",\"cluster\":%u}\n", cluster);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Write the counters of the report as the last JSON line
+ *
+ * @param report Counters of the check
+ * @param out Receives the line, may be NULL
+ */
+static void fatfs_check_summary(const fatfs_check_report_t *report, FILE *out)
+{
+    if (out != NULL)
+    {
+        fprintf(out,
+                "{\"type\":\"summary\",\"threads\":%u,\"clusters\":%u,\"free_clusters\":%u,\"bad_clusters\":%u,"
+                "\"directories\":%u,\"files\":%u,\"fat_mismatches\":%u,\"bad_links\":%u,\"cross_links\":%u,"
+                "\"cycles\":%u,\"lost_clusters\":%u,\"lost_chains\":%u,\"bad_entries\":%u,\"size_mismatches\":%u}\n",
+                report->threads, report->clusters, report->free_clusters, report->bad_clusters, report->directories,
+                report->files, report->fat_mismatches, report->bad_links, report->cross_links, report->cycles,
+                report->lost_clusters, report->lost_chains, report->bad_entries, report->size_mismatches);
+    }
+}
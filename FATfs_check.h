@@ -0,0 +1,57 @@
+#ifndef _FATFS_CHECK_H_
+#define _FATFS_CHECK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "FATfs.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define FATFS_CHECK_MAX_THREADS 64U /** Upper bound of the threads sharing the FAT */
+
+/**
+ * @brief  Define the structure of the summary of a volume check
+ */
+typedef struct
+{
+    uint32_t threads;         /** Threads used for the FAT passes */
+    uint32_t clusters;        /** Data clusters of the volume */
+    uint32_t free_clusters;   /** Clusters marked free */
+    uint32_t bad_clusters;    /** Clusters marked bad */
+    uint32_t directories;     /** Directories walked, the root included */
+    uint32_t files;           /** Files found */
+    uint32_t fat_mismatches;  /** Entries differing between the first FAT and one of its copies */
+    uint32_t bad_links;       /** Entries pointing to a reserved value or past the volume */
+    uint32_t cross_links;     /** Clusters reached by more than one chain */
+    uint32_t cycles;          /** Chains looping back on themselves */
+    uint32_t lost_clusters;   /** Used clusters no directory entry reaches */
+    uint32_t lost_chains;     /** Chains of lost clusters */
+    uint32_t bad_entries;     /** Directory entries whose first cluster is free or past the volume */
+    uint32_t size_mismatches; /** Files whose size does not match the length of their chain */
+} fatfs_check_report_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Check the consistency of the volume opened by fatfs_init.
+ *
+ * The FAT is decoded and checked by several threads, each one owning a range of clusters:
+ * FAT copies, links, predecessors and lost clusters are found in one pass over the FAT each.
+ * The directory tree is walked once, every chain is followed once and stops at the first
+ * cluster already reached, so the check runs in time linear in the size of the volume.
+ *
+ * Every problem is written to out as one JSON object per line, in cluster order, followed by
+ * a line of "type":"summary" holding the counters of the report.
+ *
+ * @param threads Number of threads, 0 selects the number of processors.
+ * @param report Receives the counters, may be NULL.
+ * @param out Receives the JSON lines, may be NULL.
+ * @return int 0 when the volume is consistent, 1 when problems are found, -1 on a read or allocation error.
+ */
+int fatfs_check(uint32_t threads, fatfs_check_report_t *report, FILE *out);
+
+#endif /** _FATFS_CHECK_H_ */
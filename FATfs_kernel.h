@@ -0,0 +1,334 @@
+/*******************************************************************************
+ * Kernels of one FAT type, generated by FATfs.c once per set
+ *
+ * This file has no include guard: each inclusion generates the kernels of the
+ * set described by the parameters below, which are undefined at the end.
+ *
+ *   FATFS_KERNEL_SUFFIX     Suffix of the generated names (required)
+ *   FATFS_KERNEL_BITS       Width of the FAT entries: 12, 16 or 32 (required)
+ *   FATFS_KERNEL_BPS        Bytes per sector, when known at compile time
+ *   FATFS_KERNEL_SPC        Sectors per cluster, when known at compile time
+ *   FATFS_KERNEL_DATA_START First sector of cluster 2, when known at compile time
+ *   FATFS_KERNEL_CLUSTERS   Number of data clusters, when known at compile time
+ *
+ * The optional parameters describe a fixed layout such as a standard floppy:
+ * the kernels then divide and compare by constants. Without them the layout
+ * is read from s_geo.
+ ******************************************************************************/
+
+#if !defined(FATFS_KERNEL_SUFFIX) || !defined(FATFS_KERNEL_BITS)
+#error "FATFS_KERNEL_SUFFIX and FATFS_KERNEL_BITS must be defined before including FATfs_kernel.h"
+#endif
+
+#define FATFS_K_PASTE(name, suffix) name##_##suffix
+#define FATFS_K_EXPAND(name, suffix) FATFS_K_PASTE(name, suffix)
+#define FATFS_K(name) FATFS_K_EXPAND(name, FATFS_KERNEL_SUFFIX) /** Name of the kernel in this set */
+
+#if defined(FATFS_KERNEL_BPS)
+#define FATFS_K_BPS FATFS_KERNEL_BPS
+#else
+#define FATFS_K_BPS s_geo.bytes_per_sector
+#endif
+#if defined(FATFS_KERNEL_SPC)
+#define FATFS_K_SPC FATFS_KERNEL_SPC
+#else
+#define FATFS_K_SPC s_geo.sectors_per_cluster
+#endif
+#if defined(FATFS_KERNEL_DATA_START)
+#define FATFS_K_DATA_START FATFS_KERNEL_DATA_START
+#else
+#define FATFS_K_DATA_START s_geo.data_start
+#endif
+#if defined(FATFS_KERNEL_CLUSTERS)
+#define FATFS_K_CLUSTERS FATFS_KERNEL_CLUSTERS
+#else
+#define FATFS_K_CLUSTERS s_geo.cluster_count
+#endif
+
+/**
+ * @brief Decode one FAT entry through the window
+ *
+ * @param cluster Cluster number, below the number of entries of the FAT
+ * @return uint32_t The entry, or an end of chain value when its sector can not be read
+ */
+static uint32_t FATFS_K(fatfs_fat_entry)(uint32_t cluster)
+{
+#if 12 == FATFS_KERNEL_BITS
+    uint32_t offset = cluster + cluster / 2U;                       /** Byte of the entry in the FAT */
+    const uint8_t *data = fatfs_fat_sector(offset / FATFS_K_BPS);   /** Sector of the current byte */
+    uint32_t value = FATFS_FAT32_MASK;                              /** The entry */
+
+    if (data != NULL)
+    {
+        value = data[offset % FATFS_K_BPS];
+        if (0 == (offset + 1U) % FATFS_K_BPS)
+        {
+            data = fatfs_fat_sector((offset + 1U) / FATFS_K_BPS); /** Only a FAT12 entry can straddle two sectors */
+        }
+        if (data != NULL)
+        {
+            value |= (uint32_t)data[(offset + 1U) % FATFS_K_BPS] << 8;
+            value = (cluster & 1U) ? (value >> 4) : (value & 0x0FFFU); /** Odd entries use the high 12 bits */
+        }
+        else
+        {
+            value = FATFS_FAT32_MASK; /** Ends the chain */
+        }
+    }
+#else
+    uint32_t offset = cluster * (FATFS_KERNEL_BITS / 8U);           /** Byte of the entry in the FAT, never across two sectors */
+    const uint8_t *data = fatfs_fat_sector(offset / FATFS_K_BPS);   /** Sector of the entry */
+    uint32_t value = FATFS_FAT32_MASK;                              /** The entry, ends the chain when not read */
+
+    if (data != NULL)
+    {
+        data += offset % FATFS_K_BPS;
+#if 16 == FATFS_KERNEL_BITS
+        value = (uint32_t)data[0] | ((uint32_t)data[1] << 8);
+#else
+        value = ((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24)) & FATFS_FAT32_MASK;
+#endif
+    }
+#endif
+
+    return value;
+}
+
+/**
+ * @brief Get the next cluster of a chain
+ *
+ * @param cluster Cluster number
+ * @return uint32_t The FAT entry of the cluster, an end of chain value past the FAT
+ */
+static inline uint32_t FATFS_K(fatfs_next)(uint32_t cluster)
+{
+    uint32_t next = FATFS_FAT32_MASK; /** A cluster outside the FAT ends the chain */
+
+    if (cluster < s_fat_entries)
+    {
+        next = (s_fat_next != NULL) ? s_fat_next[cluster] : FATFS_K(fatfs_fat_entry)(cluster);
+    }
+
+    return next;
+}
+
+/**
+ * @brief Check if a FAT entry ends a chain
+ *
+ * @param cluster Value of the FAT entry
+ * @return bool true when the chain has no cluster after this entry
+ */
+static inline bool FATFS_K(fatfs_end_of_chain)(uint32_t cluster)
+{
+    return (cluster < 2U) || (cluster >= FATFS_K_CLUSTERS + 2U);
+}
+
+/**
+ * @brief Get the first sector of a data cluster
+ *
+ * @param cluster Cluster number, 2 or more
+ * @return uint32_t Index of the first sector of the cluster
+ */
+static inline uint32_t FATFS_K(fatfs_cluster_sector)(uint32_t cluster)
+{
+    return FATFS_K_DATA_START + (cluster - 2U) * FATFS_K_SPC;
+}
+
+/**
+ * @brief Walk a cluster chain and merge the contiguous clusters into extents
+ *
+ * @param start_cluster First cluster of the chain
+ * @param count Receives the number of extents
+ * @return fatfs_extent_t* Array of extents to be freed by the caller, NULL on an empty chain or allocation failure
+ */
+static fatfs_extent_t *FATFS_K(fatfs_build_extents)(uint32_t start_cluster, uint32_t *count)
+{
+    fatfs_extent_t *extents = NULL; /** Extents found so far */
+    fatfs_extent_t *grown = NULL;   /** Array after a realloc */
+    uint32_t capacity = 0;          /** Number of extents allocated */
+    uint32_t used = 0;              /** Number of extents filled */
+    uint32_t file_cluster = 0;      /** Position of the current cluster in the file */
+    bool valid = true;              /** Cleared on allocation failure */
+
+    /** A chain never has more clusters than the FAT has entries: a longer walk is a loop */
+    while ((valid) && (!FATFS_K(fatfs_end_of_chain)(start_cluster)) && (file_cluster < s_fat_entries))
+    {
+        if ((used > 0) && (extents[used - 1].first_cluster + extents[used - 1].length == start_cluster))
+        {
+            extents[used - 1].length++; /** Next to the previous cluster on disk */
+        }
+        else
+        {
+            if (used == capacity)
+            {
+                capacity = (0 == capacity) ? 8U : (capacity * 2U);
+                grown = (fatfs_extent_t *)realloc(extents, capacity * sizeof(fatfs_extent_t));
+                valid = (grown != NULL);
+                extents = (valid) ? grown : extents;
+            }
+            if (valid)
+            {
+                extents[used].file_cluster = file_cluster;
+                extents[used].first_cluster = start_cluster;
+                extents[used].length = 1;
+                used++;
+            }
+        }
+        file_cluster++;
+        start_cluster = FATFS_K(fatfs_next)(start_cluster); /** Next cluster of the chain */
+    }
+    if ((!valid) || (0 == used))
+    {
+        free(extents);
+        extents = NULL;
+        used = 0;
+    }
+    *count = used;
+
+    return extents;
+}
+
+/**
+ * @brief Append the entries of a block of a directory to the list
+ *
+ * @param data Directory entries as stored on disk
+ * @param bytes Size of the block
+ * @param list Listing receiving the entries
+ * @param lfn Long name being assembled, carried over from the previous block
+ * @return fatfs_scan_t FATFS_SCAN_MORE when the next block must be read, FATFS_SCAN_END at the end of the directory, FATFS_SCAN_ERROR on an allocation error
+ */
+static fatfs_scan_t FATFS_K(fatfs_add_entries)(const uint8_t *data, uint32_t bytes, DirList *list, fatfs_lfn_t *lfn)
+{
+    const fatfs_dir_entry_t *dir = (const fatfs_dir_entry_t *)data; /** Pointer to directory entries in the block */
+    DirEntry *entry = NULL;                                         /** Entry being filled */
+    fatfs_scan_t varReturn = FATFS_SCAN_MORE;                       /** Outcome of the block */
+    uint32_t j = (uint32_t)FAT_OK;                                  /** Used as an index of operation */
+
+    varReturn = fatfs_reserve_entries(list, bytes / FATFS_DIR_ENTRY_SIZE) ? FATFS_SCAN_MORE : FATFS_SCAN_ERROR; /** Room for the whole block at once */
+    for (j = 0; (j < bytes / FATFS_DIR_ENTRY_SIZE) && (FATFS_SCAN_MORE == varReturn); ++j)
+    {
+        /** Check if the directory entry is empty */
+        if (dir[j].name[0] == 0x00)
+        {
+            varReturn = FATFS_SCAN_END; /** End of the directory */
+        }
+        /** Check if the entry is deleted */
+        else if (dir[j].name[0] == 0xE5)
+        {
+            lfn->entries = 0; /** A long name before a deleted entry belongs to it */
+            lfn->remaining = 0;
+        }
+        /** Check if the entry is part of a long file name */
+        else if ((dir[j].attr & 0x0F) == 0x0F)
+        {
+            fatfs_lfn_collect(lfn, (const uint8_t *)&dir[j]);
+        }
+        else
+        {
+            entry = &list->entries[list->count++];     /** Append in place, the room is reserved */
+            memcpy(entry->name, dir[j].name, 11);      /** Copy the name */
+            entry->name[11] = '\0';                    /** Null-terminate the name */
+            entry->size = dir[j].file_size;            /** File size */
+            entry->is_dir = (dir[j].attr & 0x10) != 0; /** Check if it's a directory */
+#if 32 == FATFS_KERNEL_BITS
+            entry->first_cluster = dir[j].first_cluster_low | ((uint32_t)dir[j].first_cluster_high << 16); /** Only FAT32 uses the high word */
+#else
+            entry->first_cluster = dir[j].first_cluster_low; /** First cluster of the file or directory */
+#endif
+            entry->modified_time = dir[j].write_time; /** Last write time of the file or directory */
+            entry->modified_date = dir[j].write_date; /** Last write date of the file or directory */
+            if (lfn->entries != 0)
+            {
+                varReturn = fatfs_lfn_attach(lfn, dir[j].name, list, entry) ? FATFS_SCAN_MORE : FATFS_SCAN_ERROR; /** Checked and converted once the short entry is reached */
+            }
+            else
+            {
+                entry->long_name = FATFS_NO_LONG_NAME; /** Most entries of large directories have no long name */
+            }
+        }
+    }
+
+    return varReturn;
+}
+
+/**
+ * @brief Append the entries of a block of a directory to a listing stored by columns
+ *
+ * @param data Directory entries as stored on disk
+ * @param bytes Size of the block
+ * @param columns Listing receiving the entries
+ * @return fatfs_scan_t FATFS_SCAN_MORE when the next block must be read, FATFS_SCAN_END at the end of the directory, FATFS_SCAN_ERROR on an allocation error
+ */
+static fatfs_scan_t FATFS_K(fatfs_add_columns)(const uint8_t *data, uint32_t bytes, fatfs_dir_columns_t *columns)
+{
+    const fatfs_dir_entry_t *dir = (const fatfs_dir_entry_t *)data; /** Pointer to directory entries in the block */
+    fatfs_scan_t varReturn = FATFS_SCAN_MORE;                       /** Outcome of the block */
+    uint32_t n = 0;                                                 /** Index of the new entry */
+    uint32_t j = 0;                                                 /** Used as an index of operation */
+
+    varReturn = fatfs_reserve_columns(columns, bytes / FATFS_DIR_ENTRY_SIZE) ? FATFS_SCAN_MORE : FATFS_SCAN_ERROR; /** Room for the whole block at once */
+    for (j = 0; (j < bytes / FATFS_DIR_ENTRY_SIZE) && (FATFS_SCAN_MORE == varReturn); ++j)
+    {
+        if (dir[j].name[0] == 0x00)
+        {
+            varReturn = FATFS_SCAN_END; /** End of the directory */
+        }
+        else if ((dir[j].name[0] == 0xE5) || ((dir[j].attr & 0x0F) == 0x0F))
+        {
+            /** Deleted entry or long file name */
+        }
+        else
+        {
+            n = columns->count++;
+            memcpy(columns->names[n], dir[j].name, 11);
+            columns->sizes[n] = dir[j].file_size;
+#if 32 == FATFS_KERNEL_BITS
+            columns->clusters[n] = dir[j].first_cluster_low | ((uint32_t)dir[j].first_cluster_high << 16); /** Only FAT32 uses the high word */
+#else
+            columns->clusters[n] = dir[j].first_cluster_low;
+#endif
+            columns->mtimes[n] = ((uint32_t)dir[j].write_date << 16) | dir[j].write_time;
+            if (dir[j].attr & 0x10)
+            {
+                columns->dirs[n / 64U] |= 1ULL << (n % 64U);
+            }
+        }
+    }
+
+    return varReturn;
+}
+
+/** Kernels of the set, with the layout they were generated for */
+static const fatfs_kernel_t FATFS_K(s_kernel) = {
+    FATFS_KERNEL_BITS,
+#if defined(FATFS_KERNEL_CLUSTERS)
+    FATFS_KERNEL_SPC,
+    FATFS_KERNEL_DATA_START,
+    FATFS_KERNEL_CLUSTERS,
+#else
+    0,
+    0,
+    0,
+#endif
+    FATFS_K(fatfs_next),
+    FATFS_K(fatfs_end_of_chain),
+    FATFS_K(fatfs_cluster_sector),
+    FATFS_K(fatfs_fat_entry),
+    FATFS_K(fatfs_build_extents),
+    FATFS_K(fatfs_add_entries),
+    FATFS_K(fatfs_add_columns),
+};
+
+#undef FATFS_K_PASTE
+#undef FATFS_K_EXPAND
+#undef FATFS_K
+#undef FATFS_K_BPS
+#undef FATFS_K_SPC
+#undef FATFS_K_DATA_START
+#undef FATFS_K_CLUSTERS
+#undef FATFS_KERNEL_SUFFIX
+#undef FATFS_KERNEL_BITS
+#undef FATFS_KERNEL_BPS
+#undef FATFS_KERNEL_SPC
+#undef FATFS_KERNEL_DATA_START
+#undef FATFS_KERNEL_CLUSTERS
@@ -0,0 +1,422 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "FATfs_owner.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * @brief  Define the structure of one entry of the map
+ */
+typedef struct
+{
+    uint32_t directory;     /** First cluster of the directory holding the entry */
+    uint32_t first_cluster; /** First cluster of the entry */
+    uint32_t size;          /** Size in bytes */
+    uint32_t path;          /** Offset of the path in s_owner_paths */
+    uint8_t is_dir;         /** 1 for a directory */
+} fatfs_owner_record_t;
+
+/**
+ * @brief  Define the structure of one run of clusters of an entry
+ */
+typedef struct
+{
+    uint32_t first_cluster; /** First cluster of the run */
+    uint32_t length;        /** Number of clusters of the run */
+    uint32_t file_cluster;  /** Position of the run in the chain of the entry */
+    uint32_t entry;         /** Index of the entry in s_owner_records */
+} fatfs_owner_extent_t;
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static fatfs_owner_record_t *s_owner_records = NULL; /** Entries, the root first */
+static uint32_t s_owner_record_count = 0;            /** Number of entries */
+static uint32_t s_owner_record_capacity = 0;         /** Room of s_owner_records */
+static fatfs_owner_extent_t *s_owner_extents = NULL; /** Runs sorted by first cluster */
+static uint32_t s_owner_extent_count = 0;            /** Number of runs */
+static uint32_t s_owner_extent_capacity = 0;         /** Room of s_owner_extents */
+static uint32_t *s_owner_reach = NULL;               /** Furthest end of the runs up to each index */
+static char *s_owner_paths = NULL;                   /** Paths of the entries, one after the other */
+static uint32_t s_owner_path_bytes = 0;              /** Bytes used in s_owner_paths */
+static uint32_t s_owner_path_capacity = 0;           /** Room of s_owner_paths */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static int32_t fatfs_owner_add(const DirEntry *entry, uint32_t parent);                       /** Add an entry and its runs */
+static bool fatfs_owner_add_extents(uint32_t first_cluster, uint32_t entry);                  /** Add the runs of a chain */
+static int fatfs_owner_compare(const void *a, const void *b);                                 /** Order runs by first cluster */
+static void fatfs_owner_fill(uint32_t entry, fatfs_owner_t *owner);                           /** Copy an entry to the caller */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Build the reverse map from clusters to directory entries of the open volume.
+ *
+ * @return int 0 on success, -1 when no volume is open or on a read or allocation error.
+ */
+int fatfs_owner_build(void)
+{
+    const fatfs_geometry_t *geo = fatfs_get_geometry(); /** Layout of the volume */
+    uint32_t *pending = NULL;                           /** Directories left to list, as entry indexes */
+    uint32_t used = 0;                                  /** Directories in the work list */
+    uint32_t capacity = 0;                              /** Room of the work list */
+    uint8_t *listed = NULL;                             /** One bit per cluster: directory already listed */
+    uint32_t directory = 0;                             /** Entry of the directory being listed */
+    uint32_t first = 0;                                 /** First cluster of the directory being listed */
+    uint32_t i = 0;                                     /** Used as an index of operation */
+    int32_t added = 0;                                  /** Index of the entry added, or -1 */
+    DirList list = {0};                                 /** Entries of the directory, reused for every directory */
+    DirEntry *entry = NULL;                             /** Entry being added */
+    uint32_t e = 0;                                     /** Used as an index of operation */
+    int status = FAT_OK;                                /** Status of the build */
+
+    fatfs_owner_deinit();
+    if (0 == geo->type)
+    {
+        status = FAT_ERROR; /** No volume open */
+    }
+    else
+    {
+        listed = (uint8_t *)calloc((geo->cluster_count + 2U + 7U) / 8U, 1);
+        status = ((listed != NULL) && fatfs_grow((void **)&pending, &capacity, 1, sizeof(uint32_t)) &&
+                  fatfs_grow((void **)&s_owner_records, &s_owner_record_capacity, 1, sizeof(fatfs_owner_record_t)) &&
+                  fatfs_grow((void **)&s_owner_paths, &s_owner_path_capacity, 2, 1))
+                     ? FAT_OK
+                     : FAT_ERROR;
+    }
+
+    if (FAT_OK == status)
+    {
+        memset(&s_owner_records[0], 0, sizeof(fatfs_owner_record_t));
+        s_owner_records[0].first_cluster = geo->root_cluster; /** 0 for the fixed root of FAT12 and FAT16 */
+        s_owner_records[0].is_dir = 1;
+        memcpy(s_owner_paths, "/", 2);
+        s_owner_path_bytes = 2;
+        s_owner_record_count = 1;
+        pending[used++] = 0;
+        if ((geo->root_cluster != 0) && !fatfs_owner_add_extents(geo->root_cluster, 0))
+        {
+            status = FAT_ERROR;
+        }
+    }
+
+    while ((FAT_OK == status) && (used > 0))
+    {
+        directory = pending[--used];
+        first = s_owner_records[directory].first_cluster;
+        list.count = 0; /** Keep the room of the previous directory */
+        list.names_used = 0;
+        status = fatfs_read_dir((0 == directory) ? 0 : first, &list); /** A partial listing would leave owned clusters without owner */
+
+        for (e = 0; (FAT_OK == status) && (e < list.count); e++)
+        {
+            entry = &list.entries[e];
+            if (('.' == entry->name[0]) || (entry->first_cluster < 2U) || (entry->first_cluster >= geo->cluster_count + 2U))
+            {
+                /** "." and "..", or an entry owning no cluster */
+            }
+            else
+            {
+                added = fatfs_owner_add(entry, directory);
+                status = (added >= 0) ? FAT_OK : FAT_ERROR;
+                if ((FAT_OK == status) && (entry->is_dir) &&
+                    (0 == (listed[entry->first_cluster / 8U] & (1U << (entry->first_cluster % 8U)))))
+                {
+                    listed[entry->first_cluster / 8U] |= (uint8_t)(1U << (entry->first_cluster % 8U)); /** A loop in the tree is listed once */
+                    status = fatfs_grow((void **)&pending, &capacity, used + 1U, sizeof(uint32_t)) ? FAT_OK : FAT_ERROR;
+                    if (FAT_OK == status)
+                    {
+                        pending[used++] = (uint32_t)added;
+                    }
+                }
+            }
+        }
+    }
+    free_entries(&list);
+
+    if (FAT_OK == status)
+    {
+        qsort(s_owner_extents, s_owner_extent_count, sizeof(fatfs_owner_extent_t), fatfs_owner_compare);
+        s_owner_reach = (uint32_t *)malloc(((size_t)s_owner_extent_count + 1U) * sizeof(uint32_t));
+        status = (s_owner_reach != NULL) ? FAT_OK : FAT_ERROR;
+    }
+    for (i = 0; (FAT_OK == status) && (i < s_owner_extent_count); i++)
+    {
+        s_owner_reach[i] = s_owner_extents[i].first_cluster + s_owner_extents[i].length;
+        if ((i > 0) && (s_owner_reach[i - 1] > s_owner_reach[i]))
+        {
+            s_owner_reach[i] = s_owner_reach[i - 1];
+        }
+    }
+
+    free(listed);
+    free(pending);
+    if (status != FAT_OK)
+    {
+        fprintf(stderr, "Error: Failed to build the cluster owner map\n");
+        fatfs_owner_deinit();
+    }
+
+    return status;
+}
+
+/**
+ * @brief Find the entry owning a cluster.
+ *
+ * @param cluster Data cluster, numbered from 2.
+ * @param owner Receives the owner.
+ * @return int 1 when an entry owns the cluster, 0 when none does, -1 when the map is not built.
+ */
+int fatfs_owner_of_cluster(uint32_t cluster, fatfs_owner_t *owner)
+{
+    uint32_t low = 0;      /** Binary search: first candidate run */
+    uint32_t high = 0;     /** Binary search: one past the last candidate */
+    uint32_t mid = 0;      /** Binary search: run being tested */
+    bool searching = true; /** Cleared when the owner is found or no earlier run can hold the cluster */
+    int result = 0;        /** Found, not found or error */
+
+    memset(owner, 0, sizeof(*owner));
+    owner->region = FATFS_REGION_DATA;
+    owner->cluster = cluster;
+
+    if (NULL == s_owner_reach)
+    {
+        result = FAT_ERROR; /** Map not built */
+    }
+    else
+    {
+        high = s_owner_extent_count;
+        while (low < high)
+        {
+            mid = (low + high) / 2U;
+            if (s_owner_extents[mid].first_cluster <= cluster)
+            {
+                low = mid + 1U; /** The run holding the cluster starts here or later */
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+
+        /** Runs starting at or before the cluster, latest first, while one of them may still reach it */
+        while ((searching) && (low > 0) && (s_owner_reach[low - 1U] > cluster))
+        {
+            low--;
+            if (s_owner_extents[low].first_cluster + s_owner_extents[low].length > cluster)
+            {
+                fatfs_owner_fill(s_owner_extents[low].entry, owner);
+                owner->file_cluster = s_owner_extents[low].file_cluster + (cluster - s_owner_extents[low].first_cluster);
+                result = 1;
+                searching = false;
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Find the entry owning a sector of the image.
+ *
+ * @param sector Sector of the image, numbered from the boot sector.
+ * @param owner Receives the owner.
+ * @return int 1 when an entry owns the sector, 0 when none does, -1 when the map is not built.
+ */
+int fatfs_owner_of_sector(uint32_t sector, fatfs_owner_t *owner)
+{
+    const fatfs_geometry_t *geo = fatfs_get_geometry(); /** Layout of the volume */
+    uint32_t cluster = 0;                               /** Cluster holding the sector */
+    int result = 0;                                     /** Found, not found or error */
+
+    memset(owner, 0, sizeof(*owner));
+
+    if (NULL == s_owner_reach)
+    {
+        result = FAT_ERROR; /** Map not built */
+    }
+    else if (sector < geo->fat_start)
+    {
+        owner->region = FATFS_REGION_RESERVED;
+    }
+    else if (sector < geo->fat_start + geo->fat_count * geo->fat_sectors)
+    {
+        owner->region = FATFS_REGION_FAT;
+    }
+    else if (sector < geo->data_start)
+    {
+        fatfs_owner_fill(0, owner);
+        owner->region = FATFS_REGION_ROOT;
+        owner->file_cluster = 0;
+        result = 1; /** Fixed root directory */
+    }
+    else
+    {
+        cluster = (sector - geo->data_start) / geo->sectors_per_cluster + 2U;
+        if (cluster >= geo->cluster_count + 2U)
+        {
+            owner->region = FATFS_REGION_NONE; /** Tail of the image after the last cluster */
+        }
+        else
+        {
+            result = fatfs_owner_of_cluster(cluster, owner);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Release the reverse map.
+ */
+void fatfs_owner_deinit(void)
+{
+    free(s_owner_reach);
+    free(s_owner_extents);
+    free(s_owner_records);
+    free(s_owner_paths);
+    s_owner_reach = NULL;
+    s_owner_extents = NULL;
+    s_owner_records = NULL;
+    s_owner_paths = NULL;
+    s_owner_extent_count = 0;
+    s_owner_extent_capacity = 0;
+    s_owner_record_count = 0;
+    s_owner_record_capacity = 0;
+    s_owner_path_bytes = 0;
+    s_owner_path_capacity = 0;
+}
+
+/**
+ * @brief Add a directory entry, its path and the runs of its chain to the map
+ *
+ * @param entry Directory entry owning at least one cluster
+ * @param parent Index of the directory holding the entry
+ * @return int32_t Index of the new entry, or -1 on an allocation error
+ */
+static int32_t fatfs_owner_add(const DirEntry *entry, uint32_t parent)
+{
+    fatfs_owner_record_t *record = NULL;                              /** The new entry */
+    uint32_t parent_path = s_owner_records[parent].path;              /** Offset of the path of the directory */
+    uint32_t parent_length = (uint32_t)strlen(s_owner_paths + parent_path); /** Length of the path of the directory */
+    uint32_t length = 0;                                              /** Length of the path of the entry */
+    char *path = NULL;                                                /** Path being written */
+    int32_t result = FAT_ERROR;                                       /** Index of the entry or error */
+
+    if (fatfs_grow((void **)&s_owner_records, &s_owner_record_capacity, s_owner_record_count + 1U, sizeof(fatfs_owner_record_t)) &&
+        fatfs_grow((void **)&s_owner_paths, &s_owner_path_capacity, s_owner_path_bytes + parent_length + 14U, 1))
+    {
+        /** "/DIR" + "/" + "NAME.EXT": the 8.3 name loses its padding */
+        path = s_owner_paths + s_owner_path_bytes;
+        memcpy(path, s_owner_paths + parent_path, parent_length);
+        length = (1U == parent_length) ? 1U : (parent_length + 1U);
+        path[length - 1U] = '/';
+        length += fatfs_format_name(entry->name, path + length) + 1U; /** With its terminator */
+
+        record = &s_owner_records[s_owner_record_count];
+        record->directory = (0 == parent) ? 0U : s_owner_records[parent].first_cluster; /** 0 for the root, as for fatfs_read_dir */
+        record->first_cluster = entry->first_cluster;
+        record->size = entry->is_dir ? 0U : entry->size;
+        record->path = s_owner_path_bytes;
+        record->is_dir = entry->is_dir ? 1U : 0U;
+        s_owner_path_bytes += length;
+
+        if (fatfs_owner_add_extents(entry->first_cluster, s_owner_record_count))
+        {
+            result = (int32_t)s_owner_record_count++;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Add the runs of a chain to the map
+ *
+ * @param first_cluster First cluster of the chain
+ * @param entry Index of the entry owning the chain
+ * @return bool true on success, false on an allocation error
+ */
+static bool fatfs_owner_add_extents(uint32_t first_cluster, uint32_t entry)
+{
+    int count = fatfs_get_extents(first_cluster, NULL, 0); /** Runs of the chain */
+    fatfs_extent_t *extents = NULL;                        /** Runs of the chain, in file order */
+    int i = 0;                                             /** Used as an index of operation */
+    bool result = (count >= 0);                            /** Status of the operation */
+
+    if ((result) && (count > 0))
+    {
+        extents = (fatfs_extent_t *)malloc((size_t)count * sizeof(fatfs_extent_t));
+        result = (extents != NULL) &&
+                 fatfs_grow((void **)&s_owner_extents, &s_owner_extent_capacity, s_owner_extent_count + (uint32_t)count, sizeof(fatfs_owner_extent_t));
+    }
+    if ((result) && (count > 0))
+    {
+        count = fatfs_get_extents(first_cluster, extents, (uint32_t)count);
+        for (i = 0; i < count; i++)
+        {
+            s_owner_extents[s_owner_extent_count].first_cluster = extents[i].first_cluster;
+            s_owner_extents[s_owner_extent_count].length = extents[i].length;
+            s_owner_extents[s_owner_extent_count].file_cluster = extents[i].file_cluster;
+            s_owner_extents[s_owner_extent_count].entry = entry;
+            s_owner_extent_count++;
+        }
+    }
+    free(extents);
+
+    return result;
+}
+
+/**
+ * @brief Order two runs by first cluster, then by entry so that the order is stable
+ *
+ * @param a First run
+ * @param b Second run
+ * @return int Negative, zero or positive as for qsort
+ */
+static int fatfs_owner_compare(const void *a, const void *b)
+{
+    const fatfs_owner_extent_t *x = (const fatfs_owner_extent_t *)a; /** First run */
+    const fatfs_owner_extent_t *y = (const fatfs_owner_extent_t *)b; /** Second run */
+    int result = 0;                                                  /** Order of the runs */
+
+    if (x->first_cluster != y->first_cluster)
+    {
+        result = (x->first_cluster < y->first_cluster) ? -1 : 1;
+    }
+    else if (x->entry != y->entry)
+    {
+        result = (x->entry < y->entry) ? -1 : 1;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Copy an entry of the map to the structure given to the caller
+ *
+ * @param entry Index of the entry
+ * @param owner Receives the entry, the region and cluster are left as they are
+ */
+static void fatfs_owner_fill(uint32_t entry, fatfs_owner_t *owner)
+{
+    const fatfs_owner_record_t *record = &s_owner_records[entry]; /** The entry */
+
+    owner->entry = entry;
+    owner->directory = record->directory;
+    owner->first_cluster = record->first_cluster;
+    owner->size = record->size;
+    owner->is_dir = record->is_dir;
+    owner->path = s_owner_paths + record->path;
+}
@@ -0,0 +1,79 @@
+#ifndef _FATFS_OWNER_H_
+#define _FATFS_OWNER_H_
+
+#include <stdint.h>
+#include "FATfs.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+/** Define enumeration to represent the area of the volume holding a sector */
+typedef enum
+{
+    FATFS_REGION_NONE = 0,     /** Past the last cluster of the volume */
+    FATFS_REGION_RESERVED = 1, /** Boot sector and reserved sectors */
+    FATFS_REGION_FAT = 2,      /** One of the copies of the FAT */
+    FATFS_REGION_ROOT = 3,     /** Fixed root directory of FAT12 and FAT16 */
+    FATFS_REGION_DATA = 4      /** Data clusters */
+} fatfs_region_t;
+
+/**
+ * @brief  Define the structure describing the owner of a cluster or a sector
+ */
+typedef struct
+{
+    fatfs_region_t region;  /** Area of the volume holding the sector */
+    uint32_t cluster;       /** Cluster holding the sector, 0 outside the data area */
+    uint32_t entry;         /** Id of the owning entry, 0 for the root directory */
+    uint32_t file_cluster;  /** Position of the cluster in the chain of the owner */
+    uint32_t directory;     /** First cluster of the directory holding the entry, 0 for the root */
+    uint32_t first_cluster; /** First cluster of the owner */
+    uint32_t size;          /** Size of the owner in bytes, 0 for a directory */
+    uint8_t is_dir;         /** 1 when the owner is a directory */
+    const char *path;       /** Path of the owner, valid until the next build or fatfs_owner_deinit */
+} fatfs_owner_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Build the reverse map from clusters to directory entries of the open volume.
+ *
+ * The directory tree is walked once and the chain of every entry is merged into extents.
+ * The extents are sorted by first cluster, with the furthest end reached so far kept beside
+ * each one: a lookup is a binary search followed by a short backward scan, which also finds
+ * the owners of overlapping (cross-linked) extents. A previous map is released first.
+ *
+ * @return int 0 on success, -1 when no volume is open or on a read or allocation error.
+ */
+int fatfs_owner_build(void);
+
+/**
+ * @brief Find the entry owning a cluster.
+ *
+ * @param cluster Data cluster, numbered from 2.
+ * @param owner Receives the owner.
+ * @return int 1 when an entry owns the cluster, 0 when none does, -1 when the map is not built.
+ */
+int fatfs_owner_of_cluster(uint32_t cluster, fatfs_owner_t *owner);
+
+/**
+ * @brief Find the entry owning a sector of the image.
+ *
+ * Sectors outside the data area only get their region, except those of the fixed root
+ * directory of FAT12 and FAT16, owned by the root (entry 0).
+ *
+ * @param sector Sector of the image, numbered from the boot sector.
+ * @param owner Receives the owner.
+ * @return int 1 when an entry owns the sector, 0 when none does, -1 when the map is not built.
+ */
+int fatfs_owner_of_sector(uint32_t sector, fatfs_owner_t *owner);
+
+/**
+ * @brief Release the reverse map.
+ */
+void fatfs_owner_deinit(void);
+
+#endif /** _FATFS_OWNER_H_ */
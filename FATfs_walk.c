@@ -0,0 +1,1020 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "FATfs_walk.h"
+#include "HAL.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#define FATFS_WALK_DEFAULT_THREADS 4U          /** Threads used when the number of processors is unknown */
+#define FATFS_WALK_SEGMENT_BYTES (64U * 1024U) /** Bytes of a directory listed by one task, larger directories are split */
+#define FATFS_WALK_LFN_BYTES 640U              /** Long name entries of one short entry at most: 20 entries of 32 bytes */
+#define FATFS_WALK_WHOLE 0xFFFFFFFFU           /** Task listing a whole directory, not one of its segments */
+#define FATFS_WALK_NAME_MAX 768U               /** Bytes of a name in UTF-8: 255 UTF-16 characters, 3 bytes each */
+#define FATFS_WALK_MIN_TASKS 16U               /** First room of a queue of tasks */
+
+/**
+ * @brief  Define the structure of a run of clusters of a directory, listed by one task
+ */
+typedef struct
+{
+    DirList list;   /** Entries of the run */
+    uint32_t first; /** Position of the first cluster of the run in the chain */
+    uint32_t count; /** Clusters of the run */
+    int status;     /** 1 when the end of the directory is in the run, 0 when not, -1 on a read or allocation error */
+} fatfs_walk_segment_t;
+
+/**
+ * @brief  Define the structure of a directory of the walk
+ */
+typedef struct fatfs_walk_node
+{
+    struct fatfs_walk_node *next;        /** Next directory created, for the release */
+    struct fatfs_walk_node *first_child; /** First subdirectory, in listing order */
+    struct fatfs_walk_node *last_child;  /** Last subdirectory */
+    struct fatfs_walk_node *sibling;     /** Next subdirectory of the same directory */
+    uint32_t cluster;                    /** First cluster, 0 for the root of FAT12 and FAT16 */
+    uint32_t depth;                      /** Depth of the entries of the directory */
+    uint32_t parent_segment;             /** Segment of the entry of the directory in its parent */
+    uint32_t parent_entry;               /** Index of the entry of the directory in that segment */
+    char *path;                          /** Path from the start directory, "" for the start directory */
+    uint32_t *chain;                     /** Clusters of the directory in chain order */
+    uint32_t chain_length;               /** Number of clusters of the chain */
+    fatfs_walk_segment_t *segments;      /** Runs of clusters, in chain order */
+    uint32_t segment_count;              /** Number of runs */
+    uint32_t segments_left;              /** Runs still being listed, the task listing the last one finishes the directory */
+    uint32_t end;                        /** First run holding the end of the directory, runs past it are not listed */
+} fatfs_walk_node_t;
+
+/**
+ * @brief  Define the structure of one task: a whole directory or one of its segments
+ */
+typedef struct
+{
+    fatfs_walk_node_t *node; /** Directory */
+    uint32_t segment;        /** Segment to list, FATFS_WALK_WHOLE for the whole directory */
+} fatfs_walk_task_t;
+
+struct fatfs_walk;
+
+/**
+ * @brief  Define the structure of one thread of the pool and its queue of tasks
+ */
+typedef struct
+{
+    struct fatfs_walk *walk;  /** Shared state */
+    uint32_t id;              /** Index of the thread, 0 for the calling thread */
+    pthread_t thread;         /** Thread, unused for the calling thread */
+    pthread_mutex_t lock;     /** Protects the queue: the owner pushes and pops at the tail, the others steal at the head */
+    fatfs_walk_task_t *tasks; /** Queue of tasks */
+    uint32_t head;            /** First task of the queue, stolen first */
+    uint32_t tail;            /** One past the last task, run first by the owner */
+    uint32_t capacity;        /** Room of tasks */
+    char *path;               /** Path of the entry being visited */
+    uint32_t path_capacity;   /** Room of path */
+} fatfs_walk_worker_t;
+
+/**
+ * @brief  Define the state shared by every thread of a walk
+ */
+typedef struct fatfs_walk
+{
+    const fatfs_geometry_t *geo;  /** Layout of the volume */
+    uint32_t *next;               /** First FAT, decoded: the chains are followed without the shared FAT state */
+    uint32_t entries;             /** Entries of next: the clusters and the two reserved entries */
+    uint8_t *listed;              /** One bit per cluster: directory already queued */
+    uint32_t segment_clusters;    /** Clusters of a segment */
+    uint32_t lookback;            /** Clusters before a segment read again for the long names crossing into it */
+    fatfs_walk_order_t order;     /** Order of the visits */
+    fatfs_walk_visitor_t visitor; /** Function called for every entry */
+    void *context;                /** Pointer given to the visitor */
+    fatfs_walk_worker_t *workers; /** Threads of the pool */
+    uint32_t worker_count;        /** Number of threads */
+    pthread_mutex_t lock;         /** Protects the counters and the directories */
+    pthread_cond_t wake;          /** Signaled when a task is queued or the walk is over */
+    uint32_t pending;             /** Tasks queued or running, the walk is over at 0 */
+    int32_t queued;               /** Tasks queued, not yet taken */
+    fatfs_walk_node_t *nodes;     /** Every directory created */
+    fatfs_walk_node_t *root;      /** Start directory */
+    bool stop;                    /** Set when the visitor stops the walk */
+    bool failed;                  /** Set on a read or allocation error */
+} fatfs_walk_t;
+
+/**
+ * @brief  Define one directory of the depth first visit of the tree
+ */
+typedef struct
+{
+    fatfs_walk_node_t *node;  /** Directory */
+    fatfs_walk_node_t *child; /** Next subdirectory to enter */
+    uint32_t segment;         /** Segment being visited */
+    uint32_t entry;           /** Next entry of the segment */
+} fatfs_walk_frame_t;
+
+/**
+ * @brief  Define one entry sorted by first cluster
+ */
+typedef struct
+{
+    fatfs_walk_node_t *node; /** Directory holding the entry */
+    uint32_t segment;        /** Segment holding the entry */
+    uint32_t entry;          /** Index of the entry in the segment */
+    uint32_t cluster;        /** First cluster of the entry: the key */
+    uint32_t order;          /** Position in the depth first order, keeps the sort stable */
+} fatfs_walk_ref_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static uint32_t fatfs_walk_threads(uint32_t threads);                                         /** Number of threads to use */
+static bool fatfs_walk_read_fat(fatfs_walk_t *walk);                                          /** Decode the first FAT */
+static fatfs_walk_node_t *fatfs_walk_node(fatfs_walk_t *walk, fatfs_walk_node_t *parent, uint32_t cluster, const char *name); /** Create a directory */
+static bool fatfs_walk_mark(fatfs_walk_t *walk, uint32_t cluster);                            /** Mark a directory listed, false when it already is */
+static void fatfs_walk_push(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node, uint32_t segment); /** Queue a task */
+static bool fatfs_walk_pop(fatfs_walk_worker_t *worker, fatfs_walk_task_t *task, bool own);   /** Take a task from a queue */
+static bool fatfs_walk_take(fatfs_walk_worker_t *worker, fatfs_walk_task_t *task);            /** Take a task, stealing it when needed */
+static void *fatfs_walk_worker(void *arg);                                                    /** Run tasks until the walk is over */
+static void fatfs_walk_run(fatfs_walk_worker_t *worker, const fatfs_walk_task_t *task);       /** Run one task */
+static void fatfs_walk_list(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node);            /** List a whole directory */
+static void fatfs_walk_segment(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node, uint32_t segment); /** List one segment */
+static void fatfs_walk_finish(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node);          /** Visit the entries and queue the subdirectories */
+static bool fatfs_walk_visit(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node, const DirList *list, const DirEntry *entry); /** Call the visitor */
+static uint32_t fatfs_walk_name(const DirList *list, const DirEntry *entry, char *out);       /** Long name or NAME.EXT of an entry */
+static uint32_t fatfs_walk_preorder(fatfs_walk_t *walk, fatfs_walk_ref_t *refs);              /** Visit or collect the tree depth first */
+static void fatfs_walk_physical(fatfs_walk_t *walk);                                          /** Visit the tree by first cluster */
+static int fatfs_walk_compare(const void *a, const void *b);                                  /** Order entries by first cluster */
+static void fatfs_walk_free(fatfs_walk_t *walk);                                              /** Release the directories */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Visit every file and directory below a directory of the volume opened by fatfs_init.
+ *
+ * @param start_cluster First cluster of the directory to walk, 0 for the root directory.
+ * @param order Order of the visits.
+ * @param threads Number of threads, 0 selects the number of processors.
+ * @param visitor Function called for every entry.
+ * @param context Pointer given to the visitor.
+ * @return int 0 when the whole tree is visited, 1 when the visitor stops the walk, -1 on a read or allocation error
+ * or when start_cluster is not a cluster of the volume.
+ */
+int fatfs_walk(uint32_t start_cluster, fatfs_walk_order_t order, uint32_t threads, fatfs_walk_visitor_t visitor, void *context)
+{
+    fatfs_walk_t walk;          /** Shared state */
+    uint32_t cluster_bytes = 0; /** Size of one cluster */
+    uint32_t i = 0;             /** Used as an index of operation */
+    int result = FAT_OK;        /** 0, 1 or -1 */
+
+    memset(&walk, 0, sizeof(walk));
+    walk.geo = fatfs_get_geometry();
+    walk.order = order;
+    walk.visitor = visitor;
+    walk.context = context;
+    if (0 == walk.geo->type)
+    {
+        result = FAT_ERROR; /** No volume open */
+    }
+    else if ((1U == start_cluster) || (start_cluster >= walk.geo->cluster_count + 2U))
+    {
+        result = FAT_ERROR; /** Not a cluster of the volume */
+    }
+    else
+    {
+        walk.entries = walk.geo->cluster_count + 2U;
+        cluster_bytes = walk.geo->sectors_per_cluster * walk.geo->bytes_per_sector;
+        walk.segment_clusters = (cluster_bytes < FATFS_WALK_SEGMENT_BYTES) ? (FATFS_WALK_SEGMENT_BYTES / cluster_bytes) : 1U;
+        walk.lookback = (FATFS_WALK_LFN_BYTES + cluster_bytes - 1U) / cluster_bytes;
+        walk.worker_count = fatfs_walk_threads(threads);
+        walk.listed = (uint8_t *)calloc((walk.entries + 7U) / 8U, 1);
+        walk.workers = (fatfs_walk_worker_t *)calloc(walk.worker_count, sizeof(fatfs_walk_worker_t));
+        if ((NULL == walk.listed) || (NULL == walk.workers) || (!fatfs_walk_read_fat(&walk)))
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for the walk\n");
+            result = FAT_ERROR;
+        }
+    }
+
+    if (FAT_OK == result)
+    {
+        pthread_mutex_init(&walk.lock, NULL);
+        pthread_cond_init(&walk.wake, NULL);
+        for (i = 0; i < walk.worker_count; i++)
+        {
+            walk.workers[i].walk = &walk;
+            walk.workers[i].id = i;
+            pthread_mutex_init(&walk.workers[i].lock, NULL);
+        }
+
+        /** On FAT32 the root directory is a cluster chain like any other directory */
+        start_cluster = ((0 == start_cluster) && (FAT_TYPE_32 == walk.geo->type)) ? walk.geo->root_cluster : start_cluster;
+        walk.root = fatfs_walk_node(&walk, NULL, start_cluster, NULL);
+        if ((walk.root != NULL) && ((start_cluster < 2U) || (fatfs_walk_mark(&walk, start_cluster))))
+        {
+            fatfs_walk_push(&walk.workers[0], walk.root, FATFS_WALK_WHOLE);
+        }
+        else
+        {
+            walk.failed = true;
+        }
+
+        /** The calling thread is the first thread of the pool: no thread is started for a small tree */
+        for (i = 1; i < walk.worker_count; i++)
+        {
+            if (pthread_create(&walk.workers[i].thread, NULL, fatfs_walk_worker, &walk.workers[i]) != 0)
+            {
+                walk.workers[i].walk = NULL; /** Its queue stays empty */
+            }
+        }
+        (void)fatfs_walk_worker(&walk.workers[0]);
+        for (i = 1; i < walk.worker_count; i++)
+        {
+            if (walk.workers[i].walk != NULL)
+            {
+                pthread_join(walk.workers[i].thread, NULL);
+            }
+        }
+
+        if ((walk.failed) || (NULL == walk.root))
+        {
+            /** A tree missing listings is not visited */
+        }
+        else if (FATFS_WALK_PREORDER == order)
+        {
+            (void)fatfs_walk_preorder(&walk, NULL);
+        }
+        else if (FATFS_WALK_PHYSICAL == order)
+        {
+            fatfs_walk_physical(&walk);
+        }
+
+        for (i = 0; i < walk.worker_count; i++)
+        {
+            pthread_mutex_destroy(&walk.workers[i].lock);
+            free(walk.workers[i].tasks);
+            free(walk.workers[i].path);
+        }
+        pthread_cond_destroy(&walk.wake);
+        pthread_mutex_destroy(&walk.lock);
+        result = (walk.failed) ? FAT_ERROR : ((walk.stop) ? 1 : FAT_OK);
+    }
+
+    fatfs_walk_free(&walk);
+    free(walk.workers);
+    free(walk.listed);
+    free(walk.next);
+
+    return result;
+}
+
+/**
+ * @brief Number of threads to use
+ *
+ * @param threads Number of threads asked, 0 for the number of processors
+ * @return uint32_t Number of threads, from 1 to FATFS_WALK_MAX_THREADS
+ */
+static uint32_t fatfs_walk_threads(uint32_t threads)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long online = sysconf(_SC_NPROCESSORS_ONLN); /** Processors available */
+
+    if (0 == threads)
+    {
+        threads = (online > 0) ? (uint32_t)online : FATFS_WALK_DEFAULT_THREADS;
+    }
+#else
+    if (0 == threads)
+    {
+        threads = FATFS_WALK_DEFAULT_THREADS;
+    }
+#endif
+
+    return (threads > FATFS_WALK_MAX_THREADS) ? FATFS_WALK_MAX_THREADS : threads;
+}
+
+/**
+ * @brief Read the first FAT and decode it: the threads follow the chains in it without locks
+ *
+ * @param walk Walk receiving the decoded FAT
+ * @return bool true on success, false on a read or allocation error
+ */
+static bool fatfs_walk_read_fat(fatfs_walk_t *walk)
+{
+    uint32_t fat_bytes = walk->geo->fat_sectors * walk->geo->bytes_per_sector; /** Size of one FAT in bytes */
+    uint32_t decoded = (uint32_t)((uint64_t)fat_bytes * 8U / walk->geo->type); /** Entries held by the FAT */
+    uint8_t *fat_table = (uint8_t *)malloc(fat_bytes);                         /** FAT as stored on disk */
+    bool result = false;                                                       /** Status of the operation */
+
+    decoded = (decoded > walk->entries) ? walk->entries : decoded;
+    walk->next = (uint32_t *)malloc((size_t)walk->entries * sizeof(uint32_t));
+    if ((fat_table != NULL) && (walk->next != NULL) &&
+        (kmc_read_multi_sector(walk->geo->fat_start, walk->geo->fat_sectors, fat_table) == (int32_t)fat_bytes))
+    {
+        fatfs_decode_fat(fat_table, walk->next, decoded);
+        for (; decoded < walk->entries; decoded++)
+        {
+            walk->next[decoded] = 0; /** Past the end of a truncated FAT: ends every chain */
+        }
+        result = true;
+    }
+    free(fat_table);
+
+    return result;
+}
+
+/**
+ * @brief Create a directory of the walk, as the last subdirectory of its parent
+ *
+ * @param walk Shared state
+ * @param parent Directory holding the new one, NULL for the start directory
+ * @param cluster First cluster of the directory
+ * @param name Name of the directory in its parent, NULL for the start directory
+ * @return fatfs_walk_node_t* The directory, NULL on an allocation error
+ */
+static fatfs_walk_node_t *fatfs_walk_node(fatfs_walk_t *walk, fatfs_walk_node_t *parent, uint32_t cluster, const char *name)
+{
+    fatfs_walk_node_t *node = (fatfs_walk_node_t *)calloc(1, sizeof(fatfs_walk_node_t)); /** New directory */
+    size_t length = (parent != NULL) ? strlen(parent->path) : 0U;                        /** Length of the path of the parent */
+
+    if (node != NULL)
+    {
+        node->path = (char *)malloc(length + ((name != NULL) ? strlen(name) : 0U) + 2U);
+        if (NULL == node->path)
+        {
+            free(node);
+            node = NULL;
+        }
+    }
+    if (node != NULL)
+    {
+        node->cluster = cluster;
+        node->end = FATFS_WALK_WHOLE;
+        node->path[0] = '\0';
+        if (parent != NULL)
+        {
+            node->depth = parent->depth + 1U;
+            memcpy(node->path, parent->path, length);
+            node->path[length] = '/';
+            strcpy(node->path + length + 1U, name);
+            if (NULL == parent->first_child)
+            {
+                parent->first_child = node;
+            }
+            else
+            {
+                parent->last_child->sibling = node;
+            }
+            parent->last_child = node; /** Only the thread finishing the parent adds children */
+        }
+        pthread_mutex_lock(&walk->lock);
+        node->next = walk->nodes;
+        walk->nodes = node;
+        pthread_mutex_unlock(&walk->lock);
+    }
+
+    return node;
+}
+
+/**
+ * @brief Mark a directory listed
+ *
+ * @param walk Shared state
+ * @param cluster First cluster of the directory
+ * @return bool true when the directory was not listed yet, false when it already was: a loop of a damaged volume
+ */
+static bool fatfs_walk_mark(fatfs_walk_t *walk, uint32_t cluster)
+{
+    uint8_t bit = (uint8_t)(1U << (cluster % 8U)); /** Bit of the cluster */
+
+    return 0 == (__atomic_fetch_or(&walk->listed[cluster / 8U], bit, __ATOMIC_RELAXED) & bit);
+}
+
+/**
+ * @brief Queue a task on the queue of a thread
+ *
+ * The counters are raised before the task is visible, so that the walk can not end while it waits.
+ *
+ * @param worker Thread queuing the task, its own queue receives it
+ * @param node Directory
+ * @param segment Segment to list, FATFS_WALK_WHOLE for the whole directory
+ */
+static void fatfs_walk_push(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node, uint32_t segment)
+{
+    fatfs_walk_t *walk = worker->walk; /** Shared state */
+    fatfs_walk_task_t *grown = NULL;   /** Queue after realloc */
+    uint32_t capacity = 0;             /** Room of the grown queue */
+    bool room = true;                  /** Set when the queue has room for the task */
+
+    pthread_mutex_lock(&worker->lock);
+    if ((worker->head != 0) && (worker->tail == worker->capacity))
+    {
+        memmove(worker->tasks, worker->tasks + worker->head, (size_t)(worker->tail - worker->head) * sizeof(fatfs_walk_task_t));
+        worker->tail -= worker->head; /** Reuse the room of the stolen tasks */
+        worker->head = 0;
+    }
+    if (worker->tail == worker->capacity)
+    {
+        capacity = (0 == worker->capacity) ? FATFS_WALK_MIN_TASKS : (worker->capacity * 2U);
+        grown = (fatfs_walk_task_t *)realloc(worker->tasks, (size_t)capacity * sizeof(fatfs_walk_task_t));
+        room = (grown != NULL);
+        if (room)
+        {
+            worker->tasks = grown;
+            worker->capacity = capacity;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (room)
+    {
+        pthread_mutex_lock(&walk->lock);
+        walk->pending++;
+        walk->queued++;
+        pthread_cond_signal(&walk->wake);
+        pthread_mutex_unlock(&walk->lock);
+
+        pthread_mutex_lock(&worker->lock);
+        worker->tasks[worker->tail].node = node; /** Only the owner pushes: the room is still there */
+        worker->tasks[worker->tail].segment = segment;
+        worker->tail++;
+        pthread_mutex_unlock(&worker->lock);
+    }
+    else
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for the walk\n");
+        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Take a task from a queue
+ *
+ * @param worker Thread owning the queue
+ * @param task Receives the task
+ * @param own Set for the owner, taking the task queued last; the others steal the task queued first
+ * @return bool true when a task is taken, false when the queue is empty
+ */
+static bool fatfs_walk_pop(fatfs_walk_worker_t *worker, fatfs_walk_task_t *task, bool own)
+{
+    bool found = false; /** Set when a task is taken */
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head < worker->tail)
+    {
+        *task = (own) ? worker->tasks[--worker->tail] : worker->tasks[worker->head++];
+        found = true;
+        if (worker->head == worker->tail)
+        {
+            worker->head = 0; /** Empty: start again at the front */
+            worker->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return found;
+}
+
+/**
+ * @brief Take a task: from the own queue first, then from the other threads, else wait for one
+ *
+ * The owner runs its last task first, depth first, while the thieves take the first tasks: the
+ * directories queued earliest, near the top of the tree, whose subtrees hold the most work.
+ *
+ * @param worker Thread taking the task
+ * @param task Receives the task
+ * @return bool true when a task is taken, false when the walk is over
+ */
+static bool fatfs_walk_take(fatfs_walk_worker_t *worker, fatfs_walk_task_t *task)
+{
+    fatfs_walk_t *walk = worker->walk; /** Shared state */
+    bool found = false;                /** Set when a task is taken */
+    bool over = false;                 /** Set when no task is queued or running */
+    uint32_t i = 0;                    /** Used as an index of operation */
+
+    while ((!found) && (!over))
+    {
+        found = fatfs_walk_pop(worker, task, true);
+        for (i = 1; (!found) && (i < walk->worker_count); i++)
+        {
+            found = fatfs_walk_pop(&walk->workers[(worker->id + i) % walk->worker_count], task, false);
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        if (found)
+        {
+            walk->queued--;
+        }
+        else
+        {
+            while ((walk->queued <= 0) && (walk->pending != 0))
+            {
+                pthread_cond_wait(&walk->wake, &walk->lock); /** Sleep until a task is queued */
+            }
+            over = (0 == walk->pending);
+        }
+        pthread_mutex_unlock(&walk->lock);
+    }
+
+    return found;
+}
+
+/**
+ * @brief Run tasks until the walk is over
+ *
+ * @param arg Thread of the pool
+ * @return void* NULL
+ */
+static void *fatfs_walk_worker(void *arg)
+{
+    fatfs_walk_worker_t *worker = (fatfs_walk_worker_t *)arg; /** Thread of the pool */
+    fatfs_walk_t *walk = worker->walk;                        /** Shared state */
+    fatfs_walk_task_t task;                                   /** Task being run */
+
+    while (fatfs_walk_take(worker, &task))
+    {
+        fatfs_walk_run(worker, &task);
+        pthread_mutex_lock(&walk->lock);
+        walk->pending--;
+        if (0 == walk->pending)
+        {
+            pthread_cond_broadcast(&walk->wake); /** The walk is over: wake every thread so it can return */
+        }
+        pthread_mutex_unlock(&walk->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Run one task, unless the walk is stopped
+ *
+ * @param worker Thread running the task
+ * @param task Task to run
+ */
+static void fatfs_walk_run(fatfs_walk_worker_t *worker, const fatfs_walk_task_t *task)
+{
+    if (__atomic_load_n(&worker->walk->stop, __ATOMIC_RELAXED))
+    {
+        /** Stopped by the visitor: the queued tasks are dropped */
+    }
+    else if (FATFS_WALK_WHOLE == task->segment)
+    {
+        fatfs_walk_list(worker, task->node);
+    }
+    else
+    {
+        fatfs_walk_segment(worker, task->node, task->segment);
+    }
+}
+
+/**
+ * @brief List a whole directory: in place when it is small, split into segments queued for the other threads otherwise
+ *
+ * @param worker Thread listing the directory
+ * @param node Directory
+ */
+static void fatfs_walk_list(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node)
+{
+    fatfs_walk_t *walk = worker->walk; /** Shared state */
+    uint32_t cluster = node->cluster;  /** Cluster of the chain being followed */
+    uint32_t capacity = 0;             /** Room of the chain */
+    uint32_t *grown = NULL;            /** Chain after realloc */
+    uint32_t s = 0;                    /** Used as an index of operation */
+    bool valid = true;                 /** Cleared on an allocation error */
+
+    if (node->cluster < 2U)
+    {
+        /** Root of FAT12 and FAT16: a fixed run of sectors, read without the FAT */
+        node->segments = (fatfs_walk_segment_t *)calloc(1, sizeof(fatfs_walk_segment_t));
+        valid = (node->segments != NULL);
+        if (valid)
+        {
+            node->segment_count = 1;
+            node->segments[0].status = (fatfs_read_dir(0, &node->segments[0].list) == FAT_OK) ? 1 : FAT_ERROR;
+            if (node->segments[0].status < 0)
+            {
+                __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED); /** Not visited as a complete listing */
+            }
+        }
+    }
+    else
+    {
+        /** The chain ends on an end of chain marker, a free or reserved entry, or a loop */
+        while ((valid) && (cluster >= 2U) && (cluster < walk->entries) && (node->chain_length < walk->geo->cluster_count))
+        {
+            if (node->chain_length == capacity)
+            {
+                capacity = (0 == capacity) ? walk->segment_clusters : (capacity * 2U);
+                grown = (uint32_t *)realloc(node->chain, (size_t)capacity * sizeof(uint32_t));
+                valid = (grown != NULL);
+                node->chain = (valid) ? grown : node->chain;
+            }
+            if (valid)
+            {
+                node->chain[node->chain_length++] = cluster;
+                cluster = walk->next[cluster];
+            }
+        }
+        node->segment_count = (node->chain_length + walk->segment_clusters - 1U) / walk->segment_clusters;
+        node->segments = (valid) ? (fatfs_walk_segment_t *)calloc((0 == node->segment_count) ? 1U : node->segment_count, sizeof(fatfs_walk_segment_t)) : NULL;
+        valid = (node->segments != NULL);
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for directory cluster %u\n", node->cluster);
+        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+        node->segment_count = 0;
+    }
+    else if ((node->cluster < 2U) || (0 == node->segment_count))
+    {
+        fatfs_walk_finish(worker, node); /** Root of FAT12 and FAT16 listed above, or empty chain */
+    }
+    else
+    {
+        for (s = 0; s < node->segment_count; s++)
+        {
+            node->segments[s].first = s * walk->segment_clusters;
+            node->segments[s].count = ((s + 1U) * walk->segment_clusters < node->chain_length) ? walk->segment_clusters : (node->chain_length - s * walk->segment_clusters);
+        }
+        node->segments_left = node->segment_count;
+        for (s = node->segment_count - 1U; s > 0; s--)
+        {
+            fatfs_walk_push(worker, node, s); /** Queued from the last one: the thieves take the last segments, the owner the first ones */
+        }
+        fatfs_walk_segment(worker, node, 0);
+    }
+}
+
+/**
+ * @brief List one segment of a directory, and finish the directory when it is the last segment listed
+ *
+ * @param worker Thread listing the segment
+ * @param node Directory
+ * @param segment Segment to list
+ */
+static void fatfs_walk_segment(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node, uint32_t segment)
+{
+    fatfs_walk_segment_t *run = &node->segments[segment];                                            /** Segment to list */
+    uint32_t lookback = (run->first < worker->walk->lookback) ? run->first : worker->walk->lookback; /** Clusters read only for the long names */
+    uint32_t end = FATFS_WALK_WHOLE;                                                                 /** First segment holding the end */
+
+    if (segment < __atomic_load_n(&node->end, __ATOMIC_RELAXED))
+    {
+        run->status = fatfs_read_dir_clusters(node->chain + run->first - lookback, run->count + lookback, lookback, &run->list);
+    }
+    if (run->status < 0)
+    {
+        __atomic_store_n(&worker->walk->failed, true, __ATOMIC_RELAXED);
+    }
+    else if (run->status > 0)
+    {
+        end = __atomic_load_n(&node->end, __ATOMIC_RELAXED);
+        while ((segment < end) && (!__atomic_compare_exchange_n(&node->end, &end, segment, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+        {
+            /** end is reloaded by the failed exchange */
+        }
+    }
+    if (__atomic_sub_fetch(&node->segments_left, 1U, __ATOMIC_ACQ_REL) == 0)
+    {
+        fatfs_walk_finish(worker, node); /** The other segments are listed and visible */
+    }
+}
+
+/**
+ * @brief Visit the entries of a listed directory in the FATFS_WALK_ANY order, and queue its subdirectories
+ *
+ * @param worker Thread finishing the directory
+ * @param node Directory
+ */
+static void fatfs_walk_finish(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node)
+{
+    fatfs_walk_t *walk = worker->walk;                         /** Shared state */
+    const DirList *list = NULL;                                /** Entries of the segment */
+    const DirEntry *entry = NULL;                              /** Entry being visited */
+    fatfs_walk_node_t *child = NULL;                           /** Subdirectory */
+    char name[FATFS_WALK_NAME_MAX + 1U];                       /** Name of the subdirectory */
+    bool go = !__atomic_load_n(&walk->stop, __ATOMIC_RELAXED); /** Cleared when the visitor stops the walk */
+    uint32_t s = 0;                                            /** Segment being visited */
+    uint32_t e = 0;                                            /** Entry being visited */
+
+    /** After a read error the walk fails: the listings left are not visited as complete ones */
+    go = (go) && (!__atomic_load_n(&walk->failed, __ATOMIC_RELAXED));
+
+    /** The segments past the end of the directory hold stale entries: they are dropped */
+    for (s = node->end + 1U; (node->end < node->segment_count) && (s < node->segment_count); s++)
+    {
+        free_entries(&node->segments[s].list);
+    }
+    node->segment_count = (node->end < node->segment_count) ? (node->end + 1U) : node->segment_count;
+    for (s = 0; (go) && (s < node->segment_count); s++)
+    {
+        list = &node->segments[s].list;
+        for (e = 0; (go) && (e < list->count); e++)
+        {
+            entry = &list->entries[e];
+            if ('.' == entry->name[0])
+            {
+                /** "." and "..": the directory itself and its parent */
+            }
+            else
+            {
+                go = (walk->order != FATFS_WALK_ANY) || (fatfs_walk_visit(worker, node, list, entry));
+                if ((go) && (entry->is_dir) && (entry->first_cluster >= 2U) && (entry->first_cluster < walk->entries) && (fatfs_walk_mark(walk, entry->first_cluster)))
+                {
+                    (void)fatfs_walk_name(list, entry, name);
+                    child = fatfs_walk_node(walk, node, entry->first_cluster, name);
+                    if (child != NULL)
+                    {
+                        child->parent_segment = s;
+                        child->parent_entry = e;
+                        fatfs_walk_push(worker, child, FATFS_WALK_WHOLE);
+                    }
+                    else
+                    {
+                        fprintf(stderr, "Error: Failed to allocate memory for the walk\n");
+                        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+                    }
+                }
+            }
+        }
+    }
+    if (!go)
+    {
+        __atomic_store_n(&walk->stop, true, __ATOMIC_RELAXED);
+    }
+
+    free(node->chain);
+    node->chain = NULL;
+    if (FATFS_WALK_ANY == walk->order)
+    {
+        for (s = 0; s < node->segment_count; s++)
+        {
+            free_entries(&node->segments[s].list); /** Visited: only the orders visiting later keep the entries */
+        }
+        node->segment_count = 0;
+    }
+}
+
+/**
+ * @brief Call the visitor for one entry
+ *
+ * @param worker Thread calling the visitor, its buffer receives the path
+ * @param node Directory holding the entry
+ * @param list Listing holding the entry
+ * @param entry Entry to visit
+ * @return bool The answer of the visitor: true to go on, false to stop the walk; false on an allocation error
+ */
+static bool fatfs_walk_visit(fatfs_walk_worker_t *worker, fatfs_walk_node_t *node, const DirList *list, const DirEntry *entry)
+{
+    fatfs_walk_entry_t visit;                            /** Entry given to the visitor */
+    uint32_t length = (uint32_t)strlen(node->path);      /** Length of the path of the directory */
+    uint32_t needed = length + FATFS_WALK_NAME_MAX + 2U; /** Room of the path of the entry */
+    char *grown = NULL;                                  /** Buffer after realloc */
+    bool result = true;                                  /** Answer of the visitor */
+
+    if (worker->path_capacity < needed)
+    {
+        grown = (char *)realloc(worker->path, needed);
+        result = (grown != NULL);
+        if (result)
+        {
+            worker->path = grown;
+            worker->path_capacity = needed;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for the walk\n");
+            __atomic_store_n(&worker->walk->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+    if (result)
+    {
+        memcpy(worker->path, node->path, length);
+        worker->path[length] = '/';
+        (void)fatfs_walk_name(list, entry, worker->path + length + 1U);
+        visit.entry = entry;
+        visit.long_name = fatfs_long_name(list, entry);
+        visit.path = worker->path;
+        visit.directory = (node->cluster == worker->walk->geo->root_cluster) ? 0U : node->cluster;
+        visit.depth = node->depth;
+        result = worker->walk->visitor(&visit, worker->walk->context);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Write the name of an entry: its long name, or NAME.EXT without the padding of the 8.3 name
+ *
+ * @param list Listing holding the entry
+ * @param entry Entry
+ * @param out Receives the terminated name, FATFS_WALK_NAME_MAX + 1 bytes at most
+ * @return uint32_t Length of the name
+ */
+static uint32_t fatfs_walk_name(const DirList *list, const DirEntry *entry, char *out)
+{
+    const char *longName = fatfs_long_name(list, entry); /** Long name, NULL when none */
+    uint32_t length = 0;                                 /** Length of the name */
+
+    if (longName != NULL)
+    {
+        length = (uint32_t)strlen(longName);
+        length = (length > FATFS_WALK_NAME_MAX) ? FATFS_WALK_NAME_MAX : length;
+        memcpy(out, longName, length);
+    }
+    else
+    {
+        length = fatfs_format_name(entry->name, out);
+    }
+    out[length] = '\0';
+
+    return length;
+}
+
+/**
+ * @brief Go through the listed tree depth first, a directory before its contents, without recursion
+ *
+ * @param walk Shared state, the directories are listed
+ * @param refs Receives every entry in depth first order, NULL to call the visitor instead
+ * @return uint32_t Number of entries collected or visited
+ */
+static uint32_t fatfs_walk_preorder(fatfs_walk_t *walk, fatfs_walk_ref_t *refs)
+{
+    fatfs_walk_worker_t *worker = &walk->workers[0]; /** The calling thread */
+    fatfs_walk_frame_t *stack = NULL;                /** Directories being visited, the start directory first */
+    fatfs_walk_frame_t *grown = NULL;                /** Stack after realloc */
+    fatfs_walk_frame_t *top = NULL;                  /** Directory being visited */
+    const DirList *list = NULL;                      /** Entries of the segment */
+    const DirEntry *entry = NULL;                    /** Entry being visited */
+    uint32_t depth = 0;                              /** Directories on the stack */
+    uint32_t capacity = FATFS_WALK_MIN_TASKS;        /** Room of the stack */
+    uint32_t count = 0;                              /** Entries collected */
+    bool go = true;                                  /** Cleared when the visitor stops the walk */
+
+    stack = (fatfs_walk_frame_t *)malloc((size_t)capacity * sizeof(fatfs_walk_frame_t));
+    if (stack != NULL)
+    {
+        stack[0].node = walk->root;
+        stack[0].child = walk->root->first_child;
+        stack[0].segment = 0;
+        stack[0].entry = 0;
+        depth = 1;
+    }
+    else
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for the walk\n");
+        walk->failed = true;
+    }
+
+    while ((go) && (depth != 0))
+    {
+        top = &stack[depth - 1U];
+        if (top->segment >= top->node->segment_count)
+        {
+            depth--; /** Directory done */
+        }
+        else if (top->entry >= top->node->segments[top->segment].list.count)
+        {
+            top->segment++;
+            top->entry = 0;
+        }
+        else
+        {
+            list = &top->node->segments[top->segment].list;
+            entry = &list->entries[top->entry];
+            if ('.' != entry->name[0])
+            {
+                if (refs != NULL)
+                {
+                    refs[count].node = top->node;
+                    refs[count].segment = top->segment;
+                    refs[count].entry = top->entry;
+                    refs[count].cluster = entry->first_cluster;
+                    refs[count].order = count;
+                }
+                else
+                {
+                    go = fatfs_walk_visit(worker, top->node, list, entry);
+                }
+                count++;
+            }
+            if ((top->child != NULL) && (top->child->parent_segment == top->segment) && (top->child->parent_entry == top->entry))
+            {
+                if (depth == capacity)
+                {
+                    grown = (fatfs_walk_frame_t *)realloc(stack, (size_t)capacity * 2U * sizeof(fatfs_walk_frame_t));
+                    go = go && (grown != NULL);
+                    stack = (grown != NULL) ? grown : stack;
+                    capacity = (grown != NULL) ? (capacity * 2U) : capacity;
+                    top = &stack[depth - 1U];
+                    walk->failed = walk->failed || (NULL == grown);
+                }
+                if (go)
+                {
+                    stack[depth].node = top->child;
+                    stack[depth].child = top->child->first_child;
+                    stack[depth].segment = 0;
+                    stack[depth].entry = 0;
+                    depth++;
+                }
+                top->child = top->child->sibling;
+            }
+            top->entry++;
+        }
+    }
+    walk->stop = walk->stop || (!go);
+    free(stack);
+
+    return count;
+}
+
+/**
+ * @brief Visit the listed tree by first cluster on the volume: a reader of every file then moves forward on the disk
+ *
+ * @param walk Shared state, the directories are listed
+ */
+static void fatfs_walk_physical(fatfs_walk_t *walk)
+{
+    fatfs_walk_ref_t *refs = NULL;         /** Every entry */
+    fatfs_walk_node_t *node = walk->nodes; /** Directory being counted */
+    uint32_t count = 0;                    /** Entries of the tree, "." and ".." included */
+    uint32_t i = 0;                        /** Used as an index of operation */
+    uint32_t s = 0;                        /** Used as an index of operation */
+    bool go = true;                        /** Cleared when the visitor stops the walk */
+
+    for (; node != NULL; node = node->next)
+    {
+        for (s = 0; s < node->segment_count; s++)
+        {
+            count += node->segments[s].list.count;
+        }
+    }
+    refs = (fatfs_walk_ref_t *)malloc(((0 == count) ? 1U : (size_t)count) * sizeof(fatfs_walk_ref_t));
+    if (NULL == refs)
+    {
+        fprintf(stderr, "Error: Failed to allocate memory for the walk\n");
+        walk->failed = true;
+    }
+    else
+    {
+        count = fatfs_walk_preorder(walk, refs); /** "." and ".." are left out */
+        qsort(refs, count, sizeof(fatfs_walk_ref_t), fatfs_walk_compare);
+        for (i = 0; (go) && (i < count); i++)
+        {
+            go = fatfs_walk_visit(&walk->workers[0], refs[i].node, &refs[i].node->segments[refs[i].segment].list,
+                                  &refs[i].node->segments[refs[i].segment].list.entries[refs[i].entry]);
+        }
+        walk->stop = walk->stop || (!go);
+    }
+    free(refs);
+}
+
+/**
+ * @brief Order two entries by first cluster, then by depth first order so that the order is stable
+ *
+ * @param a First entry
+ * @param b Second entry
+ * @return int Negative, zero or positive as a is before, with or after b
+ */
+static int fatfs_walk_compare(const void *a, const void *b)
+{
+    const fatfs_walk_ref_t *left = (const fatfs_walk_ref_t *)a;                       /** First entry */
+    const fatfs_walk_ref_t *right = (const fatfs_walk_ref_t *)b;                      /** Second entry */
+    int result = (left->cluster > right->cluster) - (left->cluster < right->cluster); /** Order of the clusters */
+
+    return (0 != result) ? result : ((left->order > right->order) - (left->order < right->order));
+}
+
+/**
+ * @brief Release every directory of the walk
+ *
+ * @param walk Shared state
+ */
+static void fatfs_walk_free(fatfs_walk_t *walk)
+{
+    fatfs_walk_node_t *node = NULL; /** Directory being released */
+    uint32_t s = 0;                 /** Used as an index of operation */
+
+    while (walk->nodes != NULL)
+    {
+        node = walk->nodes;
+        walk->nodes = node->next;
+        for (s = 0; (node->segments != NULL) && (s < node->segment_count); s++)
+        {
+            free_entries(&node->segments[s].list);
+        }
+        free(node->segments);
+        free(node->chain);
+        free(node->path);
+        free(node);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _FATFS_WALK_H_
+#define _FATFS_WALK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FATfs.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define FATFS_WALK_MAX_THREADS 64U /** Upper bound of the threads listing the directories */
+
+/** Define enumeration to represent the order in which the entries are given to the visitor */
+typedef enum
+{
+    FATFS_WALK_ANY = 0,      /** As soon as their directory is listed, from every thread at once: the fastest */
+    FATFS_WALK_PREORDER = 1, /** Depth first, a directory before its contents, in listing order, from the calling thread */
+    FATFS_WALK_PHYSICAL = 2  /** By first cluster on the volume, entries owning no cluster first, from the calling thread */
+} fatfs_walk_order_t;
+
+/**
+ * @brief  Define the structure given to the visitor for every entry of the tree
+ */
+typedef struct
+{
+    const DirEntry *entry; /** Entry as listed by fatfs_read_dir */
+    const char *long_name; /** UTF-8 long name, NULL when the entry has none */
+    const char *path;      /** Path from the start directory, such as "/DIR/FILE.TXT", made of the long names when there are some */
+    uint32_t directory;    /** First cluster of the directory holding the entry, 0 for the root */
+    uint32_t depth;        /** 0 for the entries of the start directory */
+} fatfs_walk_entry_t;
+
+/**
+ * @brief Function called once for every entry of the tree
+ *
+ * The entry and its strings are only valid during the call.
+ *
+ * @param entry Entry being visited
+ * @param context Pointer given to fatfs_walk
+ * @return bool true to go on, false to stop the walk
+ */
+typedef bool (*fatfs_walk_visitor_t)(const fatfs_walk_entry_t *entry, void *context);
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Visit every file and directory below a directory of the volume opened by fatfs_init.
+ *
+ * The directories are listed by a pool of threads stealing work from each other: every
+ * subdirectory is a task, and a directory larger than 64 KiB is split into runs of clusters
+ * listed in parallel. The tree is walked without recursion, so its depth is only bounded by
+ * memory, and a directory reached twice through a damaged volume is listed once, under one of
+ * its paths. "." and ".." are not visited.
+ *
+ * In the FATFS_WALK_ANY order the visitor is called from several threads at once and must be
+ * thread safe. In the other orders the whole tree is listed first, then the visitor is called
+ * from the calling thread only. After a read or allocation error no directory listed later is
+ * visited, and the other orders visit nothing.
+ *
+ * @param start_cluster First cluster of the directory to walk, 0 for the root directory.
+ * @param order Order of the visits.
+ * @param threads Number of threads, 0 selects the number of processors.
+ * @param visitor Function called for every entry.
+ * @param context Pointer given to the visitor.
+ * @return int 0 when the whole tree is visited, 1 when the visitor stops the walk, -1 on a read or allocation error
+ * or when start_cluster is not a cluster of the volume.
+ */
+int fatfs_walk(uint32_t start_cluster, fatfs_walk_order_t order, uint32_t threads, fatfs_walk_visitor_t visitor, void *context);
+
+#endif /** _FATFS_WALK_H_ */
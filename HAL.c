@@ -3,18 +3,65 @@
  ******************************************************************************/
 
 #include "HAL.h"
+#include "HAL_async.h"
+#include "HAL_backend.h"
+#include "HAL_cache.h"
+#include "HAL_pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define KMC_RA_STREAMS 4U /** Number of sequential streams tracked at once */
+#define KMC_READV_BATCH 64U /** Ranges passed to the backend in one vectored request */
+
+/**
+ * @brief  Define the structure tracking one sequential stream for readahead
+ */
+typedef struct
+{
+    uint32_t next;    /** Sector expected by the next sequential read */
+    uint32_t window;  /** Current readahead window in sectors, 0 until the stream is sequential */
+    uint32_t raEnd;   /** End of the range already read ahead */
+    uint32_t lastUse; /** Clock of the last access, the least recent stream is replaced */
+} kmc_stream_t;
 
 /*******************************************************************************
  * Variables
  ******************************************************************************/
 
-static FILE *s_imageFile = NULL;                    /** File pointer to the image file */
-static uint16_t s_sectorSize = DEFAULT_SECTOR_SIZE; /** Initializedto DEFAULT_SECTOR_SIZE */
+static const kmc_backend_t *s_backend = NULL;                /** Backend serving the reads, NULL when no image is open */
+static void *s_backendCtx = NULL;                            /** Private state of the backend */
+static uint64_t s_imageSize = 0;                             /** Size in bytes of the image */
+static uint64_t s_baseOffset = 0;                            /** Byte offset of sector 0 of the volume in the image */
+static uint16_t s_sectorSize = DEFAULT_SECTOR_SIZE;          /** Initializedto DEFAULT_SECTOR_SIZE */
+static uint32_t s_cacheBudget = 0;                           /** Memory given to the sector cache, 0 when disabled */
+static pthread_mutex_t s_raLock = PTHREAD_MUTEX_INITIALIZER; /** Protects the stream table */
+static kmc_stream_t s_streams[KMC_RA_STREAMS];               /** Streams tracked for readahead */
+static uint32_t s_raClock = 0;                               /** Incremented on every read */
+static uint32_t s_raMax = 0;                                 /** Largest window, 0 disables readahead */
+static pthread_cond_t s_raWake = PTHREAD_COND_INITIALIZER;   /** Signaled when a window is queued, the worker goes idle or stops */
+static pthread_t s_raThread;                                 /** Worker reading the windows into the cache */
+static bool s_raRunning = false;                             /** Set while the worker runs */
+static bool s_raStop = false;                                /** Asks the worker to exit */
+static bool s_raBusy = false;                                /** Set while the worker reads a window */
+static uint32_t s_raPendStart = 0;                           /** First sector of the window waiting for the worker */
+static uint32_t s_raPendCount = 0;                           /** Sectors of the waiting window, 0 for none */
 
 /*******************************************************************************
  * Prototypes
  ******************************************************************************/
 
+static int kmc_start(const kmc_config_t *config);                                     /** Set up the layers above a freshly opened backend */
+static uint64_t kmc_sector_offset(uint32_t index);                                    /** Byte offset of a sector in the image */
+static int32_t kmc_read_image(uint32_t index, uint32_t num, uint8_t *buff);           /** Read sectors from the image, bypassing the cache */
+static uint32_t kmc_readahead_track(uint32_t index, uint32_t num, uint32_t *raStart); /** Detect sequential streams */
+static void kmc_readahead_hint(uint32_t index, uint32_t num);                         /** Ask the OS to prefetch sectors */
+static void kmc_readahead_clamp(void);                                                /** Fit the readahead window in the cache */
+static void kmc_readahead_start(void);                                                /** Start the worker filling the cache */
+static void kmc_readahead_queue(uint32_t index, uint32_t num);                        /** Hand a window to the worker */
+static void kmc_readahead_drain(bool stop);                                           /** Drop the waiting window and wait for the worker */
+static void *kmc_readahead_worker(void *arg);                                         /** Read the queued windows into the cache */
+
 /*******************************************************************************
  * Code
  ******************************************************************************/
@@ -26,14 +73,145 @@ static uint16_t s_sectorSize = DEFAULT_SECTOR_SIZE; /** Initializedto DEFAULT_SE
  * @return int Returns 0 if the file is successfully opened, or -1 if there is an error.
  */
 int kmc_init(const char *imagePath)
+{
+    return kmc_init_ex(imagePath, NULL); /** Use the default configuration */
+}
+
+/**
+ * @brief Function to initialize the image file with an explicit configuration
+ *
+ * @param imagePath The path to the image file to be opened.
+ * @param config Access mode and flags, NULL selects KMC_MODE_DEFAULT.
+ * @return int Returns 0 if the file is successfully opened, or -1 if there is an error.
+ */
+int kmc_init_ex(const char *imagePath, const kmc_config_t *config)
+{
+    static const kmc_backend_t *const backends[] = {
+        &kmc_backend_stdio, &kmc_backend_mmap, &kmc_backend_pread, &kmc_backend_ramdisk, &kmc_backend_direct}; /** Indexed by kmc_mode_t */
+    kmc_status_t status = KMC_ERROR;                                      /** Initialize status to KMC_ERROR until a backend is open */
+    kmc_mode_t mode = (config != NULL) ? config->mode : KMC_MODE_DEFAULT; /** Select the access mode */
+    kmc_config_t shapedConfig;                                            /** Configuration pointing at the completed shape */
+    kmc_shape_t shape;                                                    /** Shape with its inner backend filled in */
+
+    if ((uint32_t)mode >= (sizeof(backends) / sizeof(backends[0])))
+    {
+        fprintf(stderr, "Error: Unknown access mode\n"); /** Print error message */
+    }
+    else if ((config != NULL) && (config->shape != NULL))
+    {
+        shape = *config->shape;
+        if (NULL == shape.inner)
+        {
+            shape.inner = backends[mode]; /** Slow down the configured mode */
+        }
+        shapedConfig = *config;
+        shapedConfig.shape = &shape;
+        status = (kmc_status_t)kmc_init_backend(&kmc_backend_shaped, imagePath, &shapedConfig);
+    }
+    else
+    {
+        status = (kmc_status_t)kmc_init_backend(backends[mode], imagePath, config);
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Initialize the layer on a given backend, built-in or provided by the caller.
+ *
+ * @param backend Operations of the backend, must stay valid until kmc_deinit.
+ * @param imagePath The path passed to the open operation.
+ * @param config Flags, cache and queue settings, the mode field is ignored. May be NULL.
+ * @return int Returns 0 if the image is successfully opened, or -1 if there is an error and nothing is left open.
+ */
+int kmc_init_backend(const kmc_backend_t *backend, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the backend is open */
+    void *ctx = NULL;                /** Private state returned by the backend */
+
+    if ((backend != NULL) && (backend->open != NULL) && (backend->open(&ctx, imagePath, config) == 0))
+    {
+        s_backend = backend;
+        s_backendCtx = ctx;
+        status = (kmc_status_t)kmc_start(config);
+        if (status != KMC_OK)
+        {
+            kmc_deinit(); /** Close the backend and whatever kmc_start did set up */
+        }
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Initialize the layer on an image already in memory.
+ *
+ * @param image Pointer to the first byte of the image, borrowed until kmc_deinit.
+ * @param size Size of the image in bytes.
+ * @param config Flags, cache and queue settings, the mode field is ignored. May be NULL.
+ * @return int Returns 0 on success, or -1 if there is an error and nothing is left attached.
+ */
+int kmc_init_ramdisk(const uint8_t *image, uint64_t size, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the image is attached */
+    void *ctx = NULL;                /** Private state of the RAM disk */
+
+    if (kmc_ramdisk_attach(&ctx, image, size) == 0)
+    {
+        s_backend = &kmc_backend_ramdisk;
+        s_backendCtx = ctx;
+        status = (kmc_status_t)kmc_start(config);
+        if (status != KMC_OK)
+        {
+            kmc_deinit(); /** Detach the image and whatever kmc_start did set up */
+        }
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Set up the size, cache, readahead and asynchronous layers above a freshly opened backend.
+ *
+ * @param config Flags, cache and queue settings. May be NULL.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+static int kmc_start(const kmc_config_t *config)
 {
     kmc_status_t status = KMC_OK; /** Initialize status to KMC_OK, indicate success */
+    kmc_stat_t st;                /** Size of the image */
 
-    s_imageFile = fopen(imagePath, "rb"); /** Open the image file in read */
-    if (!s_imageFile)                     /** Check if the file failed to open */
+    if (s_backend->stat(s_backendCtx, &st) != 0)
+    {
+        fprintf(stderr, "Error: Failed to get size of image file\n");
+        status = KMC_ERROR;
+    }
+    else
+    {
+        s_imageSize = st.size;
+        (void)kmc_pool_init(st.block_size); /** Aligned buffers usable for direct I/O on this image */
+    }
+
+    s_cacheBudget = ((config != NULL) && (NULL == s_backend->map)) ? config->cache_bytes : 0; /** An image in memory is its own cache */
+    s_raMax = ((config != NULL) && (config->readahead != 0)) ? config->readahead : KMC_READAHEAD_DEFAULT;
+    if ((config != NULL) && (config->flags & KMC_FLAG_NO_READAHEAD))
+    {
+        s_raMax = 0;
+    }
+    memset(s_streams, 0, sizeof(s_streams)); /** No stream known on a new image */
+    if ((KMC_OK == status) && (s_cacheBudget > 0))
+    {
+        status = (kmc_status_t)kmc_cache_init(s_cacheBudget, s_sectorSize); /** Keep hot sectors in memory */
+        kmc_readahead_clamp();
+        kmc_readahead_start();
+    }
+    if ((KMC_OK == status) && (config != NULL) && (config->queue_depth > 1))
     {
-        fprintf(stderr, "Error: Failed to open image file\n"); /** Print error message */
-        status = KMC_ERROR;                                    /** Set status to indicate failure */
+        if (kmc_async_init(config->queue_depth) != 0) /** Keep many reads in flight when asked for */
+        {
+            fprintf(stderr, "Error: Failed to start asynchronous I/O\n");
+            status = KMC_ERROR;
+        }
     }
 
     return status; /** Return the status */
@@ -53,52 +231,495 @@ int kmc_update_sector_size(uint16_t sectorSize)
     {
         status = KMC_ERROR; /** Set status to KMC_ERROR to indicate the error */
     }
+    kmc_readahead_drain(false); /** A window being read has the old size */
+    if ((sectorSize != s_sectorSize) && (s_cacheBudget > 0))
+    {
+        (void)kmc_cache_init(s_cacheBudget, sectorSize); /** Cached sectors have the old size, start over */
+    }
     s_sectorSize = sectorSize; /** Update the sector size */
+    kmc_readahead_clamp();
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Get the sector size currently used by the layer.
+ *
+ * @return uint16_t The sector size in bytes.
+ */
+uint16_t kmc_get_sector_size(void)
+{
+    return s_sectorSize;
+}
+
+/**
+ * @brief Get the backend serving the reads.
+ *
+ * @return const kmc_backend_t* The backend, NULL when no image is open.
+ */
+const kmc_backend_t *kmc_get_backend(void)
+{
+    return s_backend;
+}
+
+/**
+ * @brief Get the size of the opened image.
+ *
+ * @return uint64_t The size in bytes, 0 when no image is open.
+ */
+uint64_t kmc_get_image_size(void)
+{
+    return s_imageSize;
+}
+
+/**
+ * @brief Set where the volume starts inside the image, for disk dumps holding a partition table.
+ *
+ * @param offset Byte offset of the first sector of the volume, a multiple of 512 inside the image.
+ * @return int Returns 0 on success, or -1 if the offset is not valid.
+ */
+int kmc_set_base_offset(uint64_t offset)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the offset is checked */
+
+    if ((0 == offset % 512) && (offset < s_imageSize))
+    {
+        kmc_readahead_drain(false); /** A window being read is indexed from the old base */
+        s_baseOffset = offset;
+        if (kmc_cache_enabled())
+        {
+            kmc_cache_invalidate(); /** Cached sectors are indexed from the old base */
+        }
+        pthread_mutex_lock(&s_raLock);
+        memset(s_streams, 0, sizeof(s_streams)); /** Streams are tracked by sector index too */
+        pthread_mutex_unlock(&s_raLock);
+        status = KMC_OK;
+    }
 
     return status; /** Return the status */
 }
 
+/**
+ * @brief Get the byte offset of the volume inside the image.
+ *
+ * @return uint64_t The offset set by kmc_set_base_offset, 0 by default.
+ */
+uint64_t kmc_get_base_offset(void)
+{
+    return s_baseOffset;
+}
+
+/**
+ * @brief Byte offset of a sector in the image, computed on 64 bits.
+ *
+ * @param index The index of the sector, relative to the base offset.
+ * @return uint64_t The byte offset.
+ */
+static uint64_t kmc_sector_offset(uint32_t index)
+{
+    return s_baseOffset + (uint64_t)index * s_sectorSize;
+}
+
+/**
+ * @brief Get the file descriptor of the image, for positional or asynchronous I/O.
+ *
+ * @return int The descriptor when the backend has one, -1 otherwise.
+ */
+int kmc_get_image_fd(void)
+{
+    int fd = -1; /** Descriptor to return */
+
+    if ((s_backend != NULL) && (s_backend->fd != NULL))
+    {
+        fd = s_backend->fd(s_backendCtx);
+    }
+
+    return fd; /** Return the descriptor */
+}
+
+/**
+ * @brief Get a direct pointer to sectors of the image without copying them.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors that will be accessed.
+ * @return const uint8_t* Pointer to the sector data, or NULL if the backend has no mapping or the range is out of the image.
+ */
+const uint8_t *kmc_get_sector_ptr(uint32_t index, uint32_t num)
+{
+    const uint8_t *ptr = NULL; /** Pointer to return, NULL when not available */
+
+    if ((s_backend != NULL) && (s_backend->map != NULL))
+    {
+        ptr = s_backend->map(s_backendCtx, kmc_sector_offset(index), num * s_sectorSize);
+    }
+
+    return ptr; /** Return the pointer */
+}
+
 /**
  * @brief Reads data from a specified sector in the system.
  *
+ * The read functions may be called concurrently from several threads in every mode.
+ *
  * @param index The index of the sector to read from
  * @param buff Pointer to a buffer where the read data will be stored
  * @return int32_t return the number of bytes read on success, or a negative value to indicate an error:
  */
 int32_t kmc_read_sector(uint32_t index, uint8_t *buff)
 {
-    int byteRead = (int)KMC_OK; /** ByteRead variable to return the number of bytes read or failure */
+    return kmc_read_multi_sector(index, 1, buff); /** A single sector is a range of one */
+}
+
+/**
+ * @brief Reads data from multiple consecutive sectors starting from a specified index.
+ *
+ * @param index The starting index of the first sector to read from.
+ * @param num The number of consecutive sectors to read.
+ * @param buff Pointer to a buffer where the read data will be stored.
+ * @return int32_t return the number of bytes read on success, or a negative value to indicate an error:
+ */
+int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t *buff)
+{
+    int32_t byteRead = (int32_t)KMC_ERROR;                        /** ByteRead variable to return the number of bytes read or failure */
+    uint32_t raStart = 0;                                         /** First sector to read ahead */
+    uint32_t raCount = kmc_readahead_track(index, num, &raStart); /** Number of sectors to read ahead, 0 for none */
 
-    if (fseek(s_imageFile, index * s_sectorSize, SEEK_SET) != 0) /** Move file pointer to the desire sector */
+    if (raCount > 0)
+    {
+        kmc_readahead_hint(raStart, raCount); /** Let the OS fetch the window in the background */
+        if (s_raRunning)
+        {
+            kmc_readahead_queue(raStart, raCount); /** The worker brings it into the cache while this read runs */
+        }
+    }
+    if (kmc_cache_enabled())
     {
-        byteRead = KMC_ERROR; /** Set byteRead to indicate failure */
+        byteRead = kmc_cache_read(index, num, buff, kmc_read_image); /** Serve what is cached, read the rest */
     }
     else
     {
-        byteRead = fread(buff, 1, s_sectorSize, s_imageFile); /** Read sector into the buffer */
+        byteRead = kmc_read_image(index, num, buff);
     }
+
     return byteRead; /** Return the byteRead */
 }
 
 /**
- * @brief Reads data from multiple consecutive sectors starting from a specified index.
+ * @brief Read several ranges of sectors in one call.
  *
- * @param index The starting index of the first sector to read from.
- * @param num The number of consecutive sectors to read.
- * @param buff Pointer to a buffer where the read data will be stored.
- * @return int32_t return the number of bytes read on success, or a negative value to indicate an error:
+ * @param ranges Array of ranges to read.
+ * @param count Number of ranges.
+ * @return int32_t The total number of bytes read, or a negative value to indicate an error.
  */
-int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t *buff)
+int32_t kmc_readv(const kmc_range_t *ranges, uint32_t count)
 {
-    int byteRead = (int)KMC_OK; /** ByteRead variable to return the number of bytes read or failure */
+    int32_t byteRead = (int32_t)KMC_OK; /** Total number of bytes read */
+    int32_t ret = 0;                    /** Bytes read by one call */
+    kmc_iovec_t iov[KMC_READV_BATCH];   /** Byte ranges of the current batch */
+    uint32_t batch = 0;                 /** Number of ranges in the batch */
+    uint32_t i = 0;                     /** Used as an index of operation */
+    uint32_t j = 0;                     /** Used as an index of operation */
 
-    if (fseek(s_imageFile, index * s_sectorSize, SEEK_SET) != 0) /** Move file pointer to the desire sector */
+    if (NULL == s_backend)
     {
         byteRead = KMC_ERROR;
     }
+    else if ((kmc_cache_enabled()) || (NULL == s_backend->readv))
+    {
+        for (i = 0; (i < count) && (byteRead >= 0); i++)
+        {
+            ret = kmc_read_multi_sector(ranges[i].index, ranges[i].num, ranges[i].buff); /** Cached sectors are not read again */
+            byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+        }
+    }
     else
     {
-        byteRead = fread(buff, 1, s_sectorSize * num, s_imageFile); /** Read mutiple sector into the buffer */
+        for (i = 0; (i < count) && (byteRead >= 0); i += batch)
+        {
+            batch = ((count - i) < KMC_READV_BATCH) ? (count - i) : KMC_READV_BATCH;
+            for (j = 0; j < batch; j++)
+            {
+                iov[j].offset = kmc_sector_offset(ranges[i + j].index);
+                iov[j].buff = ranges[i + j].buff;
+                iov[j].length = ranges[i + j].num * s_sectorSize;
+            }
+            ret = s_backend->readv(s_backendCtx, iov, batch);
+            byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+        }
+    }
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Detect sequential streams and decide what to read ahead.
+ *
+ * A read starting where a tracked stream stopped is sequential: the window of the stream starts
+ * at KMC_READAHEAD_MIN and doubles on every sequential read up to the configured maximum. A new
+ * window is read ahead once less than half of the previous one is left in front of the reader.
+ *
+ * @param index The starting index of the read.
+ * @param num The number of sectors of the read.
+ * @param raStart Receives the first sector to read ahead.
+ * @return uint32_t The number of sectors to read ahead, 0 for none.
+ */
+static uint32_t kmc_readahead_track(uint32_t index, uint32_t num, uint32_t *raStart)
+{
+    uint32_t raCount = 0;        /** Number of sectors to read ahead */
+    uint32_t end = index + num;  /** Sector following the read */
+    kmc_stream_t *stream = NULL; /** Stream the read belongs to */
+    uint32_t i = 0;              /** Used as an index of operation */
+
+    if (s_raMax > 0)
+    {
+        pthread_mutex_lock(&s_raLock);
+        s_raClock++;
+        for (i = 0; (i < KMC_RA_STREAMS) && (NULL == stream); i++)
+        {
+            if ((s_streams[i].lastUse != 0) && (s_streams[i].next == index))
+            {
+                stream = &s_streams[i]; /** Continues a known stream */
+            }
+        }
+
+        if (stream != NULL)
+        {
+            stream->window = (0 == stream->window) ? KMC_READAHEAD_MIN : (stream->window * 2);
+            if (stream->window > s_raMax)
+            {
+                stream->window = s_raMax;
+            }
+            if (stream->raEnd < end)
+            {
+                stream->raEnd = end; /** The reader went past the prefetched range */
+            }
+            if ((stream->raEnd - end) < (stream->window / 2))
+            {
+                *raStart = stream->raEnd;
+                raCount = end + stream->window - stream->raEnd;
+                stream->raEnd = end + stream->window;
+            }
+        }
+        else
+        {
+            stream = &s_streams[0];
+            for (i = 1; i < KMC_RA_STREAMS; i++)
+            {
+                if (s_streams[i].lastUse < stream->lastUse)
+                {
+                    stream = &s_streams[i]; /** Replace the least recently used stream */
+                }
+            }
+            stream->window = 0;
+            stream->raEnd = end;
+        }
+        stream->next = end;
+        stream->lastUse = s_raClock;
+        pthread_mutex_unlock(&s_raLock);
+    }
+
+    return raCount;
+}
+
+/**
+ * @brief Fit the readahead window in the cache.
+ *
+ * Read ahead sectors wait in the A1in queue of the cache (a quarter of its slots), the window is
+ * kept to half of that so they are not evicted before the reader gets to them.
+ */
+static void kmc_readahead_clamp(void)
+{
+    kmc_cache_stats_t stats; /** Used to get the capacity of the cache */
+
+    if (kmc_cache_enabled())
+    {
+        kmc_cache_get_stats(&stats);
+        if (s_raMax > stats.capacity / 8)
+        {
+            s_raMax = stats.capacity / 8; /** 0 disables readahead on a very small cache */
+        }
+    }
+}
+
+/**
+ * @brief Ask the OS to prefetch sectors in the background.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of sectors.
+ */
+static void kmc_readahead_hint(uint32_t index, uint32_t num)
+{
+    if (s_backend->advise != NULL)
+    {
+        s_backend->advise(s_backendCtx, kmc_sector_offset(index), (uint64_t)num * s_sectorSize);
+    }
+}
+
+/**
+ * @brief Start the worker reading the windows into the cache, readahead falls back to OS hints without it.
+ */
+static void kmc_readahead_start(void)
+{
+    if ((s_raMax > 0) && (!s_raRunning))
+    {
+        s_raStop = false;
+        s_raBusy = false;
+        s_raPendCount = 0;
+        s_raRunning = (pthread_create(&s_raThread, NULL, kmc_readahead_worker, NULL) == 0);
+    }
+}
+
+/**
+ * @brief Hand a window to the worker without waiting for it.
+ *
+ * Only one window waits at a time: a window continuing the waiting one extends it up to twice
+ * the largest window, any other replaces it since the reader has moved on.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of sectors.
+ */
+static void kmc_readahead_queue(uint32_t index, uint32_t num)
+{
+    pthread_mutex_lock(&s_raLock);
+    if ((s_raPendCount > 0) && (s_raPendStart + s_raPendCount == index) && (s_raPendCount + num <= 2U * s_raMax))
+    {
+        s_raPendCount += num;
+    }
+    else
+    {
+        s_raPendStart = index;
+        s_raPendCount = num;
+    }
+    pthread_cond_broadcast(&s_raWake);
+    pthread_mutex_unlock(&s_raLock);
+}
+
+/**
+ * @brief Drop the waiting window and wait until the worker is idle, or has exited.
+ *
+ * @param stop true to make the worker exit, false to keep it for the next windows.
+ */
+static void kmc_readahead_drain(bool stop)
+{
+    bool join = false; /** Set when the worker has to be joined */
+
+    pthread_mutex_lock(&s_raLock);
+    s_raPendCount = 0;
+    if ((stop) && (s_raRunning))
+    {
+        s_raStop = true;
+        s_raRunning = false;
+        join = true;
+        pthread_cond_broadcast(&s_raWake);
+    }
+    while (s_raBusy)
+    {
+        pthread_cond_wait(&s_raWake, &s_raLock);
+    }
+    pthread_mutex_unlock(&s_raLock);
+    if (join)
+    {
+        pthread_join(s_raThread, NULL);
+    }
+}
+
+/**
+ * @brief Body of the readahead worker: read the queued windows into the cache until stopped.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *kmc_readahead_worker(void *arg)
+{
+    uint8_t *buffer = NULL;   /** Destination of the windows, kept between them */
+    size_t capacity = 0;      /** Size of buffer */
+    uint8_t *grown = NULL;    /** Buffer after a resize */
+    uint32_t start = 0;       /** First sector of the window being read */
+    uint32_t count = 0;       /** Sectors of the window being read */
+    size_t bytes = 0;         /** Size of the window */
+    bool running = true;      /** Cleared when the worker is asked to exit */
+
+    (void)arg;
+    pthread_mutex_lock(&s_raLock);
+    while (running)
+    {
+        while ((0 == s_raPendCount) && (!s_raStop))
+        {
+            pthread_cond_wait(&s_raWake, &s_raLock); /** Sleep until a window is queued */
+        }
+        if (s_raStop)
+        {
+            running = false;
+        }
+        else
+        {
+            start = s_raPendStart;
+            count = s_raPendCount;
+            s_raPendCount = 0;
+            s_raBusy = true;
+            pthread_mutex_unlock(&s_raLock);
+
+            bytes = (size_t)count * s_sectorSize;
+            if (bytes > capacity)
+            {
+                grown = (uint8_t *)realloc(buffer, bytes); /** Grows to the largest window once, then reused */
+                if (grown != NULL)
+                {
+                    buffer = grown;
+                    capacity = bytes;
+                }
+            }
+            if (bytes <= capacity)
+            {
+                (void)kmc_cache_read(start, count, buffer, kmc_read_image); /** Only the cached copy is kept */
+            }
+
+            pthread_mutex_lock(&s_raLock);
+            s_raBusy = false;
+            pthread_cond_broadcast(&s_raWake); /** Wake up a drain waiting for the window */
+        }
+    }
+    pthread_mutex_unlock(&s_raLock);
+    free(buffer);
+
+    return NULL;
+}
+
+/**
+ * @brief Read bytes of the volume, whatever the sector size, bypassing the cache.
+ *
+ * @param offset Offset of the first byte from the start of the volume.
+ * @param buff Buffer of at least length bytes receiving the data.
+ * @param length Number of bytes to read.
+ * @return int32_t The number of bytes read, or a negative value to indicate an error.
+ */
+int32_t kmc_read_bytes(uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    int32_t byteRead = (int32_t)KMC_ERROR; /** Number of bytes read or failure */
+
+    if (s_backend != NULL)
+    {
+        byteRead = s_backend->read(s_backendCtx, s_baseOffset + offset, buff, length);
+    }
+
+    return byteRead;
+}
+
+/**
+ * @brief Read sectors from the image, bypassing the cache.
+ *
+ * @param index The starting index of the first sector to read from.
+ * @param num The number of consecutive sectors to read.
+ * @param buff Pointer to a buffer where the read data will be stored.
+ * @return int32_t return the number of bytes read on success, or a negative value to indicate an error:
+ */
+static int32_t kmc_read_image(uint32_t index, uint32_t num, uint8_t *buff)
+{
+    int32_t byteRead = (int32_t)KMC_ERROR; /** ByteRead variable to return the number of bytes read or failure */
+
+    if (s_backend != NULL)
+    {
+        byteRead = s_backend->read(s_backendCtx, kmc_sector_offset(index), buff, num * s_sectorSize);
     }
 
     return byteRead; /** Return the byteRead */
@@ -109,9 +730,18 @@ int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t *buff)
  */
 void kmc_deinit(void)
 {
-    if (s_imageFile != NULL) /** Check if the file is open */
+    kmc_async_deinit();        /** Stop the asynchronous interface before its file goes away */
+    kmc_readahead_drain(true); /** Stop the readahead worker before the cache and the file go away */
+    kmc_cache_deinit();        /** Drop the cached sectors of this image */
+    kmc_pool_deinit();         /** Release the free aligned buffers */
+    s_cacheBudget = 0;
+    if (s_backend != NULL) /** Check if an image is open */
     {
-        fclose(s_imageFile); /** Close the file */
-        s_imageFile = NULL;  /** Set the file pointer to NULL */
+        s_backend->close(s_backendCtx); /** Release the image */
+        s_backend = NULL;               /** No backend until the next init */
+        s_backendCtx = NULL;
+        s_imageSize = 0;
     }
+    s_baseOffset = 0;                   /** The next image starts with a whole-disk view */
+    s_sectorSize = DEFAULT_SECTOR_SIZE; /** And with sectors of the default size until its boot sector is read */
 }
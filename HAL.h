@@ -18,6 +18,131 @@ typedef enum
     KMC_OK = 0      /**  Status code indicating success */
 } kmc_status_t;     /**  Define the type name for the enumeration */
 
+/**  Define an enumeration to select how the image file is accessed */
+typedef enum
+{
+    KMC_MODE_STDIO = 0,   /**  Buffered reads through fseek + fread, serialized on the shared file cursor */
+    KMC_MODE_MMAP = 1,    /**  Image mapped into memory, sectors are read in place */
+    KMC_MODE_PREAD = 2,   /**  Positional reads (pread), no shared cursor, safe to call from several threads */
+    KMC_MODE_RAMDISK = 3, /**  Whole image loaded into memory at init, no I/O afterwards */
+    KMC_MODE_DIRECT = 4   /**  Positional reads with O_DIRECT, aligned blocks bypass the page cache */
+} kmc_mode_t;             /**  Define the type name for the enumeration */
+
+/** Mode used when no configuration is given: positional reads where the platform has them */
+#if defined(_WIN32)
+#define KMC_MODE_DEFAULT KMC_MODE_STDIO
+#else
+#define KMC_MODE_DEFAULT KMC_MODE_PREAD
+#endif
+
+#define KMC_FLAG_POPULATE 0x01U /** mmap: pre-fault the whole image at init (MAP_POPULATE) */
+#define KMC_FLAG_HUGEPAGE 0x02U /** mmap: back the mapping with transparent huge pages when possible */
+#define KMC_FLAG_RANDOM 0x04U   /** mmap: advise random access instead of sequential */
+#define KMC_FLAG_NO_READAHEAD 0x08U /** Disable the sequential readahead of the read functions */
+
+#define KMC_READAHEAD_MIN 4U      /** Readahead window, in sectors, once a stream is found sequential */
+#define KMC_READAHEAD_DEFAULT 64U /** Largest readahead window, in sectors, when none is configured */
+
+typedef struct kmc_shape kmc_shape_t; /** Storage emulation settings, defined below */
+
+/**
+ * @brief  Define the structure used to configure the layer at init time
+ */
+typedef struct
+{
+    kmc_mode_t mode;          /** Access mode of the image file */
+    uint32_t flags;           /** Combination of KMC_FLAG_* values */
+    uint32_t queue_depth;     /** Start the asynchronous interface (HAL_async.h) with this depth when above 1 */
+    uint32_t cache_bytes;     /** Memory given to the sector cache (HAL_cache.h), 0 disables it */
+    uint32_t readahead;       /** Largest readahead window in sectors, 0 selects KMC_READAHEAD_DEFAULT */
+    const kmc_shape_t *shape; /** Emulate slow storage on top of the mode (HAL_shape.c), NULL for none */
+} kmc_config_t;
+
+/**
+ * @brief  Define the structure returned by the stat operation of a backend
+ */
+typedef struct
+{
+    uint64_t size;       /** Size of the image in bytes */
+    uint32_t block_size; /** Preferred I/O size of the underlying storage in bytes */
+} kmc_stat_t;
+
+/**
+ * @brief  Define one segment of a vectored read: a byte range of the image and its destination
+ */
+typedef struct
+{
+    uint64_t offset; /** Byte offset in the image */
+    uint8_t *buff;   /** Destination buffer */
+    uint32_t length; /** Number of bytes */
+} kmc_iovec_t;
+
+/**
+ * @brief  Define one range of consecutive sectors of a vectored read and its destination
+ */
+typedef struct
+{
+    uint32_t index; /** Index of the first sector */
+    uint32_t num;   /** Number of consecutive sectors */
+    uint8_t *buff;  /** Buffer of at least num sectors receiving the data */
+} kmc_range_t;
+
+/**
+ * @brief  Define the operations of an image backend
+ *
+ * read, close and stat are mandatory, the other operations may be NULL.
+ * Reads may be issued from several threads at once.
+ */
+typedef struct
+{
+    const char *name; /** Name of the backend, for messages */
+
+    /** Open the image, ctx receives the private state of the backend. Returns 0 or -1 */
+    int (*open)(void **ctx, const char *imagePath, const kmc_config_t *config);
+    /** Read length bytes at offset. Returns the number of bytes read (short at end of image) or -1 */
+    int32_t (*read)(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length);
+    /** Read several segments. Returns the total number of bytes read or -1 */
+    int32_t (*readv)(void *ctx, const kmc_iovec_t *iov, uint32_t count);
+    /** Release the image and the private state */
+    void (*close)(void *ctx);
+    /** Get the size of the image. Returns 0 or -1 */
+    int (*stat)(void *ctx, kmc_stat_t *st);
+    /** Get a pointer to a byte range held in memory, NULL when not available */
+    const uint8_t *(*map)(void *ctx, uint64_t offset, uint32_t length);
+    /** Get the file descriptor of the image, -1 when there is none */
+    int (*fd)(void *ctx);
+    /** Hint that a byte range will be read soon */
+    void (*advise)(void *ctx, uint64_t offset, uint64_t length);
+} kmc_backend_t;
+
+extern const kmc_backend_t kmc_backend_stdio;   /** fseek + fread under the stream lock */
+extern const kmc_backend_t kmc_backend_pread;   /** Positional reads on a file descriptor */
+extern const kmc_backend_t kmc_backend_mmap;    /** Read-only mapping of the image */
+extern const kmc_backend_t kmc_backend_ramdisk; /** Image held in memory */
+extern const kmc_backend_t kmc_backend_direct;  /** Direct I/O on the aligned part of every request, buffered for the rest */
+extern const kmc_backend_t kmc_backend_shaped;  /** Another backend slowed down to emulate real storage */
+
+/**
+ * @brief  Define the settings of kmc_backend_shaped
+ *
+ * Every request waits for latency_us plus a random part of jitter_us, the bytes then go through
+ * a link of bandwidth_kib shared by all requests. At most queue_depth requests are served at once,
+ * the others wait for a free slot.
+ */
+struct kmc_shape
+{
+    const kmc_backend_t *inner; /** Backend holding the image, NULL selects the one of the configured mode */
+    uint32_t latency_us;        /** Fixed delay of every request in microseconds */
+    uint32_t jitter_us;         /** Upper bound of the random delay added to the latency */
+    uint32_t bandwidth_kib;     /** Transfer rate in KiB per second, 0 for unlimited */
+    uint32_t queue_depth;       /** Requests served at once, 0 for unlimited */
+};
+
+/** Settings close to common slow storage: inner, latency, jitter, bandwidth, queue depth */
+#define KMC_SHAPE_USB_FLOPPY {NULL, 30000U, 20000U, 60U, 1U} /** USB floppy drive, seeks dominate */
+#define KMC_SHAPE_SD_CARD {NULL, 500U, 300U, 20000U, 1U}     /** SD card behind a USB reader */
+#define KMC_SHAPE_NFS {NULL, 1000U, 500U, 100000U, 16U}      /** Image on NFS over gigabit ethernet */
+
 /*******************************************************************************
  * Prototypes
  ******************************************************************************/
@@ -30,6 +155,81 @@ typedef enum
  */
 int kmc_init(const char *imagePath);
 
+/**
+ * @brief Function to initialize the image file with an explicit configuration
+ *
+ * @param imagePath The path to the image file to be opened.
+ * @param config Access mode and flags, NULL selects KMC_MODE_DEFAULT.
+ * @return int Returns 0 if the file is successfully opened, or -1 if there is an error.
+ */
+int kmc_init_ex(const char *imagePath, const kmc_config_t *config);
+
+/**
+ * @brief Initialize the layer on a given backend, built-in or provided by the caller.
+ *
+ * @param backend Operations of the backend, must stay valid until kmc_deinit.
+ * @param imagePath The path passed to the open operation.
+ * @param config Flags, cache and queue settings, the mode field is ignored. May be NULL.
+ * @return int Returns 0 if the image is successfully opened, or -1 if there is an error and nothing is left open.
+ */
+int kmc_init_backend(const kmc_backend_t *backend, const char *imagePath, const kmc_config_t *config);
+
+/**
+ * @brief Initialize the layer on an image already in memory.
+ *
+ * The memory is borrowed, not copied: it must stay valid until kmc_deinit.
+ *
+ * @param image Pointer to the first byte of the image.
+ * @param size Size of the image in bytes.
+ * @param config Flags, cache and queue settings, the mode field is ignored. May be NULL.
+ * @return int Returns 0 on success, or -1 if there is an error and nothing is left attached.
+ */
+int kmc_init_ramdisk(const uint8_t *image, uint64_t size, const kmc_config_t *config);
+
+/**
+ * @brief Get the backend serving the reads.
+ *
+ * @return const kmc_backend_t* The backend, NULL when no image is open.
+ */
+const kmc_backend_t *kmc_get_backend(void);
+
+/**
+ * @brief Get the size of the opened image.
+ *
+ * @return uint64_t The size in bytes, 0 when no image is open.
+ */
+uint64_t kmc_get_image_size(void);
+
+/**
+ * @brief Set where the volume starts inside the image, for disk dumps holding a partition table.
+ *
+ * Sector indexes given to the read functions are relative to this offset. The cached sectors
+ * are dropped since their indexes no longer match.
+ *
+ * @param offset Byte offset of the first sector of the volume, a multiple of 512 inside the image.
+ * @return int Returns 0 on success, or -1 if the offset is not valid.
+ */
+int kmc_set_base_offset(uint64_t offset);
+
+/**
+ * @brief Get the byte offset of the volume inside the image.
+ *
+ * @return uint64_t The offset set by kmc_set_base_offset, 0 by default.
+ */
+uint64_t kmc_get_base_offset(void);
+
+/**
+ * @brief Get a direct pointer to sectors of the image without copying them.
+ *
+ * Only available when the backend holds the image in memory (KMC_MODE_MMAP, KMC_MODE_RAMDISK),
+ * the pointer stays valid until kmc_deinit is called.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors that will be accessed.
+ * @return const uint8_t* Pointer to the sector data, or NULL if the mode has no mapping or the range is out of the image.
+ */
+const uint8_t *kmc_get_sector_ptr(uint32_t index, uint32_t num);
+
 /**
  * @brief Updates the sector size used by the system.
  *
@@ -38,9 +238,27 @@ int kmc_init(const char *imagePath);
  */
 int kmc_update_sector_size(uint16_t sectorSize);
 
+/**
+ * @brief Get the sector size currently used by the layer.
+ *
+ * @return uint16_t The sector size in bytes.
+ */
+uint16_t kmc_get_sector_size(void);
+
+/**
+ * @brief Get the file descriptor of the image, for positional or asynchronous I/O.
+ *
+ * @return int The descriptor when the backend has one (KMC_MODE_PREAD), -1 otherwise.
+ */
+int kmc_get_image_fd(void);
+
 /**
  * @brief Reads data from a specified sector in the system.
  *
+ * The read functions may be called concurrently from several threads in every mode.
+ * Sequential streams are detected and read ahead with a window that doubles on every
+ * sequential hit: into the sector cache when it is enabled, otherwise as a hint to the OS.
+ *
  * @param index The index of the sector to read from
  * @param buff Pointer to a buffer where the read data will be stored
  * @return int32_t return the number of bytes read on success, or a negative value to indicate an error:
@@ -57,6 +275,30 @@ int32_t kmc_read_sector(uint32_t index, uint8_t *buff);
  */
 int32_t kmc_read_multi_sector(uint32_t index, uint32_t num, uint8_t *buff);
 
+/**
+ * @brief Read several ranges of sectors in one call.
+ *
+ * The ranges go to the backend as one vectored request: with positional reads, neighbouring
+ * ranges are read with a single preadv. Sectors held by the cache are served from it.
+ *
+ * @param ranges Array of ranges to read.
+ * @param count Number of ranges.
+ * @return int32_t The total number of bytes read, or a negative value to indicate an error.
+ */
+int32_t kmc_readv(const kmc_range_t *ranges, uint32_t count);
+
+/**
+ * @brief Read bytes of the volume, whatever the sector size, bypassing the cache.
+ *
+ * Used for the boot sector, read before the sector size of the volume is known.
+ *
+ * @param offset Offset of the first byte from the start of the volume.
+ * @param buff Buffer of at least length bytes receiving the data.
+ * @param length Number of bytes to read.
+ * @return int32_t The number of bytes read, or a negative value to indicate an error.
+ */
+int32_t kmc_read_bytes(uint64_t offset, uint8_t *buff, uint32_t length);
+
 /**
  * @brief Function to deinitialize the image file
  */
@@ -0,0 +1,577 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "HAL_async.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define KMC_HAVE_IO_URING 1 /** Build the io_uring engine, it is still probed at run time */
+#endif
+#endif
+
+#define KMC_ASYNC_MAX_THREADS 8U /** Upper bound of worker threads of the fallback engine */
+
+#if defined(KMC_HAVE_IO_URING)
+/**
+ * @brief  Define the structure holding the rings shared with the kernel
+ */
+typedef struct
+{
+    int fd;                    /** io_uring instance */
+    void *sqRing;              /** Mapping of the submission ring */
+    void *cqRing;              /** Mapping of the completion ring (same as sqRing with IORING_FEAT_SINGLE_MMAP) */
+    size_t sqRingSize;         /** Size of the submission ring mapping */
+    size_t cqRingSize;         /** Size of the completion ring mapping */
+    struct io_uring_sqe *sqes; /** Submission queue entries */
+    size_t sqesSize;           /** Size of the entries mapping */
+    uint32_t *sqTail;          /** Producer index of the submission ring */
+    uint32_t sqMask;           /** Index mask of the submission ring */
+    uint32_t *sqArray;         /** Indirection array of the submission ring */
+    uint32_t *cqHead;          /** Consumer index of the completion ring */
+    uint32_t *cqTail;          /** Producer index of the completion ring, written by the kernel */
+    uint32_t cqMask;           /** Index mask of the completion ring */
+    struct io_uring_cqe *cqes; /** Completion queue entries */
+} kmc_uring_t;
+#endif
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static kmc_async_engine_t s_engine = KMC_ASYNC_NONE; /** Engine serving the requests */
+static uint32_t s_depth = 0;                         /** Maximum number of requests in flight */
+static uint32_t s_inFlight = 0;                      /** Requests submitted and not reaped yet */
+
+/** Thread pool engine: a pending queue consumed by the workers and a completion queue */
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;      /** Protects both queues */
+static pthread_cond_t s_pendingCond = PTHREAD_COND_INITIALIZER; /** Signaled when work is queued or at shutdown */
+static pthread_cond_t s_doneCond = PTHREAD_COND_INITIALIZER;    /** Signaled when a request completes */
+static kmc_async_req_t *s_pending[KMC_ASYNC_MAX_DEPTH];         /** Ring of requests waiting for a worker */
+static uint32_t s_pendingHead = 0;                              /** Next pending request to serve */
+static uint32_t s_pendingCount = 0;                             /** Number of pending requests */
+static kmc_async_req_t *s_done[KMC_ASYNC_MAX_DEPTH];            /** Ring of completed requests */
+static uint32_t s_doneHead = 0;                                 /** Next completed request to reap */
+static uint32_t s_doneCount = 0;                                /** Number of completed requests */
+static pthread_t s_workers[KMC_ASYNC_MAX_THREADS];              /** Worker threads */
+static uint32_t s_workerCount = 0;                              /** Number of running workers */
+static bool s_stopping = false;                                 /** Asks the workers to exit */
+
+#if defined(KMC_HAVE_IO_URING)
+static kmc_uring_t s_ring = {.fd = -1};                 /** io_uring engine state */
+static struct iovec s_iov[KMC_ASYNC_MAX_DEPTH];         /** One iovec per slot in flight */
+static kmc_async_req_t *s_slotReq[KMC_ASYNC_MAX_DEPTH]; /** Request owning each slot */
+static uint32_t s_freeSlots[KMC_ASYNC_MAX_DEPTH];       /** Stack of unused slots */
+static uint32_t s_freeCount = 0;                        /** Number of unused slots */
+#endif
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static void *kmc_async_worker(void *arg);    /** Body of the worker threads */
+static int kmc_threads_init(uint32_t depth); /** Start the thread pool engine */
+static void kmc_threads_deinit(void);        /** Stop the thread pool engine */
+
+#if defined(KMC_HAVE_IO_URING)
+static int kmc_uring_init(uint32_t depth);                                                 /** Start the io_uring engine */
+static void kmc_uring_deinit(void);                                                        /** Stop the io_uring engine */
+static int kmc_uring_submit(kmc_async_req_t *reqs[], uint32_t count);                      /** Queue reads on the submission ring */
+static int kmc_uring_reap(kmc_async_req_t *done[], uint32_t maxCount, uint32_t minCount); /** Collect completions */
+#endif
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Start the asynchronous interface on the image opened by kmc_init.
+ *
+ * @param queueDepth Maximum number of requests in flight, clamped to KMC_ASYNC_MAX_DEPTH.
+ * @return int Returns 0 on success, or -1 if no engine can be started.
+ */
+int kmc_async_init(uint32_t queueDepth)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until an engine runs */
+
+    if (s_engine != KMC_ASYNC_NONE)
+    {
+        kmc_async_deinit(); /** Restart with the new depth */
+    }
+    if (0 == queueDepth)
+    {
+        queueDepth = 1;
+    }
+    else if (queueDepth > KMC_ASYNC_MAX_DEPTH)
+    {
+        queueDepth = KMC_ASYNC_MAX_DEPTH;
+    }
+
+#if defined(KMC_HAVE_IO_URING)
+    if ((kmc_get_image_fd() >= 0) && (kmc_uring_init(queueDepth) == 0))
+    {
+        s_engine = KMC_ASYNC_IO_URING;
+        status = KMC_OK;
+    }
+#endif
+    if ((KMC_ASYNC_NONE == s_engine) && (kmc_threads_init(queueDepth) == 0))
+    {
+        s_engine = KMC_ASYNC_THREADS; /** Fallback engine, works with every HAL mode */
+        status = KMC_OK;
+    }
+    if (KMC_OK == status)
+    {
+        s_depth = queueDepth;
+        s_inFlight = 0;
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Get the queue depth of the running interface.
+ *
+ * @return uint32_t The maximum number of requests in flight, 0 when the interface is not started.
+ */
+uint32_t kmc_async_depth(void)
+{
+    return s_depth;
+}
+
+/**
+ * @brief Get the engine serving the asynchronous requests.
+ *
+ * @return kmc_async_engine_t The running engine, KMC_ASYNC_NONE when not started.
+ */
+kmc_async_engine_t kmc_async_engine(void)
+{
+    return s_engine;
+}
+
+/**
+ * @brief Queue several reads in one call.
+ *
+ * @param reqs Array of pointers to the requests to queue.
+ * @param count Number of requests in the array.
+ * @return int The number of requests accepted, the first ones of reqs (less than count when the queue is full or the kernel takes fewer), or -1 on error with none accepted.
+ */
+int kmc_async_submit(kmc_async_req_t *reqs[], uint32_t count)
+{
+    int accepted = (int)KMC_ERROR; /** Number of requests queued */
+    uint32_t i = 0;                /** Used as an index of operation */
+
+    if (count > s_depth - s_inFlight)
+    {
+        count = s_depth - s_inFlight; /** Never exceed the queue depth */
+    }
+
+#if defined(KMC_HAVE_IO_URING)
+    if (KMC_ASYNC_IO_URING == s_engine)
+    {
+        accepted = kmc_uring_submit(reqs, count);
+    }
+#endif
+    if (KMC_ASYNC_THREADS == s_engine)
+    {
+        pthread_mutex_lock(&s_lock);
+        for (i = 0; i < count; i++)
+        {
+            s_pending[(s_pendingHead + s_pendingCount) % KMC_ASYNC_MAX_DEPTH] = reqs[i]; /** Append to the pending ring */
+            s_pendingCount++;
+        }
+        pthread_cond_broadcast(&s_pendingCond); /** Wake up the idle workers */
+        pthread_mutex_unlock(&s_lock);
+        accepted = (int)count;
+    }
+    if (accepted > 0)
+    {
+        s_inFlight += (uint32_t)accepted;
+    }
+
+    return accepted; /** Return the number of requests queued */
+}
+
+/**
+ * @brief Collect completed reads.
+ *
+ * @param done Array receiving the pointers of the completed requests.
+ * @param maxCount Capacity of the done array.
+ * @param minCount Number of completions to wait for, 0 only collects what is already finished.
+ * @return int The number of requests returned in done, or -1 on error.
+ */
+int kmc_async_reap(kmc_async_req_t *done[], uint32_t maxCount, uint32_t minCount)
+{
+    int reaped = (int)KMC_ERROR; /** Number of requests returned */
+
+    if (minCount > maxCount)
+    {
+        minCount = maxCount;
+    }
+    if (minCount > s_inFlight)
+    {
+        minCount = s_inFlight; /** Do not wait for requests that were never submitted */
+    }
+
+#if defined(KMC_HAVE_IO_URING)
+    if (KMC_ASYNC_IO_URING == s_engine)
+    {
+        reaped = kmc_uring_reap(done, maxCount, minCount);
+    }
+#endif
+    if (KMC_ASYNC_THREADS == s_engine)
+    {
+        reaped = 0;
+        pthread_mutex_lock(&s_lock);
+        while (s_doneCount < minCount)
+        {
+            pthread_cond_wait(&s_doneCond, &s_lock); /** Wait for the workers */
+        }
+        while ((s_doneCount > 0) && ((uint32_t)reaped < maxCount))
+        {
+            done[reaped++] = s_done[s_doneHead]; /** Pop from the completion ring */
+            s_doneHead = (s_doneHead + 1) % KMC_ASYNC_MAX_DEPTH;
+            s_doneCount--;
+        }
+        pthread_mutex_unlock(&s_lock);
+    }
+    if (reaped > 0)
+    {
+        s_inFlight -= (uint32_t)reaped;
+    }
+
+    return reaped; /** Return the number of completed requests */
+}
+
+/**
+ * @brief Stop the asynchronous interface, requests still in flight are waited for.
+ */
+void kmc_async_deinit(void)
+{
+    kmc_async_req_t *done[KMC_ASYNC_MAX_DEPTH]; /** Completions drained before stopping */
+
+    while ((s_inFlight > 0) && (kmc_async_reap(done, KMC_ASYNC_MAX_DEPTH, 1) > 0))
+    {
+        /** Drain the requests still in flight, their buffers may be released right after */
+    }
+#if defined(KMC_HAVE_IO_URING)
+    if (KMC_ASYNC_IO_URING == s_engine)
+    {
+        kmc_uring_deinit();
+    }
+#endif
+    if (KMC_ASYNC_THREADS == s_engine)
+    {
+        kmc_threads_deinit();
+    }
+    s_engine = KMC_ASYNC_NONE;
+    s_depth = 0;
+    s_inFlight = 0;
+}
+
+/**
+ * @brief Body of the worker threads: serve pending requests until the pool stops.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *kmc_async_worker(void *arg)
+{
+    kmc_async_req_t *req = NULL; /** Request being served */
+    bool running = true;         /** Cleared when the pool stops */
+
+    (void)arg;
+    while (running)
+    {
+        pthread_mutex_lock(&s_lock);
+        while ((0 == s_pendingCount) && (!s_stopping))
+        {
+            pthread_cond_wait(&s_pendingCond, &s_lock); /** Sleep until there is work */
+        }
+        if (0 == s_pendingCount)
+        {
+            running = false; /** Stopping and nothing left to serve */
+            req = NULL;
+        }
+        else
+        {
+            req = s_pending[s_pendingHead]; /** Pop from the pending ring */
+            s_pendingHead = (s_pendingHead + 1) % KMC_ASYNC_MAX_DEPTH;
+            s_pendingCount--;
+        }
+        pthread_mutex_unlock(&s_lock);
+
+        if (req != NULL)
+        {
+            req->result = kmc_read_multi_sector(req->index, req->num, req->buff); /** Blocking read, outside the lock */
+
+            pthread_mutex_lock(&s_lock);
+            s_done[(s_doneHead + s_doneCount) % KMC_ASYNC_MAX_DEPTH] = req; /** Append to the completion ring */
+            s_doneCount++;
+            pthread_cond_signal(&s_doneCond);
+            pthread_mutex_unlock(&s_lock);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Start the thread pool engine.
+ *
+ * @param depth Maximum number of requests in flight, one worker per request up to KMC_ASYNC_MAX_THREADS.
+ * @return int Returns 0 on success, or -1 if no worker can be started.
+ */
+static int kmc_threads_init(uint32_t depth)
+{
+    uint32_t wanted = (depth < KMC_ASYNC_MAX_THREADS) ? depth : KMC_ASYNC_MAX_THREADS; /** Number of workers to start */
+
+    s_stopping = false;
+    s_pendingHead = 0;
+    s_pendingCount = 0;
+    s_doneHead = 0;
+    s_doneCount = 0;
+    s_workerCount = 0;
+    while ((s_workerCount < wanted) && (pthread_create(&s_workers[s_workerCount], NULL, kmc_async_worker, NULL) == 0))
+    {
+        s_workerCount++; /** Keep the workers that did start */
+    }
+
+    return (s_workerCount > 0) ? (int)KMC_OK : (int)KMC_ERROR;
+}
+
+/**
+ * @brief Stop the thread pool engine.
+ */
+static void kmc_threads_deinit(void)
+{
+    uint32_t i = 0; /** Used as an index of operation */
+
+    pthread_mutex_lock(&s_lock);
+    s_stopping = true;
+    pthread_cond_broadcast(&s_pendingCond); /** Wake up every worker so it can exit */
+    pthread_mutex_unlock(&s_lock);
+    for (i = 0; i < s_workerCount; i++)
+    {
+        pthread_join(s_workers[i], NULL);
+    }
+    s_workerCount = 0;
+}
+
+#if defined(KMC_HAVE_IO_URING)
+/**
+ * @brief Start the io_uring engine.
+ *
+ * The rings are set up with the raw system calls so that no extra library is needed.
+ *
+ * @param depth Number of submission queue entries.
+ * @return int Returns 0 on success, or -1 if the kernel does not provide io_uring.
+ */
+static int kmc_uring_init(uint32_t depth)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the rings are mapped */
+    struct io_uring_params params;   /** Parameters filled by the kernel */
+    uint32_t i = 0;                  /** Used as an index of operation */
+    uint8_t *sq = NULL;              /** Base of the submission ring */
+    uint8_t *cq = NULL;              /** Base of the completion ring */
+
+    memset(&params, 0, sizeof(params));
+    memset(&s_ring, 0, sizeof(s_ring));
+    s_ring.fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (s_ring.fd >= 0)
+    {
+        s_ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        s_ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if (s_ring.cqRingSize > s_ring.sqRingSize)
+            {
+                s_ring.sqRingSize = s_ring.cqRingSize; /** Both rings share one mapping */
+            }
+            s_ring.cqRingSize = s_ring.sqRingSize;
+        }
+        s_ring.sqRing = mmap(NULL, s_ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s_ring.fd, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            s_ring.cqRing = s_ring.sqRing;
+        }
+        else
+        {
+            s_ring.cqRing = mmap(NULL, s_ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s_ring.fd, IORING_OFF_CQ_RING);
+        }
+        s_ring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        s_ring.sqes = mmap(NULL, s_ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s_ring.fd, IORING_OFF_SQES);
+
+        if ((s_ring.sqRing != MAP_FAILED) && (s_ring.cqRing != MAP_FAILED) && ((void *)s_ring.sqes != MAP_FAILED))
+        {
+            sq = (uint8_t *)s_ring.sqRing;
+            cq = (uint8_t *)s_ring.cqRing;
+            s_ring.sqTail = (uint32_t *)(sq + params.sq_off.tail);
+            s_ring.sqMask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+            s_ring.sqArray = (uint32_t *)(sq + params.sq_off.array);
+            s_ring.cqHead = (uint32_t *)(cq + params.cq_off.head);
+            s_ring.cqTail = (uint32_t *)(cq + params.cq_off.tail);
+            s_ring.cqMask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+            s_ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+            for (i = 0; i < depth; i++)
+            {
+                s_freeSlots[i] = depth - 1 - i; /** Every slot starts unused */
+            }
+            s_freeCount = depth;
+            status = KMC_OK;
+        }
+        else
+        {
+            kmc_uring_deinit(); /** Release whatever was mapped */
+        }
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Stop the io_uring engine and release the rings.
+ */
+static void kmc_uring_deinit(void)
+{
+    if ((s_ring.sqes != NULL) && ((void *)s_ring.sqes != MAP_FAILED))
+    {
+        munmap(s_ring.sqes, s_ring.sqesSize);
+    }
+    if ((s_ring.cqRing != NULL) && (s_ring.cqRing != MAP_FAILED) && (s_ring.cqRing != s_ring.sqRing))
+    {
+        munmap(s_ring.cqRing, s_ring.cqRingSize);
+    }
+    if ((s_ring.sqRing != NULL) && (s_ring.sqRing != MAP_FAILED))
+    {
+        munmap(s_ring.sqRing, s_ring.sqRingSize);
+    }
+    if (s_ring.fd >= 0)
+    {
+        close(s_ring.fd);
+    }
+    memset(&s_ring, 0, sizeof(s_ring));
+    s_ring.fd = -1;
+    s_freeCount = 0;
+}
+
+/**
+ * @brief Queue reads on the submission ring and hand them to the kernel in one system call.
+ *
+ * The entries the kernel does not consume, all of them when io_uring_enter fails, are taken
+ * back from the ring and their slots freed, so the requests accepted are exactly those in flight.
+ *
+ * @param reqs Array of pointers to the requests to queue.
+ * @param count Number of requests, already clamped to the free slots.
+ * @return int The number of requests the kernel consumed, or -1 on error.
+ */
+static int kmc_uring_submit(kmc_async_req_t *reqs[], uint32_t count)
+{
+    uint32_t first = *s_ring.sqTail;             /** Only this thread writes the tail */
+    uint32_t tail = first;                       /** Tail after the new entries */
+    uint32_t sectorSize = kmc_get_sector_size(); /** Bytes per sector */
+    uint64_t base = kmc_get_base_offset();       /** Byte offset of the volume in the image */
+    uint32_t i = 0;                              /** Used as an index of operation */
+    uint32_t consumed = 0;                       /** Entries taken by the kernel */
+    int ret = 0;                                 /** Result of io_uring_enter */
+
+    for (i = 0; (i < count) && (s_freeCount > 0); i++)
+    {
+        uint32_t slot = s_freeSlots[--s_freeCount]; /** Slot holding the iovec of the request */
+        uint32_t idx = tail & s_ring.sqMask;        /** Position in the submission ring */
+        struct io_uring_sqe *sqe = &s_ring.sqes[idx];
+
+        s_slotReq[slot] = reqs[i];
+        s_iov[slot].iov_base = reqs[i]->buff;
+        s_iov[slot].iov_len = (size_t)reqs[i]->num * sectorSize;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = kmc_get_image_fd();
+        sqe->off = base + (uint64_t)reqs[i]->index * sectorSize;
+        sqe->addr = (uint64_t)(uintptr_t)&s_iov[slot];
+        sqe->len = 1;
+        sqe->user_data = slot;
+        s_ring.sqArray[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(s_ring.sqTail, tail, __ATOMIC_RELEASE); /** Publish the entries to the kernel */
+
+    if (i > 0)
+    {
+        ret = (int)syscall(__NR_io_uring_enter, s_ring.fd, i, 0, 0, NULL, 0);
+        consumed = (ret < 0) ? 0U : (((uint32_t)ret < i) ? (uint32_t)ret : i);
+    }
+    if (consumed < i)
+    {
+        /** The kernel only takes entries inside io_uring_enter, the ones left can be taken back */
+        while (tail != first + consumed)
+        {
+            tail--;
+            s_freeSlots[s_freeCount++] = (uint32_t)s_ring.sqes[tail & s_ring.sqMask].user_data;
+        }
+        __atomic_store_n(s_ring.sqTail, tail, __ATOMIC_RELEASE);
+    }
+
+    return (ret < 0) ? (int)KMC_ERROR : (int)consumed;
+}
+
+/**
+ * @brief Collect completions from the completion ring, waiting in the kernel if needed.
+ *
+ * @param done Array receiving the pointers of the completed requests.
+ * @param maxCount Capacity of the done array.
+ * @param minCount Number of completions to wait for.
+ * @return int The number of requests returned in done, fewer than minCount when waiting failed
+ * after some were collected, or -1 when waiting failed before any.
+ */
+static int kmc_uring_reap(kmc_async_req_t *done[], uint32_t maxCount, uint32_t minCount)
+{
+    uint32_t reaped = 0;            /** Number of requests returned */
+    uint32_t head = *s_ring.cqHead; /** Only this thread writes the head */
+    bool failed = false;            /** Set when waiting in the kernel fails */
+    bool collecting = true;         /** Cleared once everything available has been collected */
+
+    while ((reaped < maxCount) && (!failed) && (collecting))
+    {
+        uint32_t tail = __atomic_load_n(s_ring.cqTail, __ATOMIC_ACQUIRE); /** Completions posted by the kernel */
+
+        if (head != tail)
+        {
+            struct io_uring_cqe *cqe = &s_ring.cqes[head & s_ring.cqMask];
+            uint32_t slot = (uint32_t)cqe->user_data;
+            kmc_async_req_t *req = s_slotReq[slot];
+
+            req->result = (cqe->res < 0) ? (int32_t)KMC_ERROR : (int32_t)cqe->res;
+            done[reaped++] = req;
+            s_freeSlots[s_freeCount++] = slot; /** The slot can be reused */
+            head++;
+            __atomic_store_n(s_ring.cqHead, head, __ATOMIC_RELEASE);
+        }
+        else if (reaped < minCount)
+        {
+            /** Not enough completions yet: sleep in the kernel until at least one more is posted */
+            if (syscall(__NR_io_uring_enter, s_ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+            {
+                failed = (errno != EINTR);
+            }
+        }
+        else
+        {
+            collecting = false; /** Everything available has been collected */
+        }
+    }
+
+    /** Completions already popped must reach the caller: their slots are free again */
+    return ((failed) && (0 == reaped)) ? (int)KMC_ERROR : (int)reaped;
+}
+#endif
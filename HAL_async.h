@@ -0,0 +1,88 @@
+#ifndef _HAL_ASYNC_H_
+#define _HAL_ASYNC_H_
+
+#include <stdint.h>
+#include "HAL.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define KMC_ASYNC_MAX_DEPTH 256U /** Upper bound of requests that can be in flight at once */
+
+/**
+ * @brief  Define the structure of one asynchronous sector-range read
+ *
+ * The request is owned by the caller and must stay valid until it is returned by kmc_async_reap.
+ */
+typedef struct
+{
+    uint32_t index; /** Index of the first sector to read */
+    uint32_t num;   /** Number of consecutive sectors to read */
+    uint8_t *buff;  /** Buffer of at least num sectors receiving the data */
+    int32_t result; /** Set at completion: number of bytes read, or KMC_ERROR */
+    void *userData; /** Free for the caller, not touched by the layer */
+} kmc_async_req_t;
+
+/** Define an enumeration of the engines behind the asynchronous interface */
+typedef enum
+{
+    KMC_ASYNC_NONE = 0,     /** Interface not initialized */
+    KMC_ASYNC_IO_URING = 1, /** Linux io_uring, reads go straight from the kernel into the buffers */
+    KMC_ASYNC_THREADS = 2   /** Pool of worker threads calling kmc_read_multi_sector */
+} kmc_async_engine_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Start the asynchronous interface on the image opened by kmc_init.
+ *
+ * io_uring is used when the kernel supports it and the image is opened with a file
+ * descriptor (KMC_MODE_PREAD), otherwise a thread pool serves the requests.
+ *
+ * @param queueDepth Maximum number of requests in flight, clamped to KMC_ASYNC_MAX_DEPTH.
+ * @return int Returns 0 on success, or -1 if no engine can be started.
+ */
+int kmc_async_init(uint32_t queueDepth);
+
+/**
+ * @brief Get the queue depth of the running interface.
+ *
+ * @return uint32_t The maximum number of requests in flight, 0 when the interface is not started.
+ */
+uint32_t kmc_async_depth(void);
+
+/**
+ * @brief Get the engine serving the asynchronous requests.
+ *
+ * @return kmc_async_engine_t The running engine, KMC_ASYNC_NONE when not started.
+ */
+kmc_async_engine_t kmc_async_engine(void);
+
+/**
+ * @brief Queue several reads in one call.
+ *
+ * @param reqs Array of pointers to the requests to queue.
+ * @param count Number of requests in the array.
+ * @return int The number of requests accepted, the first ones of reqs (less than count when the queue is full or the kernel takes fewer), or -1 on error with none accepted.
+ */
+int kmc_async_submit(kmc_async_req_t *reqs[], uint32_t count);
+
+/**
+ * @brief Collect completed reads.
+ *
+ * @param done Array receiving the pointers of the completed requests.
+ * @param maxCount Capacity of the done array.
+ * @param minCount Number of completions to wait for, 0 only collects what is already finished.
+ * @return int The number of requests returned in done, or -1 on an error before any was collected.
+ */
+int kmc_async_reap(kmc_async_req_t *done[], uint32_t maxCount, uint32_t minCount);
+
+/**
+ * @brief Stop the asynchronous interface, requests still in flight are waited for.
+ */
+void kmc_async_deinit(void);
+
+#endif /** _HAL_ASYNC_H_ */
@@ -0,0 +1,1087 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define _FILE_OFFSET_BITS 64 /** 64-bit off_t, fseeko and pread on 32-bit hosts, images larger than 2 GiB */
+#define _GNU_SOURCE          /** O_DIRECT and statx on Linux */
+
+#include "HAL_backend.h"
+#include "HAL_pool.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define KMC_HAVE_POSIX_IO 1 /** Memory-mapped access and positional reads are available on POSIX hosts */
+#define KMC_LOCK_FILE(f) flockfile(f)
+#define KMC_UNLOCK_FILE(f) funlockfile(f)
+#define KMC_FSEEK(f, o, w) fseeko((f), (off_t)(o), (w)) /** fseek takes a long, 32 bits on some hosts */
+#define KMC_FTELL(f) ((int64_t)ftello(f))
+#else
+#define KMC_LOCK_FILE(f) _lock_file(f)
+#define KMC_UNLOCK_FILE(f) _unlock_file(f)
+#define KMC_FSEEK(f, o, w) _fseeki64((f), (__int64)(o), (w)) /** long is 32 bits on Windows */
+#define KMC_FTELL(f) ((int64_t)_ftelli64(f))
+#endif
+
+#define KMC_DEFAULT_BLOCK_SIZE 4096U /** Block size reported when the storage does not tell */
+#define KMC_PREADV_MAX 64U           /** Largest number of buffers given to one preadv */
+#define KMC_PREADV_GAP 4096U         /** Largest hole between two segments read through and dropped */
+
+/** Define an enumeration of the owners of an in-memory image */
+typedef enum
+{
+    KMC_MEM_BORROWED = 0, /** Memory of the caller, left alone on close */
+    KMC_MEM_HEAP = 1,     /** Loaded with malloc, freed on close */
+    KMC_MEM_MAPPED = 2    /** Mapped with mmap, unmapped on close */
+} kmc_mem_owner_t;
+
+/**
+ * @brief  Define the state of the backends holding the image in memory (mmap and RAM disk)
+ */
+typedef struct
+{
+    uint8_t *base;         /** Address of the first byte of the image */
+    uint64_t size;         /** Size of the image in bytes */
+    kmc_mem_owner_t owner; /** How the memory is released */
+} kmc_mem_t;
+
+/**
+ * @brief  Define the state of the positional read backend
+ */
+typedef struct
+{
+    int fd; /** Descriptor of the image */
+} kmc_fd_t;
+
+/**
+ * @brief  Define the state of the direct I/O backend
+ */
+typedef struct
+{
+    kmc_fd_t buffered; /** Descriptor through the page cache, for unaligned parts */
+    kmc_fd_t direct;   /** Descriptor opened with O_DIRECT, -1 when the file system refuses it */
+    uint32_t align;    /** Alignment of offsets, lengths and buffers for direct reads */
+} kmc_direct_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static int kmc_stdio_open(void **ctx, const char *imagePath, const kmc_config_t *config);                /** Open the image as a stdio stream */
+static int32_t kmc_stdio_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length);               /** Seek and read under the stream lock */
+static int32_t kmc_stdio_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count);                       /** Read several segments under one lock */
+static void kmc_stdio_close(void *ctx);                                                                  /** Close the stream */
+static int kmc_stdio_stat(void *ctx, kmc_stat_t *st);                                                    /** Get the size of the stream */
+static void kmc_stdio_advise(void *ctx, uint64_t offset, uint64_t length);                               /** Prefetch hint on the stream */
+static int kmc_pread_open(void **ctx, const char *imagePath, const kmc_config_t *config);                /** Open the image as a file descriptor */
+static int32_t kmc_pread_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length);               /** Positional read */
+static int32_t kmc_pread_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count);                       /** Positional read of several segments */
+static void kmc_pread_close(void *ctx);                                                                  /** Close the descriptor */
+static int kmc_pread_stat(void *ctx, kmc_stat_t *st);                                                    /** Get the size of the file */
+static int kmc_pread_fd(void *ctx);                                                                      /** Get the descriptor */
+static void kmc_pread_advise(void *ctx, uint64_t offset, uint64_t length);                               /** Prefetch hint on the descriptor */
+static int kmc_direct_open(void **ctx, const char *imagePath, const kmc_config_t *config);               /** Open the image for direct I/O */
+static void kmc_direct_alignment(kmc_direct_t *state);                                                   /** Get the alignment of direct reads */
+static int32_t kmc_direct_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length);              /** Direct read of the aligned part */
+static int32_t kmc_direct_aligned(kmc_direct_t *state, uint64_t offset, uint8_t *buff, uint32_t length); /** Direct read of aligned bytes */
+static int32_t kmc_direct_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count);                      /** Direct read of several segments */
+static void kmc_direct_close(void *ctx);                                                                 /** Close both descriptors */
+static int kmc_direct_stat(void *ctx, kmc_stat_t *st);                                                   /** Size and alignment */
+static int kmc_direct_fd(void *ctx);                                                                     /** Get the buffered descriptor */
+static int kmc_mmap_open(void **ctx, const char *imagePath, const kmc_config_t *config);                 /** Map the whole image into memory */
+static void kmc_mmap_advise(void *ctx, uint64_t offset, uint64_t length);                                /** Prefetch hint on the mapping */
+static int kmc_ramdisk_open(void **ctx, const char *imagePath, const kmc_config_t *config);              /** Load the whole image into memory */
+static int32_t kmc_mem_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length);                 /** Copy bytes out of memory */
+static int32_t kmc_mem_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count);                         /** Copy several segments out of memory */
+static void kmc_mem_close(void *ctx);                                                                    /** Release the memory */
+static int kmc_mem_stat(void *ctx, kmc_stat_t *st);                                                      /** Get the size of the image */
+static const uint8_t *kmc_mem_map(void *ctx, uint64_t offset, uint32_t length);                          /** Pointer into the image */
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+const kmc_backend_t kmc_backend_stdio = {
+    "stdio", kmc_stdio_open, kmc_stdio_read, kmc_stdio_readv, kmc_stdio_close, kmc_stdio_stat,
+    NULL, NULL, kmc_stdio_advise};
+
+const kmc_backend_t kmc_backend_pread = {
+    "pread", kmc_pread_open, kmc_pread_read, kmc_pread_readv, kmc_pread_close, kmc_pread_stat,
+    NULL, kmc_pread_fd, kmc_pread_advise};
+
+const kmc_backend_t kmc_backend_direct = {
+    "direct", kmc_direct_open, kmc_direct_read, kmc_direct_readv, kmc_direct_close, kmc_direct_stat,
+    NULL, kmc_direct_fd, NULL};
+
+const kmc_backend_t kmc_backend_mmap = {
+    "mmap", kmc_mmap_open, kmc_mem_read, kmc_mem_readv, kmc_mem_close, kmc_mem_stat,
+    kmc_mem_map, NULL, kmc_mmap_advise};
+
+const kmc_backend_t kmc_backend_ramdisk = {
+    "ramdisk", kmc_ramdisk_open, kmc_mem_read, kmc_mem_readv, kmc_mem_close, kmc_mem_stat,
+    kmc_mem_map, NULL, NULL};
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Open the image as a stdio stream.
+ *
+ * @param ctx Receives the FILE pointer.
+ * @param imagePath The path to the image file.
+ * @param config Not used.
+ * @return int Returns 0 if the file is successfully opened, or -1 if there is an error.
+ */
+static int kmc_stdio_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_OK;        /** Initialize status to KMC_OK, indicate success */
+    FILE *file = fopen(imagePath, "rb"); /** Open the image file in read */
+
+    (void)config;
+    if (!file) /** Check if the file failed to open */
+    {
+        fprintf(stderr, "Error: Failed to open image file\n"); /** Print error message */
+        status = KMC_ERROR;                                    /** Set status to indicate failure */
+    }
+    *ctx = file;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Read bytes through the stdio stream.
+ *
+ * The seek and the read are done under the stream lock so that concurrent callers can not
+ * move the shared cursor between the two calls.
+ *
+ * @param ctx The FILE pointer.
+ * @param offset Byte offset in the image.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param length Number of bytes to read.
+ * @return int32_t The number of bytes read, or KMC_ERROR.
+ */
+static int32_t kmc_stdio_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    int32_t byteRead = (int32_t)KMC_OK; /** ByteRead variable to return the number of bytes read or failure */
+    FILE *file = (FILE *)ctx;           /** Stream of the image */
+
+    KMC_LOCK_FILE(file);
+    if (KMC_FSEEK(file, offset, SEEK_SET) != 0) /** Move file pointer to the desire sector */
+    {
+        byteRead = KMC_ERROR; /** Set byteRead to indicate failure */
+    }
+    else
+    {
+        byteRead = (int32_t)fread(buff, 1, length, file); /** Read the bytes into the buffer */
+    }
+    KMC_UNLOCK_FILE(file);
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Read several segments through the stdio stream, taking the stream lock once.
+ *
+ * @param ctx The FILE pointer.
+ * @param iov Array of segments.
+ * @param count Number of segments.
+ * @return int32_t The total number of bytes read, or KMC_ERROR.
+ */
+static int32_t kmc_stdio_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count)
+{
+    int32_t byteRead = (int32_t)KMC_OK; /** Total number of bytes read */
+    FILE *file = (FILE *)ctx;           /** Stream of the image */
+    uint32_t i = 0;                     /** Used as an index of operation */
+
+    KMC_LOCK_FILE(file);
+    for (i = 0; (i < count) && (byteRead >= 0); i++)
+    {
+        if (KMC_FSEEK(file, iov[i].offset, SEEK_SET) != 0)
+        {
+            byteRead = KMC_ERROR;
+        }
+        else
+        {
+            byteRead += (int32_t)fread(iov[i].buff, 1, iov[i].length, file);
+        }
+    }
+    KMC_UNLOCK_FILE(file);
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Close the stdio stream.
+ *
+ * @param ctx The FILE pointer.
+ */
+static void kmc_stdio_close(void *ctx)
+{
+    if (ctx != NULL) /** Check if the file is open */
+    {
+        fclose((FILE *)ctx); /** Close the file */
+    }
+}
+
+/**
+ * @brief Get the size of the image opened as a stdio stream.
+ *
+ * @param ctx The FILE pointer.
+ * @param st Receives the size.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+static int kmc_stdio_stat(void *ctx, kmc_stat_t *st)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the size is known */
+    FILE *file = (FILE *)ctx;        /** Stream of the image */
+    int64_t size = -1;               /** Position of the end of the stream */
+
+    KMC_LOCK_FILE(file);
+    if (KMC_FSEEK(file, 0, SEEK_END) == 0)
+    {
+        size = KMC_FTELL(file);
+    }
+    KMC_UNLOCK_FILE(file);
+    if (size >= 0)
+    {
+        st->size = (uint64_t)size;
+        st->block_size = KMC_DEFAULT_BLOCK_SIZE;
+        status = KMC_OK;
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Ask the OS to prefetch a byte range of the stdio stream.
+ *
+ * @param ctx The FILE pointer.
+ * @param offset Byte offset of the range.
+ * @param length Number of bytes.
+ */
+static void kmc_stdio_advise(void *ctx, uint64_t offset, uint64_t length)
+{
+#if defined(KMC_HAVE_POSIX_IO)
+    (void)posix_fadvise(fileno((FILE *)ctx), (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#else
+    (void)ctx;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+/**
+ * @brief Open the image for positional reads.
+ *
+ * @param ctx Receives the state of the backend.
+ * @param imagePath The path to the image file.
+ * @param config Not used.
+ * @return int Returns 0 if the file is successfully opened, or -1 if there is an error.
+ */
+static int kmc_pread_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR;                      /** Initialize status to KMC_ERROR until the file is open */
+    kmc_fd_t *state = (kmc_fd_t *)malloc(sizeof(*state)); /** State of the backend */
+
+    (void)config;
+    if (state != NULL)
+    {
+#if defined(KMC_HAVE_POSIX_IO)
+        state->fd = open(imagePath, O_RDONLY); /** Open the image for positional reads */
+        if (state->fd >= 0)
+        {
+            status = KMC_OK;
+        }
+#else
+        (void)imagePath;
+#endif
+    }
+    if (status != KMC_OK)
+    {
+        fprintf(stderr, "Error: Failed to open image file\n"); /** Print error message */
+        free(state);
+        state = NULL;
+    }
+    *ctx = state;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Read bytes with positional reads, without touching any shared file position.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset in the image.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param length Number of bytes to read.
+ * @return int32_t The number of bytes read (short at the end of the image), or KMC_ERROR.
+ */
+static int32_t kmc_pread_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    int32_t byteRead = (int32_t)KMC_OK; /** Number of bytes read so far */
+
+#if defined(KMC_HAVE_POSIX_IO)
+    int fd = ((kmc_fd_t *)ctx)->fd; /** Descriptor of the image */
+    bool done = false;              /** Set at end of file or on error */
+
+    while ((!done) && ((uint32_t)byteRead < length))
+    {
+        ssize_t ret = pread(fd, buff + byteRead, length - (uint32_t)byteRead, (off_t)offset + byteRead);
+
+        if (ret > 0)
+        {
+            byteRead += (int32_t)ret; /** pread may return less than asked, continue from there */
+        }
+        else if ((ret < 0) && (EINTR == errno))
+        {
+            /** Interrupted before any data was read, try again */
+        }
+        else
+        {
+            if (ret < 0)
+            {
+                byteRead = KMC_ERROR; /** Real I/O error */
+            }
+            done = true; /** End of the image */
+        }
+    }
+#else
+    (void)ctx;
+    (void)offset;
+    (void)buff;
+    (void)length;
+    byteRead = KMC_ERROR;
+#endif
+
+    return byteRead; /** Return the number of bytes read */
+}
+
+/**
+ * @brief Read several segments with positional reads.
+ *
+ * @param ctx The state of the backend.
+ * @param iov Array of segments.
+ * @param count Number of segments.
+ * @return int32_t The total number of bytes read, or KMC_ERROR.
+ */
+static int32_t kmc_pread_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count)
+{
+    int32_t byteRead = (int32_t)KMC_OK; /** Total number of bytes read */
+
+#if defined(KMC_HAVE_POSIX_IO)
+    int fd = ((kmc_fd_t *)ctx)->fd;   /** Descriptor of the image */
+    struct iovec vec[KMC_PREADV_MAX]; /** Buffers of one preadv, segments and holes */
+    uint8_t hole[KMC_PREADV_GAP];     /** Receives the bytes of the holes, dropped */
+    uint32_t first = 0;               /** First segment of the group */
+    uint32_t last = 0;                /** Segment following the group */
+    uint32_t nvec = 0;                /** Number of buffers of the group */
+    uint64_t start = 0;               /** Byte offset of the group */
+    uint64_t end = 0;                 /** Byte following the group */
+    uint64_t covered = 0;             /** Bytes of a segment filled by preadv */
+    ssize_t ret = 0;                  /** Result of preadv */
+    int32_t rest = 0;                 /** Result of the read completing a segment */
+    bool grow = true;                 /** Cleared when the next segment can not join the group */
+
+    while ((first < count) && (byteRead >= 0))
+    {
+        /** Group the following segments while they are contiguous or separated by a small hole */
+        last = first;
+        nvec = 0;
+        start = iov[first].offset;
+        end = start;
+        grow = true;
+        while ((grow) && (last < count) && (nvec + 2 <= KMC_PREADV_MAX))
+        {
+            if ((iov[last].offset > end) && (iov[last].offset - end <= KMC_PREADV_GAP))
+            {
+                vec[nvec].iov_base = hole;
+                vec[nvec].iov_len = (size_t)(iov[last].offset - end);
+                nvec++;
+            }
+            else if (iov[last].offset != end)
+            {
+                grow = false; /** Behind or too far ahead, start a new group */
+            }
+            if (grow)
+            {
+                vec[nvec].iov_base = iov[last].buff;
+                vec[nvec].iov_len = iov[last].length;
+                nvec++;
+                end = iov[last].offset + iov[last].length;
+                last++;
+            }
+        }
+
+        do
+        {
+            ret = preadv(fd, vec, (int)nvec, (off_t)start);
+        } while ((ret < 0) && (EINTR == errno));
+
+        if (ret < 0)
+        {
+            byteRead = KMC_ERROR; /** Real I/O error */
+        }
+        /** preadv may stop early: complete every segment it did not fill with positional reads */
+        for (; (first < last) && (byteRead >= 0); first++)
+        {
+            covered = iov[first].offset - start; /** Position of the segment in the group */
+            covered = ((ret > 0) && ((uint64_t)ret > covered)) ? ((uint64_t)ret - covered) : 0;
+            if (covered >= iov[first].length)
+            {
+                byteRead += (int32_t)iov[first].length;
+            }
+            else
+            {
+                rest = kmc_pread_read(ctx, iov[first].offset + covered, iov[first].buff + covered, iov[first].length - (uint32_t)covered);
+                byteRead = (rest < 0) ? (int32_t)KMC_ERROR : (byteRead + (int32_t)covered + rest);
+            }
+        }
+    }
+#else
+    int32_t ret = 0; /** Bytes read for one segment */
+    uint32_t i = 0;  /** Used as an index of operation */
+
+    for (i = 0; (i < count) && (byteRead >= 0); i++)
+    {
+        ret = kmc_pread_read(ctx, iov[i].offset, iov[i].buff, iov[i].length);
+        byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+    }
+#endif
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Close the descriptor of the image.
+ *
+ * @param ctx The state of the backend.
+ */
+static void kmc_pread_close(void *ctx)
+{
+    kmc_fd_t *state = (kmc_fd_t *)ctx; /** State of the backend */
+
+    if (state != NULL)
+    {
+#if defined(KMC_HAVE_POSIX_IO)
+        close(state->fd); /** Close the file descriptor */
+#endif
+        free(state);
+    }
+}
+
+/**
+ * @brief Get the size of the image opened as a file descriptor.
+ *
+ * @param ctx The state of the backend.
+ * @param st Receives the size and block size.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+static int kmc_pread_stat(void *ctx, kmc_stat_t *st)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the size is known */
+
+#if defined(KMC_HAVE_POSIX_IO)
+    struct stat fileStat; /** Attributes of the image file */
+
+    if (fstat(((kmc_fd_t *)ctx)->fd, &fileStat) == 0)
+    {
+        st->size = (uint64_t)fileStat.st_size;
+        st->block_size = (fileStat.st_blksize > 0) ? (uint32_t)fileStat.st_blksize : KMC_DEFAULT_BLOCK_SIZE;
+        status = KMC_OK;
+    }
+#else
+    (void)ctx;
+    (void)st;
+#endif
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Get the descriptor of the image.
+ *
+ * @param ctx The state of the backend.
+ * @return int The descriptor.
+ */
+static int kmc_pread_fd(void *ctx)
+{
+    return ((kmc_fd_t *)ctx)->fd;
+}
+
+/**
+ * @brief Ask the OS to prefetch a byte range of the file.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset of the range.
+ * @param length Number of bytes.
+ */
+static void kmc_pread_advise(void *ctx, uint64_t offset, uint64_t length)
+{
+#if defined(KMC_HAVE_POSIX_IO)
+    (void)posix_fadvise(((kmc_fd_t *)ctx)->fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#else
+    (void)ctx;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+/**
+ * @brief Open the image twice: with O_DIRECT for aligned reads and through the page cache for the rest.
+ *
+ * The alignment is the one reported by statx when the kernel knows it, 4096 bytes otherwise.
+ *
+ * @param ctx Receives the state of the backend.
+ * @param imagePath The path to the image file.
+ * @param config Not used.
+ * @return int Returns 0 if the file is successfully opened, or -1 if there is an error.
+ */
+static int kmc_direct_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR;                              /** Initialize status to KMC_ERROR until the file is open */
+    kmc_direct_t *state = (kmc_direct_t *)malloc(sizeof(*state)); /** State of the backend */
+
+    (void)config;
+    if (state != NULL)
+    {
+        state->direct.fd = -1;
+        state->align = KMC_DEFAULT_BLOCK_SIZE;
+#if defined(KMC_HAVE_POSIX_IO)
+        state->buffered.fd = open(imagePath, O_RDONLY); /** Open the image for the unaligned reads */
+        if (state->buffered.fd >= 0)
+        {
+            status = KMC_OK;
+#if defined(O_DIRECT)
+            state->direct.fd = open(imagePath, O_RDONLY | O_DIRECT);
+#endif
+            kmc_direct_alignment(state);
+            if (state->direct.fd < 0)
+            {
+                fprintf(stderr, "Warning: Direct I/O is not supported for this image, reads are buffered\n");
+            }
+        }
+#else
+        (void)imagePath;
+#endif
+    }
+    if (status != KMC_OK)
+    {
+        fprintf(stderr, "Error: Failed to open image file\n"); /** Print error message */
+        free(state);
+        state = NULL;
+    }
+    *ctx = state;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Ask the kernel for the alignment of direct reads on the image.
+ *
+ * @param state The state of the backend, align is left unchanged when the kernel does not tell.
+ */
+static void kmc_direct_alignment(kmc_direct_t *state)
+{
+#if defined(KMC_HAVE_POSIX_IO) && defined(STATX_DIOALIGN)
+    struct statx stx; /** Direct I/O alignment of the file */
+
+    if ((statx(state->buffered.fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0) &&
+        (stx.stx_mask & STATX_DIOALIGN) && (stx.stx_dio_offset_align != 0))
+    {
+        state->align = (stx.stx_dio_offset_align > stx.stx_dio_mem_align) ? stx.stx_dio_offset_align : stx.stx_dio_mem_align;
+    }
+#else
+    (void)state;
+#endif
+}
+
+/**
+ * @brief Read bytes, with direct I/O for the aligned middle and buffered reads for the unaligned head and tail.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset in the image.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param length Number of bytes to read.
+ * @return int32_t The number of bytes read (short at the end of the image), or KMC_ERROR.
+ */
+static int32_t kmc_direct_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    kmc_direct_t *state = (kmc_direct_t *)ctx;   /** State of the backend */
+    uint64_t mask = (uint64_t)state->align - 1U; /** Bits below the alignment */
+    uint64_t start = (offset + mask) & ~mask;    /** First aligned byte of the request */
+    uint64_t stop = (offset + length) & ~mask;   /** End of the last aligned block of the request */
+    int32_t byteRead = (int32_t)KMC_OK;          /** Number of bytes read */
+    int32_t ret = 0;                             /** Result of one part */
+
+    if ((state->direct.fd < 0) || (stop <= start))
+    {
+        byteRead = kmc_pread_read(&state->buffered, offset, buff, length); /** Nothing aligned to read directly */
+    }
+    else
+    {
+        if (start > offset)
+        {
+            byteRead = kmc_pread_read(&state->buffered, offset, buff, (uint32_t)(start - offset)); /** Unaligned head */
+        }
+        if (byteRead == (int32_t)(start - offset))
+        {
+            ret = kmc_direct_aligned(state, start, buff + (start - offset), (uint32_t)(stop - start));
+            byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+        }
+        if ((byteRead == (int32_t)(stop - offset)) && (stop < offset + length))
+        {
+            ret = kmc_pread_read(&state->buffered, stop, buff + (stop - offset), (uint32_t)(offset + length - stop)); /** Unaligned tail */
+            byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+        }
+    }
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Read aligned bytes with direct I/O.
+ *
+ * The data goes straight into the buffer of the caller when it is aligned, through buffers of
+ * the pool otherwise. A read refused by the kernel is done again through the page cache.
+ *
+ * @param state The state of the backend.
+ * @param offset Byte offset in the image, aligned.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param length Number of bytes to read, aligned.
+ * @return int32_t The number of bytes read (short at the end of the image), or KMC_ERROR.
+ */
+static int32_t kmc_direct_aligned(kmc_direct_t *state, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    int32_t byteRead = (int32_t)KMC_OK; /** Number of bytes read */
+    int32_t ret = 0;                    /** Result of one chunk */
+    uint8_t *bounce = NULL;             /** Aligned buffer of the pool */
+    uint32_t chunk = 0;                 /** Bytes of the current chunk */
+    bool done = false;                  /** Set at the end of the image or on error */
+
+    if (((uintptr_t)buff & (state->align - 1U)) == 0)
+    {
+        byteRead = kmc_pread_read(&state->direct, offset, buff, length); /** Zero copy: the device writes into the caller buffer */
+    }
+    else if ((kmc_pool_alignment() >= state->align) && ((bounce = kmc_pool_get()) != NULL))
+    {
+        while ((!done) && ((uint32_t)byteRead < length))
+        {
+            chunk = length - (uint32_t)byteRead;
+            chunk = (chunk < KMC_POOL_BUFFER_BYTES) ? chunk : KMC_POOL_BUFFER_BYTES;
+            ret = kmc_pread_read(&state->direct, offset + (uint32_t)byteRead, bounce, chunk);
+            if (ret > 0)
+            {
+                memcpy(buff + byteRead, bounce, (size_t)ret);
+                byteRead += ret;
+            }
+            if (ret != (int32_t)chunk)
+            {
+                byteRead = (ret < 0) ? (int32_t)KMC_ERROR : byteRead;
+                done = true; /** End of the image or error */
+            }
+        }
+        kmc_pool_put(bounce);
+    }
+    else
+    {
+        byteRead = KMC_ERROR; /** No aligned memory, read through the page cache below */
+    }
+
+    if (byteRead < 0)
+    {
+        byteRead = kmc_pread_read(&state->buffered, offset, buff, length);
+    }
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Read several segments with direct I/O where they are aligned.
+ *
+ * @param ctx The state of the backend.
+ * @param iov Array of segments.
+ * @param count Number of segments.
+ * @return int32_t The total number of bytes read, or KMC_ERROR.
+ */
+static int32_t kmc_direct_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count)
+{
+    int32_t byteRead = (int32_t)KMC_OK; /** Total number of bytes read */
+    int32_t ret = 0;                    /** Bytes read for one segment */
+    uint32_t i = 0;                     /** Used as an index of operation */
+
+    for (i = 0; (i < count) && (byteRead >= 0); i++)
+    {
+        ret = kmc_direct_read(ctx, iov[i].offset, iov[i].buff, iov[i].length);
+        byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+    }
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Close both descriptors of the image.
+ *
+ * @param ctx The state of the backend.
+ */
+static void kmc_direct_close(void *ctx)
+{
+    kmc_direct_t *state = (kmc_direct_t *)ctx; /** State of the backend */
+
+    if (state != NULL)
+    {
+#if defined(KMC_HAVE_POSIX_IO)
+        close(state->buffered.fd);
+        if (state->direct.fd >= 0)
+        {
+            close(state->direct.fd);
+        }
+#endif
+        free(state);
+    }
+}
+
+/**
+ * @brief Get the size of the image and the alignment of direct reads.
+ *
+ * @param ctx The state of the backend.
+ * @param st Receives the size, and the alignment as block size.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+static int kmc_direct_stat(void *ctx, kmc_stat_t *st)
+{
+    kmc_direct_t *state = (kmc_direct_t *)ctx;         /** State of the backend */
+    int status = kmc_pread_stat(&state->buffered, st); /** Size of the file */
+
+    st->block_size = state->align; /** Buffers of the pool are aligned on it */
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Get the buffered descriptor, for asynchronous reads of any alignment.
+ *
+ * @param ctx The state of the backend.
+ * @return int The descriptor.
+ */
+static int kmc_direct_fd(void *ctx)
+{
+    return ((kmc_direct_t *)ctx)->buffered.fd;
+}
+
+/**
+ * @brief Map the whole image file into memory.
+ *
+ * @param ctx Receives the state of the backend.
+ * @param imagePath The path to the image file to be mapped.
+ * @param config Combination of KMC_FLAG_* values in the flags field, may be NULL.
+ * @return int Returns 0 if the file is successfully mapped, or -1 if there is an error.
+ */
+static int kmc_mmap_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the mapping succeeds */
+    kmc_mem_t *state = NULL;         /** State of the backend */
+
+#if defined(KMC_HAVE_POSIX_IO)
+    uint32_t flags = (config != NULL) ? config->flags : 0; /** Hints given by the caller */
+    int fd = open(imagePath, O_RDONLY);                    /** File descriptor of the image, only needed while mapping */
+    struct stat st;                                        /** Used to get the size of the image */
+    int mapFlags = MAP_PRIVATE;                            /** Flags passed to mmap */
+    void *map = MAP_FAILED;                                /** Address returned by mmap */
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Failed to open image file\n");
+    }
+    else if ((fstat(fd, &st) != 0) || (st.st_size <= 0))
+    {
+        fprintf(stderr, "Error: Failed to get size of image file\n");
+    }
+    else if ((uint64_t)st.st_size > (uint64_t)SIZE_MAX)
+    {
+        fprintf(stderr, "Error: Image file too large to be mapped, use KMC_MODE_PREAD\n"); /** 32-bit address space */
+    }
+    else
+    {
+#if defined(MAP_POPULATE)
+        if (flags & KMC_FLAG_POPULATE)
+        {
+            mapFlags |= MAP_POPULATE; /** Pre-fault every page so the first access does not stall */
+        }
+#endif
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, mapFlags, fd, 0);
+        state = (MAP_FAILED == map) ? NULL : (kmc_mem_t *)malloc(sizeof(*state));
+        if (NULL == state)
+        {
+            fprintf(stderr, "Error: Failed to map image file\n");
+            if (map != MAP_FAILED)
+            {
+                munmap(map, (size_t)st.st_size);
+            }
+        }
+        else
+        {
+            state->base = (uint8_t *)map;
+            state->size = (uint64_t)st.st_size;
+            state->owner = KMC_MEM_MAPPED;
+
+            /** The hints below are advisory only, a failure is not an error */
+            (void)madvise(map, (size_t)st.st_size, (flags & KMC_FLAG_RANDOM) ? MADV_RANDOM : MADV_SEQUENTIAL);
+            (void)madvise(map, (size_t)st.st_size, MADV_WILLNEED);
+#if defined(MADV_HUGEPAGE)
+            if (flags & KMC_FLAG_HUGEPAGE)
+            {
+                (void)madvise(map, (size_t)st.st_size, MADV_HUGEPAGE);
+            }
+#endif
+            status = KMC_OK;
+        }
+    }
+
+    if (fd >= 0)
+    {
+        close(fd); /** The mapping keeps its own reference to the file */
+    }
+#else
+    (void)imagePath;
+    (void)config;
+    fprintf(stderr, "Error: Memory-mapped mode is not supported on this platform\n");
+#endif
+    *ctx = state;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Ask the OS to fault in a byte range of the mapping.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset of the range.
+ * @param length Number of bytes.
+ */
+static void kmc_mmap_advise(void *ctx, uint64_t offset, uint64_t length)
+{
+#if defined(KMC_HAVE_POSIX_IO)
+    kmc_mem_t *state = (kmc_mem_t *)ctx;         /** State of the backend */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE); /** madvise needs a page aligned start */
+    size_t start = 0;                            /** Aligned start of the range in the mapping */
+
+    if (offset < state->size)
+    {
+        start = (size_t)offset & ~(page - 1);
+        if (length > state->size - offset)
+        {
+            length = state->size - offset;
+        }
+        (void)madvise(state->base + start, (size_t)(offset + length) - start, MADV_WILLNEED);
+    }
+#else
+    (void)ctx;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+/**
+ * @brief Load the whole image file into memory.
+ *
+ * @param ctx Receives the state of the backend.
+ * @param imagePath The path to the image file.
+ * @param config Not used.
+ * @return int Returns 0 if the image is loaded, or -1 if there is an error.
+ */
+static int kmc_ramdisk_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR;     /** Initialize status to KMC_ERROR until the image is loaded */
+    kmc_mem_t *state = NULL;             /** State of the backend */
+    FILE *file = fopen(imagePath, "rb"); /** Image file, only needed while loading */
+    kmc_stat_t st;                       /** Size of the image */
+    uint8_t *image = NULL;               /** Memory receiving the image */
+
+    (void)config;
+    if (!file)
+    {
+        fprintf(stderr, "Error: Failed to open image file\n");
+    }
+    else if ((kmc_stdio_stat(file, &st) != 0) || (0 == st.size))
+    {
+        fprintf(stderr, "Error: Failed to get size of image file\n");
+    }
+    else if (st.size > (uint64_t)SIZE_MAX)
+    {
+        fprintf(stderr, "Error: Image file too large to be loaded in memory\n"); /** 32-bit address space */
+    }
+    else
+    {
+        image = (uint8_t *)malloc((size_t)st.size);
+        state = (kmc_mem_t *)malloc(sizeof(*state));
+        if ((NULL == image) || (NULL == state) || (KMC_FSEEK(file, 0, SEEK_SET) != 0) ||
+            (fread(image, 1, (size_t)st.size, file) != (size_t)st.size))
+        {
+            fprintf(stderr, "Error: Failed to load image file\n");
+            free(image);
+            free(state);
+            state = NULL;
+        }
+        else
+        {
+            state->base = image;
+            state->size = st.size;
+            state->owner = KMC_MEM_HEAP;
+            status = KMC_OK;
+        }
+    }
+
+    if (file != NULL)
+    {
+        fclose(file); /** Every byte is in memory now */
+    }
+    *ctx = state;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Create the state of kmc_backend_ramdisk over an image already in memory.
+ *
+ * @param ctx Receives the private state of the backend.
+ * @param image Pointer to the first byte of the image.
+ * @param size Size of the image in bytes.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+int kmc_ramdisk_attach(void **ctx, const uint8_t *image, uint64_t size)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the state is created */
+    kmc_mem_t *state = NULL;         /** State of the backend */
+
+    if ((image != NULL) && (size > 0))
+    {
+        state = (kmc_mem_t *)malloc(sizeof(*state));
+    }
+    if (state != NULL)
+    {
+        state->base = (uint8_t *)image; /** Only read through this pointer */
+        state->size = size;
+        state->owner = KMC_MEM_BORROWED;
+        status = KMC_OK;
+    }
+    *ctx = state;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Copy bytes out of an image held in memory.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset in the image.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param length Number of bytes to copy.
+ * @return int32_t The number of bytes copied, short at the end of the image.
+ */
+static int32_t kmc_mem_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    kmc_mem_t *state = (kmc_mem_t *)ctx; /** State of the backend */
+
+    if (offset >= state->size)
+    {
+        length = 0; /** Nothing left past the end of the image, same as fread */
+    }
+    else if (length > state->size - offset)
+    {
+        length = (uint32_t)(state->size - offset); /** Short read at the end of the image */
+    }
+    memcpy(buff, state->base + offset, length);
+
+    return (int32_t)length; /** Return the number of bytes copied */
+}
+
+/**
+ * @brief Copy several segments out of an image held in memory.
+ *
+ * @param ctx The state of the backend.
+ * @param iov Array of segments.
+ * @param count Number of segments.
+ * @return int32_t The total number of bytes copied.
+ */
+static int32_t kmc_mem_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count)
+{
+    int32_t byteRead = 0; /** Total number of bytes copied */
+    uint32_t i = 0;       /** Used as an index of operation */
+
+    for (i = 0; i < count; i++)
+    {
+        byteRead += kmc_mem_read(ctx, iov[i].offset, iov[i].buff, iov[i].length);
+    }
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Release an image held in memory.
+ *
+ * @param ctx The state of the backend.
+ */
+static void kmc_mem_close(void *ctx)
+{
+    kmc_mem_t *state = (kmc_mem_t *)ctx; /** State of the backend */
+
+    if (state != NULL)
+    {
+        if (KMC_MEM_HEAP == state->owner)
+        {
+            free(state->base);
+        }
+#if defined(KMC_HAVE_POSIX_IO)
+        else if (KMC_MEM_MAPPED == state->owner)
+        {
+            munmap(state->base, (size_t)state->size); /** Release the mapping */
+        }
+#endif
+        free(state);
+    }
+}
+
+/**
+ * @brief Get the size of an image held in memory.
+ *
+ * @param ctx The state of the backend.
+ * @param st Receives the size.
+ * @return int Always 0.
+ */
+static int kmc_mem_stat(void *ctx, kmc_stat_t *st)
+{
+    st->size = ((kmc_mem_t *)ctx)->size;
+    st->block_size = KMC_DEFAULT_BLOCK_SIZE;
+
+    return KMC_OK;
+}
+
+/**
+ * @brief Get a pointer to a byte range of an image held in memory.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset of the range.
+ * @param length Number of bytes.
+ * @return const uint8_t* Pointer to the range, or NULL if it is not entirely inside the image.
+ */
+static const uint8_t *kmc_mem_map(void *ctx, uint64_t offset, uint32_t length)
+{
+    kmc_mem_t *state = (kmc_mem_t *)ctx; /** State of the backend */
+    const uint8_t *ptr = NULL;           /** Pointer to return */
+
+    if ((offset <= state->size) && (length <= state->size - offset))
+    {
+        ptr = state->base + offset; /** The whole range lies inside the image */
+    }
+
+    return ptr; /** Return the pointer */
+}
@@ -0,0 +1,23 @@
+#ifndef _HAL_BACKEND_H_
+#define _HAL_BACKEND_H_
+
+#include <stdint.h>
+#include "HAL.h"
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Create the state of kmc_backend_ramdisk over an image already in memory.
+ *
+ * The memory is borrowed: closing the backend does not free it.
+ *
+ * @param ctx Receives the private state of the backend.
+ * @param image Pointer to the first byte of the image.
+ * @param size Size of the image in bytes.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+int kmc_ramdisk_attach(void **ctx, const uint8_t *image, uint64_t size);
+
+#endif /** _HAL_BACKEND_H_ */
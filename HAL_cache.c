@@ -0,0 +1,590 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "HAL_cache.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define KMC_CACHE_NONE (-1) /** Null index of the entry and slot arrays */
+
+/** Define an enumeration of the queues an entry can belong to */
+typedef enum
+{
+    KMC_Q_A1IN = 0,   /** Sectors read once, FIFO */
+    KMC_Q_AM = 1,     /** Sectors read more than once, LRU */
+    KMC_Q_A1OUT = 2,  /** Ghosts: sectors recently evicted from A1in, no data */
+    KMC_Q_PINNED = 3, /** Pinned sectors, never evicted */
+    KMC_Q_COUNT = 4,  /** Number of queues */
+    KMC_Q_FREE = 5    /** Entry not in use */
+} kmc_queue_id_t;
+
+/**
+ * @brief  Define the structure of one cache entry
+ */
+typedef struct
+{
+    uint32_t sector;  /** Sector number held by the entry */
+    int32_t prev;     /** Previous entry in the queue (towards the head) */
+    int32_t next;     /** Next entry in the queue (towards the tail), or in the free list */
+    int32_t hashNext; /** Next entry in the same hash bucket */
+    int32_t slot;     /** Data slot of the sector, KMC_CACHE_NONE for a ghost */
+    uint8_t queue;    /** Queue the entry belongs to (kmc_queue_id_t) */
+} kmc_cache_entry_t;
+
+/**
+ * @brief  Define the structure of a queue, the head is the most recently inserted entry
+ */
+typedef struct
+{
+    int32_t head;   /** Most recent entry */
+    int32_t tail;   /** Oldest entry, next eviction candidate */
+    uint32_t count; /** Number of entries */
+} kmc_queue_t;
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static pthread_mutex_t s_cacheLock = PTHREAD_MUTEX_INITIALIZER; /** Protects the whole cache */
+static kmc_cache_entry_t *s_entries = NULL;                     /** Entry pool, resident sectors and ghosts */
+static int32_t *s_buckets = NULL;                               /** Hash buckets, first entry of each chain */
+static uint32_t s_bucketMask = 0;                               /** Number of buckets minus one */
+static uint8_t *s_data = NULL;                                  /** Sector data, one slot per resident sector */
+static int32_t *s_freeSlots = NULL;                             /** Stack of unused data slots */
+static uint32_t s_freeSlotCount = 0;                            /** Number of unused data slots */
+static int32_t s_freeEntry = KMC_CACHE_NONE;                    /** Free list of entries */
+static kmc_queue_t s_queues[KMC_Q_COUNT];                       /** The 2Q queues and the pinned list */
+static uint32_t s_capacity = 0;                                 /** Number of data slots */
+static uint32_t s_kin = 0;                                      /** Target size of A1in */
+static uint32_t s_kout = 0;                                     /** Maximum number of ghosts */
+static uint16_t s_cacheSectorSize = 0;                          /** Size of one data slot */
+static kmc_cache_stats_t s_stats;                               /** Exported counters */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static int32_t kmc_cache_find(uint32_t sector);                     /** Find the entry of a sector */
+static void kmc_cache_unhash(int32_t e);                            /** Remove an entry from its hash bucket */
+static void kmc_queue_push(kmc_queue_id_t q, int32_t e);            /** Insert an entry at the head of a queue */
+static void kmc_queue_unlink(int32_t e);                            /** Remove an entry from its queue */
+static void kmc_cache_release_entry(int32_t e);                     /** Return an entry to the free list */
+static int32_t kmc_cache_take_slot(void);                           /** Get a free data slot, evicting if needed */
+static void kmc_cache_insert(uint32_t sector, const uint8_t *data); /** Cache one sector */
+static bool kmc_cache_lookup(uint32_t sector, uint8_t *buff);       /** Copy a cached sector out */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Create the sector cache.
+ *
+ * @param budgetBytes Memory given to the cached sector data, 0 disables the cache.
+ * @param sectorSize Size in bytes of one sector.
+ * @return int Returns 0 on success, or -1 if the memory can not be allocated.
+ */
+int kmc_cache_init(uint32_t budgetBytes, uint16_t sectorSize)
+{
+    kmc_status_t status = KMC_OK; /** Initialize status to KMC_OK, indicate success */
+    uint32_t capacity = 0;        /** Number of data slots */
+    uint32_t entryCount = 0;      /** Size of the entry pool */
+    uint32_t bucketCount = 1;     /** Number of hash buckets, power of two */
+    uint32_t i = 0;               /** Used as an index of operation */
+
+    kmc_cache_deinit(); /** Start from an empty cache */
+
+    capacity = (sectorSize != 0) ? (budgetBytes / sectorSize) : 0;
+    if (capacity > 0)
+    {
+        s_kin = (capacity + 3) / 4;  /** A1in holds a quarter of the slots, as recommended for 2Q */
+        s_kout = (capacity + 1) / 2; /** Ghosts remember half as many sectors as the cache holds */
+        entryCount = capacity + s_kout + 1;
+        while (bucketCount < entryCount * 2)
+        {
+            bucketCount <<= 1;
+        }
+
+        s_entries = (kmc_cache_entry_t *)malloc(entryCount * sizeof(kmc_cache_entry_t));
+        s_buckets = (int32_t *)malloc(bucketCount * sizeof(int32_t));
+        s_freeSlots = (int32_t *)malloc(capacity * sizeof(int32_t));
+        s_data = (uint8_t *)malloc((size_t)capacity * sectorSize);
+        if ((NULL == s_entries) || (NULL == s_buckets) || (NULL == s_freeSlots) || (NULL == s_data))
+        {
+            fprintf(stderr, "Error: Failed to allocate memory for sector cache\n");
+            kmc_cache_deinit();
+            status = KMC_ERROR;
+        }
+        else
+        {
+            for (i = 0; i < bucketCount; i++)
+            {
+                s_buckets[i] = KMC_CACHE_NONE;
+            }
+            for (i = 0; i < entryCount; i++)
+            {
+                s_entries[i].queue = KMC_Q_FREE;
+                s_entries[i].next = ((i + 1) < entryCount) ? (int32_t)(i + 1) : KMC_CACHE_NONE; /** Chain the free list */
+            }
+            for (i = 0; i < capacity; i++)
+            {
+                s_freeSlots[i] = (int32_t)(capacity - 1 - i);
+            }
+            for (i = 0; i < KMC_Q_COUNT; i++)
+            {
+                s_queues[i].head = KMC_CACHE_NONE;
+                s_queues[i].tail = KMC_CACHE_NONE;
+                s_queues[i].count = 0;
+            }
+            s_freeEntry = 0;
+            s_freeSlotCount = capacity;
+            s_bucketMask = bucketCount - 1;
+            s_capacity = capacity;
+            s_cacheSectorSize = sectorSize;
+            memset(&s_stats, 0, sizeof(s_stats));
+        }
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Check if the cache is running.
+ *
+ * @return int Returns 1 when the cache holds sectors, 0 otherwise.
+ */
+int kmc_cache_enabled(void)
+{
+    return (s_capacity > 0) ? 1 : 0;
+}
+
+/**
+ * @brief Find the entry of a sector, resident or ghost.
+ *
+ * @param sector Sector number.
+ * @return int32_t Index of the entry, or KMC_CACHE_NONE.
+ */
+static int32_t kmc_cache_find(uint32_t sector)
+{
+    int32_t e = s_buckets[(sector * 2654435761U) & s_bucketMask]; /** Multiplicative hash of the sector */
+
+    while ((e != KMC_CACHE_NONE) && (s_entries[e].sector != sector))
+    {
+        e = s_entries[e].hashNext;
+    }
+
+    return e;
+}
+
+/**
+ * @brief Remove an entry from its hash bucket.
+ *
+ * @param e Index of the entry.
+ */
+static void kmc_cache_unhash(int32_t e)
+{
+    int32_t *link = &s_buckets[(s_entries[e].sector * 2654435761U) & s_bucketMask]; /** Link pointing to the entry */
+
+    while (*link != e)
+    {
+        link = &s_entries[*link].hashNext;
+    }
+    *link = s_entries[e].hashNext;
+}
+
+/**
+ * @brief Insert an entry at the head of a queue.
+ *
+ * @param q Queue to insert into.
+ * @param e Index of the entry.
+ */
+static void kmc_queue_push(kmc_queue_id_t q, int32_t e)
+{
+    kmc_queue_t *queue = &s_queues[q];
+
+    s_entries[e].queue = (uint8_t)q;
+    s_entries[e].prev = KMC_CACHE_NONE;
+    s_entries[e].next = queue->head;
+    if (queue->head != KMC_CACHE_NONE)
+    {
+        s_entries[queue->head].prev = e;
+    }
+    else
+    {
+        queue->tail = e; /** First entry of the queue */
+    }
+    queue->head = e;
+    queue->count++;
+}
+
+/**
+ * @brief Remove an entry from the queue it belongs to.
+ *
+ * @param e Index of the entry.
+ */
+static void kmc_queue_unlink(int32_t e)
+{
+    kmc_queue_t *queue = &s_queues[s_entries[e].queue];
+
+    if (s_entries[e].prev != KMC_CACHE_NONE)
+    {
+        s_entries[s_entries[e].prev].next = s_entries[e].next;
+    }
+    else
+    {
+        queue->head = s_entries[e].next;
+    }
+    if (s_entries[e].next != KMC_CACHE_NONE)
+    {
+        s_entries[s_entries[e].next].prev = s_entries[e].prev;
+    }
+    else
+    {
+        queue->tail = s_entries[e].prev;
+    }
+    queue->count--;
+}
+
+/**
+ * @brief Return an entry, already out of its queue, to the free list.
+ *
+ * @param e Index of the entry.
+ */
+static void kmc_cache_release_entry(int32_t e)
+{
+    kmc_cache_unhash(e);
+    if (s_entries[e].slot != KMC_CACHE_NONE)
+    {
+        s_freeSlots[s_freeSlotCount++] = s_entries[e].slot; /** Give the data slot back */
+    }
+    s_entries[e].queue = KMC_Q_FREE;
+    s_entries[e].next = s_freeEntry;
+    s_freeEntry = e;
+}
+
+/**
+ * @brief Get a free data slot, evicting a sector when the cache is full.
+ *
+ * A1in is trimmed first while it is above its target size: its sectors become ghosts, so that a
+ * second access soon after brings them straight into Am. Otherwise the least recently used Am
+ * sector is dropped.
+ *
+ * @return int32_t Index of the slot, or KMC_CACHE_NONE if every resident sector is pinned.
+ */
+static int32_t kmc_cache_take_slot(void)
+{
+    int32_t slot = KMC_CACHE_NONE;   /** Slot to return */
+    int32_t victim = KMC_CACHE_NONE; /** Entry evicted */
+
+    if (s_freeSlotCount > 0)
+    {
+        slot = s_freeSlots[--s_freeSlotCount];
+    }
+    else if ((s_queues[KMC_Q_A1IN].count > 0) && ((s_queues[KMC_Q_A1IN].count > s_kin) || (0 == s_queues[KMC_Q_AM].count)))
+    {
+        victim = s_queues[KMC_Q_A1IN].tail;
+        kmc_queue_unlink(victim);
+        slot = s_entries[victim].slot;
+        s_entries[victim].slot = KMC_CACHE_NONE;
+        kmc_queue_push(KMC_Q_A1OUT, victim); /** Remember the sector as a ghost */
+        if (s_queues[KMC_Q_A1OUT].count > s_kout)
+        {
+            victim = s_queues[KMC_Q_A1OUT].tail; /** Forget the oldest ghost */
+            kmc_queue_unlink(victim);
+            kmc_cache_release_entry(victim);
+        }
+        s_stats.evictions++;
+    }
+    else if (s_queues[KMC_Q_AM].count > 0)
+    {
+        victim = s_queues[KMC_Q_AM].tail;
+        kmc_queue_unlink(victim);
+        slot = s_entries[victim].slot;
+        s_entries[victim].slot = KMC_CACHE_NONE; /** Keep the slot for the caller */
+        kmc_cache_release_entry(victim);
+        s_stats.evictions++;
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Cache one sector, the lock must be held.
+ *
+ * @param sector Sector number.
+ * @param data Sector data.
+ */
+static void kmc_cache_insert(uint32_t sector, const uint8_t *data)
+{
+    int32_t e = kmc_cache_find(sector); /** Existing entry of the sector */
+    kmc_queue_id_t target = KMC_Q_A1IN; /** Queue receiving the sector */
+    int32_t slot = KMC_CACHE_NONE;      /** Data slot of the sector */
+
+    if ((e != KMC_CACHE_NONE) && (s_entries[e].slot != KMC_CACHE_NONE))
+    {
+        /** Already resident, filled by a concurrent reader */
+    }
+    else
+    {
+        if (e != KMC_CACHE_NONE)
+        {
+            kmc_queue_unlink(e); /** Ghost hit: out of A1out before any eviction can drop it */
+            target = KMC_Q_AM;
+            s_stats.ghost_hits++;
+        }
+        slot = kmc_cache_take_slot();
+        if (KMC_CACHE_NONE == slot)
+        {
+            if (e != KMC_CACHE_NONE)
+            {
+                kmc_cache_release_entry(e);
+            }
+            s_stats.bypassed++; /** Every resident sector is pinned */
+        }
+        else
+        {
+            if (KMC_CACHE_NONE == e)
+            {
+                uint32_t bucket = (sector * 2654435761U) & s_bucketMask;
+
+                e = s_freeEntry; /** The pool is sized so that an entry is always free here */
+                s_freeEntry = s_entries[e].next;
+                s_entries[e].sector = sector;
+                s_entries[e].hashNext = s_buckets[bucket];
+                s_buckets[bucket] = e;
+            }
+            s_entries[e].slot = slot;
+            memcpy(s_data + (size_t)slot * s_cacheSectorSize, data, s_cacheSectorSize);
+            kmc_queue_push(target, e);
+        }
+    }
+}
+
+/**
+ * @brief Copy a cached sector out, the lock must be held.
+ *
+ * @param sector Sector number.
+ * @param buff Buffer receiving the data, NULL only checks the presence.
+ * @return bool true if the sector is resident.
+ */
+static bool kmc_cache_lookup(uint32_t sector, uint8_t *buff)
+{
+    int32_t e = kmc_cache_find(sector); /** Entry of the sector */
+    bool hit = (e != KMC_CACHE_NONE) && (s_entries[e].slot != KMC_CACHE_NONE);
+
+    if ((hit) && (buff != NULL))
+    {
+        memcpy(buff, s_data + (size_t)s_entries[e].slot * s_cacheSectorSize, s_cacheSectorSize);
+        if (KMC_Q_AM == s_entries[e].queue)
+        {
+            kmc_queue_unlink(e); /** Refresh the LRU position, A1in stays FIFO */
+            kmc_queue_push(KMC_Q_AM, e);
+        }
+    }
+
+    return hit;
+}
+
+/**
+ * @brief Read sectors through the cache.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors to read.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param fill Function reading the sectors that are not cached, one call per run of misses.
+ * @return int32_t The number of bytes read, or a negative value to indicate an error.
+ */
+int32_t kmc_cache_read(uint32_t index, uint32_t num, uint8_t *buff, kmc_cache_fill_t fill)
+{
+    int32_t byteRead = 0; /** Number of bytes delivered */
+    uint32_t i = 0;       /** Sector being served, relative to index */
+    uint32_t run = 0;     /** Length of a run of misses */
+    uint32_t k = 0;       /** Used as an index of operation */
+    int32_t ret = 0;      /** Result of the fill function */
+    bool reading = true;  /** Cleared at the end of the image or on error */
+
+    while ((i < num) && (reading))
+    {
+        uint8_t *dest = buff + (size_t)i * s_cacheSectorSize;
+
+        pthread_mutex_lock(&s_cacheLock);
+        if (kmc_cache_lookup(index + i, dest))
+        {
+            s_stats.hits++;
+            byteRead += s_cacheSectorSize;
+            i++;
+            pthread_mutex_unlock(&s_cacheLock);
+        }
+        else
+        {
+            run = 1;
+            while (((i + run) < num) && (!kmc_cache_lookup(index + i + run, NULL)))
+            {
+                run++; /** Read the whole run of misses in one call */
+            }
+            pthread_mutex_unlock(&s_cacheLock);
+
+            ret = fill(index + i, run, dest); /** Blocking read, outside the lock */
+            if (ret < 0)
+            {
+                byteRead = (0 == byteRead) ? ret : byteRead;
+                reading = false;
+            }
+            else
+            {
+                pthread_mutex_lock(&s_cacheLock);
+                s_stats.misses += run;
+                for (k = 0; k < (uint32_t)ret / s_cacheSectorSize; k++)
+                {
+                    kmc_cache_insert(index + i + k, dest + (size_t)k * s_cacheSectorSize);
+                }
+                pthread_mutex_unlock(&s_cacheLock);
+
+                byteRead += ret;
+                reading = ((uint32_t)ret == run * s_cacheSectorSize); /** Stop after a short read */
+                i += run;
+            }
+        }
+    }
+
+    return byteRead; /** Return the number of bytes read */
+}
+
+/**
+ * @brief Load sectors into the cache and keep them until they are unpinned.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors to pin.
+ * @return int Returns 0 on success, or -1 if a sector can not be read or cached.
+ */
+int kmc_cache_pin(uint32_t index, uint32_t num)
+{
+    kmc_status_t status = (s_capacity > 0) ? KMC_OK : KMC_ERROR; /** Nothing can be pinned without a cache */
+    uint8_t *sector = NULL;                                        /** Buffer of the sector being loaded */
+    uint32_t i = 0;                                                /** Used as an index of operation */
+    int32_t e = KMC_CACHE_NONE;                                    /** Entry of the sector */
+
+    if (KMC_OK == status)
+    {
+        sector = (uint8_t *)malloc(s_cacheSectorSize);
+        status = (NULL == sector) ? KMC_ERROR : KMC_OK;
+    }
+    for (i = 0; (i < num) && (KMC_OK == status); i++)
+    {
+        /** Going through the public read puts the sector in the cache when it is not there yet */
+        if (kmc_read_sector(index + i, sector) != (int32_t)s_cacheSectorSize)
+        {
+            status = KMC_ERROR;
+        }
+        else
+        {
+            pthread_mutex_lock(&s_cacheLock);
+            e = kmc_cache_find(index + i);
+            if ((KMC_CACHE_NONE == e) || (KMC_CACHE_NONE == s_entries[e].slot))
+            {
+                status = KMC_ERROR; /** No slot left for it */
+            }
+            else if (s_entries[e].queue != KMC_Q_PINNED)
+            {
+                kmc_queue_unlink(e);
+                kmc_queue_push(KMC_Q_PINNED, e);
+            }
+            pthread_mutex_unlock(&s_cacheLock);
+        }
+    }
+    free(sector);
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Allow pinned sectors to be evicted again.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors to unpin.
+ */
+void kmc_cache_unpin(uint32_t index, uint32_t num)
+{
+    uint32_t i = 0;             /** Used as an index of operation */
+    int32_t e = KMC_CACHE_NONE; /** Entry of the sector */
+
+    pthread_mutex_lock(&s_cacheLock);
+    for (i = 0; (i < num) && (s_capacity > 0); i++)
+    {
+        e = kmc_cache_find(index + i);
+        if ((e != KMC_CACHE_NONE) && (KMC_Q_PINNED == s_entries[e].queue))
+        {
+            kmc_queue_unlink(e);
+            kmc_queue_push(KMC_Q_AM, e); /** Still hot, back as the most recently used sector */
+        }
+    }
+    pthread_mutex_unlock(&s_cacheLock);
+}
+
+/**
+ * @brief Drop every sector held by the cache, pinned ones included.
+ */
+void kmc_cache_invalidate(void)
+{
+    uint32_t q = 0; /** Used as an index of operation */
+
+    pthread_mutex_lock(&s_cacheLock);
+    for (q = 0; (q < KMC_Q_COUNT) && (s_capacity > 0); q++)
+    {
+        while (s_queues[q].tail != KMC_CACHE_NONE)
+        {
+            int32_t e = s_queues[q].tail;
+
+            kmc_queue_unlink(e);
+            kmc_cache_release_entry(e);
+        }
+    }
+    pthread_mutex_unlock(&s_cacheLock);
+}
+
+/**
+ * @brief Get the counters of the cache.
+ *
+ * @param stats Pointer to the structure receiving the counters.
+ */
+void kmc_cache_get_stats(kmc_cache_stats_t *stats)
+{
+    pthread_mutex_lock(&s_cacheLock);
+    *stats = s_stats;
+    stats->resident = s_capacity - s_freeSlotCount;
+    stats->pinned = s_queues[KMC_Q_PINNED].count;
+    stats->capacity = s_capacity;
+    pthread_mutex_unlock(&s_cacheLock);
+}
+
+/**
+ * @brief Reset the hit, miss and eviction counters.
+ */
+void kmc_cache_reset_stats(void)
+{
+    pthread_mutex_lock(&s_cacheLock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    pthread_mutex_unlock(&s_cacheLock);
+}
+
+/**
+ * @brief Release the cache.
+ */
+void kmc_cache_deinit(void)
+{
+    pthread_mutex_lock(&s_cacheLock);
+    free(s_entries);
+    free(s_buckets);
+    free(s_freeSlots);
+    free(s_data);
+    s_entries = NULL;
+    s_buckets = NULL;
+    s_freeSlots = NULL;
+    s_data = NULL;
+    s_freeSlotCount = 0;
+    s_freeEntry = KMC_CACHE_NONE;
+    s_capacity = 0;
+    pthread_mutex_unlock(&s_cacheLock);
+}
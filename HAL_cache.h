@@ -0,0 +1,102 @@
+#ifndef _HAL_CACHE_H_
+#define _HAL_CACHE_H_
+
+#include <stdint.h>
+#include "HAL.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+/**
+ * @brief  Define the structure of the counters exported by the sector cache
+ */
+typedef struct
+{
+    uint64_t hits;       /** Sectors served from the cache */
+    uint64_t misses;     /** Sectors read from the image */
+    uint64_t evictions;  /** Sectors dropped to make room for new ones */
+    uint64_t ghost_hits; /** Misses on recently evicted sectors, promoted straight to the hot queue */
+    uint64_t bypassed;   /** Sectors that could not be cached because every slot is pinned */
+    uint32_t resident;   /** Sectors currently held */
+    uint32_t pinned;     /** Sectors currently pinned */
+    uint32_t capacity;   /** Maximum number of sectors held */
+} kmc_cache_stats_t;
+
+/** Define the type of the function used by the cache to read sectors it does not hold */
+typedef int32_t (*kmc_cache_fill_t)(uint32_t index, uint32_t num, uint8_t *buff);
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Create the sector cache.
+ *
+ * Eviction follows the 2Q policy: sectors read once go through a small FIFO and only sectors
+ * read again are kept in the LRU queue, so one large file scan can not flush the hot metadata.
+ *
+ * @param budgetBytes Memory given to the cached sector data, 0 disables the cache.
+ * @param sectorSize Size in bytes of one sector.
+ * @return int Returns 0 on success, or -1 if the memory can not be allocated.
+ */
+int kmc_cache_init(uint32_t budgetBytes, uint16_t sectorSize);
+
+/**
+ * @brief Check if the cache is running.
+ *
+ * @return int Returns 1 when the cache holds sectors, 0 otherwise.
+ */
+int kmc_cache_enabled(void);
+
+/**
+ * @brief Read sectors through the cache.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors to read.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param fill Function reading the sectors that are not cached, one call per run of misses.
+ * @return int32_t The number of bytes read, or a negative value to indicate an error.
+ */
+int32_t kmc_cache_read(uint32_t index, uint32_t num, uint8_t *buff, kmc_cache_fill_t fill);
+
+/**
+ * @brief Load sectors into the cache and keep them until they are unpinned.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors to pin.
+ * @return int Returns 0 on success, or -1 if a sector can not be read or cached.
+ */
+int kmc_cache_pin(uint32_t index, uint32_t num);
+
+/**
+ * @brief Allow pinned sectors to be evicted again.
+ *
+ * @param index The index of the first sector.
+ * @param num The number of consecutive sectors to unpin.
+ */
+void kmc_cache_unpin(uint32_t index, uint32_t num);
+
+/**
+ * @brief Drop every sector held by the cache, pinned ones included.
+ */
+void kmc_cache_invalidate(void);
+
+/**
+ * @brief Get the counters of the cache.
+ *
+ * @param stats Pointer to the structure receiving the counters.
+ */
+void kmc_cache_get_stats(kmc_cache_stats_t *stats);
+
+/**
+ * @brief Reset the hit, miss and eviction counters.
+ */
+void kmc_cache_reset_stats(void);
+
+/**
+ * @brief Release the cache.
+ */
+void kmc_cache_deinit(void);
+
+#endif /** _HAL_CACHE_H_ */
@@ -0,0 +1,154 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "HAL_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+#define KMC_ALIGNED_FREE(p) free(p)
+#else
+#include <malloc.h>
+#define KMC_ALIGNED_FREE(p) _aligned_free(p)
+#endif
+
+#define KMC_POOL_MIN_ALIGN 512U /** Smallest logical block size of a disk */
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static pthread_mutex_t s_poolLock = PTHREAD_MUTEX_INITIALIZER; /** Protects the fields below */
+static uint8_t *s_free[KMC_POOL_KEEP];                         /** Buffers ready for reuse */
+static uint32_t s_freeCount = 0;                               /** Number of buffers in s_free */
+static uint32_t s_alignment = 4096U;                           /** Alignment of new buffers */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static uint8_t *kmc_pool_alloc(uint32_t alignment); /** Allocate one aligned buffer */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Set the alignment of the buffers handed out by the pool.
+ *
+ * @param alignment Alignment in bytes, a power of two, raised to 512 when smaller.
+ * @return int Returns 0 on success, or -1 if the alignment is not a power of two.
+ */
+int kmc_pool_init(uint32_t alignment)
+{
+    kmc_status_t status = KMC_OK; /** Initialize status to KMC_OK, indicate success */
+
+    if ((0 == alignment) || ((alignment & (alignment - 1)) != 0))
+    {
+        status = KMC_ERROR; /** Not a power of two */
+    }
+    else
+    {
+        kmc_pool_deinit(); /** Buffers of the previous alignment */
+        pthread_mutex_lock(&s_poolLock);
+        s_alignment = (alignment < KMC_POOL_MIN_ALIGN) ? KMC_POOL_MIN_ALIGN : alignment;
+        pthread_mutex_unlock(&s_poolLock);
+    }
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Get the alignment of the buffers of the pool.
+ *
+ * @return uint32_t The alignment in bytes.
+ */
+uint32_t kmc_pool_alignment(void)
+{
+    return s_alignment;
+}
+
+/**
+ * @brief Take a buffer of KMC_POOL_BUFFER_BYTES bytes from the pool.
+ *
+ * @return uint8_t* An aligned buffer, or NULL if the memory can not be allocated.
+ */
+uint8_t *kmc_pool_get(void)
+{
+    uint8_t *buff = NULL;   /** Buffer to return */
+    uint32_t alignment = 0; /** Alignment of a new buffer */
+
+    pthread_mutex_lock(&s_poolLock);
+    if (s_freeCount > 0)
+    {
+        buff = s_free[--s_freeCount]; /** Reuse the last buffer given back, still warm */
+    }
+    alignment = s_alignment;
+    pthread_mutex_unlock(&s_poolLock);
+
+    if (NULL == buff)
+    {
+        buff = kmc_pool_alloc(alignment);
+    }
+
+    return buff; /** Return the buffer */
+}
+
+/**
+ * @brief Give a buffer back to the pool.
+ *
+ * @param buff Buffer returned by kmc_pool_get, NULL is ignored.
+ */
+void kmc_pool_put(uint8_t *buff)
+{
+    if (buff != NULL)
+    {
+        pthread_mutex_lock(&s_poolLock);
+        if ((s_freeCount < KMC_POOL_KEEP) && (((uintptr_t)buff & (s_alignment - 1)) == 0))
+        {
+            s_free[s_freeCount++] = buff;
+            buff = NULL; /** Kept for the next caller */
+        }
+        pthread_mutex_unlock(&s_poolLock);
+        if (buff != NULL)
+        {
+            KMC_ALIGNED_FREE(buff); /** Pool full, or aligned for a previous image */
+        }
+    }
+}
+
+/**
+ * @brief Release every free buffer of the pool.
+ */
+void kmc_pool_deinit(void)
+{
+    pthread_mutex_lock(&s_poolLock);
+    while (s_freeCount > 0)
+    {
+        KMC_ALIGNED_FREE(s_free[--s_freeCount]);
+    }
+    pthread_mutex_unlock(&s_poolLock);
+}
+
+/**
+ * @brief Allocate one aligned buffer of KMC_POOL_BUFFER_BYTES bytes.
+ *
+ * @param alignment Alignment in bytes.
+ * @return uint8_t* The buffer, or NULL if the memory can not be allocated.
+ */
+static uint8_t *kmc_pool_alloc(uint32_t alignment)
+{
+    void *buff = NULL; /** Allocated buffer */
+
+#if !defined(_WIN32)
+    if (posix_memalign(&buff, alignment, KMC_POOL_BUFFER_BYTES) != 0)
+    {
+        buff = NULL;
+    }
+#else
+    buff = _aligned_malloc(KMC_POOL_BUFFER_BYTES, alignment);
+#endif
+
+    return (uint8_t *)buff; /** Return the buffer */
+}
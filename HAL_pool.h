@@ -0,0 +1,55 @@
+#ifndef _HAL_POOL_H_
+#define _HAL_POOL_H_
+
+#include <stdint.h>
+#include "HAL.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define KMC_POOL_BUFFER_BYTES (256U * 1024U) /** Size of every buffer of the pool */
+#define KMC_POOL_KEEP 8U                     /** Free buffers kept for reuse, the others are released */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Set the alignment of the buffers handed out by the pool.
+ *
+ * Called by kmc_init with the logical block size of the backend, so that the buffers can be
+ * used for direct I/O. The free buffers of the previous image are released.
+ *
+ * @param alignment Alignment in bytes, a power of two, raised to 512 when smaller.
+ * @return int Returns 0 on success, or -1 if the alignment is not a power of two.
+ */
+int kmc_pool_init(uint32_t alignment);
+
+/**
+ * @brief Get the alignment of the buffers of the pool.
+ *
+ * @return uint32_t The alignment in bytes.
+ */
+uint32_t kmc_pool_alignment(void);
+
+/**
+ * @brief Take a buffer of KMC_POOL_BUFFER_BYTES bytes from the pool.
+ *
+ * @return uint8_t* An aligned buffer, or NULL if the memory can not be allocated.
+ */
+uint8_t *kmc_pool_get(void);
+
+/**
+ * @brief Give a buffer back to the pool.
+ *
+ * @param buff Buffer returned by kmc_pool_get, NULL is ignored.
+ */
+void kmc_pool_put(uint8_t *buff);
+
+/**
+ * @brief Release every free buffer of the pool.
+ */
+void kmc_pool_deinit(void);
+
+#endif /** _HAL_POOL_H_ */
@@ -0,0 +1,280 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "HAL.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KMC_NSEC_PER_SEC 1000000000ULL /** Nanoseconds in one second */
+
+/**
+ * @brief  Define the state of the shaping backend
+ */
+typedef struct
+{
+    kmc_shape_t shape;          /** Settings copied at open */
+    const kmc_backend_t *inner; /** Backend holding the image */
+    void *innerCtx;             /** Private state of the inner backend */
+    pthread_mutex_t lock;       /** Protects the fields below */
+    pthread_cond_t slotFree;    /** Signaled when a request leaves the queue */
+    uint32_t inFlight;          /** Requests being served */
+    uint64_t linkFree;          /** Time in nanoseconds at which the link has sent every queued byte */
+    uint32_t random;            /** State of the jitter generator */
+} kmc_shaped_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static int kmc_shaped_open(void **ctx, const char *imagePath, const kmc_config_t *config); /** Open the inner backend */
+static int32_t kmc_shaped_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length); /** Delayed read */
+static int32_t kmc_shaped_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count);         /** Delayed vectored read */
+static void kmc_shaped_close(void *ctx);                                                    /** Close the inner backend */
+static int kmc_shaped_stat(void *ctx, kmc_stat_t *st);                                      /** Size of the inner image */
+static uint64_t kmc_shaped_enter(kmc_shaped_t *state, uint64_t bytes);                      /** Take a slot and get the completion time */
+static void kmc_shaped_leave(kmc_shaped_t *state, uint64_t deadline);                       /** Wait for the completion time and free the slot */
+static uint64_t kmc_shaped_now(void);                                                       /** Monotonic time in nanoseconds */
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+/** No map and no descriptor: zero-copy access and io_uring would skip the emulated delays */
+const kmc_backend_t kmc_backend_shaped = {
+    "shaped", kmc_shaped_open, kmc_shaped_read, kmc_shaped_readv, kmc_shaped_close, kmc_shaped_stat,
+    NULL, NULL, NULL};
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Open the inner backend and set up the emulated link.
+ *
+ * @param ctx Receives the state of the backend.
+ * @param imagePath The path passed to the inner backend.
+ * @param config Must hold the settings in its shape field, passed as is to the inner backend.
+ * @return int Returns 0 on success, or -1 if there is an error.
+ */
+static int kmc_shaped_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    kmc_status_t status = KMC_ERROR; /** Initialize status to KMC_ERROR until the inner backend is open */
+    kmc_shaped_t *state = NULL;      /** State of the backend */
+
+    if ((config != NULL) && (config->shape != NULL) && (config->shape->inner != NULL) &&
+        (config->shape->inner != &kmc_backend_shaped))
+    {
+        state = (kmc_shaped_t *)calloc(1, sizeof(*state));
+    }
+    if (state != NULL)
+    {
+        state->shape = *config->shape;
+        state->inner = config->shape->inner;
+        state->random = 2463534242U; /** Fixed seed, runs are repeatable */
+        pthread_mutex_init(&state->lock, NULL);
+        pthread_cond_init(&state->slotFree, NULL);
+        if (state->inner->open(&state->innerCtx, imagePath, config) == 0)
+        {
+            status = KMC_OK;
+        }
+        else
+        {
+            pthread_cond_destroy(&state->slotFree);
+            pthread_mutex_destroy(&state->lock);
+            free(state);
+            state = NULL;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error: Shaped backend needs an inner backend\n");
+    }
+    *ctx = state;
+
+    return status; /** Return the status */
+}
+
+/**
+ * @brief Read through the inner backend, completing after the emulated delay.
+ *
+ * @param ctx The state of the backend.
+ * @param offset Byte offset in the image.
+ * @param buff Pointer to a buffer where the data will be stored.
+ * @param length Number of bytes to read.
+ * @return int32_t The result of the inner read.
+ */
+static int32_t kmc_shaped_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    kmc_shaped_t *state = (kmc_shaped_t *)ctx;           /** State of the backend */
+    uint64_t deadline = kmc_shaped_enter(state, length); /** Time at which the request completes */
+    int32_t byteRead = state->inner->read(state->innerCtx, offset, buff, length);
+
+    kmc_shaped_leave(state, deadline);
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Read several segments as one request of the emulated storage.
+ *
+ * @param ctx The state of the backend.
+ * @param iov Array of segments.
+ * @param count Number of segments.
+ * @return int32_t The total number of bytes read, or KMC_ERROR.
+ */
+static int32_t kmc_shaped_readv(void *ctx, const kmc_iovec_t *iov, uint32_t count)
+{
+    kmc_shaped_t *state = (kmc_shaped_t *)ctx; /** State of the backend */
+    int32_t byteRead = (int32_t)KMC_OK;        /** Total number of bytes read */
+    int32_t ret = 0;                           /** Bytes read for one segment */
+    uint64_t bytes = 0;                        /** Size of the whole request */
+    uint64_t deadline = 0;                     /** Time at which the request completes */
+    uint32_t i = 0;                            /** Used as an index of operation */
+
+    for (i = 0; i < count; i++)
+    {
+        bytes += iov[i].length;
+    }
+    deadline = kmc_shaped_enter(state, bytes);
+    if (state->inner->readv != NULL)
+    {
+        byteRead = state->inner->readv(state->innerCtx, iov, count);
+    }
+    else
+    {
+        for (i = 0; (i < count) && (byteRead >= 0); i++)
+        {
+            ret = state->inner->read(state->innerCtx, iov[i].offset, iov[i].buff, iov[i].length);
+            byteRead = (ret < 0) ? (int32_t)KMC_ERROR : (byteRead + ret);
+        }
+    }
+    kmc_shaped_leave(state, deadline);
+
+    return byteRead; /** Return the byteRead */
+}
+
+/**
+ * @brief Close the inner backend and release the state.
+ *
+ * @param ctx The state of the backend.
+ */
+static void kmc_shaped_close(void *ctx)
+{
+    kmc_shaped_t *state = (kmc_shaped_t *)ctx; /** State of the backend */
+
+    if (state != NULL)
+    {
+        state->inner->close(state->innerCtx);
+        pthread_cond_destroy(&state->slotFree);
+        pthread_mutex_destroy(&state->lock);
+        free(state);
+    }
+}
+
+/**
+ * @brief Get the size of the image from the inner backend.
+ *
+ * @param ctx The state of the backend.
+ * @param st Receives the size.
+ * @return int The result of the inner stat.
+ */
+static int kmc_shaped_stat(void *ctx, kmc_stat_t *st)
+{
+    kmc_shaped_t *state = (kmc_shaped_t *)ctx; /** State of the backend */
+
+    return state->inner->stat(state->innerCtx, st);
+}
+
+/**
+ * @brief Take a slot of the queue and compute when the request completes.
+ *
+ * The request completes after its latency and jitter, and not before its bytes have gone
+ * through the link, which sends the bytes of the requests one after the other.
+ *
+ * @param state The state of the backend.
+ * @param bytes Size of the request.
+ * @return uint64_t Completion time in nanoseconds.
+ */
+static uint64_t kmc_shaped_enter(kmc_shaped_t *state, uint64_t bytes)
+{
+    uint64_t now = 0;      /** Time at which the request is served */
+    uint64_t delay = 0;    /** Latency and jitter of the request */
+    uint64_t deadline = 0; /** Completion time */
+
+    pthread_mutex_lock(&state->lock);
+    while ((state->shape.queue_depth != 0) && (state->inFlight >= state->shape.queue_depth))
+    {
+        pthread_cond_wait(&state->slotFree, &state->lock); /** Queue of the device is full */
+    }
+    state->inFlight++;
+
+    now = kmc_shaped_now();
+    delay = (uint64_t)state->shape.latency_us * 1000U;
+    if (state->shape.jitter_us != 0)
+    {
+        state->random ^= state->random << 13; /** xorshift32 */
+        state->random ^= state->random >> 17;
+        state->random ^= state->random << 5;
+        delay += (uint64_t)(state->random % (state->shape.jitter_us + 1U)) * 1000U;
+    }
+    deadline = now + delay;
+    if (state->shape.bandwidth_kib != 0)
+    {
+        if (state->linkFree < now)
+        {
+            state->linkFree = now; /** Link idle, the transfer starts now */
+        }
+        state->linkFree += bytes * KMC_NSEC_PER_SEC / ((uint64_t)state->shape.bandwidth_kib * 1024U);
+        if (deadline < state->linkFree)
+        {
+            deadline = state->linkFree;
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return deadline; /** Return the completion time */
+}
+
+/**
+ * @brief Wait for the completion time of a request and free its slot.
+ *
+ * @param state The state of the backend.
+ * @param deadline Completion time in nanoseconds.
+ */
+static void kmc_shaped_leave(kmc_shaped_t *state, uint64_t deadline)
+{
+    uint64_t now = kmc_shaped_now(); /** Current time */
+    struct timespec wait;            /** Time left before completion */
+
+    while (now < deadline)
+    {
+        wait.tv_sec = (time_t)((deadline - now) / KMC_NSEC_PER_SEC);
+        wait.tv_nsec = (long)((deadline - now) % KMC_NSEC_PER_SEC);
+        (void)nanosleep(&wait, NULL); /** Interrupted sleeps are resumed by the loop */
+        now = kmc_shaped_now();
+    }
+
+    pthread_mutex_lock(&state->lock);
+    state->inFlight--;
+    pthread_cond_signal(&state->slotFree);
+    pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * @brief Get the monotonic time.
+ *
+ * @return uint64_t The time in nanoseconds.
+ */
+static uint64_t kmc_shaped_now(void)
+{
+    struct timespec ts; /** Time returned by the clock */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * KMC_NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
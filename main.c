@@ -49,26 +49,27 @@ void format_time(uint16_t time, char *buffer)
 /**
  * @brief Displays the entries of a directory in a formatted table
  *
- * @param head A pointer to the first 'DirEntry' in the linked list
+ * @param list The listing read by fatfs_read_dir
  */
-void display_entries(DirEntry *DirEntryList)
+void display_entries(const DirList *list)
 {
-    int index = 1;          /** Index for displaying entries */
-    char modified_time[7];  /** Buffer to store formatted time */
-    char modified_date[11]; /** Buffer to store formatted date */
+    uint32_t i = 0;          /** Index of the entry in the listing */
+    const char *name = NULL; /** Long name of the entry, or its 8.3 name */
+    char modified_time[7];   /** Buffer to store formatted time */
+    char modified_date[12];  /** Buffer to store formatted date, with its leading space */
 
     printf("Index   Name            Size    Type    Modified\n");
 
-    while (DirEntryList)
+    for (i = 0; i < list->count; i++)
     {
         /** Format the date and time of the entry */
-        format_date(DirEntryList->modified_date, modified_date);
-        format_time(DirEntryList->modified_time, modified_time);
+        format_date(list->entries[i].modified_date, modified_date);
+        format_time(list->entries[i].modified_time, modified_time);
 
         /** Print the entry details */
-        printf("%-7d %-15s %-7u %-7s %-12s\n", index++, DirEntryList->name, DirEntryList->size, DirEntryList->is_dir ? "DIR" : "FILE", strcat(modified_time, modified_date));
-
-        DirEntryList = DirEntryList->next; /** Move to the next entry */
+        name = fatfs_long_name(list, &list->entries[i]);
+        name = (name != NULL) ? name : list->entries[i].name;
+        printf("%-7u %-15s %-7u %-7s %s%s\n", i + 1U, name, list->entries[i].size, list->entries[i].is_dir ? "DIR" : "FILE", modified_time, modified_date);
     }
 }
 
@@ -87,7 +88,8 @@ void printOption(void)
 int main(void)
 {
     const char *image_path = "floppy.img"; /** Path to the FAT filesystem image */
-    DirEntry *DirEntryList = NULL;         /** Head of the linked list of directory entries */
+    const DirList *DirEntryList = NULL;    /** Entries of the current directory, held in the dentry cache */
+    const DirList *nextList = NULL;        /** Entries of the directory being opened */
     uint32_t currentCluster = 0;           /** Current cliuster for directory */
 
     int choice = 0;
@@ -104,9 +106,9 @@ int main(void)
     }
     else
     {
-        fatfs_read_dir(currentCluster, &DirEntryList); /** Reads the contents of a directory from the FAT filesystem */
+        DirEntryList = fatfs_dir_acquire(currentCluster); /** Reads the contents of a directory from the FAT filesystem */
 
-        while (checkChoice)
+        while ((checkChoice) && (DirEntryList != NULL))
         {
             system("cls"); /** clear the screen on windows */
             printf("\nCurrent Directory: %s\n", currentPath);
@@ -122,21 +124,24 @@ int main(void)
                 scanf("%d", &index); /**Read input until newline character */
 
                 DirEntry *entry = get_index(DirEntryList, index); /** Get the directory entry by index */
+                const char *name = NULL;                          /** Long name of the entry, or its 8.3 name */
 
                 if (entry)
                 {
+                    name = fatfs_long_name(DirEntryList, entry);
+                    name = (name != NULL) ? name : entry->name;
                     if (entry->is_dir)
                     {
-                        currentCluster = entry->first_cluster;         /** Update the current cluster to the new directory */
-                        strcat(currentPath, "/");                      /** Update the current path with / */
-                        strcat(currentPath, entry->name);              /** Update the current path */
-                        free_entries(DirEntryList);                    /** Free the old directory entries */
-                        DirEntryList = NULL;                           /** Reset */
-                        fatfs_read_dir(currentCluster, &DirEntryList); /** Read the new directory */
+                        currentCluster = entry->first_cluster;                                  /** Update the current cluster to the new directory */
+                        strncat(currentPath, "/", MAX_PATH_LENGTH - strlen(currentPath) - 1U);  /** Update the current path with / */
+                        strncat(currentPath, name, MAX_PATH_LENGTH - strlen(currentPath) - 1U); /** Update the current path, cut when too long */
+                        nextList = fatfs_dir_acquire(currentCluster);                           /** Read the new directory, no I/O when visited before */
+                        fatfs_dir_release(DirEntryList);                                        /** Give back the old directory, entry with it, name too */
+                        DirEntryList = nextList;
                     }
                     else
                     {
-                        printf("\nReading file %s:\n", entry->name);          /** If the entry is a file, read and display its contents */
+                        printf("\nReading file %s:\n", name);          /** If the entry is a file, read and display its contents */
                         fatfs_read_file(entry->name, entry->first_cluster); /** Reads the content of a file from the FAT filesystem. */
 
                         printf("\n\nPress Enter to continue...");
@@ -155,11 +160,11 @@ int main(void)
             }
             else if (2 == choice)
             {
-                currentCluster = 0;                            /** Set the current cluster to root */
-                free_entries(DirEntryList);                    /** Free the old directory entries */
-                DirEntryList = NULL;                           /** Reset */
-                strcpy(currentPath, rootPath);                 /** Reset the current path to root */
-                fatfs_read_dir(currentCluster, &DirEntryList); /** Read the root directory */
+                currentCluster = 0;                           /** Set the current cluster to root */
+                strcpy(currentPath, rootPath);                /** Reset the current path to root */
+                nextList = fatfs_dir_acquire(currentCluster); /** The root is cached after the first visit */
+                fatfs_dir_release(DirEntryList);              /** Give back the old directory */
+                DirEntryList = nextList;
             }
             else if (3 == choice)
             {
@@ -174,8 +179,13 @@ int main(void)
             }
         }
 
+        if (NULL == DirEntryList)
+        {
+            fprintf(stderr, "Failed to read the directory %s\n", currentPath); /** The loop stops on a directory that can not be read */
+        }
+
         /** Free allocated resources and deinitialize the FAT filesystem */
-        free_entries(DirEntryList);
+        fatfs_dir_release(DirEntryList);
         fatfs_deinit();
     }
 
@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include "../FATfs_catalog.h"
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define TEST_CATALOG_IMAGE "catalog.img"   /** Image built by the test */
+#define TEST_CATALOG_PATH "catalog.cat"    /** Catalog of the image */
+#define TEST_CATALOG_COPY "catalog.bad"    /** Damaged copy of the catalog */
+#define TEST_CATALOG_EXTENTS 64U           /** Room for the extents of one file */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_catalog_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t *dir); /** Build a volume */
+static void test_catalog_compare(uint32_t directory);                                                  /** Compare with the live reader */
+static bool test_catalog_load(const char *path, uint8_t **data, long *size);                           /** Read a whole file */
+static bool test_catalog_store(const char *path, const uint8_t *data, long size);                      /** Write a whole file */
+static void test_catalog_damaged(void);                                                                /** Reject damaged catalogs */
+static void test_catalog_volume(const char *name, fatfs_type_t type, uint32_t sectors);                /** Check a volume */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Build catalogs of FAT16 and FAT32 volumes and check them against the live reader,
+ * their rebuild while open, the rejection of damaged and stale catalogs, and a failed build.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    test_catalog_volume("FAT16", FAT_TYPE_16, 40000U);
+    test_catalog_volume("FAT32", FAT_TYPE_32, 68000U);
+    unlink(TEST_CATALOG_IMAGE);
+    unlink(TEST_CATALOG_PATH);
+    unlink(TEST_CATALOG_COPY);
+
+    return test_result("test_catalog");
+}
+
+/**
+ * @brief Build a volume with files in the root and in a subdirectory.
+ *
+ * @param img Receives the volume.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume, one per cluster.
+ * @param dir Receives the first cluster of the subdirectory.
+ * @return bool false on error.
+ */
+static bool test_catalog_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t *dir)
+{
+    char name[16];                                        /** 8.3 name */
+    char longName[64];                                    /** Long name */
+    uint32_t i = 0;                                       /** Used as an index of operation */
+    bool ok = test_image_create(img, type, sectors, 1);   /** Cleared on error */
+
+    if (ok)
+    {
+        *dir = test_image_mkdir(img, 0, "DOCS", "Documents of the volume");
+        ok = (*dir != 0) && (test_image_file(img, 0, "README.TXT", NULL, 700U, 0) != 0) &&
+             (test_image_file(img, 0, "EMPTY.TXT", NULL, 0U, 0) == 0);
+        for (i = 0; (ok) && (i < 30U); i++)
+        {
+            snprintf(name, sizeof(name), "DOC%05u.TXT", i);
+            snprintf(longName, sizeof(longName), "Document %u of the catalog.txt", i);
+            ok = (test_image_file(img, *dir, name, longName, 600U * (i + 1U), i % 3U) != 0);
+        }
+        ok = (ok) && (test_image_mkdir(img, *dir, "SUB", NULL) != 0) && (test_image_save(img, TEST_CATALOG_IMAGE, 0, 0));
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Compare the listing, lookups and extents of a directory in the open catalog with
+ * those of the live reader.
+ *
+ * @param directory First cluster of the directory, 0 for the root.
+ */
+static void test_catalog_compare(uint32_t directory)
+{
+    fatfs_extent_t extents[TEST_CATALOG_EXTENTS];  /** Extents read from the volume */
+    const fatfs_catalog_entry_t *entries = NULL;   /** Listing of the catalog */
+    const fatfs_catalog_entry_t *found = NULL;     /** Entry found by path */
+    const fatfs_extent_t *stored = NULL;           /** Extents of the catalog */
+    const char *longName = NULL;                   /** Long name of the live reader */
+    const char *path = NULL;                       /** Path of the catalog entry */
+    DirList list = {0};                            /** Listing of the live reader */
+    uint32_t count = 0;                            /** Entries of the catalog listing */
+    uint32_t runs = 0;                             /** Extents of the catalog */
+    uint32_t e = 0;                                /** Used as an index of operation */
+    int live = 0;                                  /** Extents read from the volume */
+
+    if ((TEST_CHECK(fatfs_read_dir(directory, &list) == 0)) && (TEST_CHECK(fatfs_catalog_list(directory, &entries, &count) == 0)) &&
+        (TEST_CHECK(count == list.count)))
+    {
+        for (e = 0; e < count; e++)
+        {
+            TEST_CHECK(memcmp(entries[e].name, list.entries[e].name, sizeof(entries[e].name)) == 0);
+            TEST_CHECK((entries[e].size == list.entries[e].size) && (entries[e].first_cluster == list.entries[e].first_cluster));
+            TEST_CHECK(entries[e].is_dir == (uint8_t)list.entries[e].is_dir);
+            longName = fatfs_long_name(&list, &list.entries[e]);
+            TEST_CHECK(((NULL == longName) && (NULL == fatfs_catalog_long_name(&entries[e]))) ||
+                       ((longName != NULL) && (fatfs_catalog_long_name(&entries[e]) != NULL) && (strcmp(longName, fatfs_catalog_long_name(&entries[e])) == 0)));
+            path = fatfs_catalog_path(&entries[e]);
+            if (('.' != entries[e].name[0]) && (TEST_CHECK(path != NULL)))
+            {
+                TEST_CHECK((fatfs_catalog_lookup(path, &found) == 0) && (found == &entries[e]));
+                stored = fatfs_catalog_extents(&entries[e], &runs);
+                live = (entries[e].first_cluster >= 2U) ? fatfs_get_extents(entries[e].first_cluster, extents, TEST_CATALOG_EXTENTS) : 0;
+                TEST_CHECK((live >= 0) && ((uint32_t)live == runs));
+                TEST_CHECK((0 == runs) || ((stored != NULL) && (memcmp(stored, extents, runs * sizeof(fatfs_extent_t)) == 0)));
+            }
+        }
+    }
+    free_entries(&list);
+}
+
+/**
+ * @brief Read a whole file into memory.
+ *
+ * @param path Path of the file.
+ * @param data Receives the bytes, to release with free.
+ * @param size Receives the size.
+ * @return bool false on error.
+ */
+static bool test_catalog_load(const char *path, uint8_t **data, long *size)
+{
+    FILE *in = fopen(path, "rb"); /** The file */
+    bool ok = (in != NULL);       /** Status of the read */
+
+    *data = NULL;
+    ok = (ok) && (fseek(in, 0, SEEK_END) == 0) && ((*size = ftell(in)) > 0) && (fseek(in, 0, SEEK_SET) == 0);
+    *data = (ok) ? (uint8_t *)malloc((size_t)*size) : NULL;
+    ok = (*data != NULL) && (fread(*data, 1, (size_t)*size, in) == (size_t)*size);
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Write a whole file.
+ *
+ * @param path Path of the file, replaced when it exists.
+ * @param data Bytes of the file.
+ * @param size Size of the file.
+ * @return bool false on error.
+ */
+static bool test_catalog_store(const char *path, const uint8_t *data, long size)
+{
+    FILE *out = fopen(path, "wb");  /** The file */
+    bool ok = (out != NULL) && (fwrite(data, 1, (size_t)size, out) == (size_t)size); /** Status of the write */
+
+    if (out != NULL)
+    {
+        ok = (fclose(out) == 0) && (ok);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Check that a damaged or stale catalog is rejected and the open one is closed.
+ */
+static void test_catalog_damaged(void)
+{
+    uint8_t *data = NULL;       /** Bytes of the good catalog */
+    long size = 0;              /** Size of the good catalog */
+    struct stat st;             /** Times of the image */
+    struct timeval times[2];    /** Access and write times given to the image */
+
+    TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, "missing.cat") != 0);
+    TEST_CHECK(NULL == fatfs_catalog_geometry());
+    if (TEST_CHECK(test_catalog_load(TEST_CATALOG_PATH, &data, &size)))
+    {
+        /** Truncated: the header promises more bytes than the file holds */
+        TEST_CHECK(test_catalog_store(TEST_CATALOG_COPY, data, size - 8));
+        TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_COPY) != 0);
+        /** Wrong magic, as left by an interrupted write */
+        data[0] ^= 0xFFU;
+        TEST_CHECK(test_catalog_store(TEST_CATALOG_COPY, data, size));
+        TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_COPY) != 0);
+        data[0] ^= 0xFFU;
+        /** Another version */
+        data[8] ^= 0x40U;
+        TEST_CHECK(test_catalog_store(TEST_CATALOG_COPY, data, size));
+        TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_COPY) != 0);
+        data[8] ^= 0x40U;
+        TEST_CHECK(test_catalog_store(TEST_CATALOG_COPY, data, size));
+        TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_COPY) == 0);
+        fatfs_catalog_close();
+    }
+    free(data);
+
+    /** Stale: the image was written after the catalog */
+    if (TEST_CHECK(stat(TEST_CATALOG_IMAGE, &st) == 0))
+    {
+        times[0].tv_sec = st.st_atime;
+        times[0].tv_usec = 0;
+        times[1].tv_sec = st.st_mtime + 10;
+        times[1].tv_usec = 0;
+        TEST_CHECK(utimes(TEST_CATALOG_IMAGE, times) == 0);
+        TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) != 0);
+    }
+}
+
+/**
+ * @brief Build the catalog of one volume and check it.
+ *
+ * @param name Name of the volume, for the messages.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ */
+static void test_catalog_volume(const char *name, fatfs_type_t type, uint32_t sectors)
+{
+    kmc_shape_t shape = {&test_backend_faulty, 0U, 0U, 0U, 0U}; /** Reads failing on a range, without delays */
+    kmc_config_t config;                                        /** Configuration of the HAL */
+    test_image_t img;                                           /** Volume */
+    const fatfs_catalog_entry_t *old = NULL;                    /** Entry of the catalog mapped before the rebuild */
+    const uint32_t *fat = NULL;                                 /** FAT of the catalog */
+    uint8_t *before = NULL;                                     /** Catalog before the failed build */
+    uint8_t *after = NULL;                                      /** Catalog after the failed build */
+    long beforeSize = 0;                                        /** Size of before */
+    long afterSize = 0;                                         /** Size of after */
+    uint32_t dir = 0;                                           /** Subdirectory */
+    uint32_t count = 0;                                         /** Entries of the FAT */
+    uint32_t cluster = 0;                                       /** Used as an index of operation */
+    bool same = true;                                           /** FAT of the catalog matches the volume */
+
+    printf("test_catalog: %s\n", name);
+    memset(&config, 0, sizeof(config));
+    config.mode = KMC_MODE_PREAD;
+    config.flags = KMC_FLAG_NO_READAHEAD;
+    config.shape = &shape;
+    if ((TEST_CHECK(test_catalog_build(&img, type, sectors, &dir))) && (TEST_CHECK(fatfs_init_ex(TEST_CATALOG_IMAGE, &config) == 0)))
+    {
+        unlink(TEST_CATALOG_PATH);
+        TEST_CHECK(fatfs_catalog_build(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) == 0);
+        TEST_CHECK(access(TEST_CATALOG_PATH ".tmp", F_OK) != 0);
+        if (TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) == 0))
+        {
+            TEST_CHECK(memcmp(fatfs_catalog_geometry(), fatfs_get_geometry(), sizeof(fatfs_geometry_t)) == 0);
+            test_catalog_compare(0);
+            test_catalog_compare(dir);
+            fat = fatfs_catalog_fat(&count);
+            TEST_CHECK((fat != NULL) && (count == img.cluster_count + 2U));
+            for (cluster = 2; (fat != NULL) && (cluster < count); cluster++)
+            {
+                same = (same) && (fat[cluster] == test_image_get_fat(&img, cluster));
+            }
+            TEST_CHECK(same);
+
+            /** Rebuilt while mapped: the old mapping stays readable, the new file replaces it */
+            TEST_CHECK(fatfs_catalog_lookup("/Documents of the volume/Document 29 of the catalog.txt", &old) == 0);
+            TEST_CHECK(fatfs_catalog_build(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) == 0);
+            TEST_CHECK((old != NULL) && (30U * 600U == old->size));
+            TEST_CHECK((old != NULL) && (strcmp(fatfs_catalog_path(old), "/Documents of the volume/Document 29 of the catalog.txt") == 0));
+            TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) == 0);
+            test_catalog_compare(dir);
+            fatfs_catalog_close();
+        }
+
+        /** A directory that can not be read fails the build and keeps the old catalog */
+        TEST_CHECK(test_catalog_load(TEST_CATALOG_PATH, &before, &beforeSize));
+        test_fail_range(((uint64_t)img.data_start + dir - 2U) * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE);
+        TEST_CHECK(fatfs_catalog_build(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) != 0);
+        test_fail_range(0, 0);
+        TEST_CHECK(access(TEST_CATALOG_PATH ".tmp", F_OK) != 0);
+        TEST_CHECK(test_catalog_load(TEST_CATALOG_PATH, &after, &afterSize));
+        TEST_CHECK((before != NULL) && (after != NULL) && (beforeSize == afterSize) && (memcmp(before, after, (size_t)afterSize) == 0));
+        TEST_CHECK(fatfs_catalog_open(TEST_CATALOG_IMAGE, TEST_CATALOG_PATH) == 0);
+        fatfs_catalog_close();
+        free(before);
+        free(after);
+
+        test_catalog_damaged();
+        fatfs_deinit();
+    }
+    test_image_free(&img);
+}
@@ -0,0 +1,228 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include "../FATfs_check.h"
+#include <unistd.h>
+
+#define TEST_CHECK_PATH "check.img" /** Image built by the test */
+#define TEST_CHECK_THREADS 8U       /** The check runs with 1 to this many threads */
+
+/**
+ * @brief  Define the damage done to the volume before it is checked
+ */
+typedef enum
+{
+    TEST_CHECK_CLEAN = 0,   /** No damage */
+    TEST_CHECK_CYCLE,       /** The last cluster of a file links back to its first */
+    TEST_CHECK_CROSS,       /** A fragmented file joins the middle of another file */
+    TEST_CHECK_LOST,        /** A chain no entry reaches */
+    TEST_CHECK_MISMATCH,    /** Two entries differ in the second FAT */
+    TEST_CHECK_BAD_LINK,    /** A link past the volume */
+    TEST_CHECK_BAD_ENTRY,   /** An entry starting past the volume */
+    TEST_CHECK_SIZE,        /** A size longer than the chain */
+    TEST_CHECK_CASES        /** Number of cases */
+} test_check_case_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_check_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t spc, test_check_case_t damage,
+                             fatfs_check_report_t *want);                                          /** Build a damaged volume */
+static void test_check_volume(const char *name, fatfs_type_t type, uint32_t sectors, uint32_t spc);     /** Check every case of a type */
+static void test_check_errors(void);                                                                   /** Check the read errors */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check clean and damaged FAT12, FAT16 and FAT32 volumes with 1 to 8 threads.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    test_check_volume("FAT12", FAT_TYPE_12, 4000U, 1U);
+    test_check_volume("FAT16", FAT_TYPE_16, 40000U, 2U);
+    test_check_volume("FAT32", FAT_TYPE_32, 68000U, 1U);
+    unlink(TEST_CHECK_PATH);
+
+    return test_result("test_check");
+}
+
+/**
+ * @brief Build a volume holding a file in the root and two in a subdirectory, damage it and write it.
+ *
+ * @param img Receives the volume.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ * @param spc Sectors per cluster.
+ * @param damage Damage done to the volume.
+ * @param want Receives the counters the check must report.
+ * @return bool false on error.
+ */
+static bool test_check_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t spc, test_check_case_t damage,
+                             fatfs_check_report_t *want)
+{
+    uint32_t dir = 0;                                       /** Subdirectory */
+    uint32_t a = 0;                                         /** Contiguous file of 8 clusters */
+    uint32_t b = 0;                                         /** File of 6 clusters, one free cluster after each */
+    uint32_t c = 0;                                         /** File of one cluster */
+    uint32_t run = 0;                                       /** Chain added by a case */
+    uint32_t cluster = 0;                                   /** Used as an index of operation */
+    uint32_t bytes = spc * TEST_SECTOR_SIZE;                /** Bytes per cluster */
+    bool ok = test_image_create(img, type, sectors, spc);   /** Cleared on error */
+
+    memset(want, 0, sizeof(*want));
+    if (ok)
+    {
+        a = test_image_file(img, 0, "A.BIN", NULL, 8U * bytes, 0);
+        dir = test_image_mkdir(img, 0, "DIR", "A directory");
+        b = test_image_file(img, dir, "B.BIN", "A fragmented file", 6U * bytes - 10U, 1);
+        c = test_image_file(img, dir, "C.BIN", NULL, 100U, 0);
+        ok = (a != 0) && (dir != 0) && (b != 0) && (c != 0);
+        want->clusters = img->cluster_count;
+        want->directories = 2;
+        want->files = 3;
+    }
+
+    if (!ok)
+    {
+        /** Nothing to damage */
+    }
+    else if (TEST_CHECK_CYCLE == damage)
+    {
+        test_image_set_fat(img, a + 7U, a);
+        want->cycles = 1;
+    }
+    else if (TEST_CHECK_CROSS == damage)
+    {
+        test_image_set_fat(img, b + 2U, a + 3U); /** The last 4 clusters of B are lost */
+        want->cross_links = 1;
+        want->lost_clusters = 4;
+        want->lost_chains = 1;
+    }
+    else if (TEST_CHECK_LOST == damage)
+    {
+        run = test_image_alloc(img, 3, 0);
+        ok = (run != 0);
+        want->lost_clusters = 3;
+        want->lost_chains = 1;
+    }
+    else if (TEST_CHECK_MISMATCH == damage)
+    {
+        test_image_set_fat_copy(img, 1, a + 1U, 0);
+        test_image_set_fat_copy(img, 1, c, a);
+        want->fat_mismatches = 2;
+    }
+    else if (TEST_CHECK_BAD_LINK == damage)
+    {
+        test_image_set_fat(img, a + 7U, img->cluster_count + 10U);
+        want->bad_links = 1;
+    }
+    else if (TEST_CHECK_BAD_ENTRY == damage)
+    {
+        ok = test_image_add(img, 0, "GHOST.BIN", NULL, 0x20, img->cluster_count + 10U, 100U);
+        want->files = 4;
+        want->bad_entries = 1;
+    }
+    else if (TEST_CHECK_SIZE == damage)
+    {
+        run = test_image_alloc(img, 2, 0);
+        ok = (run != 0) && (test_image_add(img, dir, "SHORT.BIN", NULL, 0x20, run, 5U * bytes));
+        want->files = 4;
+        want->size_mismatches = 1;
+    }
+
+    for (cluster = 2; (ok) && (cluster < img->cluster_count + 2U); cluster++)
+    {
+        want->free_clusters += (0 == test_image_get_fat(img, cluster)) ? 1U : 0U;
+    }
+    ok = (ok) && (test_image_save(img, TEST_CHECK_PATH, 0, 0));
+
+    return ok;
+}
+
+/**
+ * @brief Check every case on one type of volume, with every thread count.
+ *
+ * @param name Name of the volume, for the messages.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ * @param spc Sectors per cluster.
+ */
+static void test_check_volume(const char *name, fatfs_type_t type, uint32_t sectors, uint32_t spc)
+{
+    test_image_t img;             /** Volume */
+    fatfs_check_report_t want;    /** Expected counters */
+    fatfs_check_report_t got;     /** Counters of the check */
+    uint32_t damage = 0;          /** Used as an index of operation */
+    uint32_t threads = 0;         /** Threads of the check */
+    int result = 0;               /** Status of the check */
+
+    for (damage = TEST_CHECK_CLEAN; damage < TEST_CHECK_CASES; damage++)
+    {
+        printf("test_check: %s, case %u\n", name, damage);
+        if ((TEST_CHECK(test_check_build(&img, type, sectors, spc, (test_check_case_t)damage, &want))) && (TEST_CHECK(fatfs_init(TEST_CHECK_PATH) == 0)))
+        {
+            for (threads = 1; threads <= TEST_CHECK_THREADS; threads++)
+            {
+                result = fatfs_check(threads, &got, NULL);
+                TEST_CHECK(result == ((TEST_CHECK_CLEAN == damage) ? 0 : 1));
+                want.threads = got.threads; /** Rounded to the shards of the FAT */
+                TEST_CHECK((got.threads >= 1U) && (got.threads <= threads));
+                if (!TEST_CHECK(memcmp(&got, &want, sizeof(got)) == 0))
+                {
+                    printf("  threads %u: free %u/%u dirs %u/%u files %u/%u mismatch %u/%u links %u/%u cross %u/%u cycles %u/%u "
+                           "lost %u/%u chains %u/%u entries %u/%u sizes %u/%u\n",
+                           threads, got.free_clusters, want.free_clusters, got.directories, want.directories, got.files,
+                           want.files, got.fat_mismatches, want.fat_mismatches, got.bad_links, want.bad_links,
+                           got.cross_links, want.cross_links, got.cycles, want.cycles, got.lost_clusters, want.lost_clusters,
+                           got.lost_chains, want.lost_chains, got.bad_entries, want.bad_entries, got.size_mismatches,
+                           want.size_mismatches);
+                }
+            }
+            fatfs_deinit();
+            if (TEST_CHECK_CLEAN == damage)
+            {
+                test_check_errors();
+            }
+        }
+        test_image_free(&img);
+    }
+}
+
+/**
+ * @brief Check that a directory that can not be read fails the check instead of reporting its
+ * files as lost.
+ */
+static void test_check_errors(void)
+{
+    kmc_shape_t shape = {&test_backend_faulty, 0U, 0U, 0U, 0U}; /** Reads failing on a range, without delays */
+    kmc_config_t config;                                        /** Configuration of the HAL */
+    fatfs_check_report_t got;                                   /** Counters of the check */
+    const fatfs_geometry_t *geo = NULL;                         /** Layout of the volume */
+    DirEntry entry;                                             /** The subdirectory */
+    uint32_t threads = 0;                                       /** Threads of the check */
+
+    memset(&config, 0, sizeof(config));
+    config.mode = KMC_MODE_PREAD;
+    config.flags = KMC_FLAG_NO_READAHEAD;
+    config.shape = &shape;
+    if ((TEST_CHECK(fatfs_init_ex(TEST_CHECK_PATH, &config) == 0)) && (TEST_CHECK(fatfs_lookup("/DIR", &entry) == 0)))
+    {
+        geo = fatfs_get_geometry();
+        test_fail_range(((uint64_t)geo->data_start + (entry.first_cluster - 2U) * geo->sectors_per_cluster) * geo->bytes_per_sector,
+                        geo->bytes_per_sector);
+        for (threads = 1; threads <= TEST_CHECK_THREADS; threads += 7U)
+        {
+            TEST_CHECK(fatfs_check(threads, &got, NULL) == -1);
+        }
+        test_fail_range(0, 0);
+        TEST_CHECK(fatfs_check(2, &got, NULL) == 0);
+    }
+    fatfs_deinit();
+}
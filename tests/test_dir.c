@@ -0,0 +1,525 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include <unistd.h>
+
+#define TEST_DIR_PATH "dir.img" /** Image built by the test */
+#define TEST_DIR_FILES 40U      /** Files of the subdirectory: their long names span several clusters */
+#define TEST_DIR_BIG 5000U      /** Entries of the directory listed by columns */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_dir_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t *dir); /** Build a volume */
+static void test_dir_volume(const char *name, fatfs_type_t type, uint32_t sectors);                /** Check a volume */
+static void test_dir_errors(const test_image_t *img, uint32_t dir);                                /** Check the read errors */
+static void test_dir_lookups(uint32_t dir);                                                        /** Check the edge cases of the paths */
+static void test_dir_cache(uint32_t dir);                                                          /** Check the dentry cache */
+static void test_dir_alloc(uint32_t dir);                                                          /** Check the allocation errors */
+static bool test_dir_complete(const DirList *list);                                                /** Check a listing of the subdirectory */
+static void test_dir_names(void);                                                                  /** Check damaged and unusual long names */
+static void test_dir_columns(void);                                                                /** Check the columns of a large directory */
+static void test_dir_sorted(const uint32_t *column, uint32_t count);                               /** Check the sort of a column */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief List, look up and read the files of FAT12, FAT16 and FAT32 volumes, check that a
+ * directory that can not be read is reported and not cached, then check damaged long names
+ * and the columns of a large directory.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    test_dir_volume("FAT12", FAT_TYPE_12, 4000U);
+    test_dir_volume("FAT16", FAT_TYPE_16, 40000U);
+    test_dir_volume("FAT32", FAT_TYPE_32, 68000U);
+    test_dir_names();
+    test_dir_columns();
+    unlink(TEST_DIR_PATH);
+
+    return test_result("test_dir");
+}
+
+/**
+ * @brief Build a volume with a few files in the root and many long names in a subdirectory.
+ *
+ * @param img Receives the volume.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume, one per cluster.
+ * @param dir Receives the first cluster of the subdirectory.
+ * @return bool false on error.
+ */
+static bool test_dir_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t *dir)
+{
+    char name[16];                                    /** 8.3 name */
+    char longName[64];                                /** Long name */
+    uint32_t i = 0;                                   /** Used as an index of operation */
+    bool ok = test_image_create(img, type, sectors, 1); /** Cleared on error */
+
+    if (ok)
+    {
+        *dir = test_image_mkdir(img, 0, "SUBDIR", "A directory with a long name");
+        ok = (*dir != 0) && (test_image_file(img, 0, "README.TXT", NULL, 700U, 0) != 0) &&
+             (test_image_file(img, 0, "NOTES.TXT", "Notes of the volume.txt", 3000U, 2) != 0);
+        for (i = 0; (ok) && (i < TEST_DIR_FILES); i++)
+        {
+            snprintf(name, sizeof(name), "FILE%04u.BIN", i);
+            snprintf(longName, sizeof(longName), "File number %u with a name of several entries.bin", i);
+            ok = (test_image_file(img, *dir, name, longName, 100U * i, i % 3U) != 0) || (0 == i);
+        }
+        ok = (ok) && (test_image_save(img, TEST_DIR_PATH, 0, 0));
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Check the listings, lookups and reads of one volume.
+ *
+ * @param name Name of the volume, for the messages.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ */
+static void test_dir_volume(const char *name, fatfs_type_t type, uint32_t sectors)
+{
+    static uint8_t got[TEST_DIR_FILES * 100U];   /** File read */
+    static uint8_t want[TEST_DIR_FILES * 100U];  /** Expected bytes */
+    test_image_t img;                            /** Volume */
+    DirList list = {0};                          /** Listing read without the cache */
+    const DirList *cached = NULL;                /** Listing of the dentry cache */
+    const char *longName = NULL;                 /** Long name of an entry */
+    char path[96];                               /** Path looked up */
+    char expected[64];                           /** Long name expected */
+    DirEntry entry;                              /** Entry looked up */
+    uint32_t dir = 0;                            /** First cluster of the subdirectory */
+    uint32_t i = 0;                              /** Used as an index of operation */
+    uint32_t count = 0;                          /** Entries of a listing held over the unmount */
+
+    printf("test_dir: %s\n", name);
+    if ((TEST_CHECK(test_dir_build(&img, type, sectors, &dir))) && (TEST_CHECK(fatfs_init(TEST_DIR_PATH) == 0)))
+    {
+        TEST_CHECK(fatfs_read_dir(0, &list) == 0);
+        TEST_CHECK(list.count == 3U);
+        free_entries(&list);
+        TEST_CHECK(fatfs_read_dir(dir, &list) == 0);
+        TEST_CHECK(list.count == TEST_DIR_FILES + 2U); /** "." and "..", then names of 5 entries: some span two clusters */
+        for (i = 0; (list.count == TEST_DIR_FILES + 2U) && (i < TEST_DIR_FILES); i++)
+        {
+            snprintf(expected, sizeof(expected), "File number %u with a name of several entries.bin", i);
+            longName = fatfs_long_name(&list, &list.entries[i + 2U]);
+            TEST_CHECK((longName != NULL) && (strcmp(longName, expected) == 0));
+            TEST_CHECK(list.entries[i + 2U].size == 100U * i);
+        }
+        free_entries(&list);
+
+        cached = fatfs_dir_acquire(dir);
+        TEST_CHECK((cached != NULL) && (cached->count == TEST_DIR_FILES + 2U));
+        TEST_CHECK(fatfs_dir_acquire(dir) == cached); /** Served by the cache */
+        fatfs_dir_release(cached);
+        fatfs_dir_release(cached);
+
+        TEST_CHECK(fatfs_lookup("/README.TXT", &entry) == 0);
+        TEST_CHECK((fatfs_lookup("/Notes of the volume.txt", &entry) == 0) && (3000U == entry.size));
+        test_image_pattern(entry.first_cluster, 0, want, entry.size);
+        TEST_CHECK(fatfs_read_at(entry.first_cluster, entry.size, 0, got, entry.size) == 3000);
+        TEST_CHECK(memcmp(got, want, 3000U) == 0);
+        for (i = 1; i < TEST_DIR_FILES; i += 13U)
+        {
+            snprintf(path, sizeof(path), "/A directory with a long name/File number %u with a name of several entries.bin", i);
+            if (TEST_CHECK(fatfs_lookup(path, &entry) == 0))
+            {
+                test_image_pattern(entry.first_cluster, 0, want, entry.size);
+                TEST_CHECK(fatfs_read_at(entry.first_cluster, entry.size, 0, got, entry.size) == (int32_t)(100U * i));
+                TEST_CHECK(memcmp(got, want, entry.size) == 0);
+            }
+            snprintf(path, sizeof(path), "/SUBDIR/FILE%04u.BIN", i);
+            TEST_CHECK(fatfs_lookup(path, &entry) == 0);
+        }
+        TEST_CHECK(fatfs_lookup("/SUBDIR/MISSING.BIN", &entry) != 0);
+        TEST_CHECK(fatfs_lookup("/README.TXT/FILE", &entry) != 0);
+        test_dir_lookups(dir);
+        test_dir_cache(dir);
+        test_dir_alloc(dir);
+
+        /** A listing held over the unmount stays valid and is freed on its release */
+        cached = fatfs_dir_acquire(dir);
+        fatfs_deinit();
+        count = (cached != NULL) ? cached->count : 0U;
+        TEST_CHECK(TEST_DIR_FILES + 2U == count);
+        fatfs_dir_release(cached);
+
+        test_dir_errors(&img, dir);
+    }
+    test_image_free(&img);
+}
+
+/**
+ * @brief Check that a directory whose clusters can not be read is reported, is not cached,
+ * and is listed in full once it can be read again.
+ *
+ * @param img The volume written to TEST_DIR_PATH.
+ * @param dir First cluster of the subdirectory.
+ */
+static void test_dir_errors(const test_image_t *img, uint32_t dir)
+{
+    kmc_shape_t shape = {&test_backend_faulty, 0U, 0U, 0U, 0U}; /** Reads failing on a range, without delays */
+    kmc_config_t config;                                        /** Configuration of the HAL */
+    DirList list = {0};                                         /** Listing read without the cache */
+    const DirList *cached = NULL;                               /** Listing of the dentry cache */
+    DirEntry entry;                                             /** Entry looked up */
+    uint64_t second = 0;                                        /** Byte offset of the second cluster of the subdirectory */
+
+    memset(&config, 0, sizeof(config));
+    config.mode = KMC_MODE_PREAD;
+    config.flags = KMC_FLAG_NO_READAHEAD;
+    config.shape = &shape;
+    if (TEST_CHECK(fatfs_init_ex(TEST_DIR_PATH, &config) == 0))
+    {
+        /** The second cluster of the subdirectory fails: the first one was listed in full */
+        second = ((uint64_t)img->data_start + test_image_get_fat(img, dir) - 2U) * TEST_SECTOR_SIZE;
+        test_fail_range(second, TEST_SECTOR_SIZE);
+        TEST_CHECK(fatfs_read_dir(dir, &list) != 0);
+        TEST_CHECK(list.count < TEST_DIR_FILES + 2U);
+        free_entries(&list);
+        TEST_CHECK(NULL == fatfs_dir_acquire(dir));
+        TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0039.BIN", &entry) != 0);
+
+        test_fail_range(0, 0);
+        cached = fatfs_dir_acquire(dir);
+        TEST_CHECK((cached != NULL) && (cached->count == TEST_DIR_FILES + 2U)); /** Read again, not the partial listing */
+        fatfs_dir_release(cached);
+        TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0039.BIN", &entry) == 0);
+
+        /** The root directory */
+        fatfs_dir_invalidate_all();
+        test_fail_range((uint64_t)((0 != img->root_cluster) ? (img->data_start + img->root_cluster - 2U) : img->root_start) * TEST_SECTOR_SIZE,
+                        TEST_SECTOR_SIZE);
+        TEST_CHECK(fatfs_read_dir(0, &list) != 0);
+        free_entries(&list);
+        TEST_CHECK(NULL == fatfs_dir_acquire(0));
+        TEST_CHECK(fatfs_lookup("/README.TXT", &entry) != 0);
+        test_fail_range(0, 0);
+        TEST_CHECK(fatfs_lookup("/README.TXT", &entry) == 0);
+        fatfs_deinit();
+    }
+}
+
+/**
+ * @brief Check the paths that are not plain: case, separators, "." and "..", and names that
+ * can not exist.
+ *
+ * @param dir First cluster of the subdirectory.
+ */
+static void test_dir_lookups(uint32_t dir)
+{
+    static char longPath[1024]; /** Path with a component longer than any name */
+    DirEntry entry;             /** Entry looked up */
+
+    TEST_CHECK((fatfs_lookup("/", &entry) == 0) && (entry.is_dir) && (0U == entry.first_cluster));
+    TEST_CHECK((fatfs_lookup("/readme.txt", &entry) == 0) && (700U == entry.size));
+    TEST_CHECK((fatfs_lookup("/ReadMe.Txt", &entry) == 0) && (700U == entry.size));
+    TEST_CHECK((fatfs_lookup("/a DIRECTORY with A long NAME/file NUMBER 14 with a name of several entries.BIN", &entry) == 0) &&
+               (1400U == entry.size));
+    TEST_CHECK((fatfs_lookup("//SUBDIR///FILE0014.BIN/", &entry) == 0) && (1400U == entry.size));
+    TEST_CHECK((fatfs_lookup("SUBDIR/FILE0014.BIN", &entry) == 0) && (1400U == entry.size)); /** From the root without a leading separator */
+    TEST_CHECK((fatfs_lookup("/SUBDIR/.", &entry) == 0) && (entry.is_dir) && (dir == entry.first_cluster));
+    TEST_CHECK((fatfs_lookup("/SUBDIR/..", &entry) == 0) && (entry.is_dir) && (0U == entry.first_cluster));
+    TEST_CHECK((fatfs_lookup("/SUBDIR/../README.TXT", &entry) == 0) && (700U == entry.size));
+    TEST_CHECK((fatfs_lookup("/SUBDIR/./../SUBDIR/FILE0014.BIN", &entry) == 0) && (1400U == entry.size));
+    TEST_CHECK(fatfs_lookup("/.", &entry) != 0); /** The root has no "." entry */
+    TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0014.BIN.BAK", &entry) != 0);
+    TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0014", &entry) != 0);
+    TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0014.BIN/..", &entry) != 0);
+    TEST_CHECK(fatfs_lookup("/NOTES.TXT", &entry) == 0);
+    TEST_CHECK(fatfs_lookup("/Notes of the volume", &entry) != 0);
+    memset(longPath, 'A', sizeof(longPath) - 1U);
+    longPath[0] = '/';
+    longPath[sizeof(longPath) - 1U] = '\0';
+    TEST_CHECK(fatfs_lookup(longPath, &entry) != 0);
+}
+
+/**
+ * @brief Check the dentry cache: a listing dropped while in use, a budget too small for any
+ * listing, and listings served again after they were evicted.
+ *
+ * @param dir First cluster of the subdirectory.
+ */
+static void test_dir_cache(uint32_t dir)
+{
+    const DirList *held = NULL;  /** Listing in use while dropped */
+    const DirList *fresh = NULL; /** Listing read again */
+    DirEntry entry;              /** Entry looked up */
+
+    held = fatfs_dir_acquire(dir);
+    fatfs_dir_invalidate(dir);
+    fresh = fatfs_dir_acquire(dir);
+    TEST_CHECK((held != NULL) && (fresh != NULL) && (held != fresh));
+    TEST_CHECK((held != NULL) && (held->count == TEST_DIR_FILES + 2U) && (fatfs_long_name(held, &held->entries[2]) != NULL));
+    fatfs_dir_release(fresh);
+    fatfs_dir_release(held); /** Freed here, out of the cache */
+    fatfs_dir_invalidate_all();
+    fatfs_dir_invalidate(dir); /** Nothing left to drop */
+
+    /** Over budget, a listing lives as long as it is in use */
+    fatfs_set_dcache_budget(1U);
+    held = fatfs_dir_acquire(dir);
+    TEST_CHECK((held != NULL) && (held->count == TEST_DIR_FILES + 2U));
+    TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0039.BIN", &entry) == 0);
+    TEST_CHECK((fatfs_lookup("/README.TXT", &entry) == 0) && (700U == entry.size));
+    fatfs_dir_release(held);
+    fresh = fatfs_dir_acquire(dir);
+    TEST_CHECK((fresh != NULL) && (fresh->count == TEST_DIR_FILES + 2U));
+    fatfs_dir_release(fresh);
+    fatfs_set_dcache_budget(0);
+    TEST_CHECK(fatfs_lookup("/SUBDIR/FILE0039.BIN", &entry) == 0);
+}
+
+/**
+ * @brief Check long names written entry by entry in the root of a FAT16 volume: an orphan of
+ * another checksum, a deleted one, names filling whole entries, and a name out of ASCII.
+ */
+static void test_dir_names(void)
+{
+    static const uint16_t cafe[12] = {'C', 'a', 'f', 0x00E9U, ' ', 0x2615U, ' ', 0xD83DU, 0xDE00U, '.', 't', 'x'}; /** "Café ☕ 😀.tx" */
+    static const uint8_t positions[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30}; /** Characters of a long name entry */
+    static const char *utf8 = "Caf\xC3\xA9 \xE2\x98\x95 \xF0\x9F\x98\x80.tx";              /** The same name in UTF-8 */
+    test_image_t img;            /** Volume */
+    DirList list = {0};          /** Listing of the root */
+    DirEntry entry;              /** Entry looked up */
+    uint8_t *root = NULL;        /** Slots of the root directory */
+    char path[64];               /** Path looked up */
+    uint32_t i = 0;              /** Used as an index of operation */
+    bool ok = false;             /** The volume was built */
+
+    printf("test_dir: long names\n");
+    ok = test_image_create(&img, FAT_TYPE_16, 40000U, 1);
+    if (TEST_CHECK(ok))
+    {
+        root = img.data + ((size_t)img.root_start * TEST_SECTOR_SIZE);
+        ok = (test_image_add(&img, 0, "ORPHAN.TXT", "Orphan name", 0x20U, 0, 1U)) &&                 /** Slots 0 and 1 */
+             (test_image_add(&img, 0, "DELETED.TXT", "Deleted name", 0x20U, 0, 2U)) &&              /** Slots 2 and 3 */
+             (test_image_add(&img, 0, "THIRTEEN.TXT", "Thirteen char", 0x20U, 0, 3U)) &&           /** Slots 4 and 5 */
+             (test_image_add(&img, 0, "TWENTY.TXT", "Twenty six characters long", 0x20U, 0, 4U)) && /** Slots 6 to 8 */
+             (test_image_add(&img, 0, "CAFE.TX", "Twelve chars", 0x20U, 0, 5U));                   /** Slots 9 and 10 */
+        root[13] ^= 0x5AU;                    /** Checksum of another short name */
+        root[2U * 32U] = 0xE5U;               /** Deleted long name entry before a live short entry */
+        for (i = 0; i < 12U; i++)
+        {
+            root[(9U * 32U) + positions[i]] = (uint8_t)(cafe[i] & 0xFFU);
+            root[(9U * 32U) + positions[i] + 1U] = (uint8_t)(cafe[i] >> 8);
+        }
+        ok = (ok) && (test_image_save(&img, TEST_DIR_PATH, 0, 0));
+    }
+    if ((TEST_CHECK(ok)) && (TEST_CHECK(fatfs_init(TEST_DIR_PATH) == 0)))
+    {
+        if ((TEST_CHECK(fatfs_read_dir(0, &list) == 0)) && (TEST_CHECK(5U == list.count)))
+        {
+            TEST_CHECK(NULL == fatfs_long_name(&list, &list.entries[0]));
+            TEST_CHECK(NULL == fatfs_long_name(&list, &list.entries[1]));
+            TEST_CHECK((fatfs_long_name(&list, &list.entries[2]) != NULL) && (strcmp(fatfs_long_name(&list, &list.entries[2]), "Thirteen char") == 0));
+            TEST_CHECK((fatfs_long_name(&list, &list.entries[3]) != NULL) &&
+                       (strcmp(fatfs_long_name(&list, &list.entries[3]), "Twenty six characters long") == 0));
+            TEST_CHECK((fatfs_long_name(&list, &list.entries[4]) != NULL) && (strcmp(fatfs_long_name(&list, &list.entries[4]), utf8) == 0));
+        }
+        free_entries(&list);
+        TEST_CHECK((fatfs_lookup("/ORPHAN.TXT", &entry) == 0) && (1U == entry.size));
+        TEST_CHECK(fatfs_lookup("/Orphan name", &entry) != 0);
+        TEST_CHECK((fatfs_lookup("/DELETED.TXT", &entry) == 0) && (2U == entry.size));
+        TEST_CHECK(fatfs_lookup("/Deleted name", &entry) != 0);
+        TEST_CHECK((fatfs_lookup("/THIRTEEN CHAR", &entry) == 0) && (3U == entry.size));
+        snprintf(path, sizeof(path), "/%s", utf8);
+        TEST_CHECK((fatfs_lookup(path, &entry) == 0) && (5U == entry.size));
+        path[1] = 'c'; /** Without case on the ASCII letters */
+        TEST_CHECK((fatfs_lookup(path, &entry) == 0) && (5U == entry.size));
+        fatfs_deinit();
+    }
+    if (ok)
+    {
+        test_image_free(&img);
+    }
+}
+
+/**
+ * @brief Check a directory of many entries listed by columns against its listing, and the
+ * sum, selection and sort of its columns against plain loops.
+ */
+static void test_dir_columns(void)
+{
+    static uint32_t indexes[TEST_DIR_BIG + 2U]; /** Entries selected */
+    fatfs_dir_columns_t columns = {0};          /** Listing by columns */
+    test_image_t img;                           /** Volume */
+    DirList list = {0};                         /** Listing of the directory */
+    char name[16];                              /** 8.3 name */
+    uint64_t sum = 0;                           /** Sum of the sizes */
+    uint32_t dir = 0;                           /** The large directory */
+    uint32_t dirs = 0;                          /** Directories of the listing */
+    uint32_t selected = 0;                      /** Entries in the selected range */
+    uint32_t i = 0;                             /** Used as an index of operation */
+    bool same = true;                           /** Every entry matches */
+    bool ok = false;                            /** The volume was built */
+
+    printf("test_dir: columns\n");
+    ok = test_image_create(&img, FAT_TYPE_32, 68000U, 1);
+    if (TEST_CHECK(ok))
+    {
+        dir = test_image_mkdir(&img, 0, "BIG", NULL);
+        for (i = 0; (dir != 0) && (ok) && (i < TEST_DIR_BIG); i++)
+        {
+            snprintf(name, sizeof(name), "E%07u", i);
+            ok = test_image_add(&img, dir, name, NULL, (0U == i % 7U) ? 0x10U : 0x20U, 2U + ((i * 7919U) % 60000U), (i * 2654435761U) % 100000U);
+        }
+        ok = (ok) && (dir != 0) && (test_image_save(&img, TEST_DIR_PATH, 0, 0));
+    }
+    if ((TEST_CHECK(ok)) && (TEST_CHECK(fatfs_init(TEST_DIR_PATH) == 0)))
+    {
+        if ((TEST_CHECK(fatfs_read_dir(dir, &list) == 0)) && (TEST_CHECK(fatfs_read_dir_columns(dir, &columns) == 0)) &&
+            (TEST_CHECK((TEST_DIR_BIG + 2U == list.count) && (columns.count == list.count))))
+        {
+            for (i = 0; i < list.count; i++)
+            {
+                same = (same) && (memcmp(columns.names[i], list.entries[i].name, sizeof(columns.names[i])) == 0);
+                same = (same) && (columns.sizes[i] == list.entries[i].size) && (columns.clusters[i] == list.entries[i].first_cluster);
+                same = (same) && (columns.mtimes[i] == (((uint32_t)list.entries[i].modified_date << 16) | list.entries[i].modified_time));
+                same = (same) && ((0U != ((columns.dirs[i / 64U] >> (i % 64U)) & 1U)) == (0 != list.entries[i].is_dir));
+                dirs += (list.entries[i].is_dir) ? 1U : 0U;
+                sum += list.entries[i].size;
+                selected += ((list.entries[i].size >= 25000U) && (list.entries[i].size <= 50000U)) ? 1U : 0U;
+            }
+            TEST_CHECK(same);
+            TEST_CHECK(fatfs_columns_dirs(&columns) == dirs);
+            TEST_CHECK(fatfs_column_sum(columns.sizes, columns.count) == sum);
+            TEST_CHECK(fatfs_column_select(columns.sizes, columns.count, 25000U, 50000U, indexes) == selected);
+            same = true;
+            for (i = 0; i < selected; i++)
+            {
+                same = (same) && (columns.sizes[indexes[i]] >= 25000U) && (columns.sizes[indexes[i]] <= 50000U) && ((0U == i) || (indexes[i - 1U] < indexes[i]));
+            }
+            TEST_CHECK(same);
+            test_dir_sorted(columns.sizes, columns.count);
+            test_dir_sorted(columns.clusters, columns.count);
+            test_dir_sorted(columns.mtimes, columns.count);
+        }
+        free_entries(&list);
+        fatfs_free_columns(&columns);
+        fatfs_deinit();
+    }
+    if (ok)
+    {
+        test_image_free(&img);
+    }
+}
+
+/**
+ * @brief Check the sort of a column: every entry once, values in order, equal values in the
+ * order of the listing.
+ *
+ * @param column Column sorted.
+ * @param count Entries of the column.
+ */
+static void test_dir_sorted(const uint32_t *column, uint32_t count)
+{
+    static uint32_t order[TEST_DIR_BIG + 2U]; /** Entries in order of value */
+    static uint8_t seen[TEST_DIR_BIG + 2U];   /** Entries found in the order */
+    uint32_t i = 0;                           /** Used as an index of operation */
+    bool same = true;                         /** The order is right */
+
+    memset(seen, 0, sizeof(seen));
+    if (TEST_CHECK((count <= TEST_DIR_BIG + 2U) && (fatfs_column_sort(column, count, order) == 0)))
+    {
+        for (i = 0; i < count; i++)
+        {
+            same = (same) && (order[i] < count) && (0U == seen[order[i]]);
+            seen[(order[i] < count) ? order[i] : 0U] = 1U;
+            same = (same) && ((0U == i) || (column[order[i - 1U]] < column[order[i]]) ||
+                              ((column[order[i - 1U]] == column[order[i]]) && (order[i - 1U] < order[i])));
+        }
+        TEST_CHECK(same);
+    }
+}
+
+/**
+ * @brief Make the allocations fail at every point of a listing: the read reports the error,
+ * or returns the whole directory with every long name, and only a whole listing is cached.
+ *
+ * @param dir First cluster of the subdirectory.
+ */
+static void test_dir_alloc(uint32_t dir)
+{
+    fatfs_dir_columns_t columns = {0}; /** Listing by columns */
+    DirList list = {0};                /** Listing read without the cache */
+    uint32_t successes = 0;            /** Allocations allowed before the failure */
+    int result = 0;                    /** Status of the read */
+    const DirList *cached = NULL;      /** Listing of the cache */
+    DirEntry entry;                    /** Entry found by a lookup */
+    bool whole = false;                /** Every read was complete or failed */
+    bool failed = false;               /** At least one read failed */
+
+    for (successes = 0; (successes < 64U) && (!whole); successes++)
+    {
+        test_fail_alloc(successes);
+        result = fatfs_read_dir(dir, &list);
+        test_fail_alloc(TEST_ALLOC_ALWAYS);
+        TEST_CHECK((-1 == result) || ((0 == result) && (test_dir_complete(&list))));
+        failed = (failed) || (-1 == result);
+        whole = (0 == result);
+        free_entries(&list);
+    }
+    TEST_CHECK((failed) && (whole));
+
+    whole = false;
+    failed = false;
+    for (successes = 0; (successes < 64U) && (!whole); successes++)
+    {
+        test_fail_alloc(successes);
+        result = fatfs_read_dir_columns(dir, &columns);
+        test_fail_alloc(TEST_ALLOC_ALWAYS);
+        TEST_CHECK((-1 == result) || ((0 == result) && (TEST_DIR_FILES + 2U == columns.count)));
+        failed = (failed) || (-1 == result);
+        whole = (0 == result);
+        fatfs_free_columns(&columns);
+    }
+    TEST_CHECK((failed) && (whole));
+
+    whole = false;
+    failed = false;
+    for (successes = 0; (successes < 64U) && (!whole); successes++)
+    {
+        fatfs_dir_invalidate_all();
+        test_fail_alloc(successes);
+        cached = fatfs_dir_acquire(dir);
+        test_fail_alloc(TEST_ALLOC_ALWAYS);
+        TEST_CHECK((NULL == cached) || (test_dir_complete(cached)));
+        failed = (failed) || (NULL == cached);
+        whole = (cached != NULL);
+        fatfs_dir_release(cached);
+        /** Served by the cache once the listing is whole */
+        TEST_CHECK((fatfs_lookup("/SUBDIR/File number 14 with a name of several entries.bin", &entry) == 0) && (1400U == entry.size));
+    }
+    TEST_CHECK((failed) && (whole));
+}
+
+/**
+ * @brief Check that a listing of the subdirectory holds every file with its long name.
+ *
+ * @param list Listing of the subdirectory.
+ * @return bool true when the listing is whole.
+ */
+static bool test_dir_complete(const DirList *list)
+{
+    uint32_t i = 0;                                   /** Used as an index of operation */
+    bool whole = (TEST_DIR_FILES + 2U == list->count); /** The dot entries, then the files */
+
+    for (i = 2U; (i < list->count) && (whole); i++)
+    {
+        whole = (fatfs_long_name(list, &list->entries[i]) != NULL);
+    }
+
+    return whole;
+}
@@ -0,0 +1,175 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_FILE_PATH "file.img"   /** Image built by the test */
+#define TEST_FILE_OUT "file.out"    /** Output of fatfs_read_file */
+#define TEST_FILE_TIMEOUT 120U      /** Seconds before a read that does not return fails the test */
+#define TEST_FILE_LOOP 4U           /** Clusters of the looping chain */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_file_capture(uint32_t first_cluster, uint8_t **data, long *size); /** Run fatfs_read_file into a file */
+static void test_file_expect(const test_image_t *img, uint32_t first_cluster, uint32_t hops); /** Compare the output with the chain */
+static void test_file_mount(const test_image_t *img, const uint32_t *files, uint32_t count, kmc_mode_t mode, uint32_t depth); /** Check one mount */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check the bytes written by fatfs_read_file in every mode of the HAL, synchronous and
+ * with reads in flight, for contiguous and fragmented files and for a chain that loops.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    static const kmc_mode_t modes[] = {KMC_MODE_STDIO, KMC_MODE_MMAP, KMC_MODE_PREAD, KMC_MODE_DIRECT, KMC_MODE_RAMDISK}; /** Modes of the HAL */
+    static const uint32_t depths[] = {1U, 8U}; /** Extents read one by one, then the asynchronous window */
+    test_image_t img;                          /** Volume */
+    uint32_t files[3];                         /** First cluster of each file, the looping one last */
+    uint32_t m = 0;                            /** Used as an index of operation */
+    uint32_t d = 0;                            /** Used as an index of operation */
+    bool ok = false;                           /** The volume was built */
+
+    alarm(TEST_FILE_TIMEOUT); /** A read that spins kills the test instead of hanging the run */
+    printf("test_file: 1.44 MB floppy\n");
+    ok = test_image_create(&img, FAT_TYPE_12, 2880U, 1U);
+    if (TEST_CHECK(ok))
+    {
+        files[0] = test_image_file(&img, 0, "CONTIG.BIN", NULL, 20000U, 0);
+        files[1] = test_image_file(&img, 0, "FRAG.BIN", NULL, 30000U, 1);
+        files[2] = test_image_file(&img, 0, "LOOP.BIN", NULL, TEST_FILE_LOOP * TEST_SECTOR_SIZE, 0);
+        test_image_set_fat(&img, files[2] + TEST_FILE_LOOP - 1U, files[2]); /** The last cluster links back to the first */
+        ok = (files[0] != 0) && (files[1] != 0) && (files[2] != 0) && (test_image_save(&img, TEST_FILE_PATH, 0, 0));
+    }
+    if (TEST_CHECK(ok))
+    {
+        for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+            {
+                test_file_mount(&img, files, 3U, modes[m], depths[d]);
+            }
+        }
+    }
+    if (ok)
+    {
+        test_image_free(&img);
+    }
+    unlink(TEST_FILE_PATH);
+    unlink(TEST_FILE_OUT);
+
+    return test_result("test_file");
+}
+
+/**
+ * @brief Run fatfs_read_file with stdout sent to a file, then load that file.
+ *
+ * @param first_cluster First cluster of the file read.
+ * @param data Receives the bytes written, to release with free.
+ * @param size Receives the number of bytes written.
+ * @return bool false when the output could not be captured.
+ */
+static bool test_file_capture(uint32_t first_cluster, uint8_t **data, long *size)
+{
+    FILE *in = NULL;                                              /** The output read back */
+    int saved = dup(STDOUT_FILENO);                               /** Terminal of the test */
+    int fd = open(TEST_FILE_OUT, O_CREAT | O_TRUNC | O_WRONLY, 0644); /** Output of the read */
+    bool ok = (saved >= 0) && (fd >= 0);                          /** Status of the capture */
+
+    *data = NULL;
+    *size = 0;
+    fflush(stdout);
+    ok = (ok) && (dup2(fd, STDOUT_FILENO) >= 0);
+    if (ok)
+    {
+        fatfs_read_file(NULL, first_cluster);
+        fflush(stdout);
+        ok = (dup2(saved, STDOUT_FILENO) >= 0);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (saved >= 0)
+    {
+        close(saved);
+    }
+    in = (ok) ? fopen(TEST_FILE_OUT, "rb") : NULL;
+    ok = (in != NULL) && (fseek(in, 0, SEEK_END) == 0) && ((*size = ftell(in)) >= 0) && (fseek(in, 0, SEEK_SET) == 0);
+    *data = (ok) ? (uint8_t *)malloc((size_t)*size + 1U) : NULL;
+    ok = (*data != NULL) && (fread(*data, 1, (size_t)*size, in) == (size_t)*size);
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Check that the output holds the clusters of the chain, whole, in chain order.
+ *
+ * @param img The volume.
+ * @param first_cluster First cluster of the file.
+ * @param hops Clusters written for a chain that loops, the entries of the FAT.
+ */
+static void test_file_expect(const test_image_t *img, uint32_t first_cluster, uint32_t hops)
+{
+    uint32_t cluster_bytes = img->spc * TEST_SECTOR_SIZE; /** Bytes per cluster */
+    uint32_t cluster = first_cluster;                     /** Used as an iterator over the chain */
+    uint32_t written = 0;                                 /** Clusters compared */
+    uint8_t *data = NULL;                                 /** Output of the read */
+    long size = 0;                                        /** Bytes of the output */
+    bool same = true;                                     /** Every cluster matches */
+
+    if (TEST_CHECK(test_file_capture(first_cluster, &data, &size)))
+    {
+        while ((cluster >= 2U) && (cluster < img->cluster_count + 2U) && (written < hops))
+        {
+            same = (same) && ((long)((written + 1U) * cluster_bytes) <= size) &&
+                   (memcmp(data + ((size_t)written * cluster_bytes), test_image_cluster(img, cluster), cluster_bytes) == 0);
+            cluster = test_image_get_fat(img, cluster);
+            written++;
+        }
+        TEST_CHECK((same) && (size == (long)written * (long)cluster_bytes));
+    }
+    free(data);
+}
+
+/**
+ * @brief Mount the volume in one mode at one queue depth and read every file.
+ *
+ * @param img The volume.
+ * @param files First cluster of each file.
+ * @param count Number of files.
+ * @param mode Mode of the HAL.
+ * @param depth Queue depth, above 1 for the asynchronous window.
+ */
+static void test_file_mount(const test_image_t *img, const uint32_t *files, uint32_t count, kmc_mode_t mode, uint32_t depth)
+{
+    kmc_config_t config;                                                /** Configuration of the HAL */
+    uint32_t entries = img->fat_sectors * TEST_SECTOR_SIZE * 8U / 12U;  /** Entries of the FAT12 */
+    uint32_t i = 0;                                                     /** Used as an index of operation */
+
+    entries = (entries > img->cluster_count + 2U) ? (img->cluster_count + 2U) : entries;
+    memset(&config, 0, sizeof(config));
+    config.mode = mode;
+    config.queue_depth = depth;
+    if (TEST_CHECK(fatfs_init_ex(TEST_FILE_PATH, &config) == 0))
+    {
+        for (i = 0; i < count; i++)
+        {
+            test_file_expect(img, files[i], entries);
+        }
+        fatfs_deinit();
+    }
+}
@@ -0,0 +1,312 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include "../FATfs_check.h"
+#include "../FATfs_owner.h"
+#include "../FATfs_catalog.h"
+#include <unistd.h>
+
+#ifndef TEST_FLOPPY_IMAGE
+#define TEST_FLOPPY_IMAGE "../../floppy.img" /** Floppy of the repository, seen from the build directory */
+#endif
+#define TEST_FLOPPY_CATALOG "floppy.cat"     /** Catalog built by the test */
+#define TEST_FLOPPY_DEPTH 8U                 /** Deepest directory walked */
+#define TEST_FLOPPY_EXTENTS 64U              /** Room for the extents of one file */
+
+/**
+ * @brief  Define the floppy as read by the test itself, without the reader under test
+ */
+typedef struct
+{
+    uint8_t *data;          /** Whole image */
+    long size;              /** Size of the image */
+    uint32_t cluster_bytes; /** Bytes per cluster */
+    uint32_t fat_start;     /** First sector of the first FAT */
+    uint32_t data_start;    /** First sector of cluster 2 */
+    uint32_t cluster_count; /** Number of data clusters */
+} test_floppy_raw_t;
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static test_floppy_raw_t s_raw; /** The floppy, read directly */
+static uint32_t s_files;        /** Files found by the walk */
+static uint32_t s_dirs;         /** Directories found by the walk, the root included */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_floppy_load(void);                                                         /** Read the floppy and its boot sector */
+static uint32_t test_floppy_next(uint32_t cluster);                                         /** Decode a FAT12 entry */
+static uint32_t test_floppy_raw_read(uint32_t first_cluster, uint32_t size, uint8_t *buff); /** Read a file by its chain */
+static void test_floppy_dir(uint32_t directory, uint32_t depth);                            /** Check a directory and its children */
+static void test_floppy_file(const DirEntry *entry);                                        /** Check the bytes and sectors of a file */
+static void test_floppy_columns(uint32_t directory, const DirList *list);                   /** Check the columns of a directory */
+static void test_floppy_catalog(uint32_t directory, const DirList *list);                   /** Check the catalog of a directory */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check the reader on the floppy shipped with the repository: every file against an
+ * independent FAT12 reader, the owner of every sector, the columns and the catalog of every
+ * directory, and a clean check at one and several threads.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    fatfs_check_report_t one;  /** Report of one thread */
+    fatfs_check_report_t many; /** Report of several threads */
+
+    printf("test_floppy: %s\n", TEST_FLOPPY_IMAGE);
+    if ((TEST_CHECK(test_floppy_load())) && (TEST_CHECK(fatfs_init(TEST_FLOPPY_IMAGE) == 0)))
+    {
+        TEST_CHECK((fatfs_get_geometry()->data_start == s_raw.data_start) && (fatfs_get_geometry()->cluster_count == s_raw.cluster_count));
+        TEST_CHECK(FAT_TYPE_12 == fatfs_get_geometry()->type);
+        TEST_CHECK(fatfs_owner_build() == 0);
+        unlink(TEST_FLOPPY_CATALOG);
+        TEST_CHECK(fatfs_catalog_build(TEST_FLOPPY_IMAGE, TEST_FLOPPY_CATALOG) == 0);
+        TEST_CHECK(fatfs_catalog_open(TEST_FLOPPY_IMAGE, TEST_FLOPPY_CATALOG) == 0);
+        test_floppy_dir(0, 0);
+        TEST_CHECK((s_files > 0U) && (s_dirs > 1U));
+
+        /** The floppy is clean, and the threads do not change the report */
+        memset(&one, 0, sizeof(one));
+        memset(&many, 0, sizeof(many));
+        TEST_CHECK(fatfs_check(1, &one, NULL) == 0);
+        TEST_CHECK(fatfs_check(4, &many, NULL) == 0);
+        many.threads = one.threads;
+        TEST_CHECK(memcmp(&one, &many, sizeof(one)) == 0);
+        TEST_CHECK((one.files == s_files) && (one.directories == s_dirs) && (0U == one.lost_clusters) && (0U == one.cross_links));
+        TEST_CHECK((0U == one.fat_mismatches) && (0U == one.bad_links) && (0U == one.bad_entries) && (0U == one.size_mismatches));
+
+        fatfs_catalog_close();
+        fatfs_owner_deinit();
+        fatfs_deinit();
+    }
+    free(s_raw.data);
+    unlink(TEST_FLOPPY_CATALOG);
+
+    return test_result("test_floppy");
+}
+
+/**
+ * @brief Read the whole floppy and the layout of its boot sector.
+ *
+ * @return bool false on error.
+ */
+static bool test_floppy_load(void)
+{
+    FILE *in = fopen(TEST_FLOPPY_IMAGE, "rb"); /** The image */
+    const uint8_t *boot = NULL;                /** Boot sector */
+    uint32_t bps = 0;                          /** Bytes per sector */
+    uint32_t total = 0;                        /** Sectors of the volume */
+    uint32_t root = 0;                         /** Sectors of the root directory */
+    bool ok = (in != NULL);                    /** Status of the load */
+
+    ok = (ok) && (fseek(in, 0, SEEK_END) == 0) && ((s_raw.size = ftell(in)) >= (long)TEST_SECTOR_SIZE) && (fseek(in, 0, SEEK_SET) == 0);
+    s_raw.data = (ok) ? (uint8_t *)malloc((size_t)s_raw.size) : NULL;
+    ok = (s_raw.data != NULL) && (fread(s_raw.data, 1, (size_t)s_raw.size, in) == (size_t)s_raw.size);
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+    if (ok)
+    {
+        boot = s_raw.data;
+        bps = (uint32_t)boot[11] | ((uint32_t)boot[12] << 8);
+        total = (uint32_t)boot[19] | ((uint32_t)boot[20] << 8);
+        root = ((((uint32_t)boot[17] | ((uint32_t)boot[18] << 8)) * 32U) + bps - 1U) / bps;
+        s_raw.cluster_bytes = bps * boot[13];
+        s_raw.fat_start = (uint32_t)boot[14] | ((uint32_t)boot[15] << 8);
+        s_raw.data_start = s_raw.fat_start + (boot[16] * ((uint32_t)boot[22] | ((uint32_t)boot[23] << 8))) + root;
+        s_raw.cluster_count = (total - s_raw.data_start) / boot[13];
+        ok = (TEST_SECTOR_SIZE == bps) && ((uint64_t)total * bps <= (uint64_t)s_raw.size);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Decode an entry of the first FAT.
+ *
+ * @param cluster Cluster of the entry.
+ * @return uint32_t Next cluster, or an end of chain marker.
+ */
+static uint32_t test_floppy_next(uint32_t cluster)
+{
+    const uint8_t *fat = s_raw.data + ((size_t)s_raw.fat_start * TEST_SECTOR_SIZE); /** First FAT */
+    uint32_t offset = cluster + (cluster / 2U);                                     /** Offset of the 12 bits */
+    uint32_t value = (uint32_t)fat[offset] | ((uint32_t)fat[offset + 1U] << 8);     /** 16 bits holding them */
+
+    return (cluster & 1U) ? (value >> 4) : (value & 0xFFFU);
+}
+
+/**
+ * @brief Read a file by following its chain in the first FAT.
+ *
+ * @param first_cluster First cluster of the file.
+ * @param size Size of the file.
+ * @param buff Receives the file, room for size bytes.
+ * @return uint32_t Bytes read, less than size when the chain is short.
+ */
+static uint32_t test_floppy_raw_read(uint32_t first_cluster, uint32_t size, uint8_t *buff)
+{
+    uint32_t cluster = first_cluster; /** Used as an iterator over the chain */
+    uint32_t done = 0;                /** Bytes read */
+    uint32_t chunk = 0;               /** Bytes taken from the cluster */
+
+    while ((done < size) && (cluster >= 2U) && (cluster < s_raw.cluster_count + 2U))
+    {
+        chunk = ((size - done) < s_raw.cluster_bytes) ? (size - done) : s_raw.cluster_bytes;
+        memcpy(buff + done, s_raw.data + ((size_t)(s_raw.data_start * TEST_SECTOR_SIZE) + ((size_t)(cluster - 2U) * s_raw.cluster_bytes)), chunk);
+        done += chunk;
+        cluster = test_floppy_next(cluster);
+    }
+
+    return done;
+}
+
+/**
+ * @brief Check the bytes of a file and the owner of each of its sectors.
+ *
+ * @param entry Entry of the file.
+ */
+static void test_floppy_file(const DirEntry *entry)
+{
+    fatfs_extent_t extents[TEST_FLOPPY_EXTENTS];           /** Extents of the file */
+    fatfs_owner_t owner;                                   /** Owner of a sector */
+    uint8_t *got = (uint8_t *)malloc(entry->size + 1U);    /** File read by the reader */
+    uint8_t *want = (uint8_t *)malloc(entry->size + 1U);   /** File read directly */
+    uint32_t spc = s_raw.cluster_bytes / TEST_SECTOR_SIZE; /** Sectors per cluster */
+    uint32_t sector = 0;                                   /** Sector of the volume */
+    uint32_t offset = 0;                                   /** Offset of the sector in the file */
+    uint32_t k = 0;                                        /** Used as an index of operation */
+    int count = 0;                                         /** Extents of the file */
+    int e = 0;                                             /** Used as an index of operation */
+    bool same = true;                                      /** Every sector matches */
+
+    s_files++;
+    if ((TEST_CHECK((got != NULL) && (want != NULL))) && (TEST_CHECK(test_floppy_raw_read(entry->first_cluster, entry->size, want) == entry->size)))
+    {
+        TEST_CHECK(fatfs_read_at(entry->first_cluster, entry->size, 0, got, entry->size) == (int32_t)entry->size);
+        TEST_CHECK(memcmp(got, want, entry->size) == 0);
+
+        /** Every data sector is owned by the file, at the offset holding the same bytes */
+        count = (entry->first_cluster != 0U) ? fatfs_get_extents(entry->first_cluster, extents, TEST_FLOPPY_EXTENTS) : 0;
+        TEST_CHECK((count >= 0) && (count <= (int)TEST_FLOPPY_EXTENTS));
+        for (e = 0; (count <= (int)TEST_FLOPPY_EXTENTS) && (e < count); e++)
+        {
+            for (k = 0; k < extents[e].length * spc; k++)
+            {
+                sector = s_raw.data_start + ((extents[e].first_cluster - 2U) * spc) + k;
+                offset = (extents[e].file_cluster * s_raw.cluster_bytes) + (k * TEST_SECTOR_SIZE);
+                same = (same) && (fatfs_owner_of_sector(sector, &owner) == 1) && (owner.first_cluster == entry->first_cluster) &&
+                       (owner.file_cluster == extents[e].file_cluster + (k / spc)) && (owner.size == entry->size);
+                same = (same) && ((offset >= entry->size) ||
+                                  (memcmp(s_raw.data + ((size_t)sector * TEST_SECTOR_SIZE), want + offset,
+                                          ((entry->size - offset) < TEST_SECTOR_SIZE) ? (entry->size - offset) : TEST_SECTOR_SIZE) == 0));
+            }
+        }
+        TEST_CHECK(same);
+    }
+    free(got);
+    free(want);
+}
+
+/**
+ * @brief Check that the columns of a directory hold the entries of its listing.
+ *
+ * @param directory First cluster of the directory, 0 for the root.
+ * @param list Listing of the directory.
+ */
+static void test_floppy_columns(uint32_t directory, const DirList *list)
+{
+    fatfs_dir_columns_t columns = {0}; /** Columns of the directory */
+    uint32_t dirs = 0;                 /** Directories of the listing */
+    uint32_t e = 0;                    /** Used as an index of operation */
+    bool same = true;                  /** Every entry matches */
+
+    if ((TEST_CHECK(fatfs_read_dir_columns(directory, &columns) == 0)) && (TEST_CHECK(columns.count == list->count)))
+    {
+        for (e = 0; e < list->count; e++)
+        {
+            same = (same) && (memcmp(columns.names[e], list->entries[e].name, sizeof(columns.names[e])) == 0);
+            same = (same) && (columns.sizes[e] == list->entries[e].size) && (columns.clusters[e] == list->entries[e].first_cluster);
+            same = (same) && (columns.mtimes[e] == (((uint32_t)list->entries[e].modified_date << 16) | list->entries[e].modified_time));
+            same = (same) && ((0 != ((columns.dirs[e / 64U] >> (e % 64U)) & 1U)) == (0 != list->entries[e].is_dir));
+            dirs += (list->entries[e].is_dir) ? 1U : 0U;
+        }
+        TEST_CHECK(same);
+        TEST_CHECK(fatfs_columns_dirs(&columns) == dirs);
+    }
+    fatfs_free_columns(&columns);
+}
+
+/**
+ * @brief Check that the catalog of a directory holds the entries of its listing.
+ *
+ * @param directory First cluster of the directory, 0 for the root.
+ * @param list Listing of the directory.
+ */
+static void test_floppy_catalog(uint32_t directory, const DirList *list)
+{
+    const fatfs_catalog_entry_t *entries = NULL; /** Listing of the catalog */
+    const fatfs_catalog_entry_t *found = NULL;   /** Entry found by path */
+    const char *longName = NULL;                 /** Long name of the listing */
+    uint32_t count = 0;                          /** Entries of the catalog listing */
+    uint32_t e = 0;                              /** Used as an index of operation */
+
+    if ((TEST_CHECK(fatfs_catalog_list(directory, &entries, &count) == 0)) && (TEST_CHECK(count == list->count)))
+    {
+        for (e = 0; e < count; e++)
+        {
+            TEST_CHECK(memcmp(entries[e].name, list->entries[e].name, sizeof(entries[e].name)) == 0);
+            TEST_CHECK((entries[e].size == list->entries[e].size) && (entries[e].first_cluster == list->entries[e].first_cluster));
+            longName = fatfs_long_name(list, &list->entries[e]);
+            TEST_CHECK(((NULL == longName) && (NULL == fatfs_catalog_long_name(&entries[e]))) ||
+                       ((longName != NULL) && (fatfs_catalog_long_name(&entries[e]) != NULL) && (strcmp(longName, fatfs_catalog_long_name(&entries[e])) == 0)));
+            if ('.' != entries[e].name[0])
+            {
+                TEST_CHECK((fatfs_catalog_lookup(fatfs_catalog_path(&entries[e]), &found) == 0) && (found == &entries[e]));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check a directory: its columns, its catalog, its files, then its subdirectories.
+ *
+ * @param directory First cluster of the directory, 0 for the root.
+ * @param depth Depth of the directory, the root at 0.
+ */
+static void test_floppy_dir(uint32_t directory, uint32_t depth)
+{
+    DirList list = {0}; /** Listing of the directory */
+    uint32_t e = 0;     /** Used as an index of operation */
+
+    s_dirs++;
+    if ((TEST_CHECK(depth < TEST_FLOPPY_DEPTH)) && (TEST_CHECK(fatfs_read_dir(directory, &list) == 0)))
+    {
+        test_floppy_columns(directory, &list);
+        test_floppy_catalog(directory, &list);
+        for (e = 0; e < list.count; e++)
+        {
+            if ((list.entries[e].is_dir) && ('.' != list.entries[e].name[0]))
+            {
+                test_floppy_dir(list.entries[e].first_cluster, depth + 1U);
+            }
+            else if (!list.entries[e].is_dir)
+            {
+                test_floppy_file(&list.entries[e]);
+            }
+        }
+    }
+    free_entries(&list);
+}
@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_FREE_PATH "free.img" /** Image built by the test */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_free_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t spc); /** Build a volume */
+static void test_free_reference(const uint8_t *used, uint32_t end, uint32_t *count, uint32_t *first, uint32_t *length); /** Count by scanning */
+static void test_free_volume(const char *name, fatfs_type_t type, uint32_t sectors, uint32_t spc, uint32_t fatBudget); /** Check a volume */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check the free cluster queries against a scan of the FAT, before and after clusters
+ * are marked used and free with fatfs_mark_clusters.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    test_free_volume("FAT12", FAT_TYPE_12, 4000U, 1U, 0U);
+    test_free_volume("FAT16", FAT_TYPE_16, 40000U, 2U, 0U);
+    test_free_volume("FAT32", FAT_TYPE_32, 140000U, 1U, 0U);
+    test_free_volume("FAT32 on demand", FAT_TYPE_32, 140000U, 1U, 4096U); /** FAT over budget: FSInfo first */
+    unlink(TEST_FREE_PATH);
+
+    return test_result("test_free");
+}
+
+/**
+ * @brief Build a volume with files scattered over it, and write it.
+ *
+ * @param img Receives the volume.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ * @param spc Sectors per cluster.
+ * @return bool false on error.
+ */
+static bool test_free_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, uint32_t spc)
+{
+    uint32_t dir = 0;                                          /** Subdirectory */
+    bool ok = test_image_create(img, type, sectors, spc);      /** Cleared on error */
+
+    if (ok)
+    {
+        dir = test_image_mkdir(img, 0, "DIR", NULL);
+        ok = (dir != 0) && (test_image_file(img, 0, "A.BIN", NULL, 20000U, 0) != 0) &&
+             (test_image_file(img, dir, "B.BIN", NULL, 30000U, 2) != 0) &&
+             (test_image_file(img, dir, "C.BIN", NULL, 5000U, 7) != 0);
+        img->cursor += 100U; /** A hole, then a file after it */
+        ok = (ok) && (test_image_file(img, 0, "D.BIN", NULL, 9000U, 0) != 0) && (test_image_save(img, TEST_FREE_PATH, 0, 0));
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Count the free clusters and find the largest free run by scanning.
+ *
+ * @param used One byte per cluster, 0 when free.
+ * @param end One past the last cluster.
+ * @param count Receives the free clusters.
+ * @param first Receives the first cluster of the largest run, the first one among equals.
+ * @param length Receives the length of the largest run.
+ */
+static void test_free_reference(const uint8_t *used, uint32_t end, uint32_t *count, uint32_t *first, uint32_t *length)
+{
+    uint32_t cluster = 0; /** Used as an index of operation */
+    uint32_t run = 0;     /** Length of the current run */
+
+    *count = 0;
+    *first = 0;
+    *length = 0;
+    for (cluster = 2; cluster < end; cluster++)
+    {
+        run = (0 == used[cluster]) ? (run + 1U) : 0U;
+        *count += (0 == used[cluster]) ? 1U : 0U;
+        if (run > *length)
+        {
+            *length = run;
+            *first = cluster + 1U - run;
+        }
+    }
+}
+
+/**
+ * @brief Check the free cluster queries of one volume.
+ *
+ * @param name Name of the volume, for the messages.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ * @param spc Sectors per cluster.
+ * @param fatBudget Memory given to the FAT, 0 for the default.
+ */
+static void test_free_volume(const char *name, fatfs_type_t type, uint32_t sectors, uint32_t spc, uint32_t fatBudget)
+{
+    test_image_t img;          /** Volume */
+    uint8_t *used = NULL;      /** Reference: one byte per cluster */
+    uint32_t end = 0;          /** One past the last cluster */
+    uint32_t count = 0;        /** Reference free count */
+    uint32_t first = 0;        /** Reference largest run */
+    uint32_t length = 0;       /** Reference length of the largest run */
+    uint32_t gotFirst = 0;     /** Largest run found */
+    uint32_t gotLength = 0;    /** Length of the largest run found */
+    uint32_t run = 0;          /** Run found by next-fit */
+    uint32_t again = 0;        /** Run found by the next call */
+    uint32_t hint = 0;         /** Stale FSInfo count */
+    uint32_t cluster = 0;      /** Used as an index of operation */
+    int fd = -1;               /** Image, to patch FSInfo */
+
+    printf("test_free: %s\n", name);
+    if (TEST_CHECK(test_free_build(&img, type, sectors, spc)))
+    {
+        end = img.cluster_count + 2U;
+        used = (uint8_t *)calloc(end, 1);
+        for (cluster = 2; (used != NULL) && (cluster < end); cluster++)
+        {
+            used[cluster] = (test_image_get_fat(&img, cluster) != 0) ? 1U : 0U;
+        }
+        test_free_reference(used, end, &count, &first, &length);
+
+        if (fatBudget != 0)
+        {
+            /** A stale FSInfo count answers until the bitmap is needed, the bitmap then gives the exact one */
+            hint = count - 10U;
+            fd = open(TEST_FREE_PATH, O_WRONLY);
+            TEST_CHECK((fd >= 0) && (pwrite(fd, &hint, sizeof(hint), 512 + 488) == (ssize_t)sizeof(hint)));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        fatfs_set_fat_budget(fatBudget);
+        if ((TEST_CHECK(used != NULL)) && (TEST_CHECK(fatfs_init(TEST_FREE_PATH) == 0)))
+        {
+            TEST_CHECK(fatfs_get_geometry()->type == type);
+            TEST_CHECK(fatfs_free_clusters() == ((fatBudget != 0) ? hint : count));
+            TEST_CHECK(fatfs_largest_free_extent(&gotFirst, &gotLength) == 0);
+            TEST_CHECK((gotFirst == first) && (gotLength == length));
+            TEST_CHECK(fatfs_free_clusters() == count);
+
+            /** Next-fit: a free run of the length asked, then the following one */
+            run = fatfs_next_fit(5);
+            TEST_CHECK((run >= 2U) && (run + 5U <= end));
+            for (cluster = run; (run != 0) && (cluster < run + 5U); cluster++)
+            {
+                TEST_CHECK(0 == used[cluster]);
+            }
+            again = fatfs_next_fit(5);
+            TEST_CHECK(again >= run + 5U);
+            TEST_CHECK(0 == fatfs_next_fit(length + 1U));
+
+            /** Allocate the largest run, then free it: count and largest run follow */
+            fatfs_mark_clusters(first, length, true);
+            memset(used + first, 1, length);
+            test_free_reference(used, end, &count, &first, &length);
+            TEST_CHECK(fatfs_free_clusters() == count);
+            TEST_CHECK(fatfs_largest_free_extent(&gotFirst, &gotLength) == 0);
+            TEST_CHECK((gotFirst == first) && (gotLength == length));
+
+            fatfs_mark_clusters(first, 3, true);
+            fatfs_mark_clusters(first, 3, true); /** Marking used clusters again changes nothing */
+            memset(used + first, 1, 3);
+            fatfs_mark_clusters(2, 4, false); /** Clusters of the root or of A.BIN, freed */
+            memset(used + 2, 0, 4);
+            fatfs_mark_clusters(0, 2, false); /** Reserved entries and clusters past the end are ignored */
+            fatfs_mark_clusters(end - 1U, 10, false);
+            used[end - 1U] = 0;
+            test_free_reference(used, end, &count, &first, &length);
+            TEST_CHECK(fatfs_free_clusters() == count);
+            TEST_CHECK(fatfs_largest_free_extent(&gotFirst, &gotLength) == 0);
+            TEST_CHECK((gotFirst == first) && (gotLength == length));
+            fatfs_deinit();
+        }
+        fatfs_set_fat_budget(0);
+        free(used);
+        test_image_free(&img);
+    }
+}
@@ -0,0 +1,798 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ENTRY_SIZE 32U     /** Size of a directory entry */
+#define TEST_LFN_CHARS 13U      /** Characters of a long name entry */
+#define TEST_ATTR_LFN 0x0FU     /** Attribute of a long name entry */
+#define TEST_ATTR_DIR 0x10U     /** Attribute of a directory */
+#define TEST_ATTR_ARCHIVE 0x20U /** Attribute of a file */
+#define TEST_ROOT_ENTRIES 512U  /** Entries of the fixed root directory of FAT12 and FAT16 */
+#define TEST_FAT32_RESERVED 32U /** Reserved sectors of a FAT32 volume */
+#define TEST_FSINFO_SECTOR 1U   /** Sector of the FSInfo structure */
+#define TEST_BACKUP_SECTOR 6U   /** Sector of the copy of the boot sector */
+#define TEST_WRITE_CHUNK (1024U * 1024U) /** Bytes written by one call */
+
+/*******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+static uint32_t s_checks = 0;      /** Checks made */
+static uint32_t s_failures = 0;    /** Checks failed */
+static uint64_t s_failStart = 0;   /** First byte whose read fails */
+static uint64_t s_failLength = 0;  /** Bytes whose read fails, 0 for none */
+static uint32_t s_allocLeft = TEST_ALLOC_ALWAYS; /** Allocations that still succeed */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+void *__real_malloc(size_t size);                                                          /** malloc of the C library */
+void *__real_realloc(void *ptr, size_t size);                                              /** realloc of the C library */
+void *__wrap_malloc(size_t size);                                                          /** malloc seen by the tests and the library */
+void *__wrap_realloc(void *ptr, size_t size);                                              /** realloc seen by the tests and the library */
+static bool test_alloc_allowed(void);                                                      /** Take one allocation from the budget */
+static uint8_t *test_image_slot(test_image_t *img, uint32_t dir, uint32_t index, bool grow); /** Get a slot of a directory */
+static bool test_image_short_name(const char *name, uint8_t *out);                         /** Convert a name to its 8.3 form */
+static uint8_t test_image_checksum(const uint8_t *shortName);                               /** Checksum of a short name */
+static void test_put16(uint8_t *p, uint32_t value);                                        /** Store 16 bits, little endian */
+static void test_put32(uint8_t *p, uint32_t value);                                        /** Store 32 bits, little endian */
+static int test_faulty_open(void **ctx, const char *imagePath, const kmc_config_t *config); /** Open the image */
+static int32_t test_faulty_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length); /** Read, failing on the range */
+static void test_faulty_close(void *ctx);                                                   /** Close the image */
+static int test_faulty_stat(void *ctx, kmc_stat_t *st);                                     /** Size of the image */
+
+const kmc_backend_t test_backend_faulty = {
+    "faulty", test_faulty_open, test_faulty_read, NULL, test_faulty_close, test_faulty_stat, NULL, NULL, NULL};
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Count a check and report it when it fails.
+ *
+ * @param ok Result of the check.
+ * @param text Text of the condition.
+ * @param file Source file of the check.
+ * @param line Line of the check.
+ * @return bool ok.
+ */
+bool test_check(bool ok, const char *text, const char *file, int line)
+{
+    s_checks++;
+    if (!ok)
+    {
+        s_failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Print the number of checks and failures of the program.
+ *
+ * @param name Name of the test program.
+ * @return int Exit status of the program: 0 when every check passed, 1 otherwise.
+ */
+int test_result(const char *name)
+{
+    printf("%s: %u checks, %u failed\n", name, s_checks, s_failures);
+
+    return (0 == s_failures) ? 0 : 1;
+}
+
+/**
+ * @brief Format an empty volume in memory.
+ *
+ * @param img Receives the volume.
+ * @param type FAT12 or FAT16 with a fixed root directory, or FAT32 with the root in cluster 2.
+ * @param total_sectors Sectors of the volume.
+ * @param spc Sectors per cluster.
+ * @return bool false on an allocation error or a layout that does not fit.
+ */
+bool test_image_create(test_image_t *img, fatfs_type_t type, uint32_t total_sectors, uint32_t spc)
+{
+    bool ok = true;             /** Cleared when the layout does not fit */
+    uint32_t root_sectors = 0;  /** Sectors of the fixed root directory */
+    uint32_t needed = 0;        /** FAT sectors needed by the clusters */
+    uint8_t *boot = NULL;       /** Boot sector */
+
+    memset(img, 0, sizeof(*img));
+    img->type = type;
+    img->spc = spc;
+    img->fat_count = 2;
+    img->reserved = (FAT_TYPE_32 == type) ? TEST_FAT32_RESERVED : 1U;
+    img->root_entries = (FAT_TYPE_32 == type) ? 0U : TEST_ROOT_ENTRIES;
+    /** The root of the standard 720 KiB, 1.44 MB and 2.88 MB floppies, so they get their fixed layout */
+    img->root_entries = ((FAT_TYPE_12 == type) && (1440U == total_sectors)) ? 112U : img->root_entries;
+    img->root_entries = ((FAT_TYPE_12 == type) && (2880U == total_sectors)) ? 224U : img->root_entries;
+    img->root_entries = ((FAT_TYPE_12 == type) && (5760U == total_sectors)) ? 240U : img->root_entries;
+    root_sectors = img->root_entries * TEST_ENTRY_SIZE / TEST_SECTOR_SIZE;
+    img->fat_sectors = 1;
+    do
+    {
+        img->fat_sectors = (needed > img->fat_sectors) ? needed : img->fat_sectors;
+        img->root_start = img->reserved + img->fat_count * img->fat_sectors;
+        img->data_start = img->root_start + root_sectors;
+        img->cluster_count = (img->data_start < total_sectors) ? (total_sectors - img->data_start) / spc : 0;
+        needed = (uint32_t)(((uint64_t)img->cluster_count + 2U) * (uint32_t)type / 8U + TEST_SECTOR_SIZE - 1U) / TEST_SECTOR_SIZE;
+    } while (needed > img->fat_sectors);
+
+    /** The reader tells FAT12 from FAT16 by the number of clusters */
+    if ((0 == img->cluster_count) || ((FAT_TYPE_12 == type) && (img->cluster_count >= 4085U)) ||
+        ((FAT_TYPE_16 == type) && ((img->cluster_count < 4085U) || (img->cluster_count >= 65525U))))
+    {
+        ok = false;
+    }
+    if (ok)
+    {
+        img->size = (uint64_t)total_sectors * TEST_SECTOR_SIZE;
+        img->data = (uint8_t *)calloc(1, (size_t)img->size);
+        ok = (img->data != NULL);
+    }
+    if (ok)
+    {
+        boot = img->data;
+        boot[0] = 0xEB;
+        boot[1] = 0x58;
+        boot[2] = 0x90;
+        memcpy(boot + 3, "MSWIN4.1", 8);
+        test_put16(boot + 11, TEST_SECTOR_SIZE);
+        boot[13] = (uint8_t)spc;
+        test_put16(boot + 14, img->reserved);
+        boot[16] = (uint8_t)img->fat_count;
+        test_put16(boot + 17, img->root_entries);
+        test_put16(boot + 19, ((total_sectors < 65536U) && (type != FAT_TYPE_32)) ? total_sectors : 0U);
+        boot[21] = 0xF8;
+        test_put16(boot + 22, (FAT_TYPE_32 == type) ? 0U : img->fat_sectors);
+        test_put16(boot + 24, 63U);
+        test_put16(boot + 26, 255U);
+        test_put32(boot + 32, ((total_sectors < 65536U) && (type != FAT_TYPE_32)) ? 0U : total_sectors);
+        if (FAT_TYPE_32 == type)
+        {
+            test_put32(boot + 36, img->fat_sectors);
+            test_put32(boot + 44, 2U);
+            test_put16(boot + 48, TEST_FSINFO_SECTOR);
+            test_put16(boot + 50, TEST_BACKUP_SECTOR);
+            boot[64] = 0x80;
+            boot[66] = 0x29;
+            test_put32(boot + 67, 0x12345678U);
+            memcpy(boot + 71, "TEST       FAT32   ", 19);
+        }
+        else
+        {
+            boot[36] = 0x80;
+            boot[38] = 0x29;
+            test_put32(boot + 39, 0x12345678U);
+            memcpy(boot + 43, (FAT_TYPE_12 == type) ? "TEST       FAT12   " : "TEST       FAT16   ", 19);
+        }
+        boot[510] = 0x55;
+        boot[511] = 0xAA;
+
+        test_image_set_fat(img, 0, (FAT_TYPE_32 == type) ? 0x0FFFFFF8U : ((FAT_TYPE_16 == type) ? 0xFFF8U : 0xFF8U));
+        test_image_set_fat(img, 1, (FAT_TYPE_32 == type) ? 0x0FFFFFFFU : ((FAT_TYPE_16 == type) ? 0xFFFFU : 0xFFFU));
+        img->cursor = 2;
+        if (FAT_TYPE_32 == type)
+        {
+            img->root_cluster = test_image_alloc(img, 1, 0);
+            ok = (2U == img->root_cluster);
+        }
+    }
+    if ((!ok) && (img->data != NULL))
+    {
+        test_image_free(img);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Release a volume built in memory.
+ *
+ * @param img The volume.
+ */
+void test_image_free(test_image_t *img)
+{
+    free(img->data);
+    memset(img, 0, sizeof(*img));
+}
+
+/**
+ * @brief Write a FAT entry in one copy of the FAT only.
+ *
+ * @param img The volume.
+ * @param copy Index of the copy, from 0.
+ * @param cluster Index of the entry.
+ * @param value Value of the entry.
+ */
+void test_image_set_fat_copy(test_image_t *img, uint32_t copy, uint32_t cluster, uint32_t value)
+{
+    uint8_t *fat = img->data + (uint64_t)(img->reserved + copy * img->fat_sectors) * TEST_SECTOR_SIZE; /** First byte of the copy */
+    uint8_t *p = NULL;                                                                                 /** Bytes of the entry */
+
+    if (FAT_TYPE_12 == img->type)
+    {
+        p = fat + cluster * 3U / 2U;
+        if (0 == (cluster & 1U))
+        {
+            p[0] = (uint8_t)value;
+            p[1] = (uint8_t)((p[1] & 0xF0U) | ((value >> 8) & 0x0FU));
+        }
+        else
+        {
+            p[0] = (uint8_t)((p[0] & 0x0FU) | ((value << 4) & 0xF0U));
+            p[1] = (uint8_t)(value >> 4);
+        }
+    }
+    else if (FAT_TYPE_16 == img->type)
+    {
+        test_put16(fat + cluster * 2U, value);
+    }
+    else
+    {
+        test_put32(fat + cluster * 4U, value);
+    }
+}
+
+/**
+ * @brief Write a FAT entry in every copy of the FAT.
+ *
+ * @param img The volume.
+ * @param cluster Index of the entry.
+ * @param value Value of the entry.
+ */
+void test_image_set_fat(test_image_t *img, uint32_t cluster, uint32_t value)
+{
+    uint32_t copy = 0; /** Used as an index of operation */
+
+    for (copy = 0; copy < img->fat_count; copy++)
+    {
+        test_image_set_fat_copy(img, copy, cluster, value);
+    }
+}
+
+/**
+ * @brief Read a FAT entry of the first FAT.
+ *
+ * @param img The volume.
+ * @param cluster Index of the entry.
+ * @return uint32_t Value of the entry.
+ */
+uint32_t test_image_get_fat(const test_image_t *img, uint32_t cluster)
+{
+    const uint8_t *fat = img->data + (uint64_t)img->reserved * TEST_SECTOR_SIZE; /** First FAT */
+    const uint8_t *p = NULL;                                                     /** Bytes of the entry */
+    uint32_t value = 0;                                                          /** Value of the entry */
+
+    if (FAT_TYPE_12 == img->type)
+    {
+        p = fat + cluster * 3U / 2U;
+        value = (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+        value = (0 == (cluster & 1U)) ? (value & 0xFFFU) : (value >> 4);
+    }
+    else if (FAT_TYPE_16 == img->type)
+    {
+        p = fat + cluster * 2U;
+        value = (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+    }
+    else
+    {
+        p = fat + cluster * 4U;
+        value = ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) & 0x0FFFFFFFU;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Get the bytes of a data cluster.
+ *
+ * @param img The volume.
+ * @param cluster Data cluster, from 2.
+ * @return uint8_t* First byte of the cluster.
+ */
+uint8_t *test_image_cluster(const test_image_t *img, uint32_t cluster)
+{
+    return img->data + ((uint64_t)img->data_start + (uint64_t)(cluster - 2U) * img->spc) * TEST_SECTOR_SIZE;
+}
+
+/**
+ * @brief Allocate a chain of free clusters, ended by an end of chain marker.
+ *
+ * @param img The volume.
+ * @param count Number of clusters.
+ * @param gap Free clusters skipped after every cluster, 0 for a contiguous chain.
+ * @return uint32_t First cluster of the chain, 0 when count is 0 or the volume is full.
+ */
+uint32_t test_image_alloc(test_image_t *img, uint32_t count, uint32_t gap)
+{
+    uint32_t eoc = (FAT_TYPE_32 == img->type) ? 0x0FFFFFFFU : ((FAT_TYPE_16 == img->type) ? 0xFFFFU : 0xFFFU); /** End of chain */
+    uint32_t end = img->cluster_count + 2U; /** One past the last cluster */
+    uint32_t first = 0;                     /** First cluster of the chain */
+    uint32_t previous = 0;                  /** Last cluster linked */
+    uint32_t cluster = img->cursor;         /** Candidate cluster */
+    uint32_t done = 0;                      /** Clusters allocated */
+
+    while ((done < count) && (cluster < end))
+    {
+        if (0 == test_image_get_fat(img, cluster))
+        {
+            test_image_set_fat(img, cluster, eoc);
+            memset(test_image_cluster(img, cluster), 0, (size_t)img->spc * TEST_SECTOR_SIZE);
+            if (0 == previous)
+            {
+                first = cluster;
+            }
+            else
+            {
+                test_image_set_fat(img, previous, cluster);
+            }
+            previous = cluster;
+            done++;
+            cluster += 1U + gap;
+        }
+        else
+        {
+            cluster++;
+        }
+    }
+    img->cursor = cluster;
+
+    return (done == count) ? first : 0U;
+}
+
+/**
+ * @brief Append an entry to a directory, its long name entries first.
+ *
+ * A directory in a cluster chain grows by one cluster when it is full.
+ *
+ * @param img The volume.
+ * @param dir First cluster of the directory, 0 for the root.
+ * @param name 8.3 name such as "FILE.TXT", "." or "..".
+ * @param long_name ASCII long name, NULL for none.
+ * @param attr Attribute byte.
+ * @param first_cluster First cluster of the entry.
+ * @param size Size in bytes.
+ * @return bool false when the directory is full or the name is not valid.
+ */
+bool test_image_add(test_image_t *img, uint32_t dir, const char *name, const char *long_name, uint8_t attr,
+                    uint32_t first_cluster, uint32_t size)
+{
+    static const uint8_t positions[TEST_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30}; /** Characters of a long name entry */
+    uint8_t shortName[11];                                                    /** 8.3 name as stored */
+    uint32_t length = (long_name != NULL) ? (uint32_t)strlen(long_name) : 0U; /** Characters of the long name */
+    uint32_t parts = (length + TEST_LFN_CHARS - 1U) / TEST_LFN_CHARS;          /** Long name entries */
+    uint32_t index = 0;                                                       /** First free slot */
+    uint32_t part = 0;                                                        /** Used as an index of operation */
+    uint32_t j = 0;                                                           /** Used as an index of operation */
+    uint32_t pos = 0;                                                         /** Character of the long name */
+    uint32_t c = 0;                                                           /** UTF-16 character */
+    uint8_t *slot = NULL;                                                     /** Entry being written */
+    bool ok = test_image_short_name(name, shortName);                         /** Cleared on error */
+
+    while ((ok) && ((slot = test_image_slot(img, dir, index, false)) != NULL) && (slot[0] != 0))
+    {
+        index++;
+    }
+    for (part = parts; (ok) && (part > 0); part--)
+    {
+        slot = test_image_slot(img, dir, index++, true);
+        ok = (slot != NULL);
+        if (ok)
+        {
+            memset(slot, 0, TEST_ENTRY_SIZE);
+            slot[0] = (uint8_t)(part | ((part == parts) ? 0x40U : 0U));
+            slot[11] = TEST_ATTR_LFN;
+            slot[13] = test_image_checksum(shortName);
+            for (j = 0; j < TEST_LFN_CHARS; j++)
+            {
+                pos = (part - 1U) * TEST_LFN_CHARS + j;
+                c = (pos < length) ? (uint8_t)long_name[pos] : ((pos == length) ? 0U : 0xFFFFU);
+                test_put16(slot + positions[j], c);
+            }
+        }
+    }
+    slot = ok ? test_image_slot(img, dir, index, true) : NULL;
+    if (slot != NULL)
+    {
+        memset(slot, 0, TEST_ENTRY_SIZE);
+        memcpy(slot, shortName, 11);
+        slot[11] = attr;
+        test_put16(slot + 20, first_cluster >> 16);
+        test_put16(slot + 22, 0x6000U); /** 12:00 */
+        test_put16(slot + 24, ((2024U - 1980U) << 9) | (1U << 5) | 1U);
+        test_put16(slot + 26, first_cluster & 0xFFFFU);
+        test_put32(slot + 28, size);
+    }
+
+    return (slot != NULL);
+}
+
+/**
+ * @brief Create a directory holding "." and "..".
+ *
+ * @param img The volume.
+ * @param dir First cluster of the parent, 0 for the root.
+ * @param name 8.3 name.
+ * @param long_name ASCII long name, NULL for none.
+ * @return uint32_t First cluster of the new directory, 0 on error.
+ */
+uint32_t test_image_mkdir(test_image_t *img, uint32_t dir, const char *name, const char *long_name)
+{
+    uint32_t cluster = test_image_alloc(img, 1, 0); /** First cluster of the directory */
+
+    if ((cluster != 0) &&
+        ((!test_image_add(img, cluster, ".", NULL, TEST_ATTR_DIR, cluster, 0)) ||
+         (!test_image_add(img, cluster, "..", NULL, TEST_ATTR_DIR, (dir == img->root_cluster) ? 0U : dir, 0)) ||
+         (!test_image_add(img, dir, name, long_name, TEST_ATTR_DIR, cluster, 0))))
+    {
+        cluster = 0;
+    }
+
+    return cluster;
+}
+
+/**
+ * @brief Create a file filled with test_image_pattern.
+ *
+ * @param img The volume.
+ * @param dir First cluster of the directory, 0 for the root.
+ * @param name 8.3 name.
+ * @param long_name ASCII long name, NULL for none.
+ * @param size Size in bytes.
+ * @param gap Free clusters skipped after every cluster of the file.
+ * @return uint32_t First cluster of the file, 0 for an empty file or on error.
+ */
+uint32_t test_image_file(test_image_t *img, uint32_t dir, const char *name, const char *long_name, uint32_t size, uint32_t gap)
+{
+    uint32_t bytes = img->spc * TEST_SECTOR_SIZE;                     /** Bytes per cluster */
+    uint32_t first = test_image_alloc(img, (size + bytes - 1U) / bytes, gap); /** First cluster of the file */
+    uint32_t cluster = first;                                         /** Cluster being filled */
+    uint32_t offset = 0;                                              /** Position in the file */
+    uint32_t chunk = 0;                                               /** Bytes of the cluster in the file */
+
+    while ((cluster >= 2U) && (offset < size))
+    {
+        chunk = ((size - offset) < bytes) ? (size - offset) : bytes;
+        test_image_pattern(first, offset, test_image_cluster(img, cluster), chunk);
+        offset += chunk;
+        cluster = test_image_get_fat(img, cluster);
+    }
+    if (((size > 0) && (0 == first)) || (!test_image_add(img, dir, name, long_name, TEST_ATTR_ARCHIVE, first, size)))
+    {
+        first = 0;
+    }
+
+    return first;
+}
+
+/**
+ * @brief Bytes of the files created by test_image_file: a function of the first cluster and the position.
+ *
+ * @param first_cluster First cluster of the file.
+ * @param offset Position of the first byte.
+ * @param buff Receives the bytes.
+ * @param length Number of bytes.
+ */
+void test_image_pattern(uint32_t first_cluster, uint32_t offset, uint8_t *buff, uint32_t length)
+{
+    uint32_t i = 0; /** Used as an index of operation */
+    uint32_t h = 0; /** Hash of the position */
+
+    for (i = 0; i < length; i++)
+    {
+        h = (offset + i + 1U) * 2654435761U ^ first_cluster * 40503U;
+        h ^= h >> 15;
+        buff[i] = (uint8_t)h;
+    }
+}
+
+/**
+ * @brief Write the volume to a file, alone or as the first partition of a disk.
+ *
+ * @param img The volume.
+ * @param path Path of the file, replaced when it exists.
+ * @param offset Byte offset of the volume, a multiple of 512. Above 0, a partition table pointing at it is written first.
+ * @param file_size Size of the file, extended with a hole when larger than the volume end.
+ * @return bool false on a write error.
+ */
+bool test_image_save(test_image_t *img, const char *path, uint64_t offset, uint64_t file_size)
+{
+    uint8_t mbr[TEST_SECTOR_SIZE];      /** Master boot record */
+    uint8_t *info = NULL;               /** FSInfo sector */
+    uint32_t free_count = 0;            /** Free clusters, for FSInfo */
+    uint32_t cluster = 0;               /** Used as an index of operation */
+    uint64_t done = 0;                  /** Bytes of the volume written */
+    size_t chunk = 0;                   /** Bytes of one write */
+    bool ok = true;                     /** Cleared on a write error */
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644); /** Image file */
+
+    test_put32(img->data + 28, (uint32_t)(offset / TEST_SECTOR_SIZE)); /** Hidden sectors */
+    if (FAT_TYPE_32 == img->type)
+    {
+        for (cluster = 2; cluster < img->cluster_count + 2U; cluster++)
+        {
+            free_count += (0 == test_image_get_fat(img, cluster)) ? 1U : 0U;
+        }
+        info = img->data + TEST_FSINFO_SECTOR * TEST_SECTOR_SIZE;
+        memset(info, 0, TEST_SECTOR_SIZE);
+        test_put32(info, FATFS_FSINFO_LEAD_SIG);
+        test_put32(info + 484, FATFS_FSINFO_STRUCT_SIG);
+        test_put32(info + 488, free_count);
+        test_put32(info + 492, img->cursor);
+        test_put32(info + 508, 0xAA550000U);
+        memcpy(img->data + TEST_BACKUP_SECTOR * TEST_SECTOR_SIZE, img->data, 2U * TEST_SECTOR_SIZE);
+    }
+    if ((fd >= 0) && (offset > 0))
+    {
+        memset(mbr, 0, sizeof(mbr));
+        mbr[446] = 0x80;
+        mbr[446 + 4] = (FAT_TYPE_32 == img->type) ? 0x0CU : ((FAT_TYPE_16 == img->type) ? 0x0EU : 0x01U);
+        test_put32(mbr + 446 + 8, (uint32_t)(offset / TEST_SECTOR_SIZE));
+        test_put32(mbr + 446 + 12, (uint32_t)(img->size / TEST_SECTOR_SIZE));
+        mbr[510] = 0x55;
+        mbr[511] = 0xAA;
+        ok = (pwrite(fd, mbr, sizeof(mbr), 0) == (ssize_t)sizeof(mbr));
+    }
+    while ((fd >= 0) && (ok) && (done < img->size))
+    {
+        chunk = ((img->size - done) < TEST_WRITE_CHUNK) ? (size_t)(img->size - done) : TEST_WRITE_CHUNK;
+        ok = (pwrite(fd, img->data + done, chunk, (off_t)(offset + done)) == (ssize_t)chunk);
+        done += chunk;
+    }
+    if ((fd >= 0) && (ok) && (file_size > offset + img->size))
+    {
+        ok = (ftruncate(fd, (off_t)file_size) == 0);
+    }
+    if (fd >= 0)
+    {
+        ok = (close(fd) == 0) && (ok);
+    }
+
+    return (fd >= 0) && (ok);
+}
+
+/**
+ * @brief Make the reads of a byte range of the image fail, through test_backend_faulty.
+ *
+ * @param offset First byte of the range.
+ * @param length Bytes of the range, 0 to make every read succeed again.
+ */
+void test_fail_range(uint64_t offset, uint64_t length)
+{
+    s_failStart = offset;
+    s_failLength = length;
+}
+
+/**
+ * @brief Make the allocations fail after a number of them succeeded.
+ *
+ * @param successes Allocations that still succeed, TEST_ALLOC_ALWAYS to make every one succeed again.
+ */
+void test_fail_alloc(uint32_t successes)
+{
+    __atomic_store_n(&s_allocLeft, successes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Take one allocation from the budget set by test_fail_alloc.
+ *
+ * @return bool false when the allocation must fail.
+ */
+static bool test_alloc_allowed(void)
+{
+    uint32_t left = __atomic_load_n(&s_allocLeft, __ATOMIC_RELAXED); /** Allocations that still succeed */
+
+    while ((left != TEST_ALLOC_ALWAYS) && (left > 0U) &&
+           (!__atomic_compare_exchange_n(&s_allocLeft, &left, left - 1U, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+    {
+        /** Raced with another thread: left was reloaded */
+    }
+
+    return (TEST_ALLOC_ALWAYS == left) || (left > 0U);
+}
+
+/**
+ * @brief malloc of every object of the test, through --wrap=malloc.
+ *
+ * @param size Bytes asked.
+ * @return void* The memory, NULL once the budget of test_fail_alloc is spent.
+ */
+void *__wrap_malloc(size_t size)
+{
+    return (test_alloc_allowed()) ? __real_malloc(size) : NULL;
+}
+
+/**
+ * @brief realloc of every object of the test, through --wrap=realloc.
+ *
+ * @param ptr Memory to grow, kept when the call fails.
+ * @param size Bytes asked.
+ * @return void* The memory, NULL once the budget of test_fail_alloc is spent.
+ */
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    return (test_alloc_allowed()) ? __real_realloc(ptr, size) : NULL;
+}
+
+/**
+ * @brief Get a slot of a directory.
+ *
+ * @param img The volume.
+ * @param dir First cluster of the directory, 0 for the root.
+ * @param index Index of the slot.
+ * @param grow true to add a cluster to the chain when the slot is past its end.
+ * @return uint8_t* The slot, NULL when it is past the end of the directory.
+ */
+static uint8_t *test_image_slot(test_image_t *img, uint32_t dir, uint32_t index, bool grow)
+{
+    uint32_t per_cluster = img->spc * TEST_SECTOR_SIZE / TEST_ENTRY_SIZE;    /** Slots of a cluster */
+    uint32_t cluster = (0 == dir) ? img->root_cluster : dir;                 /** Cluster holding the slot */
+    uint32_t eoc = (FAT_TYPE_32 == img->type) ? 0x0FFFFFF8U : ((FAT_TYPE_16 == img->type) ? 0xFFF8U : 0xFF8U); /** End of chain */
+    uint32_t next = 0;                                                       /** Next cluster of the chain */
+    uint32_t skip = index / per_cluster;                                     /** Clusters before the slot */
+    uint8_t *slot = NULL;                                                    /** Slot found */
+
+    if (0 == cluster)
+    {
+        slot = (index < img->root_entries) ? (img->data + (uint64_t)img->root_start * TEST_SECTOR_SIZE + index * TEST_ENTRY_SIZE) : NULL;
+    }
+    else
+    {
+        while ((skip > 0) && (cluster != 0))
+        {
+            next = test_image_get_fat(img, cluster);
+            if ((next >= eoc) && (grow))
+            {
+                next = test_image_alloc(img, 1, 0);
+                if (next != 0)
+                {
+                    test_image_set_fat(img, cluster, next);
+                }
+            }
+            cluster = (next >= eoc) ? 0U : next;
+            skip--;
+        }
+        slot = (cluster != 0) ? (test_image_cluster(img, cluster) + (index % per_cluster) * TEST_ENTRY_SIZE) : NULL;
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Convert a name to its 8.3 form.
+ *
+ * @param name Name such as "FILE.TXT", "." or "..".
+ * @param out Receives the 11 characters.
+ * @return bool false when the name does not fit.
+ */
+static bool test_image_short_name(const char *name, uint8_t *out)
+{
+    const char *dot = strchr(name, '.');                                  /** Start of the extension */
+    size_t base = ((dot != NULL) && (dot != name)) ? (size_t)(dot - name) : strlen(name); /** Length of the base */
+    size_t ext = ((dot != NULL) && (dot != name)) ? strlen(dot + 1) : 0U;               /** Length of the extension */
+    bool ok = (base <= 8U) && (ext <= 3U);                                /** Cleared when the name does not fit */
+    size_t i = 0;                                                         /** Used as an index of operation */
+
+    memset(out, ' ', 11);
+    for (i = 0; (ok) && (i < base); i++)
+    {
+        out[i] = (uint8_t)((name[i] >= 'a') && (name[i] <= 'z') ? (name[i] - 'a' + 'A') : name[i]);
+    }
+    for (i = 0; (ok) && (i < ext); i++)
+    {
+        out[8 + i] = (uint8_t)((dot[1 + i] >= 'a') && (dot[1 + i] <= 'z') ? (dot[1 + i] - 'a' + 'A') : dot[1 + i]);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Checksum of a short name, stored in its long name entries.
+ *
+ * @param shortName The 11 characters of the name.
+ * @return uint8_t The checksum.
+ */
+static uint8_t test_image_checksum(const uint8_t *shortName)
+{
+    uint8_t sum = 0; /** Running checksum */
+    uint32_t i = 0;  /** Used as an index of operation */
+
+    for (i = 0; i < 11U; i++)
+    {
+        sum = (uint8_t)(((sum & 1U) << 7) + (sum >> 1) + shortName[i]);
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Store 16 bits, little endian.
+ *
+ * @param p Destination.
+ * @param value Value, its low 16 bits are stored.
+ */
+static void test_put16(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+/**
+ * @brief Store 32 bits, little endian.
+ *
+ * @param p Destination.
+ * @param value Value.
+ */
+static void test_put32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * @brief Open the image with positional reads.
+ *
+ * @param ctx Receives the state of kmc_backend_pread.
+ * @param imagePath The path of the image.
+ * @param config Passed to kmc_backend_pread.
+ * @return int The result of kmc_backend_pread.
+ */
+static int test_faulty_open(void **ctx, const char *imagePath, const kmc_config_t *config)
+{
+    return kmc_backend_pread.open(ctx, imagePath, config);
+}
+
+/**
+ * @brief Read with kmc_backend_pread, failing when the range set by test_fail_range is touched.
+ *
+ * @param ctx The state of kmc_backend_pread.
+ * @param offset Byte offset in the image.
+ * @param buff Receives the bytes.
+ * @param length Number of bytes.
+ * @return int32_t The number of bytes read, or -1.
+ */
+static int32_t test_faulty_read(void *ctx, uint64_t offset, uint8_t *buff, uint32_t length)
+{
+    int32_t result = (int32_t)KMC_ERROR; /** Bytes read */
+
+    if ((0 == s_failLength) || (offset + length <= s_failStart) || (offset >= s_failStart + s_failLength))
+    {
+        result = kmc_backend_pread.read(ctx, offset, buff, length);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Close the image.
+ *
+ * @param ctx The state of kmc_backend_pread.
+ */
+static void test_faulty_close(void *ctx)
+{
+    kmc_backend_pread.close(ctx);
+}
+
+/**
+ * @brief Get the size of the image.
+ *
+ * @param ctx The state of kmc_backend_pread.
+ * @param st Receives the size.
+ * @return int The result of kmc_backend_pread.
+ */
+static int test_faulty_stat(void *ctx, kmc_stat_t *st)
+{
+    return kmc_backend_pread.stat(ctx, st);
+}
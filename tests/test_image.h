@@ -0,0 +1,215 @@
+#ifndef _TEST_IMAGE_H_
+#define _TEST_IMAGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../FATfs.h"
+
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#define TEST_SECTOR_SIZE 512U /** Bytes per sector of the volumes built by the tests */
+#define TEST_ALLOC_ALWAYS 0xFFFFFFFFU /** Argument of test_fail_alloc making every allocation succeed */
+
+/** Check a condition, report it with its location when it fails and go on */
+#define TEST_CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+/**
+ * @brief  Define the structure of a FAT volume built in memory
+ */
+typedef struct
+{
+    uint8_t *data;            /** Bytes of the volume */
+    uint64_t size;            /** Size of the volume in bytes */
+    fatfs_type_t type;        /** Width of the FAT entries */
+    uint32_t spc;             /** Sectors per cluster */
+    uint32_t reserved;        /** Reserved sectors, the boot sector included */
+    uint32_t fat_sectors;     /** Sectors per FAT */
+    uint32_t fat_count;       /** Number of FAT copies */
+    uint32_t root_entries;    /** Entries of the fixed root directory, 0 on FAT32 */
+    uint32_t root_start;      /** First sector of the fixed root directory */
+    uint32_t data_start;      /** First sector of cluster 2 */
+    uint32_t cluster_count;   /** Number of data clusters */
+    uint32_t root_cluster;    /** First cluster of the root directory on FAT32, 0 otherwise */
+    uint32_t cursor;          /** Where the next allocation starts */
+} test_image_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+/**
+ * @brief Count a check and report it when it fails.
+ *
+ * @param ok Result of the check.
+ * @param text Text of the condition.
+ * @param file Source file of the check.
+ * @param line Line of the check.
+ * @return bool ok.
+ */
+bool test_check(bool ok, const char *text, const char *file, int line);
+
+/**
+ * @brief Print the number of checks and failures of the program.
+ *
+ * @param name Name of the test program.
+ * @return int Exit status of the program: 0 when every check passed, 1 otherwise.
+ */
+int test_result(const char *name);
+
+/**
+ * @brief Format an empty volume in memory.
+ *
+ * A FAT12 volume of 1440, 2880 or 5760 sectors gets the root directory of the standard floppy
+ * of that size: with the matching sectors per cluster, it has the layout of that floppy.
+ *
+ * @param img Receives the volume.
+ * @param type FAT12 or FAT16 with a fixed root directory, or FAT32 with the root in cluster 2.
+ * @param total_sectors Sectors of the volume.
+ * @param spc Sectors per cluster.
+ * @return bool false on an allocation error or a layout that does not fit.
+ */
+bool test_image_create(test_image_t *img, fatfs_type_t type, uint32_t total_sectors, uint32_t spc);
+
+/**
+ * @brief Release a volume built in memory.
+ *
+ * @param img The volume.
+ */
+void test_image_free(test_image_t *img);
+
+/**
+ * @brief Write a FAT entry in every copy of the FAT.
+ *
+ * @param img The volume.
+ * @param cluster Index of the entry.
+ * @param value Value of the entry.
+ */
+void test_image_set_fat(test_image_t *img, uint32_t cluster, uint32_t value);
+
+/**
+ * @brief Write a FAT entry in one copy of the FAT only.
+ *
+ * @param img The volume.
+ * @param copy Index of the copy, from 0.
+ * @param cluster Index of the entry.
+ * @param value Value of the entry.
+ */
+void test_image_set_fat_copy(test_image_t *img, uint32_t copy, uint32_t cluster, uint32_t value);
+
+/**
+ * @brief Read a FAT entry of the first FAT.
+ *
+ * @param img The volume.
+ * @param cluster Index of the entry.
+ * @return uint32_t Value of the entry.
+ */
+uint32_t test_image_get_fat(const test_image_t *img, uint32_t cluster);
+
+/**
+ * @brief Get the bytes of a data cluster.
+ *
+ * @param img The volume.
+ * @param cluster Data cluster, from 2.
+ * @return uint8_t* First byte of the cluster.
+ */
+uint8_t *test_image_cluster(const test_image_t *img, uint32_t cluster);
+
+/**
+ * @brief Allocate a chain of free clusters, ended by an end of chain marker.
+ *
+ * @param img The volume.
+ * @param count Number of clusters.
+ * @param gap Free clusters skipped after every cluster, 0 for a contiguous chain.
+ * @return uint32_t First cluster of the chain, 0 when count is 0 or the volume is full.
+ */
+uint32_t test_image_alloc(test_image_t *img, uint32_t count, uint32_t gap);
+
+/**
+ * @brief Append an entry to a directory, its long name entries first.
+ *
+ * A directory in a cluster chain grows by one cluster when it is full.
+ *
+ * @param img The volume.
+ * @param dir First cluster of the directory, 0 for the root.
+ * @param name 8.3 name such as "FILE.TXT", "." or "..".
+ * @param long_name ASCII long name, NULL for none.
+ * @param attr Attribute byte.
+ * @param first_cluster First cluster of the entry.
+ * @param size Size in bytes.
+ * @return bool false when the directory is full or the name is not valid.
+ */
+bool test_image_add(test_image_t *img, uint32_t dir, const char *name, const char *long_name, uint8_t attr,
+                    uint32_t first_cluster, uint32_t size);
+
+/**
+ * @brief Create a directory holding "." and "..".
+ *
+ * @param img The volume.
+ * @param dir First cluster of the parent, 0 for the root.
+ * @param name 8.3 name.
+ * @param long_name ASCII long name, NULL for none.
+ * @return uint32_t First cluster of the new directory, 0 on error.
+ */
+uint32_t test_image_mkdir(test_image_t *img, uint32_t dir, const char *name, const char *long_name);
+
+/**
+ * @brief Create a file filled with test_image_pattern.
+ *
+ * @param img The volume.
+ * @param dir First cluster of the directory, 0 for the root.
+ * @param name 8.3 name.
+ * @param long_name ASCII long name, NULL for none.
+ * @param size Size in bytes.
+ * @param gap Free clusters skipped after every cluster of the file.
+ * @return uint32_t First cluster of the file, 0 for an empty file or on error.
+ */
+uint32_t test_image_file(test_image_t *img, uint32_t dir, const char *name, const char *long_name, uint32_t size, uint32_t gap);
+
+/**
+ * @brief Bytes of the files created by test_image_file: a function of the first cluster and the position.
+ *
+ * @param first_cluster First cluster of the file.
+ * @param offset Position of the first byte.
+ * @param buff Receives the bytes.
+ * @param length Number of bytes.
+ */
+void test_image_pattern(uint32_t first_cluster, uint32_t offset, uint8_t *buff, uint32_t length);
+
+/**
+ * @brief Write the volume to a file, alone or as the first partition of a disk.
+ *
+ * The volume is written with positional writes, so the bytes before it stay a hole of a sparse
+ * file. The FSInfo sector of a FAT32 volume gets the free count of its FAT.
+ *
+ * @param img The volume.
+ * @param path Path of the file, replaced when it exists.
+ * @param offset Byte offset of the volume, a multiple of 512. Above 0, a partition table pointing at it is written first.
+ * @param file_size Size of the file, extended with a hole when larger than the volume end.
+ * @return bool false on a write error.
+ */
+bool test_image_save(test_image_t *img, const char *path, uint64_t offset, uint64_t file_size);
+
+/**
+ * @brief Make the reads of a byte range of the image fail, through test_backend_faulty.
+ *
+ * @param offset First byte of the range.
+ * @param length Bytes of the range, 0 to make every read succeed again.
+ */
+void test_fail_range(uint64_t offset, uint64_t length);
+
+/**
+ * @brief Make the allocations fail after a number of them succeeded.
+ *
+ * The tests are linked with malloc and realloc wrapped, so that the allocation errors of the
+ * library can be reached.
+ *
+ * @param successes Allocations that still succeed, TEST_ALLOC_ALWAYS to make every one succeed again.
+ */
+void test_fail_alloc(uint32_t successes);
+
+/** Positional reads failing on the range set by test_fail_range, use it as the inner backend of a shape */
+extern const kmc_backend_t test_backend_faulty;
+
+#endif /** _TEST_IMAGE_H_ */
@@ -0,0 +1,226 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TEST_LARGE_PATH "large.img"                          /** Sparse disk image built by the test */
+#define TEST_LARGE_OFFSET ((5ULL << 30) + (1ULL << 20))      /** Partition start: 5 GiB + 1 MiB, past every 32-bit offset */
+#define TEST_LARGE_FILE_SIZE (6ULL << 30)                    /** Size of the image: the volume, then a hole up to 6 GiB */
+#define TEST_LARGE_SECTORS 65536U                            /** Sectors of the FAT16 volume: 32 MiB */
+#define TEST_LARGE_BIG_SIZE (300U * 1024U + 77U)             /** Size of the fragmented file */
+
+/**
+ * @brief  Define the files of the volume checked through every mode
+ */
+typedef struct
+{
+    const char *path;   /** Path of the file */
+    uint32_t cluster;   /** First cluster */
+    uint32_t size;      /** Size in bytes */
+} test_large_file_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_large_build(test_image_t *img, test_large_file_t *files);              /** Build the image */
+static void test_large_sectors(const char *mode, const test_image_t *img);              /** Check sector reads of the HAL */
+static void test_large_files(const kmc_config_t *config, const test_large_file_t *files); /** Check file reads of FATfs */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Read a FAT16 partition starting past 4 GiB in a 6 GiB sparse image, in every mode of the HAL.
+ *
+ * KMC_MODE_RAMDISK would load the 6 GiB into memory: the RAM-disk backend is checked on a
+ * read-only mapping of the image instead, given to kmc_init_ramdisk.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    static const kmc_mode_t modes[] = {KMC_MODE_STDIO, KMC_MODE_MMAP, KMC_MODE_PREAD, KMC_MODE_DIRECT}; /** Modes reading the file */
+    static const char *const names[] = {"stdio", "mmap", "pread", "direct"};                          /** Names of the modes */
+    kmc_shape_t shape = {NULL, 0U, 0U, 0U, 0U};   /** Shaped backend without delays, over pread */
+    kmc_config_t config;                          /** Configuration of the mode being checked */
+    test_image_t img;                             /** Volume */
+    test_large_file_t files[4];                   /** Files of the volume */
+    uint8_t *map = NULL;                          /** Mapping given to the RAM disk */
+    uint32_t i = 0;                               /** Used as an index of operation */
+    int fd = -1;                                  /** Image, for the mapping */
+
+    if (TEST_CHECK(test_large_build(&img, files)))
+    {
+        for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+        {
+            memset(&config, 0, sizeof(config));
+            config.mode = modes[i];
+            if (TEST_CHECK(kmc_init_ex(TEST_LARGE_PATH, &config) == 0))
+            {
+                test_large_sectors(names[i], &img);
+                kmc_deinit();
+            }
+            test_large_files(&config, files);
+        }
+
+        memset(&config, 0, sizeof(config));
+        config.mode = KMC_MODE_PREAD;
+        config.shape = &shape;
+        if (TEST_CHECK(kmc_init_ex(TEST_LARGE_PATH, &config) == 0))
+        {
+            test_large_sectors("shaped", &img);
+            kmc_deinit();
+        }
+        test_large_files(&config, files);
+
+        memset(&config, 0, sizeof(config));
+        config.mode = KMC_MODE_PREAD;
+        config.cache_bytes = 256U * 1024U;
+        config.queue_depth = 8;
+        test_large_files(&config, files); /** Cache, readahead and asynchronous reads above the 64-bit offsets */
+
+        fd = open(TEST_LARGE_PATH, O_RDONLY);
+        map = (fd >= 0) ? (uint8_t *)mmap(NULL, TEST_LARGE_FILE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) : (uint8_t *)MAP_FAILED;
+        if (TEST_CHECK(map != (uint8_t *)MAP_FAILED))
+        {
+            if (TEST_CHECK(kmc_init_ramdisk(map, TEST_LARGE_FILE_SIZE, NULL) == 0))
+            {
+                test_large_sectors("ramdisk", &img);
+                kmc_deinit();
+            }
+            munmap(map, TEST_LARGE_FILE_SIZE);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        test_image_free(&img);
+    }
+    unlink(TEST_LARGE_PATH);
+
+    return test_result("test_large");
+}
+
+/**
+ * @brief Build the image: a partition table, a hole, then a FAT16 volume holding contiguous,
+ * fragmented and empty files, followed by another hole.
+ *
+ * @param img Receives the volume.
+ * @param files Receives the files.
+ * @return bool false when the image can not be written.
+ */
+static bool test_large_build(test_image_t *img, test_large_file_t *files)
+{
+    uint32_t dir = 0;  /** Subdirectory */
+    bool ok = test_image_create(img, FAT_TYPE_16, TEST_LARGE_SECTORS, 4); /** Cleared on error */
+
+    if (ok)
+    {
+        dir = test_image_mkdir(img, 0, "DATA", "Data of the large image");
+        files[0].path = "/README.TXT";
+        files[0].size = 1000;
+        files[0].cluster = test_image_file(img, 0, "README.TXT", NULL, files[0].size, 0);
+        files[1].path = "/DATA/BIG.BIN";
+        files[1].size = TEST_LARGE_BIG_SIZE;
+        files[1].cluster = test_image_file(img, dir, "BIG.BIN", "A fragmented file.bin", files[1].size, 3);
+        files[2].path = "/Data of the large image/Contiguous file.bin";
+        files[2].size = 65536U + 512U;
+        files[2].cluster = test_image_file(img, dir, "CONTIG.BIN", "Contiguous file.bin", files[2].size, 0);
+        files[3].path = "/DATA/EMPTY.TXT";
+        files[3].size = 0;
+        files[3].cluster = test_image_file(img, dir, "EMPTY.TXT", NULL, 0, 0);
+        ok = (dir != 0) && (files[0].cluster != 0) && (files[1].cluster != 0) && (files[2].cluster != 0) &&
+             (test_image_save(img, TEST_LARGE_PATH, TEST_LARGE_OFFSET, TEST_LARGE_FILE_SIZE));
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Check sector reads of the HAL opened on the image: the partition table, the volume
+ * through the base offset, and the hole at the end of the image.
+ *
+ * @param mode Name of the mode, for the messages.
+ * @param img Volume written in the image.
+ */
+static void test_large_sectors(const char *mode, const test_image_t *img)
+{
+    uint8_t sector[TEST_SECTOR_SIZE * 4U]; /** Sectors read */
+    uint8_t zero[TEST_SECTOR_SIZE];        /** A sector of the hole */
+    uint32_t lba = 0;                      /** First sector of the partition */
+    uint32_t data = 0;                     /** Sector of a cluster of the volume */
+    kmc_range_t ranges[2];                 /** Vectored read */
+
+    printf("test_large: sectors through %s\n", mode);
+    memset(zero, 0, sizeof(zero));
+    TEST_CHECK(kmc_get_image_size() == TEST_LARGE_FILE_SIZE);
+    TEST_CHECK(kmc_read_sector(0, sector) == (int32_t)TEST_SECTOR_SIZE);
+    memcpy(&lba, sector + 446 + 8, sizeof(lba));
+    TEST_CHECK((uint64_t)lba * TEST_SECTOR_SIZE == TEST_LARGE_OFFSET);
+
+    /** Sector indexes relative to a base past 4 GiB */
+    TEST_CHECK(kmc_set_base_offset(TEST_LARGE_OFFSET) == 0);
+    TEST_CHECK(kmc_read_sector(0, sector) == (int32_t)TEST_SECTOR_SIZE);
+    TEST_CHECK(memcmp(sector, img->data, 62) == 0);
+    data = img->data_start + 40U;
+    TEST_CHECK(kmc_read_multi_sector(data, 4, sector) == (int32_t)(4U * TEST_SECTOR_SIZE));
+    TEST_CHECK(memcmp(sector, img->data + (uint64_t)data * TEST_SECTOR_SIZE, 4U * TEST_SECTOR_SIZE) == 0);
+    ranges[0].index = TEST_LARGE_SECTORS - 1U;
+    ranges[0].num = 1;
+    ranges[0].buff = sector;
+    ranges[1].index = img->reserved;
+    ranges[1].num = 1;
+    ranges[1].buff = sector + TEST_SECTOR_SIZE;
+    TEST_CHECK(kmc_readv(ranges, 2) == (int32_t)(2U * TEST_SECTOR_SIZE));
+    TEST_CHECK(memcmp(sector, img->data + (uint64_t)(TEST_LARGE_SECTORS - 1U) * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE) == 0);
+    TEST_CHECK(memcmp(sector + TEST_SECTOR_SIZE, img->data + (uint64_t)img->reserved * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE) == 0);
+
+    /** The last sector of the image, in the hole after the volume, and the first one past its end */
+    TEST_CHECK(kmc_set_base_offset(0) == 0);
+    TEST_CHECK(kmc_read_sector((uint32_t)(TEST_LARGE_FILE_SIZE / TEST_SECTOR_SIZE) - 1U, sector) == (int32_t)TEST_SECTOR_SIZE);
+    TEST_CHECK(memcmp(sector, zero, TEST_SECTOR_SIZE) == 0);
+    TEST_CHECK(kmc_read_sector((uint32_t)(TEST_LARGE_FILE_SIZE / TEST_SECTOR_SIZE), sector) <= 0);
+}
+
+/**
+ * @brief Check file reads of FATfs on the partition of the image.
+ *
+ * @param config Configuration of the HAL.
+ * @param files Files of the volume.
+ */
+static void test_large_files(const kmc_config_t *config, const test_large_file_t *files)
+{
+    static uint8_t got[TEST_LARGE_BIG_SIZE];      /** File read */
+    static uint8_t want[TEST_LARGE_BIG_SIZE];     /** Expected bytes */
+    DirEntry entry;                               /** Entry of the file */
+    uint32_t i = 0;                               /** Used as an index of operation */
+
+    if (TEST_CHECK(fatfs_init_ex(TEST_LARGE_PATH, config) == 0))
+    {
+        TEST_CHECK(kmc_get_base_offset() == TEST_LARGE_OFFSET);
+        TEST_CHECK(fatfs_get_geometry()->type == FAT_TYPE_16);
+        for (i = 0; i < 4U; i++)
+        {
+            if (TEST_CHECK(fatfs_lookup(files[i].path, &entry) == 0))
+            {
+                TEST_CHECK(entry.first_cluster == files[i].cluster);
+                TEST_CHECK(entry.size == files[i].size);
+                memset(got, 0, files[i].size);
+                test_image_pattern(files[i].cluster, 0, want, files[i].size);
+                TEST_CHECK(fatfs_read_at(entry.first_cluster, entry.size, 0, got, entry.size) == (int32_t)files[i].size);
+                TEST_CHECK(memcmp(got, want, files[i].size) == 0);
+            }
+        }
+        /** A read in the middle of the fragmented file, across clusters */
+        test_image_pattern(files[1].cluster, 0, want, files[1].size);
+        TEST_CHECK(fatfs_read_at(files[1].cluster, files[1].size, 5000, got, 10000) == 10000);
+        TEST_CHECK(memcmp(got, want + 5000, 10000) == 0);
+        fatfs_deinit();
+    }
+}
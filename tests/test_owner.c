@@ -0,0 +1,126 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include "../FATfs_owner.h"
+#include <unistd.h>
+
+#define TEST_OWNER_PATH "owner.img" /** Image built by the test */
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static void test_owner_volume(const char *name, fatfs_type_t type, uint32_t sectors); /** Check a volume */
+static void test_owner_chain(const test_image_t *img, uint32_t first, const char *path); /** Check the owner of a chain */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check the owners of the clusters and sectors of FAT16 and FAT32 volumes, and that a
+ * directory that can not be read fails the build of the map.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    test_owner_volume("FAT16", FAT_TYPE_16, 40000U);
+    test_owner_volume("FAT32", FAT_TYPE_32, 68000U);
+    unlink(TEST_OWNER_PATH);
+
+    return test_result("test_owner");
+}
+
+/**
+ * @brief Check that every cluster of a chain is owned by its entry, in chain order.
+ *
+ * @param img The volume.
+ * @param first First cluster of the chain.
+ * @param path Expected path of the owner.
+ */
+static void test_owner_chain(const test_image_t *img, uint32_t first, const char *path)
+{
+    fatfs_owner_t owner;        /** Owner found */
+    uint32_t cluster = first;   /** Used as an iterator over the chain */
+    uint32_t position = 0;      /** Position of the cluster in the chain */
+
+    while ((cluster >= 2U) && (cluster < img->cluster_count + 2U))
+    {
+        TEST_CHECK(fatfs_owner_of_cluster(cluster, &owner) == 1);
+        TEST_CHECK((owner.path != NULL) && (strcmp(owner.path, path) == 0));
+        TEST_CHECK((owner.first_cluster == first) && (owner.file_cluster == position));
+        cluster = test_image_get_fat(img, cluster);
+        position++;
+    }
+}
+
+/**
+ * @brief Build a volume, map its owners and check them, then fail the read of a directory.
+ *
+ * @param name Name of the volume, for the messages.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ */
+static void test_owner_volume(const char *name, fatfs_type_t type, uint32_t sectors)
+{
+    kmc_shape_t shape = {&test_backend_faulty, 0U, 0U, 0U, 0U}; /** Reads failing on a range, without delays */
+    kmc_config_t config;                                        /** Configuration of the HAL */
+    test_image_t img;                                           /** Volume */
+    fatfs_owner_t owner;                                        /** Owner found */
+    uint32_t dir = 0;                                           /** Subdirectory */
+    uint32_t a = 0;                                             /** File of the root */
+    uint32_t b = 0;                                             /** Fragmented file of the subdirectory */
+    uint32_t hole = 0;                                          /** Free cluster */
+
+    printf("test_owner: %s\n", name);
+    if (TEST_CHECK(test_image_create(&img, type, sectors, 1)))
+    {
+        a = test_image_file(&img, 0, "A.BIN", "First file.bin", 5000U, 0);
+        dir = test_image_mkdir(&img, 0, "DIR", NULL);
+        b = test_image_file(&img, dir, "B.BIN", NULL, 4000U, 2);
+        hole = b + 1U; /** Skipped by the fragmented file */
+        memset(&config, 0, sizeof(config));
+        config.mode = KMC_MODE_PREAD;
+        config.flags = KMC_FLAG_NO_READAHEAD;
+        config.shape = &shape;
+        if ((TEST_CHECK((a != 0) && (dir != 0) && (b != 0))) && (TEST_CHECK(test_image_save(&img, TEST_OWNER_PATH, 0, 0))) &&
+            (TEST_CHECK(fatfs_init_ex(TEST_OWNER_PATH, &config) == 0)))
+        {
+            TEST_CHECK(fatfs_owner_of_cluster(a, &owner) == -1); /** Not built yet */
+            TEST_CHECK(fatfs_owner_build() == 0);
+            test_owner_chain(&img, a, "/A.BIN");
+            test_owner_chain(&img, dir, "/DIR");
+            test_owner_chain(&img, b, "/DIR/B.BIN");
+            TEST_CHECK(fatfs_owner_of_cluster(hole, &owner) == 0);
+            TEST_CHECK(fatfs_owner_of_sector(0, &owner) == 0);
+            TEST_CHECK(FATFS_REGION_RESERVED == owner.region);
+            TEST_CHECK(fatfs_owner_of_sector(img.reserved, &owner) == 0);
+            TEST_CHECK(FATFS_REGION_FAT == owner.region);
+            TEST_CHECK(fatfs_owner_of_sector(img.data_start + b - 2U, &owner) == 1);
+            TEST_CHECK((FATFS_REGION_DATA == owner.region) && (owner.first_cluster == b) && (4000U == owner.size));
+            if (FAT_TYPE_32 == type)
+            {
+                test_owner_chain(&img, img.root_cluster, "/");
+            }
+            else
+            {
+                TEST_CHECK(fatfs_owner_of_sector(img.root_start, &owner) == 1);
+                TEST_CHECK((FATFS_REGION_ROOT == owner.region) && (0 == owner.entry));
+            }
+
+            /** A subdirectory that can not be read fails the build: its files would have no owner */
+            test_fail_range(((uint64_t)img.data_start + dir - 2U) * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE);
+            TEST_CHECK(fatfs_owner_build() == -1);
+            TEST_CHECK(fatfs_owner_of_cluster(b, &owner) == -1);
+            test_fail_range(0, 0);
+            TEST_CHECK(fatfs_owner_build() == 0);
+            test_owner_chain(&img, b, "/DIR/B.BIN");
+            fatfs_owner_deinit();
+            fatfs_deinit();
+        }
+        test_image_free(&img);
+    }
+}
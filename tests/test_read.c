@@ -0,0 +1,296 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include <unistd.h>
+
+#define TEST_READ_PATH "read.img" /** Image built by the test */
+#define TEST_READ_FILES 4U        /** Files of every volume */
+#define TEST_READ_MAX 40000U      /** Largest file */
+#define TEST_READ_EXTENTS 256U    /** Room for the extents of one file */
+#define TEST_READ_4K_PATH "read4k.img" /** Volume of 4 KiB sectors built by the test */
+#define TEST_READ_4K 4096U             /** Bytes per sector of that volume */
+#define TEST_READ_4K_SECTORS 1000U     /** Sectors of that volume */
+
+/**
+ * @brief  Define a volume layout checked by the test
+ */
+typedef struct
+{
+    const char *name;  /** Name, for the messages */
+    fatfs_type_t type; /** FAT type */
+    uint32_t sectors;  /** Sectors of the volume */
+    uint32_t spc;      /** Sectors per cluster */
+    uint32_t data;     /** First data sector of a standard floppy, 0 otherwise */
+    uint32_t clusters; /** Clusters of a standard floppy, 0 otherwise */
+} test_read_layout_t;
+
+/**
+ * @brief  Define a file of the volume
+ */
+typedef struct
+{
+    const char *path; /** Path looked up */
+    uint32_t cluster; /** First cluster */
+    uint32_t size;    /** Size in bytes */
+} test_read_file_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_read_build(test_image_t *img, const test_read_layout_t *layout, test_read_file_t *files); /** Build a volume */
+static void test_read_mount(const test_image_t *img, const test_read_file_t *files, kmc_mode_t mode, uint32_t budget); /** Check one mount */
+static bool test_read_build_4k(void);                                                                      /** Write a volume of 4 KiB sectors */
+static void test_read_sector_size(void);                                                                   /** Check mounts after a volume of 4 KiB sectors */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Check the layout of FAT12, FAT16, FAT32 and standard floppy volumes and read their
+ * files in every mode of the HAL, with the FAT unpacked and loaded on demand, then mount a
+ * volume of 512-byte sectors after one of 4 KiB sectors.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    static const test_read_layout_t layouts[] = {
+        {"FAT12", FAT_TYPE_12, 4000U, 1U, 0U, 0U},
+        {"FAT16", FAT_TYPE_16, 40000U, 2U, 0U, 0U},
+        {"FAT32", FAT_TYPE_32, 68000U, 1U, 0U, 0U},
+        {"720 KiB floppy", FAT_TYPE_12, 1440U, 2U, 14U, 713U},
+        {"1.44 MB floppy", FAT_TYPE_12, 2880U, 1U, 33U, 2847U},
+        {"2.88 MB floppy", FAT_TYPE_12, 5760U, 2U, 34U, 2863U}}; /** Volumes checked, the floppies with the layout of their generated kernels */
+    static const kmc_mode_t modes[] = {KMC_MODE_STDIO, KMC_MODE_MMAP, KMC_MODE_PREAD, KMC_MODE_DIRECT, KMC_MODE_RAMDISK}; /** Modes of the HAL */
+    static const uint32_t budgets[] = {0U, 1U, 4096U, 65536U}; /** FAT budgets: the default unpacks these FATs, the others load them on demand */
+    test_image_t img;                                          /** Volume */
+    test_read_file_t files[TEST_READ_FILES];                   /** Files of the volume */
+    uint32_t l = 0;                                            /** Used as an index of operation */
+    uint32_t m = 0;                                            /** Used as an index of operation */
+    uint32_t b = 0;                                            /** Used as an index of operation */
+
+    for (l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++)
+    {
+        printf("test_read: %s\n", layouts[l].name);
+        if (TEST_CHECK(test_read_build(&img, &layouts[l], files)))
+        {
+            TEST_CHECK((0 == layouts[l].data) || ((img.data_start == layouts[l].data) && (img.cluster_count == layouts[l].clusters)));
+            for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+            {
+                for (b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++)
+                {
+                    test_read_mount(&img, files, modes[m], budgets[b]);
+                }
+            }
+            test_image_free(&img);
+        }
+    }
+    fatfs_set_fat_budget(0);
+    test_read_sector_size();
+    unlink(TEST_READ_PATH);
+    unlink(TEST_READ_4K_PATH);
+
+    return test_result("test_read");
+}
+
+/**
+ * @brief Build a volume holding contiguous, fragmented and empty files, one in a subdirectory.
+ *
+ * @param img Receives the volume.
+ * @param layout Layout of the volume.
+ * @param files Receives the files.
+ * @return bool false on error.
+ */
+static bool test_read_build(test_image_t *img, const test_read_layout_t *layout, test_read_file_t *files)
+{
+    uint32_t dir = 0;                                                             /** Subdirectory */
+    bool ok = test_image_create(img, layout->type, layout->sectors, layout->spc); /** Cleared on error */
+
+    if (ok)
+    {
+        dir = test_image_mkdir(img, 0, "DIR", "Sub directory");
+        files[0].path = "/README.TXT";
+        files[0].size = 1500U;
+        files[0].cluster = test_image_file(img, 0, "README.TXT", NULL, files[0].size, 0);
+        files[1].path = "/Sub directory/Fragmented file.bin";
+        files[1].size = TEST_READ_MAX;
+        files[1].cluster = test_image_file(img, dir, "FRAG.BIN", "Fragmented file.bin", files[1].size, 1);
+        files[2].path = "/DIR/CONTIG.BIN";
+        files[2].size = 20000U;
+        files[2].cluster = test_image_file(img, dir, "CONTIG.BIN", NULL, files[2].size, 0);
+        files[3].path = "/EMPTY.TXT";
+        files[3].size = 0;
+        files[3].cluster = test_image_file(img, 0, "EMPTY.TXT", NULL, 0, 0);
+        ok = (dir != 0) && (files[0].cluster != 0) && (files[1].cluster != 0) && (files[2].cluster != 0) &&
+             (test_image_save(img, TEST_READ_PATH, 0, 0));
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Mount the volume in one mode with one FAT budget, then check its layout, the extents
+ * and the bytes of every file.
+ *
+ * @param img The volume.
+ * @param files Files of the volume.
+ * @param mode Mode of the HAL.
+ * @param budget FAT budget in bytes.
+ */
+static void test_read_mount(const test_image_t *img, const test_read_file_t *files, kmc_mode_t mode, uint32_t budget)
+{
+    static uint8_t got[TEST_READ_MAX];                  /** File read */
+    static uint8_t want[TEST_READ_MAX];                 /** Expected bytes */
+    fatfs_extent_t extents[TEST_READ_EXTENTS];          /** Extents of a file */
+    const fatfs_geometry_t *geo = NULL;                 /** Layout found by the reader */
+    kmc_config_t config;                                /** Configuration of the HAL */
+    DirEntry entry;                                     /** Entry looked up */
+    uint32_t cluster = 0;                               /** Used as an iterator over a chain */
+    uint32_t position = 0;                              /** Position of the cluster in the file */
+    uint32_t f = 0;                                     /** Used as an index of operation */
+    int count = 0;                                      /** Extents of the file */
+    int e = 0;                                          /** Used as an index of operation */
+    bool same = true;                                   /** The extents follow the chain */
+
+    memset(&config, 0, sizeof(config));
+    config.mode = mode;
+    fatfs_set_fat_budget(budget);
+    if (TEST_CHECK(fatfs_init_ex(TEST_READ_PATH, &config) == 0))
+    {
+        geo = fatfs_get_geometry();
+        TEST_CHECK((geo->type == img->type) && (geo->sectors_per_cluster == img->spc) && (geo->cluster_count == img->cluster_count));
+        TEST_CHECK((geo->fat_start == img->reserved) && (geo->fat_sectors == img->fat_sectors) && (geo->fat_count == img->fat_count));
+        TEST_CHECK((geo->data_start == img->data_start) && (geo->root_cluster == img->root_cluster));
+        TEST_CHECK((FAT_TYPE_32 == img->type) || (geo->root_start == img->root_start));
+
+        for (f = 0; f < TEST_READ_FILES; f++)
+        {
+            if (TEST_CHECK(fatfs_lookup(files[f].path, &entry) == 0))
+            {
+                TEST_CHECK((entry.first_cluster == files[f].cluster) && (entry.size == files[f].size));
+                memset(got, 0, files[f].size);
+                test_image_pattern(files[f].cluster, 0, want, files[f].size);
+                TEST_CHECK(fatfs_read_at(entry.first_cluster, entry.size, 0, got, entry.size) == (int32_t)files[f].size);
+                TEST_CHECK(memcmp(got, want, files[f].size) == 0);
+                TEST_CHECK(fatfs_read_at(entry.first_cluster, entry.size, entry.size, got, 1) == 0); /** At the end of the file */
+            }
+
+            /** The extents cover the chain in order */
+            count = (files[f].cluster != 0) ? fatfs_get_extents(files[f].cluster, extents, TEST_READ_EXTENTS) : 0;
+            TEST_CHECK((count >= 0) && (count <= (int)TEST_READ_EXTENTS));
+            cluster = files[f].cluster;
+            position = 0;
+            same = true;
+            for (e = 0; (count <= (int)TEST_READ_EXTENTS) && (e < count); e++)
+            {
+                same = (same) && (extents[e].file_cluster == position) && (extents[e].first_cluster == cluster);
+                position += extents[e].length;
+                cluster = test_image_get_fat(img, extents[e].first_cluster + extents[e].length - 1U);
+            }
+            TEST_CHECK((same) && ((0 == count) || (cluster > img->cluster_count + 1U)));
+        }
+
+        /** Across clusters in the middle of the fragmented file */
+        test_image_pattern(files[1].cluster, 0, want, files[1].size);
+        TEST_CHECK(fatfs_read_at(files[1].cluster, files[1].size, 777U, got, 9000U) == 9000);
+        TEST_CHECK(memcmp(got, want + 777U, 9000U) == 0);
+        fatfs_deinit();
+    }
+}
+
+/**
+ * @brief Write a FAT12 volume of 4 KiB sectors holding HELLO.TXT in its root directory.
+ *
+ * @return bool false on error.
+ */
+static bool test_read_build_4k(void)
+{
+    uint8_t *data = (uint8_t *)calloc(TEST_READ_4K_SECTORS, TEST_READ_4K); /** The volume */
+    uint8_t *entry = NULL;                                                  /** Entry of the file in the root */
+    FILE *out = NULL;                                                       /** The image */
+    uint32_t copy = 0;                                                      /** Used as an index of operation */
+    bool ok = (data != NULL);                                               /** Status of the write */
+
+    if (ok)
+    {
+        /** One reserved sector, two FATs of one sector, a root of 512 entries in 4 sectors */
+        data[0] = 0xEBU;
+        data[1] = 0x3CU;
+        data[2] = 0x90U;
+        memcpy(data + 3, "MSWIN4.1", 8);
+        data[11] = (uint8_t)(TEST_READ_4K & 0xFFU);
+        data[12] = (uint8_t)(TEST_READ_4K >> 8);
+        data[13] = 1U;
+        data[14] = 1U;
+        data[16] = 2U;
+        data[18] = 2U;
+        data[19] = (uint8_t)(TEST_READ_4K_SECTORS & 0xFFU);
+        data[20] = (uint8_t)(TEST_READ_4K_SECTORS >> 8);
+        data[21] = 0xF8U;
+        data[22] = 1U;
+        data[38] = 0x29U;
+        memcpy(data + 54, "FAT12   ", 8);
+        data[510] = 0x55U;
+        data[511] = 0xAAU;
+        for (copy = 0; copy < 2U; copy++)
+        {
+            memcpy(data + ((size_t)(1U + copy) * TEST_READ_4K), "\xF8\xFF\xFF\xFF\x0F", 5); /** Cluster 2 ends its chain */
+        }
+        entry = data + ((size_t)3U * TEST_READ_4K);
+        memcpy(entry, "HELLO   TXT", 11);
+        entry[11] = 0x20U;
+        entry[26] = 2U;
+        entry[28] = 5U;
+        memcpy(data + ((size_t)7U * TEST_READ_4K), "hello", 5);
+        out = fopen(TEST_READ_4K_PATH, "wb");
+        ok = (out != NULL) && (fwrite(data, TEST_READ_4K, TEST_READ_4K_SECTORS, out) == TEST_READ_4K_SECTORS);
+    }
+    if (out != NULL)
+    {
+        ok = (fclose(out) == 0) && (ok);
+    }
+    free(data);
+
+    return ok;
+}
+
+/**
+ * @brief Mount a volume of 4 KiB sectors, then one of 512-byte sectors: the second boot sector
+ * is read with the default size, after a clean unmount and after a mount that failed once the
+ * sector size was set.
+ */
+static void test_read_sector_size(void)
+{
+    kmc_shape_t shape = {&test_backend_faulty, 0U, 0U, 0U, 0U}; /** Reads failing on a range, without delays */
+    kmc_config_t config;                                        /** Configuration of the HAL */
+    uint8_t got[8];                                             /** File read */
+    DirEntry entry;                                             /** Entry looked up */
+
+    printf("test_read: 4 KiB sectors\n");
+    memset(&config, 0, sizeof(config));
+    config.mode = KMC_MODE_PREAD;
+    config.shape = &shape;
+    if ((TEST_CHECK(test_read_build_4k())) && (TEST_CHECK(fatfs_init_ex(TEST_READ_4K_PATH, &config) == 0)))
+    {
+        TEST_CHECK((TEST_READ_4K == fatfs_get_geometry()->bytes_per_sector) && (7U == fatfs_get_geometry()->data_start));
+        TEST_CHECK((fatfs_lookup("/HELLO.TXT", &entry) == 0) && (fatfs_read_at(entry.first_cluster, entry.size, 0, got, 5U) == 5));
+        TEST_CHECK(memcmp(got, "hello", 5) == 0);
+        fatfs_deinit();
+        TEST_CHECK(fatfs_init(TEST_READ_PATH) == 0);
+        TEST_CHECK(TEST_SECTOR_SIZE == fatfs_get_geometry()->bytes_per_sector);
+        TEST_CHECK(fatfs_lookup("/README.TXT", &entry) == 0);
+        fatfs_deinit();
+
+        /** The FAT can not be read: the mount fails after the sector size was set */
+        test_fail_range(TEST_READ_4K, TEST_READ_4K);
+        TEST_CHECK(fatfs_init_ex(TEST_READ_4K_PATH, &config) != 0);
+        test_fail_range(0, 0);
+        TEST_CHECK(fatfs_init(TEST_READ_PATH) == 0);
+        TEST_CHECK(fatfs_lookup("/README.TXT", &entry) == 0);
+        fatfs_deinit();
+    }
+}
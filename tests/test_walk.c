@@ -0,0 +1,348 @@
+/*******************************************************************************
+ * Definitions
+ ******************************************************************************/
+
+#include "test_image.h"
+#include "../FATfs_walk.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define TEST_WALK_PATH "walk.img" /** Image built by the test */
+#define TEST_WALK_BIG 900U        /** Entries of the large directory: about 84 KiB, listed in segments */
+#define TEST_WALK_THREADS 8U      /** The walk runs with 1 to this many threads */
+
+/**
+ * @brief  Define the paths collected by the visitor
+ */
+typedef struct
+{
+    pthread_mutex_t lock;   /** The FATFS_WALK_ANY order visits from several threads */
+    char **paths;           /** Paths visited, in visit order */
+    uint32_t *clusters;     /** First cluster of every entry visited */
+    uint32_t count;         /** Entries visited */
+    uint32_t capacity;      /** Room of paths and clusters */
+    uint32_t stop_after;    /** The visitor stops the walk after this many entries, 0 never */
+    bool failed;            /** Set on an allocation error */
+} test_walk_seen_t;
+
+/*******************************************************************************
+ * Prototypes
+ ******************************************************************************/
+
+static bool test_walk_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, test_walk_seen_t *want, uint32_t *big); /** Build a volume */
+static bool test_walk_add(test_walk_seen_t *seen, const char *path, uint32_t cluster);                                    /** Record a path */
+static bool test_walk_visitor(const fatfs_walk_entry_t *entry, void *context);                                            /** Record a visit */
+static void test_walk_clear(test_walk_seen_t *seen);                                                                      /** Forget the paths */
+static int test_walk_compare(const void *a, const void *b);                                                               /** Order paths */
+static bool test_walk_ordered(const test_walk_seen_t *got, fatfs_walk_order_t order);                                    /** Check the visit order */
+static bool test_walk_same(test_walk_seen_t *got, test_walk_seen_t *want);                                                /** Compare as sets */
+static void test_walk_volume(const char *name, fatfs_type_t type, uint32_t sectors);                                      /** Check a volume */
+
+/*******************************************************************************
+ * Code
+ ******************************************************************************/
+
+/**
+ * @brief Walk FAT16 and FAT32 volumes in every order with 1 to 8 threads, against the tree the
+ * test built, and check that a directory that can not be read fails the walk.
+ *
+ * @return int 0 when every check passed.
+ */
+int main(void)
+{
+    test_walk_volume("FAT16", FAT_TYPE_16, 40000U);
+    test_walk_volume("FAT32", FAT_TYPE_32, 68000U);
+    unlink(TEST_WALK_PATH);
+
+    return test_result("test_walk");
+}
+
+/**
+ * @brief Build a volume: files in the root, a chain of nested directories and a directory
+ * large enough to be listed in segments.
+ *
+ * @param img Receives the volume.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume, one per cluster.
+ * @param want Receives the paths the walk must visit.
+ * @param big Receives the first cluster of the large directory.
+ * @return bool false on error.
+ */
+static bool test_walk_build(test_image_t *img, fatfs_type_t type, uint32_t sectors, test_walk_seen_t *want, uint32_t *big)
+{
+    char name[16];                                        /** 8.3 name */
+    char longName[64];                                    /** Long name */
+    char path[96];                                        /** Path of the entry */
+    uint32_t dir = 0;                                     /** Directory being filled */
+    uint32_t cluster = 0;                                 /** First cluster of an entry */
+    uint32_t i = 0;                                       /** Used as an index of operation */
+    bool ok = test_image_create(img, type, sectors, 1);   /** Cleared on error */
+
+    if (ok)
+    {
+        cluster = test_image_file(img, 0, "README.TXT", NULL, 700U, 0);
+        ok = test_walk_add(want, "/README.TXT", cluster);
+        cluster = test_image_file(img, 0, "NOTES.TXT", "Notes of the volume.txt", 3000U, 1);
+        ok = (ok) && (test_walk_add(want, "/Notes of the volume.txt", cluster));
+        *big = test_image_mkdir(img, 0, "BIG", "Big directory");
+        ok = (ok) && (*big != 0) && (test_walk_add(want, "/Big directory", *big));
+        for (i = 0; (ok) && (i < TEST_WALK_BIG); i++)
+        {
+            snprintf(name, sizeof(name), "E%07u.TXT", i);
+            snprintf(longName, sizeof(longName), "Entry number %u.txt", i);
+            snprintf(path, sizeof(path), "/Big directory/%s", longName);
+            cluster = (0 == i % 100U) ? test_image_alloc(img, 1, 0) : 0U; /** A few own a cluster */
+            ok = (test_image_add(img, *big, name, longName, 0x20, cluster, (0 == cluster) ? 0U : 10U)) && (test_walk_add(want, path, cluster));
+        }
+        dir = test_image_mkdir(img, 0, "A", NULL);
+        ok = (ok) && (dir != 0) && (test_walk_add(want, "/A", dir));
+        dir = test_image_mkdir(img, dir, "B", NULL);
+        ok = (ok) && (dir != 0) && (test_walk_add(want, "/A/B", dir));
+        dir = test_image_mkdir(img, dir, "C", "Third level");
+        ok = (ok) && (dir != 0) && (test_walk_add(want, "/A/B/Third level", dir));
+        cluster = test_image_file(img, dir, "DEEP.BIN", NULL, 2000U, 3);
+        ok = (ok) && (test_walk_add(want, "/A/B/Third level/DEEP.BIN", cluster));
+        ok = (ok) && (test_image_save(img, TEST_WALK_PATH, 0, 0));
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Record a path.
+ *
+ * @param seen Paths collected.
+ * @param path Path to add.
+ * @param cluster First cluster of the entry.
+ * @return bool false on an allocation error.
+ */
+static bool test_walk_add(test_walk_seen_t *seen, const char *path, uint32_t cluster)
+{
+    uint32_t capacity = (seen->capacity < 64U) ? 64U : (seen->capacity * 2U); /** Room after growth */
+    char **paths = NULL;                                                     /** Paths after realloc */
+    uint32_t *clusters = NULL;                                               /** Clusters after realloc */
+    bool ok = true;                                                          /** Status of the addition */
+
+    if (seen->count == seen->capacity)
+    {
+        paths = (char **)realloc(seen->paths, capacity * sizeof(char *));
+        seen->paths = (paths != NULL) ? paths : seen->paths;
+        clusters = (uint32_t *)realloc(seen->clusters, capacity * sizeof(uint32_t));
+        seen->clusters = (clusters != NULL) ? clusters : seen->clusters;
+        ok = (paths != NULL) && (clusters != NULL);
+        seen->capacity = (ok) ? capacity : seen->capacity;
+    }
+    if (ok)
+    {
+        seen->paths[seen->count] = strdup(path);
+        seen->clusters[seen->count] = cluster;
+        ok = (seen->paths[seen->count] != NULL);
+        seen->count += (ok) ? 1U : 0U;
+    }
+    seen->failed = (seen->failed) || (!ok);
+
+    return ok;
+}
+
+/**
+ * @brief Record a visit of the walk.
+ *
+ * @param entry Entry visited.
+ * @param context The test_walk_seen_t collecting the paths.
+ * @return bool false once stop_after entries are visited.
+ */
+static bool test_walk_visitor(const fatfs_walk_entry_t *entry, void *context)
+{
+    test_walk_seen_t *seen = (test_walk_seen_t *)context; /** Paths collected */
+    bool go = true;                                       /** Answer to the walk */
+
+    pthread_mutex_lock(&seen->lock);
+    (void)test_walk_add(seen, entry->path, entry->entry->first_cluster);
+    go = (0 == seen->stop_after) || (seen->count < seen->stop_after);
+    pthread_mutex_unlock(&seen->lock);
+
+    return go;
+}
+
+/**
+ * @brief Forget the paths collected, keeping the room.
+ *
+ * @param seen Paths collected.
+ */
+static void test_walk_clear(test_walk_seen_t *seen)
+{
+    uint32_t i = 0; /** Used as an index of operation */
+
+    for (i = 0; i < seen->count; i++)
+    {
+        free(seen->paths[i]);
+    }
+    seen->count = 0;
+    seen->stop_after = 0;
+    seen->failed = false;
+}
+
+/**
+ * @brief Order two paths for qsort.
+ *
+ * @param a First path.
+ * @param b Second path.
+ * @return int strcmp of the paths.
+ */
+static int test_walk_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Check the order of the visits: by first cluster, or every directory before its entries.
+ *
+ * @param got Paths visited, in visit order.
+ * @param order Order of the walk.
+ * @return bool true when the order is respected.
+ */
+static bool test_walk_ordered(const test_walk_seen_t *got, fatfs_walk_order_t order)
+{
+    const char *slash = NULL; /** Last separator of the path */
+    uint32_t i = 0;           /** Used as an index of operation */
+    uint32_t j = 0;           /** Used as an index of operation */
+    bool parent = false;      /** Directory of the entry visited before it */
+    bool ordered = true;      /** Result of the check */
+
+    for (i = 1; (FATFS_WALK_PHYSICAL == order) && (i < got->count); i++)
+    {
+        ordered = (ordered) && (got->clusters[i - 1U] <= got->clusters[i]);
+    }
+    for (i = 0; (FATFS_WALK_PREORDER == order) && (i < got->count); i++)
+    {
+        slash = strrchr(got->paths[i], '/');
+        parent = (slash == got->paths[i]); /** An entry of the root */
+        for (j = 0; (!parent) && (j < i); j++)
+        {
+            parent = (strlen(got->paths[j]) == (size_t)(slash - got->paths[i])) &&
+                     (strncmp(got->paths[j], got->paths[i], (size_t)(slash - got->paths[i])) == 0);
+        }
+        ordered = (ordered) && (parent);
+    }
+
+    return ordered;
+}
+
+/**
+ * @brief Compare the paths visited with the expected ones, in any order.
+ *
+ * The visit order is checked by the caller first: both lists are sorted here.
+ *
+ * @param got Paths visited.
+ * @param want Paths expected.
+ * @return bool true when both hold the same paths.
+ */
+static bool test_walk_same(test_walk_seen_t *got, test_walk_seen_t *want)
+{
+    uint32_t i = 0;                                                       /** Used as an index of operation */
+    bool same = (!got->failed) && (got->count == want->count);            /** Result of the comparison */
+
+    qsort(got->paths, got->count, sizeof(char *), test_walk_compare);
+    qsort(want->paths, want->count, sizeof(char *), test_walk_compare);
+    for (i = 0; (same) && (i < got->count); i++)
+    {
+        same = (strcmp(got->paths[i], want->paths[i]) == 0);
+    }
+
+    return same;
+}
+
+/**
+ * @brief Walk one volume in every order and with every thread count, then with read errors.
+ *
+ * @param name Name of the volume, for the messages.
+ * @param type FAT type.
+ * @param sectors Sectors of the volume.
+ */
+static void test_walk_volume(const char *name, fatfs_type_t type, uint32_t sectors)
+{
+    static const fatfs_walk_order_t orders[] = {FATFS_WALK_ANY, FATFS_WALK_PREORDER, FATFS_WALK_PHYSICAL}; /** Orders checked */
+    kmc_shape_t shape = {&test_backend_faulty, 0U, 0U, 0U, 0U}; /** Reads failing on a range, without delays */
+    kmc_config_t config;                                        /** Configuration of the HAL */
+    test_image_t img;                                           /** Volume */
+    test_walk_seen_t want;                                      /** Paths of the tree */
+    test_walk_seen_t got;                                       /** Paths visited */
+    uint32_t big = 0;                                           /** First cluster of the large directory */
+    uint32_t middle = 0;                                        /** A cluster in the middle of the large directory */
+    uint32_t o = 0;                                             /** Used as an index of operation */
+    uint32_t i = 0;                                             /** Used as an index of operation */
+    uint32_t threads = 0;                                       /** Threads of the walk */
+
+    printf("test_walk: %s\n", name);
+    memset(&want, 0, sizeof(want));
+    memset(&got, 0, sizeof(got));
+    pthread_mutex_init(&got.lock, NULL);
+    memset(&config, 0, sizeof(config));
+    config.mode = KMC_MODE_PREAD;
+    config.flags = KMC_FLAG_NO_READAHEAD;
+    config.shape = &shape;
+    if ((TEST_CHECK(test_walk_build(&img, type, sectors, &want, &big))) && (TEST_CHECK(fatfs_init_ex(TEST_WALK_PATH, &config) == 0)))
+    {
+        for (o = 0; o < sizeof(orders) / sizeof(orders[0]); o++)
+        {
+            for (threads = 1; threads <= TEST_WALK_THREADS; threads++)
+            {
+                test_walk_clear(&got);
+                TEST_CHECK(fatfs_walk(0, orders[o], threads, test_walk_visitor, &got) == 0);
+                TEST_CHECK(test_walk_ordered(&got, orders[o]));
+                TEST_CHECK(test_walk_same(&got, &want));
+            }
+        }
+
+        /** The visitor stops the walk */
+        test_walk_clear(&got);
+        got.stop_after = 5;
+        TEST_CHECK(fatfs_walk(0, FATFS_WALK_PREORDER, 4, test_walk_visitor, &got) == 1);
+        TEST_CHECK(5U == got.count);
+
+        /** A start past the volume or on the reserved cluster is refused without a visit */
+        test_walk_clear(&got);
+        TEST_CHECK(fatfs_walk(0x00FFFFFFU, FATFS_WALK_PREORDER, 1, test_walk_visitor, &got) == -1);
+        TEST_CHECK(fatfs_walk(fatfs_get_geometry()->cluster_count + 2U, FATFS_WALK_ANY, 2, test_walk_visitor, &got) == -1);
+        TEST_CHECK(fatfs_walk(1U, FATFS_WALK_PHYSICAL, 1, test_walk_visitor, &got) == -1);
+        TEST_CHECK(0U == got.count);
+
+        /** A cluster in the middle of the large directory, then the first cluster of the root, can not be read */
+        middle = big;
+        for (i = 0; i < 70U; i++)
+        {
+            middle = test_image_get_fat(&img, middle);
+        }
+        test_fail_range(((uint64_t)img.data_start + middle - 2U) * TEST_SECTOR_SIZE, TEST_SECTOR_SIZE);
+        for (threads = 1; threads <= TEST_WALK_THREADS; threads += 3U)
+        {
+            for (o = 0; o < sizeof(orders) / sizeof(orders[0]); o++)
+            {
+                test_walk_clear(&got);
+                TEST_CHECK(fatfs_walk(0, orders[o], threads, test_walk_visitor, &got) == -1);
+                TEST_CHECK((FATFS_WALK_ANY == orders[o]) || (0 == got.count)); /** Nothing visited once the tree is listed */
+            }
+        }
+        test_fail_range((uint64_t)((0 != img.root_cluster) ? (img.data_start + img.root_cluster - 2U) : img.root_start) * TEST_SECTOR_SIZE,
+                        TEST_SECTOR_SIZE);
+        for (o = 0; o < sizeof(orders) / sizeof(orders[0]); o++)
+        {
+            test_walk_clear(&got);
+            TEST_CHECK(fatfs_walk(0, orders[o], 2, test_walk_visitor, &got) == -1);
+            TEST_CHECK(0 == got.count);
+        }
+        test_fail_range(0, 0);
+        test_walk_clear(&got);
+        TEST_CHECK(fatfs_walk(0, FATFS_WALK_ANY, 3, test_walk_visitor, &got) == 0);
+        TEST_CHECK(test_walk_same(&got, &want));
+        fatfs_deinit();
+    }
+    test_walk_clear(&got);
+    test_walk_clear(&want);
+    free(got.paths);
+    free(got.clusters);
+    free(want.paths);
+    free(want.clusters);
+    pthread_mutex_destroy(&got.lock);
+    test_image_free(&img);
+}